@@ -3,11 +3,11 @@
    Program:    chaincontacts
    File:       chaincontacts.c
    
-   Version:    V1.3
-   Date:       28.10.15
+   Version:    V1.5
+   Date:       16.10.26
    Function:   Calculate details of contacts between chains
    
-   Copyright:  (c) Dr. Andrew C. R. Martin 1995-2015
+   Copyright:  (c) Dr. Andrew C. R. Martin 1995-2026
    Author:     Dr. Andrew C. R. Martin
    Address:    Biomolecular Structure & Modelling Unit,
                Department of Biochemistry & Molecular Biology,
@@ -50,29 +50,102 @@
    V1.2  04.02.15 Now only reads ATOM records
    V1.3  28.10.15 Now takes a -H option to allow analysis of contacts 
                   with HETATOMs
+   V1.4  16.10.26 Chain groups are resolved once and residues are binned
+                  in a spatial grid so that only nearby residue pairs
+                  are examined. Output is unchanged.
+   V1.5  16.10.26 Added -l, -j and -f for batch processing of a list of
+                  files with optional contact frequencies
 
 *************************************************************************/
 /* Includes
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "bioplib/MathType.h"
 #include "bioplib/SysDefs.h"
 #include "bioplib/pdb.h"
 #include "bioplib/macros.h"
 #include "bioplib/general.h"
+#include "bioplib/hash.h"
 
 /************************************************************************/
 /* Defines and macros
 */
 #define MAXBUFF 160
 #define DEF_RAD 3.0
+#define MAXGRIDCELLS 1000000  /* Maximum cells in the residue grid      */
+#define GRID_SLACK   0.001    /* Allowance for rounding in grid tests   */
+#define MAXTHREADS   256      /* Maximum number of threads with -j      */
+#define HASHSIZE     10000    /* Initial size of the frequency hash     */
+#define MAXKEY       64       /* Size of a residue pair key             */
+
+typedef struct
+{
+   PDB  *start,               /* First atom of the residue              */
+        *stop;                /* First atom of the next residue         */
+   REAL x, y, z,              /* Centre of the residue's atoms          */
+        radius;               /* Bounding sphere radius about centre    */
+   int  nextInCell;           /* Next residue in the same cell (or -1)  */
+   BOOL inX,                  /* Residue is in group X                  */
+        inY;                  /* Residue is in group Y                  */
+}  RESINFO;
+
+typedef struct
+{
+   RESINFO *res;              /* Array of residues in file order        */
+   int     *cellHead,         /* First residue in each cell (or -1)     */
+           nres,
+           nx, ny, nz;
+   REAL    minX, minY, minZ,
+           cellSize,
+           cutoff;            /* Contact distance                       */
+}  RESGRID;
+
+typedef struct _contact
+{
+   struct _contact *next;
+   char  resnam1[8],          /* Details of the two residues            */
+         resnam2[8],
+         chain1, chain2,
+         insert1, insert2;
+   int   resnum1, resnum2,
+         nContacts;           /* Number of atom contacts                */
+   BOOL  het;                 /* Second residue is a HETATM group       */
+}  CONTACT;
+
+typedef struct _pairfreq
+{
+   struct _pairfreq *next;    /* Next pair in order of first appearance */
+   CONTACT *contact;          /* First contact seen for this pair       */
+   int     nFiles;            /* Number of files containing the contact */
+}  PAIRFREQ;
+
+typedef struct
+{
+   char    **filenames;       /* Files to be processed                  */
+   CONTACT **results;         /* Contacts found in each file            */
+   BOOL    *ok;               /* Each file was read successfully        */
+   char    *chainsx,
+           *chainsy;
+   REAL    RadSq;
+   BOOL    doHet,
+           keepWater;
+   int     nFiles,
+           nextFile;          /* Next file to be taken by a thread      */
+}  BATCH;
 
 /************************************************************************/
 /* Globals
 */
+/* BiopLib's PDB reader is not guaranteed to be thread-safe, so files
+   are read one at a time. The same lock is used to hand out files
+   to the threads.
+*/
+static pthread_mutex_t sBatchMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /************************************************************************/
 /* Prototypes
@@ -81,17 +154,30 @@ int main(int argc, char **argv);
 void Usage(void);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                   REAL *radsq, char *chainsx, char *chainsy, BOOL *doHet,
-                  BOOL *verbose, BOOL *stripWater);
-void DoProteinProteinAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                              char *filename, char *chainsx, 
-                              char *chainsy, BOOL verbose);
-void DoProteinHetAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                          char *filename, char *chainsx, 
-                          char *chainsy, BOOL verbose);
-void PrintContacts(FILE *out, PDB *p, PDB *pe, PDB *q, PDB *qe, 
-                   REAL RadSq, BOOL verbose);
+                  BOOL *verbose, BOOL *stripWater, BOOL *fileList,
+                  int *nThreads, BOOL *doFreq);
+PDB *ReadStructure(FILE *in, BOOL doHet, BOOL keepWater);
+CONTACT *DoProteinProteinAnalysis(PDB *pdb, REAL RadSq, char *chainsx, 
+                                  char *chainsy);
+CONTACT *DoProteinHetAnalysis(PDB *pdb, REAL RadSq, char *chainsx, 
+                              char *chainsy);
+BOOL StoreContacts(CONTACT **contacts, CONTACT **last, PDB *p, PDB *pe,
+                   PDB *q, PDB *qe, REAL RadSq);
+void PrintContacts(FILE *out, CONTACT *contacts, char *filename, 
+                   BOOL verbose);
+BOOL DoBatchAnalysis(FILE *in, FILE *out, REAL RadSq, char *chainsx,
+                     char *chainsy, BOOL doHet, BOOL keepWater, 
+                     BOOL verbose, int nThreads, BOOL doFreq);
+void *ProcessBatchFiles(void *arg);
+BOOL PrintFrequencies(FILE *out, BATCH *batch, int nRead);
 BOOL InChainList(PDB *p, char *chains);
 void PrintHeader(FILE *out, char *filename, REAL RadSq);
+void PrintBatchHeader(FILE *out, int nFiles, REAL RadSq);
+RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff, char *chainsx, 
+                          char *chainsy);
+void FreeResidueGrid(RESGRID *grid);
+int FindNearbyResidues(RESGRID *grid, int resIndex, int *nearby);
+int CompareInts(const void *a, const void *b);
 
 
 /************************************************************************/
@@ -102,57 +188,62 @@ void PrintHeader(FILE *out, char *filename, REAL RadSq);
    17.10.95 Original    By: ACRM
    07.04.06 Added chainsx and chainsy checking
    04.03.15 Now just reads PDB atoms. Updated for new BiopLib
+   16.10.26 Added batch mode. Analysis routines now return a list of
+            contacts for printing
 */
 int main(int argc, char **argv)
 {
-   char infile[MAXBUFF],
-        outfile[MAXBUFF],
-        chainsx[MAXBUFF],
-        chainsy[MAXBUFF];
-   PDB  *pdb;
-   int  natom;
-   FILE *in        = stdin,
-        *out       = stdout;
-   REAL radsq      = DEF_RAD * DEF_RAD;
-   BOOL doHet      = FALSE,
-        verbose    = FALSE,
-        keepWater  = FALSE;
+   char    infile[MAXBUFF],
+           outfile[MAXBUFF],
+           chainsx[MAXBUFF],
+           chainsy[MAXBUFF];
+   PDB     *pdb;
+   CONTACT *contacts;
+   FILE    *in        = stdin,
+           *out       = stdout;
+   REAL    radsq      = DEF_RAD * DEF_RAD;
+   BOOL    doHet      = FALSE,
+           verbose    = FALSE,
+           keepWater  = FALSE,
+           fileList   = FALSE,
+           doFreq     = FALSE;
+   int     nThreads   = 1;
 
    chainsx[0] = '\0';
    chainsy[0] = '\0';
    
    if(ParseCmdLine(argc, argv, infile, outfile, &radsq, chainsx, chainsy,
-                   &doHet, &verbose, &keepWater))
+                   &doHet, &verbose, &keepWater, &fileList, &nThreads,
+                   &doFreq))
    {
       if(blOpenStdFiles(infile, outfile, &in, &out))
       {
-         if(doHet)
+         if(fileList)
          {
-            pdb = blReadPDB(in, &natom);
-            if(!keepWater)
+            if(!DoBatchAnalysis(in, out, radsq, chainsx, chainsy, doHet,
+                                keepWater, verbose, nThreads, doFreq))
             {
-               PDB *pdb2 = blStripWatersPDBAsCopy(pdb, &natom);
-               FREELIST(pdb, PDB);
-               pdb = pdb2;
+               fprintf(stderr,"Error: No memory for batch analysis\n");
+               return(1);
             }
          }
-         else
-         {
-            pdb = blReadPDBAtoms(in, &natom);
-         }
-         
-         if(pdb != NULL)
+         else if((pdb = ReadStructure(in, doHet, keepWater)) != NULL)
          {
             if(doHet)
             {
-               DoProteinHetAnalysis(out, pdb, radsq, infile, 
-                                    chainsx, chainsy, verbose);
+               contacts = DoProteinHetAnalysis(pdb, radsq, 
+                                               chainsx, chainsy);
             }
             else
             {
-               DoProteinProteinAnalysis(out, pdb, radsq, infile, 
-                                        chainsx, chainsy, verbose);
+               contacts = DoProteinProteinAnalysis(pdb, radsq, 
+                                                   chainsx, chainsy);
             }
+
+            PrintHeader(out, infile, radsq);
+            PrintContacts(out, contacts, NULL, verbose);
+            FREELIST(contacts, CONTACT);
+            FREELIST(pdb, PDB);
          }
          else
          {
@@ -168,6 +259,43 @@ int main(int argc, char **argv)
    
    return(0);
 }
+
+
+/************************************************************************/
+/*>PDB *ReadStructure(FILE *in, BOOL doHet, BOOL keepWater)
+   --------------------------------------------------------
+   Input:   FILE    *in        Input PDB file pointer
+            BOOL    doHet      Read HETATMs as well as ATOMs
+            BOOL    keepWater  Keep waters when reading HETATMs
+   Returns: PDB     *          PDB linked list (NULL if none)
+
+   Reads the atoms needed for the analysis from a PDB file
+
+   16.10.26 Original - split out of main()   By: ACRM
+*/
+PDB *ReadStructure(FILE *in, BOOL doHet, BOOL keepWater)
+{
+   PDB *pdb;
+   int natom;
+   
+   if(doHet)
+   {
+      pdb = blReadPDB(in, &natom);
+      if(!keepWater)
+      {
+         PDB *pdb2 = blStripWatersPDBAsCopy(pdb, &natom);
+         FREELIST(pdb, PDB);
+         pdb = pdb2;
+      }
+   }
+   else
+   {
+      pdb = blReadPDBAtoms(in, &natom);
+   }
+
+   return(pdb);
+}
+
             
 /************************************************************************/
 /*>void Usage(void)
@@ -177,19 +305,31 @@ int main(int argc, char **argv)
    17.10.95 Original    By: ACRM
    04.03.15 V1.2
    28.10.15 V1.3
+   16.10.26 V1.4
+   16.10.26 V1.5
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nChainContacts V1.3 (c) 1995-2015, Andrew C.R. \
+   fprintf(stderr,"\nChainContacts V1.5 (c) 1995-2026, Andrew C.R. \
 Martin, UCL\n");
    fprintf(stderr,"Usage: chaincontacts [-r radius] [-x CCC] \
 [-y CCC] [-H [-w]] [in.pdb [out.dat]]\n");
+   fprintf(stderr,"       chaincontacts -l [-j nthreads] [-f] \
+[-r radius] [-x CCC] [-y CCC]\n");
+   fprintf(stderr,"                     [-H [-w]] [filelist [out.dat]]\n");
    fprintf(stderr,"       -r Specify contact radius (Default: %.3f)\n\n",
            DEF_RAD);
    fprintf(stderr,"       -x/-y Specifiy one or more chains that form \
 groups\n");
    fprintf(stderr,"       -H Group Y atoms are HETATOMs\n");
    fprintf(stderr,"       -w Include waters in Group Y HETATOMs\n");
+   fprintf(stderr,"       -l Input is a file containing a list of PDB \
+files\n");
+   fprintf(stderr,"       -j Number of threads to process the list \
+of files (Default: 1)\n");
+   fprintf(stderr,"       -f Also give the fraction of files in which \
+each residue pair\n");
+   fprintf(stderr,"          is in contact\n\n");
 
    fprintf(stderr,"I/O is through stdin/stdout if files are not \
 specified.\n\n");
@@ -206,13 +346,19 @@ If you specify\n");
    fprintf(stderr,"just -x or -y then you will get contacts between that \
 chain (or chains)\n");
    fprintf(stderr,"and every other chain.\n");
+   fprintf(stderr,"\nWith -l, the results for all files are given as a \
+single table with\n");
+   fprintf(stderr,"each line preceded by the filename. Files that \
+cannot be read are\n");
+   fprintf(stderr,"reported and skipped.\n");
 }
       
 
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                      REAL *radsq, char *chainsx, char *chainsy, 
-                     BOOL *doHet, BOOL *verbose, BOOL *keepWater)
+                     BOOL *doHet, BOOL *verbose, BOOL *keepWater,
+                     BOOL *fileList, int *nThreads, BOOL *doFreq)
    ---------------------------------------------------------------------
    Input:   int      argc        Argument count
             char     **argv      Argument array
@@ -222,6 +368,9 @@ chain (or chains)\n");
             BOOL     *doHet      Do contacts with HETATMs
             BOOL     *verbose    Print more information on contacts
             BOOL     *keepWater Strip waters when using -H
+            BOOL     *fileList   Input is a list of files
+            int      *nThreads   Number of threads for a list of files
+            BOOL     *doFreq     Print contact frequencies for a list
    Returns: BOOL                 Success
 
    Parse the command line
@@ -229,11 +378,16 @@ chain (or chains)\n");
    17.10.95 Original    By: ACRM
    07.04.06 Added -x and -y
    28.10.15 Added -H and -v and -w
+   16.10.26 Added -l, -j and -f
+   16.10.26 -j and -f are rejected without -l
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                   REAL *radsq, char *chainsx, char *chainsy,
-                  BOOL *doHet, BOOL *verbose, BOOL *keepWater)
+                  BOOL *doHet, BOOL *verbose, BOOL *keepWater,
+                  BOOL *fileList, int *nThreads, BOOL *doFreq)
 {
+   BOOL gotThreads = FALSE;
+   
    argc--;
    argv++;
    
@@ -270,6 +424,21 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          case 'w':
             *keepWater = TRUE;
             break;
+         case 'l':
+            *fileList = TRUE;
+            break;
+         case 'j':
+            argv++;
+            argc--;
+            if(!argc || !sscanf(argv[0],"%d",nThreads) || (*nThreads < 1))
+               return(FALSE);
+            if(*nThreads > MAXTHREADS)
+               *nThreads = MAXTHREADS;
+            gotThreads = TRUE;
+            break;
+         case 'f':
+            *doFreq = TRUE;
+            break;
          default:
             return(FALSE);
             break;
@@ -289,27 +458,28 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          argv++;
          if(argc)
             strcpy(outfile, argv[0]);
-         return(TRUE);
+         break;
       }
       argc--;
       argv++;
    }
+
+   /* -j and -f only apply to a list of files                           */
+   if(!*fileList && (gotThreads || *doFreq))
+      return(FALSE);
    
    return(TRUE);
 }
 
 /************************************************************************/
-/*>void DoProteinProteinAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                                 char *filename, char *chainsx,
-                                 char *chainsy, BOOL verbose)
+/*>CONTACT *DoProteinProteinAnalysis(PDB *pdb, REAL RadSq, 
+                                     char *chainsx, char *chainsy)
    ----------------------------------------------------------------
-   Input:   FILE    *out       Output file pointer
-            PDB     *pdb       PDB linked list
+   Input:   PDB     *pdb       PDB linked list
             REAL    RadSq      Squared radius for contact
-            char    *filename  Input PDB filename or blank string
             char    *chainsx   Group1 chains
             char    *chainsy   Group2 chains
-            BOOL    verbose    Print more info on contacts
+   Returns: CONTACT *          Linked list of residue contacts
 
    Main routine to do the contacts analysis between protein chains
 
@@ -318,78 +488,96 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
    04.03.15 Updated for new BiopLib
    28.10.15 Renamed from DoAnalysis(). Refactored to take InChainList()
             and PrintContacts() into separate subroutines. Added verbose
+   16.10.26 Uses a RESGRID to examine only nearby residues with chain 
+            groups resolved once
+   16.10.26 Returns the contacts rather than printing them
 */   
-void DoProteinProteinAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                              char *filename, char *chainsx, 
-                              char *chainsy, BOOL verbose)
+CONTACT *DoProteinProteinAnalysis(PDB *pdb, REAL RadSq, char *chainsx, 
+                                  char *chainsy)
 {
-   PDB  *p,
-        *pe,
-        *q,
-        *qe;
-   BOOL ok1, ok2;
+   RESGRID *grid;
+   RESINFO *p, *q;
+   CONTACT *contacts = NULL,
+           *last     = NULL;
+   int     *nearby,
+           nNearby,
+           i, j;
 
-   PrintHeader(out, filename, RadSq);
+   if(((grid = BuildResidueGrid(pdb, sqrt(RadSq), chainsx, chainsy))
+       ==NULL) ||
+      ((nearby = (int *)malloc(grid->nres * sizeof(int)))==NULL))
+   {
+      fprintf(stderr,"Error: No memory for residue grid\n");
+      exit(1);
+   }
 
-   /* Run through the linked list a residue at a time                   */
-   for(p=pdb; p!=NULL; p = pe)
+   /* Run through the residues                                          */
+   for(i=0; i<grid->nres; i++)
    {
-      pe = blFindNextResidue(p);
-      
-      /* Test if this residue is in a group X chain                     */
-      ok1 = InChainList(p, chainsx);
+      p = &(grid->res[i]);
       
-      /* It is in a group X chain                                       */
-      if(ok1)
+      /* If it is in a group X chain, run through the nearby residues
+         in file order
+      */
+      if(p->inX)
       {
-         /* Run through the PDB linked list again a residue at a time   */
-         for(q=pdb; q!=NULL; q = qe)
+         nNearby = FindNearbyResidues(grid, i, nearby);
+         for(j=0; j<nNearby; j++)
          {
-            qe = blFindNextResidue(q);
-         
-            /* Check it's a different chain                             */
-            if(p->chain[0]  != q->chain[0])
+            q = &(grid->res[nearby[j]]);
+
+            /* Check it's a different chain in group Y                  */
+            if((p->start->chain[0] != q->start->chain[0]) && q->inY)
             {
-               /* If it is, check if it's a group Y chain               */
-               ok2 = InChainList(q, chainsy);
-            
-               /* If it is, then run through the first residue          */
-               if(ok2)
+               if(!StoreContacts(&contacts, &last, p->start, p->stop,
+                                 q->start, q->stop, RadSq))
                {
-                  PrintContacts(out, p, pe, q, qe, RadSq, verbose);
+                  fprintf(stderr,"Error: No memory for contacts\n");
+                  exit(1);
                }
             }
          }
       }
    }
+
+   free(nearby);
+   FreeResidueGrid(grid);
+
+   return(contacts);
 }
 
 /************************************************************************/
-/*>void PrintContacts(FILE *out, PDB *p, PDB *pe, PDB *q, PDB *qe, 
-                      REAL RadSq, BOOL verbose)
-   ---------------------------------------------------------------
-   Input:   FILE    *out       Output file pointer
-            PDB     *pdb       PDB linked list
-            REAL    RadSq      Squared radius for contact
-            char    *filename  Input PDB filename or blank string
-            char    *chainsx   Group1 chains
-            char    *chainsy   Group2 chains
-            BOOL    doHet      Do contacts with HET groups
-            BOOL    verbose    Print more information
+/*>BOOL StoreContacts(CONTACT **contacts, CONTACT **last, PDB *p, 
+                      PDB *pe, PDB *q, PDB *qe, REAL RadSq)
+   -------------------------------------------------------------
+   I/O:     CONTACT **contacts  Linked list of contacts
+            CONTACT **last      Last item in the linked list
+   Input:   PDB     *p          Start of first residue
+            PDB     *pe         Start of next residue
+            PDB     *q          Start of second residue
+            PDB     *qe         Start of next residue
+            REAL    RadSq       Squared radius for contact
+   Returns: BOOL                Success (FALSE if no memory)
+
+   Counts the atom contacts between two residues and, if there are any,
+   appends them to the list of contacts.
+
+   16.10.26 Original - counting split out of PrintContacts()  By: ACRM
 */
-void PrintContacts(FILE *out, PDB *p, PDB *pe, PDB *q, PDB *qe, 
-                   REAL RadSq, BOOL verbose)
+BOOL StoreContacts(CONTACT **contacts, CONTACT **last, PDB *p, PDB *pe,
+                   PDB *q, PDB *qe, REAL RadSq)
 {
-   int  NContacts = 0;
-   PDB  *p1, *q1;
-   REAL DistSq;
+   int     NContacts = 0;
+   PDB     *p1, *q1;
+   REAL    DistSq;
+   CONTACT *c;
 
    for(p1 = p; p1 != pe; NEXT(p1))
    {
       /* Run through the second residue                                 */
       for(q1 = q; q1 != qe; NEXT(q1))
       {
-         /* Calculate distance and display if in range                  */
+         /* Calculate distance and count if in range                    */
          DistSq = DISTSQ(p1,q1);
          if(DistSq <= RadSq)
          {
@@ -397,26 +585,79 @@ void PrintContacts(FILE *out, PDB *p, PDB *pe, PDB *q, PDB *qe,
          }
       }
    }
-   /* Print information for residue contacts                            */
+
    if(NContacts)
    {
+      if(*contacts == NULL)
+      {
+         INIT((*contacts), CONTACT);
+         c = *contacts;
+      }
+      else
+      {
+         c = *last;
+         ALLOCNEXT(c, CONTACT);
+      }
+      if(c == NULL)
+         return(FALSE);
+      *last = c;
+
+      strncpy(c->resnam1, p->resnam, 8);
+      strncpy(c->resnam2, q->resnam, 8);
+      c->chain1    = p->chain[0];
+      c->chain2    = q->chain[0];
+      c->insert1   = p->insert[0];
+      c->insert2   = q->insert[0];
+      c->resnum1   = p->resnum;
+      c->resnum2   = q->resnum;
+      c->nContacts = NContacts;
+      c->het       = !strncmp(q->record_type, "HETATM", 6);
+   }
+
+   return(TRUE);
+}
+
+/************************************************************************/
+/*>void PrintContacts(FILE *out, CONTACT *contacts, char *filename, 
+                      BOOL verbose)
+   ---------------------------------------------------------------
+   Input:   FILE    *out       Output file pointer
+            CONTACT *contacts  Linked list of residue contacts
+            char    *filename  Filename to precede each line (or NULL)
+            BOOL    verbose    Print more information
+
+   Prints the residue contacts
+
+   28.10.15 Original
+   16.10.26 Works from a list of contacts. Added filename
+*/
+void PrintContacts(FILE *out, CONTACT *contacts, char *filename, 
+                   BOOL verbose)
+{
+   CONTACT *c;
+
+   for(c=contacts; c!=NULL; NEXT(c))
+   {
+      if(filename != NULL)
+         fprintf(out, "File: %s ", filename);
+
       if(verbose)
       {
          fprintf(out,"Chain: %c Res:%4d%c %4s - \
 Chain: %c Res:%4d%c %4s Contacts: %2d %s\n",
-                 p->chain[0], p->resnum, p->insert[0], p->resnam,
-                 q->chain[0], q->resnum, q->insert[0], q->resnam,
-                 NContacts,
-                 !strncmp(q->record_type, "HETATM", 6)?"(HET)":"");
+                 c->chain1, c->resnum1, c->insert1, c->resnam1,
+                 c->chain2, c->resnum2, c->insert2, c->resnam2,
+                 c->nContacts,
+                 c->het?"(HET)":"");
       }
       else
       {
          fprintf(out,"Chain: %c Res:%4d%c - \
 Chain: %c Res:%4d%c Contacts: %2d %s\n",
-                 p->chain[0], p->resnum, p->insert[0],
-                 q->chain[0], q->resnum, q->insert[0],
-                 NContacts,
-                 !strncmp(q->record_type, "HETATM", 6)?"(HET)":"");
+                 c->chain1, c->resnum1, c->insert1,
+                 c->chain2, c->resnum2, c->insert2,
+                 c->nContacts,
+                 c->het?"(HET)":"");
       }
    }
 }
@@ -431,6 +672,7 @@ Chain: %c Res:%4d%c Contacts: %2d %s\n",
                           counts as being in the list
 
    28.10.15 Refactored from DoProteinProteinAnalysis()
+   16.10.26 Now called once per residue by BuildResidueGrid()
 */
 BOOL InChainList(PDB *p, char *chains)
 {
@@ -481,69 +723,583 @@ void PrintHeader(FILE *out, char *filename, REAL RadSq)
 
 
 /************************************************************************/
-/*>void DoProteinHetAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                             char *filename, char *chainsx, 
-                             char *chainsy, BOOL verbose)
-   ----------------------------------------------------------------
-   Input:   FILE    *out       Output file pointer
-            PDB     *pdb       PDB linked list
+/*>void PrintBatchHeader(FILE *out, int nFiles, REAL RadSq)
+   --------------------------------------------------------
+   Input:  FILE *out        Output file
+           int  nFiles      Number of files analyzed
+           REAL RadSq       Radius squared for contacts
+
+   Prints the output header for a list of files
+
+   16.10.26 Original    By: ACRM
+*/
+void PrintBatchHeader(FILE *out, int nFiles, REAL RadSq)
+{
+   fprintf(out,"Contact Analysis\n");
+   fprintf(out,"================\n\n");
+
+   fprintf(out,"Files:  %d\n",nFiles);
+   fprintf(out,"Radius: %f\n",sqrt(RadSq));
+
+   fprintf(out,"Residue level contacts\n");
+   fprintf(out,"----------------------\n\n");
+}
+
+
+/************************************************************************/
+/*>CONTACT *DoProteinHetAnalysis(PDB *pdb, REAL RadSq, char *chainsx, 
+                                 char *chainsy)
+   -------------------------------------------------------------------
+   Input:   PDB     *pdb       PDB linked list
             REAL    RadSq      Squared radius for contact
-            char    *filename  Input PDB filename or blank string
             char    *chainsx   Group1 chains
             char    *chainsy   Group2 chains
-            BOOL    verbose    Print more information on contacts
+   Returns: CONTACT *          Linked list of residue contacts
 
    Main routine to do the contacts analysis between protein chains
    and HET groups
 
    28.10.15 Original
+   16.10.26 Uses a RESGRID to examine only nearby residues with chain 
+            groups resolved once
+   16.10.26 Returns the contacts rather than printing them
 */   
-void DoProteinHetAnalysis(FILE *out, PDB *pdb, REAL RadSq, 
-                          char *filename, char *chainsx, 
-                          char *chainsy, BOOL verbose)
+CONTACT *DoProteinHetAnalysis(PDB *pdb, REAL RadSq, char *chainsx, 
+                              char *chainsy)
 {
-   PDB  *p,
-        *pe,
-        *q,
-        *qe;
-   BOOL ok1, ok2;
+   RESGRID *grid;
+   RESINFO *p, *q;
+   CONTACT *contacts = NULL,
+           *last     = NULL;
+   int     *nearby,
+           nNearby,
+           i, j;
 
-   PrintHeader(out, filename, RadSq);
+   if(((grid = BuildResidueGrid(pdb, sqrt(RadSq), chainsx, chainsy))
+       ==NULL) ||
+      ((nearby = (int *)malloc(grid->nres * sizeof(int)))==NULL))
+   {
+      fprintf(stderr,"Error: No memory for residue grid\n");
+      exit(1);
+   }
 
-   /* Run through the linked list a residue at a time                   */
-   for(p=pdb; p!=NULL; p=pe)
+   /* Run through the residues                                          */
+   for(i=0; i<grid->nres; i++)
    {
-      pe = blFindNextResidue(p);
+      p = &(grid->res[i]);
 
-      /* If this is a protein atom                                      */
-      if(!strncmp(p->record_type, "ATOM  ", 6))
+      /* If this is a protein residue in a group X chain, run through 
+         the nearby residues in file order
+      */
+      if(!strncmp(p->start->record_type, "ATOM  ", 6) && p->inX)
       {
-         /* Test if this residue is in a group X chain                  */
-         ok1 = InChainList(p, chainsx);
-         
-         /* It is in a group X chain                                    */
-         if(ok1)
+         nNearby = FindNearbyResidues(grid, i, nearby);
+         for(j=0; j<nNearby; j++)
          {
-            /* Run through the PDB linked list again a residue at a time*/
-            for(q=pdb; q!=NULL; q = qe)
-            {
-               qe = blFindNextResidue(q);
+            q = &(grid->res[nearby[j]]);
 
-               /* Check it's a HETATM group                             */
-               if(!strncmp(q->record_type, "HETATM", 6))
+            /* Check it's a HETATM group in group Y                     */
+            if(!strncmp(q->start->record_type, "HETATM", 6) && q->inY)
+            {
+               if(!StoreContacts(&contacts, &last, p->start, p->stop,
+                                 q->start, q->stop, RadSq))
                {
-                  /* If it is, check if it's a group Y chain            */
-                  ok2 = InChainList(q, chainsy);
-                  
-                  /* If it is, then run through the first residue       */
-                  if(ok2)
-                  {
-                     PrintContacts(out, p, pe, q, qe, RadSq, verbose);
-                  }
+                  fprintf(stderr,"Error: No memory for contacts\n");
+                  exit(1);
                }
             }
          }
       }
    }
+
+   free(nearby);
+   FreeResidueGrid(grid);
+
+   return(contacts);
 }
 
+
+/************************************************************************/
+/*>BOOL DoBatchAnalysis(FILE *in, FILE *out, REAL RadSq, char *chainsx,
+                        char *chainsy, BOOL doHet, BOOL keepWater, 
+                        BOOL verbose, int nThreads, BOOL doFreq)
+   ---------------------------------------------------------------------
+   Input:   FILE    *in        File containing a list of PDB files
+            FILE    *out       Output file pointer
+            REAL    RadSq      Squared radius for contact
+            char    *chainsx   Group1 chains
+            char    *chainsy   Group2 chains
+            BOOL    doHet      Do contacts with HETATMs
+            BOOL    keepWater  Keep waters when using HETATMs
+            BOOL    verbose    Print more information on contacts
+            int     nThreads   Number of threads
+            BOOL    doFreq     Print contact frequencies
+   Returns: BOOL               Success (FALSE if no memory)
+
+   Reads a list of PDB files and analyzes them using a pool of threads.
+   The contacts are printed as a single table in the order that files
+   were listed, optionally followed by the fraction of files in which
+   each residue pair is in contact.
+
+   16.10.26 Original    By: ACRM
+*/
+BOOL DoBatchAnalysis(FILE *in, FILE *out, REAL RadSq, char *chainsx,
+                     char *chainsy, BOOL doHet, BOOL keepWater, 
+                     BOOL verbose, int nThreads, BOOL doFreq)
+{
+   BATCH     batch;
+   pthread_t threads[MAXTHREADS];
+   char      buffer[MAXBUFF];
+   int       maxFiles = 0,
+             nRead    = 0,
+             i;
+   BOOL      retval   = TRUE;
+
+   batch.filenames = NULL;
+   batch.nFiles    = 0;
+   batch.nextFile  = 0;
+   batch.RadSq     = RadSq;
+   batch.chainsx   = chainsx;
+   batch.chainsy   = chainsy;
+   batch.doHet     = doHet;
+   batch.keepWater = keepWater;
+
+   /* Read the list of files                                            */
+   while(fgets(buffer, MAXBUFF, in))
+   {
+      TERMINATE(buffer);
+      if(!buffer[0])
+         continue;
+      
+      if(batch.nFiles == maxFiles)
+      {
+         maxFiles = (maxFiles ? 2 * maxFiles : MAXBUFF);
+         if((batch.filenames = 
+             (char **)realloc((void *)batch.filenames, 
+                              maxFiles * sizeof(char *)))==NULL)
+            return(FALSE);
+      }
+      if((batch.filenames[batch.nFiles] = 
+          (char *)malloc((strlen(buffer)+1) * sizeof(char)))==NULL)
+         return(FALSE);
+      strcpy(batch.filenames[batch.nFiles++], buffer);
+   }
+
+   if(batch.nFiles == 0)
+      return(TRUE);
+
+   if(((batch.results = (CONTACT **)calloc(batch.nFiles, 
+                                            sizeof(CONTACT *)))==NULL) ||
+      ((batch.ok = (BOOL *)calloc(batch.nFiles, sizeof(BOOL)))==NULL))
+      return(FALSE);
+   
+   /* Analyze the files                                                 */
+   if(nThreads > batch.nFiles)
+      nThreads = batch.nFiles;
+   for(i=0; i<nThreads; i++)
+   {
+      if(pthread_create(&(threads[i]), NULL, ProcessBatchFiles, 
+                        (void *)&batch))
+      {
+         fprintf(stderr,"Error: Unable to create thread\n");
+         exit(1);
+      }
+   }
+   for(i=0; i<nThreads; i++)
+      pthread_join(threads[i], NULL);
+
+   /* Print the results in order                                        */
+   for(i=0; i<batch.nFiles; i++)
+   {
+      if(batch.ok[i])
+         nRead++;
+   }
+   PrintBatchHeader(out, nRead, RadSq);
+   for(i=0; i<batch.nFiles; i++)
+      PrintContacts(out, batch.results[i], batch.filenames[i], verbose);
+
+   if(doFreq)
+      retval = PrintFrequencies(out, &batch, nRead);
+
+   for(i=0; i<batch.nFiles; i++)
+   {
+      FREELIST(batch.results[i], CONTACT);
+      free(batch.filenames[i]);
+   }
+   free(batch.results);
+   free(batch.filenames);
+   free(batch.ok);
+
+   return(retval);
+}
+
+
+/************************************************************************/
+/*>void *ProcessBatchFiles(void *arg)
+   ----------------------------------
+   I/O:     void   *arg        Pointer to the BATCH
+
+   Thread entry point. Repeatedly takes the next unprocessed file from
+   the batch, reads it and stores its contacts. Files that cannot be
+   read are reported and skipped.
+
+   16.10.26 Original    By: ACRM
+*/
+void *ProcessBatchFiles(void *arg)
+{
+   BATCH *batch = (BATCH *)arg;
+   PDB   *pdb;
+   FILE  *fp;
+   int   i;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&sBatchMutex);
+      i = batch->nextFile++;
+      pthread_mutex_unlock(&sBatchMutex);
+
+      if(i >= batch->nFiles)
+         break;
+
+      if((fp = fopen(batch->filenames[i], "r"))==NULL)
+      {
+         fprintf(stderr,"Warning: Unable to read file: %s\n",
+                 batch->filenames[i]);
+         continue;
+      }
+
+      pthread_mutex_lock(&sBatchMutex);
+      pdb = ReadStructure(fp, batch->doHet, batch->keepWater);
+      pthread_mutex_unlock(&sBatchMutex);
+      fclose(fp);
+
+      if(pdb == NULL)
+      {
+         fprintf(stderr,"Warning: No atoms read from PDB file: %s\n",
+                 batch->filenames[i]);
+         continue;
+      }
+
+      if(batch->doHet)
+      {
+         batch->results[i] = DoProteinHetAnalysis(pdb, batch->RadSq,
+                                                  batch->chainsx,
+                                                  batch->chainsy);
+      }
+      else
+      {
+         batch->results[i] = DoProteinProteinAnalysis(pdb, batch->RadSq,
+                                                      batch->chainsx,
+                                                      batch->chainsy);
+      }
+      batch->ok[i] = TRUE;
+      FREELIST(pdb, PDB);
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL PrintFrequencies(FILE *out, BATCH *batch, int nRead)
+   ---------------------------------------------------------
+   Input:   FILE    *out       Output file pointer
+            BATCH   *batch     Batch of analyzed files
+            int     nRead      Number of files successfully read
+   Returns: BOOL               Success (FALSE if no memory)
+
+   Prints the number and fraction of files in which each residue pair
+   is in contact. Pairs are listed in order of first appearance.
+
+   16.10.26 Original    By: ACRM
+*/
+BOOL PrintFrequencies(FILE *out, BATCH *batch, int nRead)
+{
+   HASHTABLE *hash;
+   PAIRFREQ  *pairs    = NULL,
+             *lastPair = NULL,
+             *pf;
+   CONTACT   *c;
+   char      key[MAXKEY];
+   int       i;
+
+   if((hash = blInitializeHash(HASHSIZE))==NULL)
+      return(FALSE);
+
+   for(i=0; i<batch->nFiles; i++)
+   {
+      for(c=batch->results[i]; c!=NULL; NEXT(c))
+      {
+         sprintf(key, "%c%d%c-%c%d%c", 
+                 c->chain1, c->resnum1, c->insert1,
+                 c->chain2, c->resnum2, c->insert2);
+
+         if(blHashKeyDefined(hash, key))
+         {
+            pf = (PAIRFREQ *)blGetHashValuePointer(hash, key);
+         }
+         else
+         {
+            if(pairs == NULL)
+            {
+               INIT(pairs, PAIRFREQ);
+               pf = pairs;
+            }
+            else
+            {
+               pf = lastPair;
+               ALLOCNEXT(pf, PAIRFREQ);
+            }
+            if(pf == NULL)
+               return(FALSE);
+            lastPair    = pf;
+            pf->contact = c;
+            pf->nFiles  = 0;
+            blSetHashValuePointer(hash, key, (BPTR)pf);
+         }
+         pf->nFiles++;
+      }
+   }
+
+   fprintf(out,"\nResidue pair contact frequencies\n");
+   fprintf(out,"--------------------------------\n\n");
+   
+   for(pf=pairs; pf!=NULL; NEXT(pf))
+   {
+      c = pf->contact;
+      fprintf(out,"Chain: %c Res:%4d%c - Chain: %c Res:%4d%c \
+Files: %4d Frequency: %.3f\n",
+              c->chain1, c->resnum1, c->insert1,
+              c->chain2, c->resnum2, c->insert2,
+              pf->nFiles, (REAL)pf->nFiles / (REAL)nRead);
+   }
+
+   FREELIST(pairs, PAIRFREQ);
+   blFreeHash(hash);
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff, char *chainsx, 
+                             char *chainsy)
+   ----------------------------------------------------------------
+   Input:   PDB     *pdb       PDB linked list
+            REAL    cutoff     Contact distance
+            char    *chainsx   Group1 chains
+            char    *chainsy   Group2 chains
+   Returns: RESGRID *          Malloc'd residue grid (NULL if no memory)
+
+   Builds an array of residues with their centres, bounding sphere radii
+   and chain group membership, and bins them on their centres into a
+   uniform grid. The cells are large enough that two residues with any
+   atoms within the cutoff must be in the same or adjacent cells.
+
+   16.10.26 Original    By: ACRM
+*/
+RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff, char *chainsx, 
+                          char *chainsy)
+{
+   RESGRID *grid;
+   PDB     *res, *resNext, *a;
+   REAL    maxX, maxY, maxZ,
+           maxRadius = (REAL)0.0;
+   int     i;
+
+   if((grid = (RESGRID *)malloc(sizeof(RESGRID)))==NULL)
+      return(NULL);
+   grid->cutoff   = cutoff;
+   grid->cellHead = NULL;
+
+   grid->nres = 0;
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+      grid->nres++;
+
+   if((grid->res = (RESINFO *)malloc((grid->nres + 1) * sizeof(RESINFO)))
+      ==NULL)
+   {
+      free(grid);
+      return(NULL);
+   }
+
+   /* Find residue centres and radii                                    */
+   for(res=pdb, i=0; res!=NULL; res=resNext, i++)
+   {
+      RESINFO *r     = &(grid->res[i]);
+      REAL    natoms = (REAL)0.0,
+              rSq    = (REAL)0.0;
+
+      resNext = blFindNextResidue(res);
+      r->start      = res;
+      r->stop       = resNext;
+      r->nextInCell = (-1);
+      r->inX        = InChainList(res, chainsx);
+      r->inY        = InChainList(res, chainsy);
+      r->x = r->y = r->z = (REAL)0.0;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         r->x   += a->x;
+         r->y   += a->y;
+         r->z   += a->z;
+         natoms += (REAL)1.0;
+      }
+      r->x /= natoms;
+      r->y /= natoms;
+      r->z /= natoms;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         REAL dSq = DISTSQ(a, r);
+         if(dSq > rSq)
+            rSq = dSq;
+      }
+      r->radius = sqrt(rSq);
+
+      if(i==0)
+      {
+         grid->minX = maxX = r->x;
+         grid->minY = maxY = r->y;
+         grid->minZ = maxZ = r->z;
+      }
+      grid->minX = MIN(grid->minX, r->x);
+      grid->minY = MIN(grid->minY, r->y);
+      grid->minZ = MIN(grid->minZ, r->z);
+      maxX       = MAX(maxX, r->x);
+      maxY       = MAX(maxY, r->y);
+      maxZ       = MAX(maxZ, r->z);
+      maxRadius  = MAX(maxRadius, r->radius);
+   }
+
+   if(grid->nres == 0)
+   {
+      grid->minX = grid->minY = grid->minZ = (REAL)0.0;
+      maxX       = maxY       = maxZ       = (REAL)0.0;
+   }
+
+   /* Size the cells, growing them if the grid would be unreasonably 
+      large
+   */
+   grid->cellSize = cutoff + (2.0 * maxRadius) + GRID_SLACK;
+   for(;;)
+   {
+      grid->nx = 1 + (int)((maxX - grid->minX) / grid->cellSize);
+      grid->ny = 1 + (int)((maxY - grid->minY) / grid->cellSize);
+      grid->nz = 1 + (int)((maxZ - grid->minZ) / grid->cellSize);
+      if(((double)grid->nx * (double)grid->ny * (double)grid->nz) <= 
+         (double)MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                      sizeof(int)))==NULL)
+   {
+      FreeResidueGrid(grid);
+      return(NULL);
+   }
+   for(i=0; i<grid->nx * grid->ny * grid->nz; i++)
+      grid->cellHead[i] = (-1);
+
+   /* Bin the residues                                                  */
+   for(i=0; i<grid->nres; i++)
+   {
+      RESINFO *r   = &(grid->res[i]);
+      int     cell = (int)((r->x - grid->minX) / grid->cellSize) +
+                     grid->nx * 
+                     ((int)((r->y - grid->minY) / grid->cellSize) +
+                      grid->ny * 
+                      (int)((r->z - grid->minZ) / grid->cellSize));
+      r->nextInCell        = grid->cellHead[cell];
+      grid->cellHead[cell] = i;
+   }
+
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeResidueGrid(RESGRID *grid)
+   -----------------------------------
+   Input:   RESGRID *grid     Residue grid
+
+   Frees a residue grid
+
+   16.10.26 Original    By: ACRM
+*/
+void FreeResidueGrid(RESGRID *grid)
+{
+   if(grid->cellHead != NULL)
+      free(grid->cellHead);
+   free(grid->res);
+   free(grid);
+}
+
+
+/************************************************************************/
+/*>int FindNearbyResidues(RESGRID *grid, int resIndex, int *nearby)
+   ----------------------------------------------------------------
+   Input:   RESGRID *grid      Residue grid
+            int     resIndex   Index of the residue of interest
+   Output:  int     *nearby    Indexes of nearby residues in file order
+   Returns: int                Number of nearby residues
+
+   Finds the residues whose bounding spheres are within the grid's 
+   cutoff of the bounding sphere of the specified residue. The residue
+   itself is included. These are the only residues that can have atoms
+   in contact with it. The indexes are sorted so that results are 
+   generated in the same order as a scan of the whole linked list.
+
+   16.10.26 Original    By: ACRM
+*/
+int FindNearbyResidues(RESGRID *grid, int resIndex, int *nearby)
+{
+   RESINFO *p = &(grid->res[resIndex]);
+   int     ix = (int)((p->x - grid->minX) / grid->cellSize),
+           iy = (int)((p->y - grid->minY) / grid->cellSize),
+           iz = (int)((p->z - grid->minZ) / grid->cellSize),
+           cx, cy, cz, j,
+           nNearby = 0;
+
+   for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, grid->nz-1); cz++)
+   {
+      for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, grid->ny-1); cy++)
+      {
+         for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, grid->nx-1); cx++)
+         {
+            for(j=grid->cellHead[cx + grid->nx * (cy + grid->ny * cz)];
+                j!=(-1);
+                j=grid->res[j].nextInCell)
+            {
+               RESINFO *q    = &(grid->res[j]);
+               REAL    reach = grid->cutoff + p->radius + q->radius +
+                               GRID_SLACK;
+
+               if(DISTSQ(p, q) <= reach * reach)
+                  nearby[nNearby++] = j;
+            }
+         }
+      }
+   }
+
+   qsort(nearby, nNearby, sizeof(int), CompareInts);
+   return(nNearby);
+}
+
+
+/************************************************************************/
+/*>int CompareInts(const void *a, const void *b)
+   ---------------------------------------------
+   Input:   const void *a     Pointer to first int
+            const void *b     Pointer to second int
+   Returns: int               Comparison for qsort()
+
+   Compares two integers for sorting into ascending order
+
+   16.10.26 Original    By: ACRM
+*/
+int CompareInts(const void *a, const void *b)
+{
+   return(*(const int *)a - *(const int *)b);
+}
@@ -3,12 +3,12 @@
    Program:    distmat
    File:       distmat.c
    
-   Version:    V2.1
-   Date:       13.03.19
+   Version:    V2.5
+   Date:       16.10.26
    Function:   Calculate inter-CA distances on a set of common-labelled
                PDB files
    
-   Copyright:  (c) UCL, Dr. Andrew C. R. Martin 2009-2019
+   Copyright:  (c) UCL, Dr. Andrew C. R. Martin 2009-2026
    Author:     Dr. Andrew C. R. Martin
    Address:    Biomolecular Structure & Modelling Unit,
                Department of Biochemistry & Molecular Biology,
@@ -43,6 +43,24 @@
    PDB file or a 'file of files' - i.e. a file containing a list of
    PDB files to be processed.
 
+   If a distance cutoff is given (-d), residues are binned into a
+   uniform spatial grid on their centres and only those pairs whose
+   bounding spheres lie within the cutoff have their atom distances
+   evaluated. Pairs that are never within the cutoff are reported as
+   '>cutoff' and the statistics for other pairs are calculated over
+   the structures in which they lie within the cutoff.
+
+   With -j, the list of files is split into contiguous blocks, each 
+   processed by its own thread into private pair data. These are
+   summed in block order once all threads finish, so residues are
+   listed in the same order as a serial run.
+
+   With -b, the results are written as NumPy .npy files rather than as
+   text. Only the upper triangle is calculated and stored, as float32 
+   vectors in the order given by numpy.tril_indices() on the transpose:
+   element (i,j) with i<=j is at j*(j+1)/2+i. Residue labels are 
+   written one per line, in index order, to a separate text file.
+
 **************************************************************************
 
    Usage:
@@ -60,6 +78,13 @@
                     are't needed any more - everything is dynamically
                     allocated.
    V2.1   13.03.19  Increased some buffer sizes
+   V2.2   16.10.26  Added -d cutoff with grid-based residue pair search
+   V2.3   16.10.26  Residue pair data now held in a packed triangular
+                    array indexed by residue number rather than a hash
+                    keyed on residue-pair labels
+   V2.4   16.10.26  Added -j to process the files in a file of files
+                    on several threads
+   V2.5   16.10.26  Added -b to write binary NumPy matrices
 
 *************************************************************************/
 /* #define DEBUG 1 */
@@ -69,6 +94,9 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include "bioplib/MathType.h"
 #include "bioplib/SysDefs.h"
 #include "bioplib/pdb.h"
@@ -83,15 +111,22 @@
 #define MAXCHAINLABEL 8
 #define MAXBUFF       160
 #define DEF_MAXRES    300   /* Approximate number of residues in a file.
-                               This is simply used to initialize the hash
-                               table. Increasing it will increase 
-                               efficiency for large structures, but waste
-                               memory for small ones
+                               This is simply used to size the residue
+                               hash table and the initial pair data 
+                               array. Both grow as needed.
                             */
 #define MAXLABEL      16    /* ResidueLabel size                        */
 #define ATOMS_CA      0     /* Selection types                          */
 #define ATOMS_ALL     1
 #define ATOMS_SC      2
+#define MAXGRIDCELLS  1000000 /* Maximum cells in the residue grid      */
+#define MAXTHREADS    256   /* Maximum number of threads with -j        */
+#define NPY_ALIGN     64    /* Alignment of data in .npy files          */
+
+/* Offset of a residue pair in the packed upper triangle of pair data   */
+#define PAIRINDEX(i, j) (((j) >= (i)) ?                                 \
+                         ((size_t)(j)*((j)+1)/2 + (i)) :                \
+                         ((size_t)(i)*((i)+1)/2 + (j)))
 
 typedef struct respair
 {
@@ -99,26 +134,84 @@ typedef struct respair
    REAL sxsq;
    int  nval;
 }  RESPAIR;
+
+typedef struct
+{
+   char label[MAXLABEL+1];
+   int  index;
+}  RESLABEL;
+
+typedef struct
+{
+   HASHTABLE *resHash;  /* Residue label -> RESLABEL                    */
+   RESLABEL  **residues;/* Residue labels in order of first appearance  */
+   RESPAIR   *pairs;    /* Packed upper triangle of residue pair data   */
+   int       nres,      /* Number of residues seen                      */
+             maxres;    /* Number of residues allocated                 */
+}  PAIRDATA;
+
+typedef struct
+{
+   char     **filenames;/* Complete list of files                       */
+   char     **chainList;/* Chains to keep (or NULL)                     */
+   PAIRDATA *pairData;  /* Private pair data for this thread            */
+   REAL     cutoff;
+   int      first,      /* Range of files processed by this thread      */
+            last,
+            atomTypes;
+}  WORKER;
+
+typedef struct
+{
+   PDB  *start,         /* First atom of the residue                    */
+        *stop;          /* First atom of the next residue               */
+   REAL x, y, z,        /* Centre of the residue's atoms                */
+        radius;         /* Bounding sphere radius about the centre      */
+   int  nextInCell,     /* Next residue in the same grid cell (or -1)   */
+        index;          /* Residue index in the PAIRDATA                */
+}  RESINFO;
    
 
 /************************************************************************/
 /* Globals
 */
+/* BiopLib's PDB reader is not guaranteed to be thread-safe, so files
+   are read one at a time
+*/
+static pthread_mutex_t sReadMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /************************************************************************/
 /* Prototypes
 */
 int main(int argc, char **argv);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                  BOOL *singleFile, int *atomTypes, char *chains);
+                  BOOL *singleFile, int *atomTypes, char *chains,
+                  REAL *cutoff, int *nThreads, char *binBase);
 void HandleInput(FILE *in, FILE *out, BOOL singleFile, 
-                 HASHTABLE *hashTable, int atomTypes, char *chains);
-void ProcessFile(FILE *fp, HASHTABLE *hashTable, int atomTypes,
-                 char **chainList);
-void ProcessPDB(PDB *pdb, HASHTABLE *hashTable);
-void StoreData(HASHTABLE *hashTable, PDB *res1, PDB *res2, REAL dist);
+                 PAIRDATA *pairData, int atomTypes, char *chains,
+                 REAL cutoff, int nThreads);
+void ProcessFileList(FILE *in, PAIRDATA *pairData, int atomTypes,
+                     char **chainList, REAL cutoff, int nThreads);
+void *ProcessFileRange(void *arg);
+void ProcessNamedFile(char *filename, PAIRDATA *pairData, int atomTypes,
+                      char **chainList, REAL cutoff);
+void ProcessFile(FILE *fp, PAIRDATA *pairData, int atomTypes,
+                 char **chainList, REAL cutoff);
+void ProcessPDB(PDB *pdb, PAIRDATA *pairData);
+void ProcessPDBGrid(PDB *pdb, PAIRDATA *pairData, REAL cutoff);
+REAL MinResidueDistSq(PDB *res1, PDB *res1Next, PDB *res2, 
+                      PDB *res2Next);
+RESINFO *BuildResidueInfo(PDB *pdb, PAIRDATA *pairData, int *nres);
+PAIRDATA *InitPairData(void);
+void FreePairData(PAIRDATA *pairData);
+void MergePairData(PAIRDATA *pairData, PAIRDATA *part);
+int FindResidueIndex(PAIRDATA *pairData, PDB *res);
+int FindLabelIndex(PAIRDATA *pairData, char *resID);
+void StoreData(PAIRDATA *pairData, int res1, int res2, REAL dist);
 PDB *ReduceAtomList(PDB *pdb, int atomTypes);
-void DisplayResults(FILE *out, HASHTABLE *hashTable);
+void DisplayResults(FILE *out, PAIRDATA *pairData, REAL cutoff);
+BOOL WriteBinaryResults(char *binBase, PAIRDATA *pairData);
+BOOL WriteNpyVector(char *filename, PAIRDATA *pairData, BOOL doSD);
 PDB *FindEndOfChain(PDB *chain);
 BOOL ValidChain(PDB *pdb, char **chains);
 PDB *SelectPDBChains(PDB *pdb, char **chains);
@@ -132,6 +225,10 @@ void Usage(void);
 
 -  01.04.09 Original   By: ACRM
 -  06.04.09 Added -n and -m parameters
+-  16.10.26 Added -d cutoff
+-  16.10.26 Uses PAIRDATA rather than a hash of residue pairs
+-  16.10.26 Added -j
+-  16.10.26 Added -b
 */
 int main(int argc, char **argv)
 {
@@ -140,26 +237,42 @@ int main(int argc, char **argv)
    FILE  *in  = stdin,
          *out = stdout;
    BOOL  singleFile  = FALSE;
-   ULONG hashSize    = DEF_MAXRES * DEF_MAXRES;
    int   atomTypes   = ATOMS_CA;
-   HASHTABLE *hashTable = NULL;
-   char      chains[MAXBUFF];
+   int   nThreads    = 1;
+   REAL  cutoff      = (REAL)0.0;
+   PAIRDATA  *pairData = NULL;
+   char      chains[MAXBUFF],
+             binBase[MAXBUFF];
 
-   chains[0] = '\0';
+   chains[0]  = '\0';
+   binBase[0] = '\0';
 
    if(ParseCmdLine(argc, argv, infile, outfile, &singleFile, &atomTypes,
-                   chains))
+                   chains, &cutoff, &nThreads, binBase))
    {
       if(blOpenStdFiles(infile, outfile, &in, &out))
       {
-         if((hashTable = blInitializeHash(hashSize))!=NULL)
+         if((pairData = InitPairData())!=NULL)
          {
-            HandleInput(in, out, singleFile, hashTable, atomTypes, chains);
-            DisplayResults(out, hashTable);
+            HandleInput(in, out, singleFile, pairData, atomTypes, chains,
+                        cutoff, nThreads);
+            if(binBase[0])
+            {
+               if(!WriteBinaryResults(binBase, pairData))
+               {
+                  fprintf(stderr,"ERROR: Unable to write binary \
+results.\n");
+                  return(1);
+               }
+            }
+            else
+            {
+               DisplayResults(out, pairData, cutoff);
+            }
          }
          else
          {
-            fprintf(stderr,"ERROR: Unable to initialize hash table.\n");
+            fprintf(stderr,"ERROR: Unable to initialize pair data.\n");
             return(1);
          }
       }
@@ -180,7 +293,8 @@ int main(int argc, char **argv)
 
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                     BOOL *singleFile, int *atomTypes, char *chains)
+                     BOOL *singleFile, int *atomTypes, char *chains,
+                     REAL *cutoff, int *nThreads, char *binBase)
    ---------------------------------------------------------------------
    Input:   int    argc         Argument count
             char   **argv       Argument array
@@ -189,6 +303,9 @@ int main(int argc, char **argv)
             BOOL   *singleFile  Input is a single PDB file instead of
                                 a list
             char   *chains      Comma-separated list of chains to keep
+            REAL   *cutoff      Distance cutoff (0.0 if not used)
+            int    *nThreads    Number of threads for a file of files
+            char   *binBase     Basename for binary output (or blank)
    Returns: BOOL                Success?
 
    Parse the command line
@@ -196,9 +313,14 @@ int main(int argc, char **argv)
 -  01.04.09 Original    By: ACRM
 -  06.04.09 Added -n and -m and their parameters
 -  30.11.16 Added -p
+-  16.10.26 Added -d
+-  16.10.26 Added -j
+-  16.10.26 Added -b
+-  16.10.26 An output file is rejected with -b
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                  BOOL *singleFile, int *atomTypes, char *chains)
+                  BOOL *singleFile, int *atomTypes, char *chains,
+                  REAL *cutoff, int *nThreads, char *binBase)
 {
    argc--;
    argv++;
@@ -228,6 +350,29 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          case 's':
             *atomTypes = ATOMS_SC;
             break;
+         case 'd':
+            argc--;
+            argv++;
+            if(!argc) return(FALSE);
+            if(!sscanf(argv[0], "%lf", cutoff) || (*cutoff <= (REAL)0.0))
+               return(FALSE);
+            break;
+         case 'j':
+            argc--;
+            argv++;
+            if(!argc) return(FALSE);
+            if(!sscanf(argv[0], "%d", nThreads) || (*nThreads < 1))
+               return(FALSE);
+            if(*nThreads > MAXTHREADS)
+               *nThreads = MAXTHREADS;
+            break;
+         case 'b':
+            argc--;
+            argv++;
+            if(!argc) return(FALSE);
+            strncpy(binBase, argv[0], MAXBUFF-16);
+            binBase[MAXBUFF-16] = '\0';
+            break;
          default:
             return(FALSE);
             break;
@@ -242,11 +387,17 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          /* Copy the first to infile                                    */
          strcpy(infile, argv[0]);
          
-         /* If there's another, copy it to outfile                      */
+         /* If there's another, copy it to outfile. With -b the output
+            goes to the .npy files so an output file is an error
+         */
          argc--;
          argv++;
          if(argc)
+         {
+            if(binBase[0])
+               return(FALSE);
             strcpy(outfile, argv[0]);
+         }
             
          return(TRUE);
       }
@@ -260,17 +411,20 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 
 /************************************************************************/
 /*>void HandleInput(FILE *in, FILE *out, BOOL singleFile, 
-                    HASHTABLE *hashTable, int atomTypes, char *chains)
+                    PAIRDATA *pairData, int atomTypes, char *chains,
+                    REAL cutoff, int nThreads)
    -------------------------------------------------------------------
 *//**
    \input[in]     in          Input file pointer
    \input[in]     out         Output file pointer
    \input[in]     singleFile  Input is a PDB file rather than a file of
                               files
-   \input[in,out] hashTable   Analysis data for each residue pair
+   \input[in,out] pairData    Analysis data for each residue pair
    \input[in]     atomTypes   Atom types to include
    \input[in]     chains      Comma separated list of chain names 
                               (or blank)
+   \input[in]     cutoff      Distance cutoff (0.0 for all pairs)
+   \input[in]     nThreads    Number of threads for a file of files
 
    Handle the input file - extract the PDB filenames and process each 
    in turn, or just the one file if singleFile is set.
@@ -279,9 +433,13 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 -  06.04.09 Handles maxchain
 -  30.11.16 Added singleFile
 -  01.12.16 Major rewrite
+-  16.10.26 Added cutoff
+-  16.10.26 Hash replaced by PAIRDATA
+-  16.10.26 Added nThreads
 */
 void HandleInput(FILE *in, FILE *out, BOOL singleFile, 
-                 HASHTABLE *hashTable, int atomTypes, char *chains)
+                 PAIRDATA *pairData, int atomTypes, char *chains,
+                 REAL cutoff, int nThreads)
 {
    char filename[MAXBUFF];
    char **chainList = NULL;
@@ -298,54 +456,209 @@ void HandleInput(FILE *in, FILE *out, BOOL singleFile,
 
    if(singleFile)
    {
-      ProcessFile(in, hashTable, atomTypes, chainList);
+      ProcessFile(in, pairData, atomTypes, chainList, cutoff);
+   }
+   else if(nThreads > 1)
+   {
+      ProcessFileList(in, pairData, atomTypes, chainList, cutoff, 
+                      nThreads);
    }
    else
    {
       while(fgets(filename,MAXBUFF,in))
       {
-         FILE *fp;
-         
          TERMINATE(filename);
-         
-         if((fp = fopen(filename,"r"))!=NULL)
-         {
-            fprintf(stderr,"INFO: Processing file: %s\n",filename);
-            ProcessFile(fp, hashTable, atomTypes, chainList);
-            fclose(fp);
-         }
-         else
+         ProcessNamedFile(filename, pairData, atomTypes, chainList, 
+                          cutoff);
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>void ProcessFileList(FILE *in, PAIRDATA *pairData, int atomTypes,
+                        char **chainList, REAL cutoff, int nThreads)
+   -----------------------------------------------------------------
+*//**
+   \input[in]     in          Input file pointer
+   \input[in,out] pairData    Analysis data for each residue pair
+   \input[in]     atomTypes   Atom types to include
+   \input[in]     chainList   List of chains to keep (Keep all if NULL)
+   \input[in]     cutoff      Distance cutoff (0.0 for all pairs)
+   \input[in]     nThreads    Number of threads
+
+   Reads the complete list of PDB filenames and splits it into 
+   contiguous blocks, one per thread. Each thread accumulates its own
+   pair data which are then merged into pairData in block order.
+
+-  16.10.26 Original   By: ACRM
+*/
+void ProcessFileList(FILE *in, PAIRDATA *pairData, int atomTypes,
+                     char **chainList, REAL cutoff, int nThreads)
+{
+   char      filename[MAXBUFF],
+             **filenames = NULL;
+   int       nFiles      = 0,
+             maxFiles    = 0,
+             i;
+   WORKER    workers[MAXTHREADS];
+   pthread_t threads[MAXTHREADS];
+
+   /* Read the complete list of files                                   */
+   while(fgets(filename,MAXBUFF,in))
+   {
+      TERMINATE(filename);
+      if(nFiles == maxFiles)
+      {
+         maxFiles = (maxFiles ? 2 * maxFiles : DEF_MAXRES);
+         if((filenames = (char **)realloc((void *)filenames,
+                                          maxFiles * sizeof(char *)))
+            ==NULL)
          {
-            fprintf(stderr,"WARNING: Unable to read file: %s\n", 
-                    filename);
+            fprintf(stderr,"Error: No memory for file list\n");
+            exit(1);
          }
       }
+      if((filenames[nFiles] = (char *)malloc((strlen(filename)+1) *
+                                             sizeof(char)))==NULL)
+      {
+         fprintf(stderr,"Error: No memory for file list\n");
+         exit(1);
+      }
+      strcpy(filenames[nFiles++], filename);
    }
+
+   if(nThreads > nFiles)
+      nThreads = nFiles;
+
+   /* Start a thread for each block of files                            */
+   for(i=0; i<nThreads; i++)
+   {
+      workers[i].filenames = filenames;
+      workers[i].chainList = chainList;
+      workers[i].cutoff    = cutoff;
+      workers[i].atomTypes = atomTypes;
+      workers[i].first     = (int)(((double)nFiles * i) / nThreads);
+      workers[i].last      = (int)(((double)nFiles * (i+1)) / nThreads);
+      
+      if((workers[i].pairData = InitPairData())==NULL)
+      {
+         fprintf(stderr,"Error: Unable to initialize pair data\n");
+         exit(1);
+      }
+
+      if(pthread_create(&(threads[i]), NULL, ProcessFileRange,
+                        (void *)&(workers[i])))
+      {
+         fprintf(stderr,"Error: Unable to create thread\n");
+         exit(1);
+      }
+   }
+
+   /* Wait for them all and combine the results in order                */
+   for(i=0; i<nThreads; i++)
+   {
+      pthread_join(threads[i], NULL);
+      MergePairData(pairData, workers[i].pairData);
+      FreePairData(workers[i].pairData);
+   }
+
+   for(i=0; i<nFiles; i++)
+      free(filenames[i]);
+   free(filenames);
 }
 
 
 /************************************************************************/
-/*>void ProcessFile(FILE *fp, HASHTABLE *hashTable, int atomTypes, 
-                    char **chainList)
+/*>void *ProcessFileRange(void *arg)
+   ---------------------------------
+*//**
+   \input[in,out] arg         Pointer to the WORKER for this thread
+
+   Thread entry point to process a block of files from the file list
+
+-  16.10.26 Original   By: ACRM
+*/
+void *ProcessFileRange(void *arg)
+{
+   WORKER *worker = (WORKER *)arg;
+   int    i;
+   
+   for(i=worker->first; i<worker->last; i++)
+   {
+      ProcessNamedFile(worker->filenames[i], worker->pairData, 
+                       worker->atomTypes, worker->chainList,
+                       worker->cutoff);
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>void ProcessNamedFile(char *filename, PAIRDATA *pairData, 
+                         int atomTypes, char **chainList, REAL cutoff)
+   -------------------------------------------------------------------
+*//**
+   \input[in]     filename    PDB filename
+   \input[in,out] pairData    Analysis data for each residue pair
+   \input[in]     atomTypes   Atom types to include
+   \input[in]     chainList   List of chains to keep (Keep all if NULL)
+   \input[in]     cutoff      Distance cutoff (0.0 for all pairs)
+
+   Opens and processes a PDB file from the file of files
+
+-  16.10.26 Original - split out of HandleInput()   By: ACRM
+*/
+void ProcessNamedFile(char *filename, PAIRDATA *pairData, int atomTypes,
+                      char **chainList, REAL cutoff)
+{
+   FILE *fp;
+
+   if((fp = fopen(filename,"r"))!=NULL)
+   {
+      fprintf(stderr,"INFO: Processing file: %s\n",filename);
+      ProcessFile(fp, pairData, atomTypes, chainList, cutoff);
+      fclose(fp);
+   }
+   else
+   {
+      fprintf(stderr,"WARNING: Unable to read file: %s\n", 
+              filename);
+   }
+}
+
+
+/************************************************************************/
+/*>void ProcessFile(FILE *fp, PAIRDATA *pairData, int atomTypes, 
+                    char **chainList, REAL cutoff)
    ---------------------------------------------------------------
 *//**
    \param[in]      fp          File pointer for input file
-   \input[in,out]  hashTable   Analysis data for each residue pair
+   \input[in,out]  pairData    Analysis data for each residue pair
    \param[in]      atomTypes   Atom types to keep
    \param[in]      chainList   List of chains to keep (Keep all if NULL)
+   \param[in]      cutoff      Distance cutoff (0.0 for all pairs)
 
    Processes an individual PDB file, selecting required atoms and
    chains if necessary 
 
 -  01.12.16 Original - Complete new version   By: ACRM  
+-  16.10.26 Added cutoff
+-  16.10.26 Hash replaced by PAIRDATA
+-  16.10.26 Reading is protected by sReadMutex
 */
-void ProcessFile(FILE *fp, HASHTABLE *hashTable, int atomTypes, 
-                 char **chainList)
+void ProcessFile(FILE *fp, PAIRDATA *pairData, int atomTypes, 
+                 char **chainList, REAL cutoff)
 {
    PDB *pdb;
    int natoms;
    
-   if((pdb = blReadPDBAtoms(fp, &natoms))!=NULL)
+   pthread_mutex_lock(&sReadMutex);
+   pdb = blReadPDBAtoms(fp, &natoms);
+   pthread_mutex_unlock(&sReadMutex);
+   
+   if(pdb!=NULL)
    {
       pdb = ReduceAtomList(pdb, atomTypes);
       if(chainList)
@@ -353,7 +666,12 @@ void ProcessFile(FILE *fp, HASHTABLE *hashTable, int atomTypes,
          pdb = SelectPDBChains(pdb, chainList);
       }
       if(pdb!=NULL)
-         ProcessPDB(pdb, hashTable);
+      {
+         if(cutoff > (REAL)0.0)
+            ProcessPDBGrid(pdb, pairData, cutoff);
+         else
+            ProcessPDB(pdb, pairData);
+      }
       FREELIST(pdb, PDB);
    }
    else
@@ -365,112 +683,517 @@ void ProcessFile(FILE *fp, HASHTABLE *hashTable, int atomTypes,
 
 
 /************************************************************************/
-/*>void ProcessPDB(PDB *pdb, HASHTABLE *hashTable)
+/*>void ProcessPDB(PDB *pdb, PAIRDATA *pairData)
    -----------------------------------------------
 *//**
    \input[in]      pdb        PDB linked list
-   \input[in,out]  hashTable  Analysis data for each residue pair
+   \input[in,out]  pairData   Analysis data for each residue pair
 
    Does the actual analysis of a PDB linked list
 
 -  01.12.16 Original - Complete new version   By: ACRM  
+-  16.10.26 Minimum distance now found by MinResidueDistSq()
+-  16.10.26 Works from the RESINFO array and only examines each pair
+            once
+*/
+void ProcessPDB(PDB *pdb, PAIRDATA *pairData)
+{
+   RESINFO *resInfo = NULL;
+   int     nres, i, j;
+
+   if((resInfo = BuildResidueInfo(pdb, pairData, &nres))==NULL)
+   {
+      fprintf(stderr,"Error: No memory for residue data\n");
+      exit(1);
+   }
+
+   /* Step through each pair of residues once - the distances are 
+      symmetric
+   */
+   for(i=0; i<nres; i++)
+   {
+      for(j=i; j<nres; j++)
+      {
+         StoreData(pairData, resInfo[i].index, resInfo[j].index,
+                   sqrt(MinResidueDistSq(resInfo[i].start,
+                                         resInfo[i].stop,
+                                         resInfo[j].start,
+                                         resInfo[j].stop)));
+      }
+   }
+
+   free(resInfo);
+}
+
+
+/************************************************************************/
+/*>REAL MinResidueDistSq(PDB *res1, PDB *res1Next, PDB *res2, 
+                         PDB *res2Next)
+   ----------------------------------------------------------
+*//**
+   \input[in]      res1       Start of first residue
+   \input[in]      res1Next   Start of residue after first residue
+   \input[in]      res2       Start of second residue
+   \input[in]      res2Next   Start of residue after second residue
+   \return                    Minimum squared distance between the 
+                              atoms of the two residues
+
+   Finds the minimum squared inter-atom distance between two residues
+
+-  16.10.26 Original - split out of ProcessPDB()   By: ACRM  
 */
-void ProcessPDB(PDB *pdb, HASHTABLE *hashTable)
+REAL MinResidueDistSq(PDB *res1, PDB *res1Next, PDB *res2, 
+                      PDB *res2Next)
 {
-   PDB *atom1, *atom2, 
-       *res1,  *res1Next, 
-       *res2,  *res2Next;
-   REAL minDistSq = (REAL)0.0;
+   PDB  *atom1, *atom2;
+   REAL minDistSq;
+
+   /* Initialize minimum distance between the residues                  */
+   minDistSq = DISTSQ(res1, res2);
 
-   /* Step through a residue at a time                                  */
-   for(res1=pdb; res1!=NULL; res1=res1Next)
+   /* Step through atoms in first residue                               */
+   for(atom1=res1;
+       ((atom1!=NULL)&&(atom1!=res1Next));
+       NEXT(atom1))
    {
-      /* Find the start of the next residue                             */
-      res1Next = blFindNextResidue(res1);
+      /* Step through atoms in second residue to find the minimum 
+         distance between the two residues
+      */
+      for(atom2=res2; 
+          ((atom2!=NULL)&&(atom2!=res2Next));
+          NEXT(atom2))
+      {
+         REAL dSq = DISTSQ(atom1, atom2);
+         if(dSq < minDistSq)
+         {
+            minDistSq = dSq;
+         }
+      }
+   }
+
+   return(minDistSq);
+}
+
+
+/************************************************************************/
+/*>RESINFO *BuildResidueInfo(PDB *pdb, PAIRDATA *pairData, int *nres)
+   -------------------------------------------------------------------
+*//**
+   \input[in]      pdb        PDB linked list
+   \input[in,out]  pairData   Analysis data for each residue pair
+   \output[out]    nres       Number of residues
+   \return                    Malloc'd array of residue information
+
+   Builds an array giving the extent, centre, bounding sphere radius
+   and pair data index of each residue in the linked list
+
+-  16.10.26 Original   By: ACRM  
+*/
+RESINFO *BuildResidueInfo(PDB *pdb, PAIRDATA *pairData, int *nres)
+{
+   RESINFO *resInfo = NULL;
+   PDB     *res, *resNext, *p;
+   int     i;
+
+   *nres = 0;
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+      (*nres)++;
+
+   if((resInfo = (RESINFO *)malloc((*nres) * sizeof(RESINFO)))==NULL)
+      return(NULL);
+
+   for(res=pdb, i=0; res!=NULL; res=resNext, i++)
+   {
+      REAL natoms = (REAL)0.0,
+           rSq    = (REAL)0.0;
       
-      /* Step through again a residue at a time                         */
-      for(res2=pdb; res2!=NULL; res2=res2Next)
+      resNext = blFindNextResidue(res);
+      resInfo[i].start      = res;
+      resInfo[i].stop       = resNext;
+      resInfo[i].nextInCell = (-1);
+      resInfo[i].index      = FindResidueIndex(pairData, res);
+      resInfo[i].x = resInfo[i].y = resInfo[i].z = (REAL)0.0;
+
+      for(p=res; p!=resNext; NEXT(p))
+      {
+         resInfo[i].x += p->x;
+         resInfo[i].y += p->y;
+         resInfo[i].z += p->z;
+         natoms       += (REAL)1.0;
+      }
+      resInfo[i].x /= natoms;
+      resInfo[i].y /= natoms;
+      resInfo[i].z /= natoms;
+
+      for(p=res; p!=resNext; NEXT(p))
       {
-         /* Find the start of the next residue                          */
-         res2Next = blFindNextResidue(res2);
+         REAL dSq = DISTSQ(p, &(resInfo[i]));
+         if(dSq > rSq)
+            rSq = dSq;
+      }
+      resInfo[i].radius = sqrt(rSq);
+   }
+
+   return(resInfo);
+}
+
+
+/************************************************************************/
+/*>void ProcessPDBGrid(PDB *pdb, PAIRDATA *pairData, REAL cutoff)
+   ----------------------------------------------------------------
+*//**
+   \input[in]      pdb        PDB linked list
+   \input[in,out]  pairData   Analysis data for each residue pair
+   \input[in]      cutoff     Distance cutoff
 
-         /* Initialize minimum distance between the residues            */
-         minDistSq = DISTSQ(res1, res2);
+   Does the analysis of a PDB linked list, only storing residue pairs
+   that lie within the cutoff distance. Residues are binned on their
+   centres into a uniform grid with cells large enough that any pair
+   of bounding spheres within the cutoff must be in the same or an
+   adjacent cell. Each pair is evaluated once.
 
-         /* Step through atoms in first residue                         */
-         for(atom1=res1;
-             ((atom1!=NULL)&&(atom1!=res1Next));
-             NEXT(atom1))
+-  16.10.26 Original   By: ACRM  
+*/
+void ProcessPDBGrid(PDB *pdb, PAIRDATA *pairData, REAL cutoff)
+{
+   RESINFO *resInfo  = NULL;
+   int     *cellHead = NULL,
+           nres, i, j,
+           nx, ny, nz;
+   REAL    minX, minY, minZ,
+           maxX, maxY, maxZ,
+           maxRadius = (REAL)0.0,
+           cellSize,
+           cutoffSq  = cutoff * cutoff;
+
+   if((resInfo = BuildResidueInfo(pdb, pairData, &nres))==NULL)
+   {
+      fprintf(stderr,"Error: No memory for residue grid\n");
+      exit(1);
+   }
+   if(nres == 0)
+   {
+      free(resInfo);
+      return;
+   }
+
+   /* Find the bounds of the residue centres and the largest residue    */
+   minX = maxX = resInfo[0].x;
+   minY = maxY = resInfo[0].y;
+   minZ = maxZ = resInfo[0].z;
+   for(i=0; i<nres; i++)
+   {
+      minX = MIN(minX, resInfo[i].x);
+      minY = MIN(minY, resInfo[i].y);
+      minZ = MIN(minZ, resInfo[i].z);
+      maxX = MAX(maxX, resInfo[i].x);
+      maxY = MAX(maxY, resInfo[i].y);
+      maxZ = MAX(maxZ, resInfo[i].z);
+      maxRadius = MAX(maxRadius, resInfo[i].radius);
+   }
+
+   /* Size the cells so that residues whose bounding spheres are within
+      the cutoff are always in neighbouring cells. Grow them if the 
+      grid would be unreasonably large.
+   */
+   cellSize = cutoff + (2.0 * maxRadius);
+   for(;;)
+   {
+      nx = 1 + (int)((maxX - minX) / cellSize);
+      ny = 1 + (int)((maxY - minY) / cellSize);
+      nz = 1 + (int)((maxZ - minZ) / cellSize);
+      if(((double)nx * (double)ny * (double)nz) <= (double)MAXGRIDCELLS)
+         break;
+      cellSize *= 2.0;
+   }
+
+   if((cellHead = (int *)malloc(nx * ny * nz * sizeof(int)))==NULL)
+   {
+      fprintf(stderr,"Error: No memory for residue grid\n");
+      exit(1);
+   }
+   for(i=0; i<nx*ny*nz; i++)
+      cellHead[i] = (-1);
+
+   /* Bin the residues                                                  */
+   for(i=nres-1; i>=0; i--)
+   {
+      int cell = (int)((resInfo[i].x - minX) / cellSize) +
+                 nx * ((int)((resInfo[i].y - minY) / cellSize) +
+                       ny * (int)((resInfo[i].z - minZ) / cellSize));
+      resInfo[i].nextInCell = cellHead[cell];
+      cellHead[cell]        = i;
+   }
+
+   /* Evaluate each pair of residues in the same or adjacent cells      */
+   for(i=0; i<nres; i++)
+   {
+      int ix = (int)((resInfo[i].x - minX) / cellSize),
+          iy = (int)((resInfo[i].y - minY) / cellSize),
+          iz = (int)((resInfo[i].z - minZ) / cellSize),
+          cx, cy, cz;
+
+      for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, nz-1); cz++)
+      {
+         for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, ny-1); cy++)
          {
-            /* Step through atoms in second residue to find 
-               the minimum distance between the two residues
-            */
-            for(atom2=res2; 
-                ((atom2!=NULL)&&(atom2!=res2Next));
-                 NEXT(atom2))
+            for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, nx-1); cx++)
             {
-               REAL dSq = DISTSQ(atom1, atom2);
-               if(dSq < minDistSq)
+               for(j=cellHead[cx + nx * (cy + ny * cz)]; 
+                   j!=(-1); 
+                   j=resInfo[j].nextInCell)
                {
-                  minDistSq = dSq;
+                  REAL reach, distSq;
+
+                  if(j < i)
+                     continue;
+
+                  /* Skip if the bounding spheres are beyond cutoff     */
+                  reach = cutoff + resInfo[i].radius + resInfo[j].radius;
+                  if(DISTSQ(&(resInfo[i]), &(resInfo[j])) > reach*reach)
+                     continue;
+
+                  distSq = MinResidueDistSq(resInfo[i].start,
+                                            resInfo[i].stop,
+                                            resInfo[j].start,
+                                            resInfo[j].stop);
+                  if(distSq <= cutoffSq)
+                  {
+                     StoreData(pairData, resInfo[i].index,
+                               resInfo[j].index, sqrt(distSq));
+                  }
                }
             }
          }
-
-         StoreData(hashTable, res1, res2, sqrt(minDistSq));
       }
    }
+
+   free(cellHead);
+   free(resInfo);
 }
 
 
 /************************************************************************/
-/*>void StoreData(HASHTABLE *hashTable, PDB *res1, PDB *res2, REAL dist)
-   ---------------------------------------------------------------------
+/*>PAIRDATA *InitPairData(void)
+   ----------------------------
 *//**
-   \input[in,out]  hashTable   Analysis data for each residue pair
-   \input[in]      res1        First residue PDB pointer
-   \input[in]      res2        Second residue PDB pointer
-   \input[in]      dist        Distance between residues
+   \return                    Malloc'd, empty, residue pair data
 
-   Creates a hash key from the two residues, allocates memory for data
-   for this residue pair if needed and store the data in the hash keyed
-   by the residue pair.
+   Allocates the residue pair data with space for DEF_MAXRES residues
 
--  01.12.16 Original - Complete new version   By: ACRM  
--  13.03.19 Added 1 to resID1, resID2 and resPair sizes  
+-  16.10.26 Original   By: ACRM  
 */
-void StoreData(HASHTABLE *hashTable, PDB *res1, PDB *res2, REAL dist)
+PAIRDATA *InitPairData(void)
 {
-   RESPAIR *rp = NULL;
-   char resID1[MAXLABEL+1], resID2[MAXLABEL+1], resPair[(MAXLABEL+1)*2];
-   
-   MAKERESID(resID1, res1);
-   MAKERESID(resID2, res2);
-   sprintf(resPair, "%s-%s", resID1, resID2);
+   PAIRDATA *pairData = NULL;
+
+   if((pairData = (PAIRDATA *)malloc(sizeof(PAIRDATA)))==NULL)
+      return(NULL);
+
+   pairData->nres     = 0;
+   pairData->maxres   = DEF_MAXRES;
+   pairData->resHash  = blInitializeHash(DEF_MAXRES);
+   pairData->residues = (RESLABEL **)malloc(DEF_MAXRES * 
+                                            sizeof(RESLABEL *));
+   pairData->pairs    = (RESPAIR *)calloc(PAIRINDEX(0, DEF_MAXRES),
+                                          sizeof(RESPAIR));
+
+   if((pairData->resHash == NULL) || 
+      (pairData->residues == NULL) ||
+      (pairData->pairs == NULL))
+   {
+      return(NULL);
+   }
+
+   return(pairData);
+}
+
+
+/************************************************************************/
+/*>void FreePairData(PAIRDATA *pairData)
+   -------------------------------------
+*//**
+   \input[in,out]  pairData    Residue pair data
+
+   Frees residue pair data
+
+-  16.10.26 Original   By: ACRM  
+*/
+void FreePairData(PAIRDATA *pairData)
+{
+   int i;
+
+   for(i=0; i<pairData->nres; i++)
+      free(pairData->residues[i]);
+   free(pairData->residues);
+   free(pairData->pairs);
+   blFreeHash(pairData->resHash);
+   free(pairData);
+}
+
+
+/************************************************************************/
+/*>void MergePairData(PAIRDATA *pairData, PAIRDATA *part)
+   ------------------------------------------------------
+*//**
+   \input[in,out]  pairData    Residue pair data to update
+   \input[in]      part        Residue pair data to merge in
+
+   Adds residue pair data accumulated separately (e.g. by a thread) into
+   the main pair data. The residues in part are mapped onto pairData, 
+   adding any new ones, and the running sums and counts are then added.
+   Since these are the raw sums used by blCalcExtSD(), this combines
+   the means and variances exactly.
+
+-  16.10.26 Original   By: ACRM  
+*/
+void MergePairData(PAIRDATA *pairData, PAIRDATA *part)
+{
+   int *map = NULL,
+       i, j;
+
+   if(part->nres == 0)
+      return;
+
+   if((map = (int *)malloc(part->nres * sizeof(int)))==NULL)
+   {
+      fprintf(stderr, "Error: no memory for merging pair data\n");
+      exit(1);
+   }
    
-   /* This key not in the hash so create it */
-   if(!blHashKeyDefined(hashTable, resPair))
+   for(i=0; i<part->nres; i++)
+      map[i] = FindLabelIndex(pairData, part->residues[i]->label);
+
+   for(j=0; j<part->nres; j++)
    {
-      if((rp = (RESPAIR *)malloc(sizeof(RESPAIR))) == NULL)
+      for(i=0; i<=j; i++)
       {
-         fprintf(stderr, "Error: no memory for RESPAIR data\n");
-         exit(1);
+         RESPAIR *from = part->pairs + PAIRINDEX(i, j),
+                 *to;
+
+         if(from->nval)
+         {
+            to = pairData->pairs + PAIRINDEX(map[i], map[j]);
+            to->sx   += from->sx;
+            to->sxsq += from->sxsq;
+            to->nval += from->nval;
+         }
       }
+   }
+
+   free(map);
+}
 
-      rp->sx   = 0.0;
-      rp->sxsq = 0.0;
-      rp->nval = 0;
 
-      blSetHashValuePointer(hashTable, resPair, (BPTR)rp);
-   }
-   else
+/************************************************************************/
+/*>int FindResidueIndex(PAIRDATA *pairData, PDB *res)
+   --------------------------------------------------
+*//**
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \input[in]      res         Residue PDB pointer
+   \return                     Index of the residue in the pair data
+
+   Looks up the index for a residue by building its label
+
+-  16.10.26 Original   By: ACRM  
+*/
+int FindResidueIndex(PAIRDATA *pairData, PDB *res)
+{
+   char resID[MAXLABEL+1];
+
+   MAKERESID(resID, res);
+   return(FindLabelIndex(pairData, resID));
+}
+
+
+/************************************************************************/
+/*>int FindLabelIndex(PAIRDATA *pairData, char *resID)
+   ---------------------------------------------------
+*//**
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \input[in]      resID       Residue label
+   \return                     Index of the residue in the pair data
+
+   Looks up the index for a residue label. If the residue has not been
+   seen before, it is added to the end of the residue list and the pair
+   data are expanded if needed. Residue pairs are stored as a packed 
+   upper triangle with each column contiguous, so expansion does not 
+   move existing data.
+
+-  16.10.26 Original - split out of FindResidueIndex()   By: ACRM  
+*/
+int FindLabelIndex(PAIRDATA *pairData, char *resID)
+{
+   RESLABEL *rl = NULL;
+
+   if(blHashKeyDefined(pairData->resHash, resID))
    {
-      if((rp=(RESPAIR *)blGetHashValuePointer(hashTable, resPair))==NULL)
+      if((rl=(RESLABEL *)blGetHashValuePointer(pairData->resHash, resID))
+         ==NULL)
       {
          fprintf(stderr, "Error: internal Hash confused!\n");
          exit(1);
       }
+      return(rl->index);
    }
+
+   /* Expand the storage if required                                    */
+   if(pairData->nres == pairData->maxres)
+   {
+      size_t oldSize = PAIRINDEX(0, pairData->maxres),
+             newSize;
+
+      pairData->maxres *= 2;
+      newSize = PAIRINDEX(0, pairData->maxres);
+      
+      if(((pairData->residues = 
+           (RESLABEL **)realloc((void *)pairData->residues,
+                                pairData->maxres * sizeof(RESLABEL *)))
+          ==NULL) ||
+         ((pairData->pairs = 
+           (RESPAIR *)realloc((void *)pairData->pairs,
+                              newSize * sizeof(RESPAIR)))==NULL))
+      {
+         fprintf(stderr, "Error: no memory for RESPAIR data\n");
+         exit(1);
+      }
+      memset((void *)(pairData->pairs + oldSize), 0,
+             (newSize - oldSize) * sizeof(RESPAIR));
+   }
+
+   if((rl = (RESLABEL *)malloc(sizeof(RESLABEL)))==NULL)
+   {
+      fprintf(stderr, "Error: no memory for residue label\n");
+      exit(1);
+   }
+   strcpy(rl->label, resID);
+   rl->index = pairData->nres;
+   pairData->residues[pairData->nres++] = rl;
+   blSetHashValuePointer(pairData->resHash, resID, (BPTR)rl);
+
+   return(rl->index);
+}
+
+
+/************************************************************************/
+/*>void StoreData(PAIRDATA *pairData, int res1, int res2, REAL dist)
+   -----------------------------------------------------------------
+*//**
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \input[in]      res1        First residue index
+   \input[in]      res2        Second residue index
+   \input[in]      dist        Distance between residues
+
+   Stores the distance for a residue pair
+
+-  01.12.16 Original - Complete new version   By: ACRM  
+-  13.03.19 Added 1 to resID1, resID2 and resPair sizes  
+-  16.10.26 Takes residue indexes and stores in the PAIRDATA rather
+            than building a key for the hash
+*/
+void StoreData(PAIRDATA *pairData, int res1, int res2, REAL dist)
+{
+   RESPAIR *rp = pairData->pairs + PAIRINDEX(res1, res2);
    
    blCalcExtSD(dist, 0, &(rp->sx), &(rp->sxsq), &(rp->nval), NULL, NULL);
 }
@@ -551,57 +1274,185 @@ PDB *ReduceAtomList(PDB *pdb, int atomTypes)
 
 
 /************************************************************************/
-/*>void DisplayResults(FILE *out, HASHTABLE *hashTable)
-   -----------------------------------------------------
+/*>void DisplayResults(FILE *out, PAIRDATA *pairData, REAL cutoff)
+   ---------------------------------------------------------------
    \input[in]      out         Output file pointer
-   \input[in,out]  hashTable   Analysis data for each residue pair
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \input[in]      cutoff      Distance cutoff (0.0 if not used)
 
-   Display the results. Run through each indexed location and calculate 
+   Display the results. Run through each residue pair and calculate 
    the mean and standard deviation then print the residue IDs with these
-   values.
+   values. If a cutoff was used, the pairs that were never within the
+   cutoff are reported as such.
 
 -  01.04.09 Original   By: ACRM
 -  01.12.16 Major rewrite
 -  13.03.19 Added 1 to res1 and res2 sizes and terminate string
+-  16.10.26 Added cutoff
+-  16.10.26 Works from the PAIRDATA rather than the hash
 */
-void DisplayResults(FILE *out, HASHTABLE *hashTable)
+void DisplayResults(FILE *out, PAIRDATA *pairData, REAL cutoff)
 {
-   char **keys = NULL;
-   int  i;
+   int  i, j;
    REAL mean, 
         sd;
 
-
-   if((keys = blGetHashKeyList(hashTable))!=NULL)
+   for(i=0; i<pairData->nres; i++)
    {
-      for(i=0; keys[i] != NULL; i++)
+      for(j=0; j<pairData->nres; j++)
       {
-         RESPAIR *rp;
-         char    res1[MAXLABEL+1],
-                 res2[MAXLABEL+1],
-                 *chp;
-      
-         if((rp=(RESPAIR *)blGetHashValuePointer(hashTable,keys[i]))==NULL)
+         RESPAIR *rp = pairData->pairs + PAIRINDEX(i, j);
+
+         if(rp->nval)
          {
-            fprintf(stderr, "Error: internal Hash confused!\n");
-            exit(1);
+            blCalcExtSD((REAL)0.0, 1, 
+                        &(rp->sx), &(rp->sxsq), &(rp->nval), &mean, &sd);
+            fprintf(out,"%s %s %6.3f %6.3f\n", 
+                    pairData->residues[i]->label,
+                    pairData->residues[j]->label,
+                    mean, sd);
+         }
+         else if(cutoff > (REAL)0.0)
+         {
+            fprintf(out,"%s %s >cutoff\n", 
+                    pairData->residues[i]->label,
+                    pairData->residues[j]->label);
          }
+      }
+   }
+}
+
+
+
+/************************************************************************/
+/*>BOOL WriteBinaryResults(char *binBase, PAIRDATA *pairData)
+   ----------------------------------------------------------
+*//**
+   \input[in]      binBase     Basename for output files
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \return                     Success?
 
-         strncpy(res1, keys[i], MAXLABEL);
-         TERMAT(res1, '-');
-         chp = strchr(keys[i], '-');
-         strncpy(res2, chp+1, MAXLABEL);
-         res2[MAXLABEL]='\0';
+   Writes the results as binary files that may be memory mapped: 
+   binBase_mean.npy and binBase_sd.npy contain the packed upper triangle
+   of the means and standard deviations and binBase_labels.txt contains
+   the residue labels in index order. Pairs with no data (e.g. never 
+   within the cutoff) are stored as NaN.
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL WriteBinaryResults(char *binBase, PAIRDATA *pairData)
+{
+   char filename[MAXBUFF];
+   FILE *fp;
+   int  i;
+
+   sprintf(filename, "%s_labels.txt", binBase);
+   if((fp=fopen(filename, "w"))==NULL)
+      return(FALSE);
+   for(i=0; i<pairData->nres; i++)
+      fprintf(fp, "%s\n", pairData->residues[i]->label);
+   fclose(fp);
+
+   sprintf(filename, "%s_mean.npy", binBase);
+   if(!WriteNpyVector(filename, pairData, FALSE))
+      return(FALSE);
+   
+   sprintf(filename, "%s_sd.npy", binBase);
+   if(!WriteNpyVector(filename, pairData, TRUE))
+      return(FALSE);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteNpyVector(char *filename, PAIRDATA *pairData, BOOL doSD)
+   ------------------------------------------------------------------
+*//**
+   \input[in]      filename    Output filename
+   \input[in,out]  pairData    Analysis data for each residue pair
+   \input[in]      doSD        Write standard deviations rather than
+                               means
+   \return                     Success?
+
+   Writes the means or standard deviations as a NumPy (format 1.0) file
+   containing a float32 vector of the packed upper triangle. The header
+   is padded so that the data start on a NPY_ALIGN byte boundary. The
+   data are written in native byte order, which is recorded in the 
+   header.
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL WriteNpyVector(char *filename, PAIRDATA *pairData, BOOL doSD)
+{
+   FILE   *fp;
+   char   header[MAXBUFF];
+   float  *column;
+   int    one = 1,
+          headerLen,
+          i, j;
+   size_t nValues = PAIRINDEX(0, pairData->nres);
+   REAL   mean, sd;
+
+   if((column = (float *)malloc((pairData->nres + 1) * sizeof(float)))
+      ==NULL)
+      return(FALSE);
+   
+   if((fp=fopen(filename, "wb"))==NULL)
+   {
+      free(column);
+      return(FALSE);
+   }
+
+   /* Build the header dictionary padded with spaces and a newline so
+      that the magic string, version, length and header fill a whole
+      number of NPY_ALIGN blocks
+   */
+   sprintf(header, "{'descr': '%cf4', 'fortran_order': False, \
+'shape': (%lu,), }", 
+           (*(char *)&one ? '<' : '>'), (unsigned long)nValues);
+   headerLen = strlen(header);
+   while(((10 + headerLen + 1) % NPY_ALIGN) != 0)
+      header[headerLen++] = ' ';
+   header[headerLen++] = '\n';
+   header[headerLen]   = '\0';
+
+   fwrite("\x93NUMPY\x01\x00", 1, 8, fp);
+   fputc(headerLen & 0xFF, fp);
+   fputc((headerLen >> 8) & 0xFF, fp);
+   fwrite(header, 1, headerLen, fp);
+
+   /* Write the data a column at a time                                 */
+   for(j=0; j<pairData->nres; j++)
+   {
+      for(i=0; i<=j; i++)
+      {
+         RESPAIR *rp = pairData->pairs + PAIRINDEX(i, j);
+
+         if(rp->nval)
+         {
+            blCalcExtSD((REAL)0.0, 1, 
+                        &(rp->sx), &(rp->sxsq), &(rp->nval), &mean, &sd);
+            column[i] = (float)(doSD ? sd : mean);
+         }
+         else
+         {
+            column[i] = (float)(sqrt(-1.0));
+         }
+      }
       
-         blCalcExtSD((REAL)0.0, 1, 
-                     &(rp->sx), &(rp->sxsq), &(rp->nval), &mean, &sd);
-         fprintf(out,"%s %s %6.3f %6.3f\n", 
-                 res1, res2, mean, sd);
+      if(fwrite(column, sizeof(float), j+1, fp) != (size_t)(j+1))
+      {
+         fclose(fp);
+         free(column);
+         return(FALSE);
       }
-      blFreeHashKeyList(keys);
-   }            
-}
+   }
 
+   fclose(fp);
+   free(column);
+   return(TRUE);
+}
 
 
 /************************************************************************/
@@ -714,18 +1565,35 @@ PDB *FindEndOfChain(PDB *chain)
 -  30.11.16 V1.2
 -  01.12.16 V2.0
 -  13.03.19 V2.1
+-  16.10.26 V2.2
+-  16.10.26 V2.3
+-  16.10.26 V2.4
+-  16.10.26 V2.5
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nDistMat V2.1 (c) 2009-2019, Dr. Andrew C.R. Martin, \
+   fprintf(stderr,"\nDistMat V2.5 (c) 2009-2026, Dr. Andrew C.R. Martin, \
 UCL\n");
 
-   fprintf(stderr,"\nUsage: distmat [-p][-c chains][-a | -s] [input [output]]\n");
+   fprintf(stderr,"\nUsage: distmat [-p][-c chains][-a | -s][-d cutoff] \
+[-j nthreads]\n");
+   fprintf(stderr,"               [input [output]]\n");
+   fprintf(stderr,"       distmat [-p][-c chains][-a | -s][-d cutoff] \
+[-j nthreads]\n");
+   fprintf(stderr,"               -b basename [input]\n");
    fprintf(stderr,"       -p Input is a single PDB file instead \
 of a file of files\n");
    fprintf(stderr,"       -c chains Only look at specified chaind\n");
    fprintf(stderr,"       -a Look at all atoms rather than CAs\n");
    fprintf(stderr,"       -s Look at sidechain atoms rather than CAs\n");
+   fprintf(stderr,"       -d cutoff Only analyze residue pairs within \
+this distance\n");
+   fprintf(stderr,"       -j nthreads Process the files in a file of \
+files using this\n");
+   fprintf(stderr,"          many threads\n");
+   fprintf(stderr,"       -b basename Write binary NumPy files instead \
+of text output\n");
+   fprintf(stderr,"          (an output file may not be given)\n");
    fprintf(stderr,"\nI/O Through stdin/stdout if not specified\n");
 
    fprintf(stderr,"\nDistMat analyses inter-CA distances in one or \
@@ -737,6 +1605,33 @@ the PDB files to be processed.\n");
 file.\n");
 
    fprintf(stderr,"\nIf -c is specified it is followed by a comma-separated \
-list if chain names to analyze.\n\n");
+list if chain names to analyze.\n");
+
+   fprintf(stderr,"\nIf -d is specified, only residue pairs whose minimum \
+distance is within\n");
+   fprintf(stderr,"the cutoff are analyzed and a spatial grid is used to \
+avoid examining\n");
+   fprintf(stderr,"distant pairs. Pairs never within the cutoff are \
+reported as '>cutoff'.\n");
+   fprintf(stderr,"Statistics for other pairs are calculated over the \
+structures in which\n");
+   fprintf(stderr,"they are within the cutoff.\n");
+
+   fprintf(stderr,"\nIf -b is specified, the means and standard \
+deviations are written to\n");
+   fprintf(stderr,"basename_mean.npy and basename_sd.npy as float32 \
+vectors holding the\n");
+   fprintf(stderr,"upper triangle of each matrix. The element for \
+residues i and j (i<=j)\n");
+   fprintf(stderr,"is at j*(j+1)/2+i. Pairs with no data are NaN. \
+The residue labels are\n");
+   fprintf(stderr,"written in order to basename_labels.txt. A full \
+matrix may be obtained\n");
+   fprintf(stderr,"in Python with:\n");
+   fprintf(stderr,"   v = numpy.load('basename_mean.npy', \
+mmap_mode='r')\n");
+   fprintf(stderr,"   m = numpy.zeros((n,n), dtype=numpy.float32)\n");
+   fprintf(stderr,"   j, i = numpy.tril_indices(n)\n");
+   fprintf(stderr,"   m[i,j] = v; m[j,i] = v\n\n");
 }
 
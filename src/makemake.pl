@@ -70,6 +70,7 @@
 #   V1.8    14.08.18  Bumped to require BiopLib V3.10
 #   V1.9    13.03.19  Added -Wno-stringop-truncation
 #   V1.10   04.02.21  Bumped to require BiopLib V3.11
+#   V1.11   16.10.26  Links with -lpthread
 #
 #*************************************************************************
 $::biopversion = "3.11";
@@ -324,6 +325,7 @@ __EOF
 # Write the flags for the compiler and directories
 #
 # 06.11.14 Original   By: ACRM
+# 16.10.26 Added -lpthread
 sub WriteFlags
 {
     my($makefp, $libdir, $incdir, $bindir, $datadir) = @_;
@@ -332,7 +334,7 @@ CC      = gcc
 BINDIR  = $bindir
 DATADIR = $datadir
 CFLAGS  = -O3 -ansi -Wall -pedantic -Wno-stringop-truncation -I$incdir -L$libdir
-LFLAGS  = -lbiop -lgen -lm -lxml2
+LFLAGS  = -lbiop -lgen -lm -lxml2 -lpthread
 __EOF
 }
 
@@ -3,12 +3,12 @@
 
    \file       pdbatomcount.c
    
-   \version    V1.8
-   \date       12.03.15
+   \version    V1.9
+   \date       16.10.26
    \brief      Count atoms neighbouring each atom in a PDB file
                Results output in B-val column
    
-   \copyright  (c) Dr. Andrew C. R. Martin 1994-2015
+   \copyright  (c) Dr. Andrew C. R. Martin 1994-2026
    \author     Dr. Andrew C. R. Martin
    \par
                Biomolecular Structure & Modelling Unit,
@@ -58,13 +58,17 @@
 -  V1.6  06.11.14 Renamed from atomcount
 -  V1.7  12.02.15 Uses WholePDB
 -  V1.8  12.03.15 Changed to use CHAINMATCH()
-
+-  V1.9  16.10.26 Neighbours are found using a grid of atoms rather
+                  than comparing all pairs. -r takes a comma-separated
+                  list of radii which are all counted in one pass and
+                  written as a table with a column for each radius
 
 *************************************************************************/
 /* Includes
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "bioplib/SysDefs.h"
@@ -85,6 +89,28 @@
 #define TYP_NONBOND     2
 #define TYP_CONTACT     3
 #define TYP_NORMCONTACT 4
+#define MAXRADII     32       /* Maximum number of radii with -r        */
+#define MAXGRIDCELLS 1000000  /* Maximum cells in the atom grid         */
+
+typedef struct
+{
+   PDB  *atom;
+   int  res,                  /* Index of the residue                   */
+        nextInCell;           /* Next atom in the same cell (or -1)     */
+}  GRIDATOM;
+
+typedef struct
+{
+   GRIDATOM *atoms;           /* Array of atoms in file order           */
+   PDB      **resStart;       /* First atom of each residue             */
+   int      *resFirstAtom,    /* Index of the first atom of each res    */
+            *cellHead,        /* First atom in each cell (or -1)        */
+            natoms,
+            nres,
+            nx, ny, nz;
+   REAL     minX, minY, minZ,
+            cellSize;
+}  ATOMGRID;
 
 /************************************************************************/
 /* Globals
@@ -95,11 +121,19 @@
 */
 int main(int argc, char **argv);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
-                  REAL *radius, int *CountType, BOOL *StripWater);
-void CountNeighbours(PDB *pdb, REAL radius, int CountType);
+                  REAL *radii, int *nRadii, int *CountType, 
+                  BOOL *StripWater);
+REAL *CountNeighbours(PDB *pdb, REAL *RadSq, int nRadii, 
+                      int CountType);
 void Usage(void);
-void doResidueContacts(PDB *pdb, REAL RadSq, int CountType);
-BOOL ResSep(PDB *pdb, PDB *pr, PDB *qr);
+BOOL doResidueContacts(PDB *pdb, ATOMGRID *grid, REAL *RadSq, 
+                       int nRadii, int CountType, REAL *counts);
+BOOL ResSepIndex(ATOMGRID *grid, int pr, int qr);
+ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cellSize);
+void FreeAtomGrid(ATOMGRID *grid);
+void SetBValues(PDB *pdb, REAL *counts);
+void WriteCountTable(FILE *out, PDB *pdb, REAL *counts, REAL *radii, 
+                     int nRadii, int CountType);
 
 
 /************************************************************************/
@@ -115,6 +149,7 @@ BOOL ResSep(PDB *pdb, PDB *pr, PDB *qr);
 -  22.07.14 Renamed deprecated functions with bl prefix. By: CTP
 -  19.08.14 Fixed call to renamed function blStripWatersPDBAsCopy() 
             By: CTP
+-  16.10.26 Handles a list of radii   By: ACRM
 */
 int main(int argc, char **argv)
 {
@@ -122,16 +157,23 @@ int main(int argc, char **argv)
         *out = stdout;
    char infile[MAXBUFF],
         outfile[MAXBUFF];
-   REAL radius = DEFRAD;
+   REAL radii[MAXRADII],
+        RadSq[MAXRADII],
+        *counts;
    PDB  *pdb;
-   int  CountType;
+   int  CountType,
+        nRadii = 1,
+        i;
    BOOL StripWater = TRUE;
+
+   radii[0] = DEFRAD;
    
-   if(ParseCmdLine(argc, argv, infile, outfile, &radius, &CountType,
-                   &StripWater))
+   if(ParseCmdLine(argc, argv, infile, outfile, radii, &nRadii, 
+                   &CountType, &StripWater))
    {
-      /* Square the radius to save on distance sqrt()s                  */
-      radius *= radius;
+      /* Square the radii to save on distance sqrt()s                   */
+      for(i=0; i<nRadii; i++)
+         RadSq[i] = radii[i] * radii[i];
       
       if(blOpenStdFiles(infile, outfile, &in, &out))
       {
@@ -148,8 +190,24 @@ int main(int argc, char **argv)
                FREELIST(pdb, PDB);
                wpdb->pdb = pdb = pdb2;
             }
-            CountNeighbours(pdb, radius, CountType);
-            blWriteWholePDB(out, wpdb);
+            if((counts = CountNeighbours(pdb, RadSq, nRadii, 
+                                         CountType))==NULL)
+            {
+               fprintf(stderr,"No memory for neighbour counts\n");
+               return(1);
+            }
+
+            if(nRadii == 1)
+            {
+               SetBValues(pdb, counts);
+               blWriteWholePDB(out, wpdb);
+            }
+            else
+            {
+               WriteCountTable(out, pdb, counts, radii, nRadii, 
+                               CountType);
+            }
+            free(counts);
          }
          else
          {
@@ -167,7 +225,8 @@ int main(int argc, char **argv)
 
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
-                     REAL *radius, int *CountType, BOOL *StripWater)
+                     REAL *radii, int *nRadii, int *CountType, 
+                     BOOL *StripWater)
    ---------------------------------------------------------------------
 *//**
 
@@ -175,7 +234,8 @@ int main(int argc, char **argv)
    \param[in]      **argv       Argument array
    \param[out]     *infile      Input file (or blank string)
    \param[out]     *outfile     Output file (or blank string)
-   \param[out]     *radius      Neighbour radius
+   \param[out]     *radii       Neighbour radii
+   \param[out]     *nRadii      Number of radii
    \param[out]     *CountType   Counting scheme
    \param[out]     *StripWater  Strip waters?
    \return                     Success?
@@ -185,11 +245,14 @@ int main(int argc, char **argv)
 -  05.07.94 Original    By: ACRM
 -  29.04.08 Added -c and -n handling
 -  30.04.08 Added -w handling
+-  16.10.26 -r takes a comma-separated list of radii
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
-                  REAL *radius, int *CountType, BOOL *StripWater)
+                  REAL *radii, int *nRadii, int *CountType, 
+                  BOOL *StripWater)
 {
    BOOL GotRad;
+   char *c;
 
    argc--;
    argv++;
@@ -208,7 +271,19 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          case 'r':
             argc--;
             argv++;
-            sscanf(argv[0],"%lf",radius);
+            if(!argc)
+               return(FALSE);
+            *nRadii = 0;
+            for(c=argv[0]; c!=NULL; c=strchr(c, ','))
+            {
+               if(*c == ',')
+                  c++;
+               if(*nRadii >= MAXRADII)
+                  return(FALSE);
+               if(sscanf(c,"%lf",&(radii[*nRadii]))!=1)
+                  return(FALSE);
+               (*nRadii)++;
+            }
             GotRad = TRUE;
             break;
          case 'd':
@@ -221,14 +296,16 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
             *CountType = TYP_CONTACT;
             if(!GotRad)
             {
-               *radius = DEFCRAD;
+               radii[0] = DEFCRAD;
+               *nRadii  = 1;
             }
             break;
          case 'n':
             *CountType = TYP_NORMCONTACT;
             if(!GotRad)
             {
-               *radius = DEFCRAD;
+               radii[0] = DEFCRAD;
+               *nRadii  = 1;
             }
             break;
          case 'w':
@@ -264,13 +341,18 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 }
 
 /************************************************************************/
-/*>void CountNeighbours(PDB *pdb, REAL RadSq, int CountType)
-   ---------------------------------------------------------
+/*>REAL *CountNeighbours(PDB *pdb, REAL *RadSq, int nRadii, 
+                         int CountType)
+   ----------------------------------------------------------
 *//**
 
    \param[in,out]  *pdb       PDB linked list
-   \param[in]      RadSq      Radius squared for neighbour search
+   \param[in]      *RadSq     Radii squared for neighbour search
+   \param[in]      nRadii     Number of radii
    \param[in]      CountType  Counting scheme
+   \return                    Malloc'd array of counts for each atom
+                              with nRadii values per atom (NULL if no
+                              memory)
 
    Does the actual work of counting the neighbours. 5 schemes are allowed:
    TYP_ALL         All atoms counted
@@ -280,62 +362,129 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
    TYP_NORMCONTACT Counts number of residues which contact each residue
                    and normalize by number of atoms in this residue
 
+   The atoms are placed in a grid with cells the size of the largest
+   radius so only atoms in neighbouring cells need be compared. The
+   counts for all radii are made in the same pass.
+
 -  05.07.94 Original    By: ACRM
 -  29.04.08 Added TYP_CONTACT / TYP_NORMCONTACT
 -  12.03.15 Changed to use CHAINMATCH()
+-  16.10.26 Uses an ATOMGRID and counts for a list of radii. Returns 
+            the counts rather than setting the B-values
 */
-void CountNeighbours(PDB *pdb, REAL RadSq, int CountType)
+REAL *CountNeighbours(PDB *pdb, REAL *RadSq, int nRadii, int CountType)
 {
-   PDB *p,
-       *q;
-   int count;
+   ATOMGRID *grid;
+   PDB      *p,
+            *q;
+   REAL     *counts,
+            maxRadSq = (REAL)0.0,
+            distSq;
+   int      i, j, k,
+            ix, iy, iz,
+            cx, cy, cz;
+
+   for(k=0; k<nRadii; k++)
+      maxRadSq = MAX(maxRadSq, RadSq[k]);
+
+   if((grid = BuildAtomGrid(pdb, sqrt(maxRadSq)))==NULL)
+      return(NULL);
+   
+   if((counts = (REAL *)malloc((grid->natoms * nRadii + 1) * 
+                               sizeof(REAL)))==NULL)
+   {
+      FreeAtomGrid(grid);
+      return(NULL);
+   }
+   for(i=0; i<grid->natoms * nRadii; i++)
+      counts[i] = (REAL)0.0;
 
    if((CountType == TYP_CONTACT) || (CountType == TYP_NORMCONTACT))
    {
-      doResidueContacts(pdb, RadSq, CountType);
+      if(!doResidueContacts(pdb, grid, RadSq, nRadii, CountType, 
+                            counts))
+      {
+         free(counts);
+         FreeAtomGrid(grid);
+         return(NULL);
+      }
    }
    else
    {
-      for(p=pdb; p!=NULL; NEXT(p))
+      for(i=0; i<grid->natoms; i++)
       {
-         count = 0;
-         for(q=pdb; q!=NULL; NEXT(q))
+         p  = grid->atoms[i].atom;
+         ix = (int)((p->x - grid->minX) / grid->cellSize);
+         iy = (int)((p->y - grid->minY) / grid->cellSize);
+         iz = (int)((p->z - grid->minZ) / grid->cellSize);
+
+         for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, grid->nz-1); cz++)
          {
-            /* Skip this comparison if the appropriate conditions apply */
-            switch(CountType)
+            for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, grid->ny-1); cy++)
             {
-            case TYP_ALL:
-               if(p==q) continue;
-               break;
-            case TYP_DIFFRES:
-               if(p->resnum    == q->resnum    &&
-                  p->insert[0] == q->insert[0] &&
-                  CHAINMATCH(p->chain, q->chain))
-                  continue;
-               break;
-            case TYP_NONBOND:
-               /* 29.04.08 Corrected to <4.0 rather than >4.0 !!!       */
-               if((p==q) || (DISTSQ(p,q) < (REAL)4.0))
-                  continue;
-               break;
+               for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, grid->nx-1); cx++)
+               {
+                  for(j=grid->cellHead[cx + grid->nx * 
+                                       (cy + grid->ny * cz)];
+                      j!=(-1);
+                      j=grid->atoms[j].nextInCell)
+                  {
+                     q      = grid->atoms[j].atom;
+                     distSq = DISTSQ(p,q);
+                     
+                     /* Skip this comparison if the appropriate 
+                        conditions apply 
+                     */
+                     switch(CountType)
+                     {
+                     case TYP_ALL:
+                        if(p==q) continue;
+                        break;
+                     case TYP_DIFFRES:
+                        if(p->resnum    == q->resnum    &&
+                           p->insert[0] == q->insert[0] &&
+                           CHAINMATCH(p->chain, q->chain))
+                           continue;
+                        break;
+                     case TYP_NONBOND:
+                        /* 29.04.08 Corrected to <4.0 rather than >4.0 
+                           !!!
+                        */
+                        if((p==q) || (distSq < (REAL)4.0))
+                           continue;
+                        break;
+                     }
+
+                     for(k=0; k<nRadii; k++)
+                     {
+                        if(distSq < RadSq[k])
+                           counts[i*nRadii + k] += (REAL)1.0;
+                     }
+                  }
+               }
             }
-            
-            if(DISTSQ(p,q) < RadSq)
-               count++;
          }
-         p->bval = (REAL)count;
       }
    }
+
+   FreeAtomGrid(grid);
+   return(counts);
 }
 
 /************************************************************************/
-/*>void doResidueContacts(PDB *pdb, REAL RadSq, int CountType)
-   -----------------------------------------------------------
+/*>BOOL doResidueContacts(PDB *pdb, ATOMGRID *grid, REAL *RadSq, 
+                          int nRadii, int CountType, REAL *counts)
+   ---------------------------------------------------------------
 *//**
 
-   \param[in]      *pdb        PDB linked list
-   \param[in]      RadSq       Squared cutoff distance
+   \param[in,out]  *pdb        PDB linked list
+   \param[in]      *grid       Grid of atoms in the PDB linked list
+   \param[in]      *RadSq      Squared cutoff distances
+   \param[in]      nRadii      Number of cutoff distances
    \param[in]      CountType   Counting scheme
+   \param[out]     *counts     Counts for each atom with nRadii values
+                               per atom
+   \return                     Success (FALSE if no memory)
 
    Does residue-by-residue contacts rather than atom-atom contacts
    Allowed counting schemes are
@@ -345,165 +494,394 @@ void CountNeighbours(PDB *pdb, REAL RadSq, int CountType)
    (though no check is made for invalid types which are treated as
    TYP_CONTACT)
 
+   A residue is counted once for each radius the first time one of its 
+   atoms is found in contact; the residue being marked with the index
+   of the current residue so the marks need not be cleared.
+
 -  29.04.08  Original   By: ACRM
+-  16.10.26  Uses the ATOMGRID and a list of radii rather than flagging
+             contacts in the occupancy
+-  16.10.26  Returns BOOL
 */
-
-void doResidueContacts(PDB *pdb, REAL RadSq, int CountType)
+BOOL doResidueContacts(PDB *pdb, ATOMGRID *grid, REAL *RadSq, 
+                       int nRadii, int CountType, REAL *counts)
 {
-   PDB *p, *q,
-       *res_p, *res_q,
-       *next_res_p = NULL,
-       *next_res_q = NULL;
-   
-   int atomcount = 0,
-       contacts = 0;
+   PDB  *p, *q;
+   int  *marked,
+        *contacts,
+        res_p, res_q,
+        atomcount,
+        i, j, k,
+        ix, iy, iz,
+        cx, cy, cz;
+   REAL distsq;
+
+   if((marked = (int *)malloc((grid->nres * nRadii + 1) * sizeof(int)))
+      ==NULL)
+      return(FALSE);
+   if((contacts = (int *)malloc((nRadii + 1) * sizeof(int)))==NULL)
+   {
+      free(marked);
+      return(FALSE);
+   }
+   for(i=0; i<grid->nres * nRadii; i++)
+      marked[i] = (-1);
 
    /* Step through each residue                                         */
-   for(res_p=pdb; res_p!=NULL; res_p = next_res_p)
+   for(res_p=0; res_p<grid->nres; res_p++)
    {
-      next_res_p=blFindNextResidue(res_p);
-      /* Using the occupancy as a flag, clear the contact list          */
-      for(p=pdb; p!=NULL; NEXT(p))
-      {
-         p->occ = 0.0;
-      }
-      /* Count of atoms in this residue                                 */
-      atomcount = 0;
-      contacts = 0;
-         
+      for(k=0; k<nRadii; k++)
+         contacts[k] = 0;
       
       /* Step through atoms in this residue                             */
-      for(p=res_p; p!=next_res_p; NEXT(p))
+      for(i=grid->resFirstAtom[res_p]; 
+          i<grid->resFirstAtom[res_p+1]; 
+          i++)
       {
-         atomcount++;   /* Increment atoms in this residue              */
+         p  = grid->atoms[i].atom;
+         ix = (int)((p->x - grid->minX) / grid->cellSize);
+         iy = (int)((p->y - grid->minY) / grid->cellSize);
+         iz = (int)((p->z - grid->minZ) / grid->cellSize);
 
-         /* Step through the other residues                             */
-         for(res_q=pdb; res_q!=NULL; res_q = next_res_q)
+         /* Step through the atoms in neighbouring cells                */
+         for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, grid->nz-1); cz++)
          {
-            next_res_q=blFindNextResidue(res_q);
-
-            /* Check it's a different and not-bonded residue            */
-            if(ResSep(pdb, res_p, res_q))
+            for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, grid->ny-1); cy++)
             {
-               /* Run through the atoms in this residue                 */
-               for(q=res_q; q!=next_res_q; NEXT(q))
+               for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, grid->nx-1); cx++)
                {
-                  REAL distsq;
-                  distsq = DISTSQ(p,q);
-                  if((distsq < RadSq) && (distsq > (REAL)4.0))
+                  for(j=grid->cellHead[cx + grid->nx * 
+                                       (cy + grid->ny * cz)];
+                      j!=(-1);
+                      j=grid->atoms[j].nextInCell)
                   {
-                     q->occ = 1.0;
+                     q      = grid->atoms[j].atom;
+                     res_q  = grid->atoms[j].res;
+                     distsq = DISTSQ(p,q);
+
+                     /* Check it's a different and not-bonded residue
+                        and the atoms are in range
+                     */
+                     if((distsq > (REAL)4.0) &&
+                        ResSepIndex(grid, res_p, res_q))
+                     {
+                        for(k=0; k<nRadii; k++)
+                        {
+                           if((distsq < RadSq[k]) &&
+                              (marked[res_q*nRadii + k] != res_p))
+                           {
+                              marked[res_q*nRadii + k] = res_p;
+                              contacts[k]++;
+                           }
+                        }
+                     }
                   }
                }
             }
          }
       }  /* Atoms in res_p                                              */
 
-      /* Step through the other residues again and count how many
-         residues make contact
-      */
-      for(res_q=pdb; res_q!=NULL; res_q = next_res_q)
+      /* Step through atoms in this residue and store the counts        */
+      atomcount = grid->resFirstAtom[res_p+1] - grid->resFirstAtom[res_p];
+      for(i=grid->resFirstAtom[res_p]; 
+          i<grid->resFirstAtom[res_p+1]; 
+          i++)
       {
-         next_res_q=blFindNextResidue(res_q);
-
-         /* Run through the atoms in this residue                       */
-         for(q=res_q; q!=next_res_q; NEXT(q))
+         for(k=0; k<nRadii; k++)
          {
-            /* As soon as we find one atom flagged in this residue,
-               bump the counter and jump out of the loop
-            */
-            if(q->occ > (REAL)0.5)
+            if(CountType == TYP_NORMCONTACT)
             {
-               contacts++;
-               break;
+               counts[i*nRadii + k] = (REAL)contacts[k] / 
+                                      (REAL)atomcount;
+            }
+            else
+            {
+               counts[i*nRadii + k] = (REAL)contacts[k];
             }
-         }  /* Atoms in res_q                                           */
-      }  /* res_q                                                       */
-
-      /* Step through atoms in this residue and update the b-value      */
-      for(p=res_p; p!=next_res_p; NEXT(p))
-      {
-         if(CountType == TYP_NORMCONTACT)
-         {
-            p->bval = (REAL)contacts / (REAL)atomcount;
-         }
-         else
-         {
-            p->bval = (REAL)contacts;
          }
       }  /* Atoms in res_p                                              */
    }  /* res_p                                                          */
 
+   free(contacts);
+   free(marked);
+
    /* Reset the occupancy                                               */
    for(p=pdb; p!=NULL; NEXT(p))
    {
       p->occ = 1.0;
    }
+
+   return(TRUE);
 }
 
 
 /************************************************************************/
-/*>BOOL ResSep(PDB *pdb, PDB *pr, PDB *qr)
-   ---------------------------------------
+/*>BOOL ResSepIndex(ATOMGRID *grid, int pr, int qr)
+   ------------------------------------------------
 *//**
 
-   \param[in]      *pdb       PDB linked list
-   \param[in]      *pr        Pointer to first residue of interest
-   \param[in]      *qr        Pointer to second residue of interest
-   \return                     Are the residues separated?
+   \param[in]      *grid      Grid of atoms with residue index
+   \param[in]      pr         Index of first residue of interest
+   \param[in]      qr         Index of second residue of interest
+   \return                    Are the residues separated?
 
--  29.04.08  Original   By: ACRM
+   Residues are separated unless their residue numbers and their 
+   positions in the linked list are both within one of each other
+
+-  29.04.08  Original (as ResSep())   By: ACRM
 -  22.07.14 Renamed deprecated functions with bl prefix. By: CTP
+-  16.10.26  Uses residue indexes rather than walking the linked list
 */
-BOOL ResSep(PDB *pdb, PDB *pr, PDB *qr)
+BOOL ResSepIndex(ATOMGRID *grid, int pr, int qr)
 {
-   int sep;
-   PDB *p, *q;
-   BOOL GotPR = FALSE,
-        GotQR = FALSE;
+   PDB *p = grid->resStart[pr],
+       *q = grid->resStart[qr];
    
    /* If they are more than 1 resnum apart immediately return TRUE      */
-   if(pr->resnum < (qr->resnum - 1))
+   if(p->resnum < (q->resnum - 1))
       return(TRUE);
-   if(pr->resnum > (qr->resnum + 1))
+   if(p->resnum > (q->resnum + 1))
       return(TRUE);
 
-   /* Otherwise count through the PDB linked list and see how far 
-      apart they are
-   */
-   sep = 0;
-   for(p=pdb; p!=NULL; p = q)
+   /* Otherwise see how far apart they are in the linked list           */
+   return((pr < (qr - 1)) || (pr > (qr + 1)));
+}
+
+
+/************************************************************************/
+/*>ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cellSize)
+   ------------------------------------------------
+*//**
+
+   \param[in]      *pdb       PDB linked list
+   \param[in]      cellSize   Size of the grid cells
+   \return                    Malloc'd atom grid (NULL if no memory)
+
+   Builds an array of the atoms with the index of the residue each is
+   in, and bins them into a uniform grid. If the grid would be 
+   unreasonably large the cells are made bigger.
+
+-  16.10.26  Original   By: ACRM
+*/
+ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cellSize)
+{
+   ATOMGRID *grid;
+   PDB      *p, *res, *nextRes;
+   REAL     maxX, maxY, maxZ;
+   int      i;
+
+   if((grid = (ATOMGRID *)malloc(sizeof(ATOMGRID)))==NULL)
+      return(NULL);
+   grid->atoms        = NULL;
+   grid->resStart     = NULL;
+   grid->resFirstAtom = NULL;
+   grid->cellHead     = NULL;
+
+   grid->natoms = grid->nres = 0;
+   for(res=pdb; res!=NULL; res=nextRes)
+   {
+      nextRes = blFindNextResidue(res);
+      for(p=res; p!=nextRes; NEXT(p))
+         grid->natoms++;
+      grid->nres++;
+   }
+
+   if(((grid->atoms = (GRIDATOM *)malloc((grid->natoms + 1) * 
+                                         sizeof(GRIDATOM)))==NULL) ||
+      ((grid->resStart = (PDB **)malloc((grid->nres + 1) * 
+                                        sizeof(PDB *)))==NULL) ||
+      ((grid->resFirstAtom = (int *)malloc((grid->nres + 1) * 
+                                           sizeof(int)))==NULL))
    {
-      q = blFindNextResidue(p);
-      if(p == pr)
+      FreeAtomGrid(grid);
+      return(NULL);
+   }
+
+   /* Store the atoms and residues and find the bounding box            */
+   grid->minX = grid->minY = grid->minZ = (REAL)0.0;
+   maxX       = maxY       = maxZ       = (REAL)0.0;
+   grid->natoms = grid->nres = 0;
+   for(res=pdb; res!=NULL; res=nextRes)
+   {
+      nextRes = blFindNextResidue(res);
+      grid->resStart[grid->nres]     = res;
+      grid->resFirstAtom[grid->nres] = grid->natoms;
+
+      for(p=res; p!=nextRes; NEXT(p))
       {
-         if(!GotQR)
-         {
-            sep = 0;
-         }
-         GotPR = TRUE;
-         if(sep > 1)
+         grid->atoms[grid->natoms].atom       = p;
+         grid->atoms[grid->natoms].res        = grid->nres;
+         grid->atoms[grid->natoms].nextInCell = (-1);
+
+         if(grid->natoms == 0)
          {
-            return(TRUE);
+            grid->minX = maxX = p->x;
+            grid->minY = maxY = p->y;
+            grid->minZ = maxZ = p->z;
          }
+         grid->minX = MIN(grid->minX, p->x);
+         grid->minY = MIN(grid->minY, p->y);
+         grid->minZ = MIN(grid->minZ, p->z);
+         maxX       = MAX(maxX, p->x);
+         maxY       = MAX(maxY, p->y);
+         maxZ       = MAX(maxZ, p->z);
+         grid->natoms++;
       }
-      if(p == qr)
+      grid->nres++;
+   }
+   grid->resFirstAtom[grid->nres] = grid->natoms;
+
+   /* Size the cells, growing them if the grid would be unreasonably 
+      large
+   */
+   grid->cellSize = MAX(cellSize, (REAL)0.1);
+   for(;;)
+   {
+      grid->nx = 1 + (int)((maxX - grid->minX) / grid->cellSize);
+      grid->ny = 1 + (int)((maxY - grid->minY) / grid->cellSize);
+      grid->nz = 1 + (int)((maxZ - grid->minZ) / grid->cellSize);
+      if(((double)grid->nx * (double)grid->ny * (double)grid->nz) <= 
+         (double)MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                      sizeof(int)))==NULL)
+   {
+      FreeAtomGrid(grid);
+      return(NULL);
+   }
+   for(i=0; i<grid->nx * grid->ny * grid->nz; i++)
+      grid->cellHead[i] = (-1);
+
+   /* Bin the atoms                                                     */
+   for(i=grid->natoms-1; i>=0; i--)
+   {
+      PDB *a    = grid->atoms[i].atom;
+      int  cell = (int)((a->x - grid->minX) / grid->cellSize) +
+                  grid->nx * 
+                  ((int)((a->y - grid->minY) / grid->cellSize) +
+                   grid->ny * 
+                   (int)((a->z - grid->minZ) / grid->cellSize));
+      grid->atoms[i].nextInCell = grid->cellHead[cell];
+      grid->cellHead[cell]      = i;
+   }
+
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeAtomGrid(ATOMGRID *grid)
+   ---------------------------------
+*//**
+
+   \param[in]      *grid      Atom grid
+
+   Frees an atom grid
+
+-  16.10.26  Original   By: ACRM
+*/
+void FreeAtomGrid(ATOMGRID *grid)
+{
+   if(grid->atoms != NULL)
+      free(grid->atoms);
+   if(grid->resStart != NULL)
+      free(grid->resStart);
+   if(grid->resFirstAtom != NULL)
+      free(grid->resFirstAtom);
+   if(grid->cellHead != NULL)
+      free(grid->cellHead);
+   free(grid);
+}
+
+
+/************************************************************************/
+/*>void SetBValues(PDB *pdb, REAL *counts)
+   ---------------------------------------
+*//**
+
+   \param[in,out]  *pdb       PDB linked list
+   \param[in]      *counts    Count for each atom
+
+   Places the counts for a single radius in the B-value column
+
+-  16.10.26  Original   By: ACRM
+*/
+void SetBValues(PDB *pdb, REAL *counts)
+{
+   PDB *p;
+   int i = 0;
+   
+   for(p=pdb; p!=NULL; NEXT(p))
+      p->bval = counts[i++];
+}
+
+
+/************************************************************************/
+/*>void WriteCountTable(FILE *out, PDB *pdb, REAL *counts, REAL *radii, 
+                        int nRadii, int CountType)
+   ---------------------------------------------------------------------
+*//**
+
+   \param[in]      *out       Output file
+   \param[in]      *pdb       PDB linked list
+   \param[in]      *counts    Counts for each atom with nRadii values
+                              per atom
+   \param[in]      *radii     The radii
+   \param[in]      nRadii     Number of radii
+   \param[in]      CountType  Counting scheme
+
+   Writes the counts for several radii as a table with a column for each
+   radius. Atom counts are written for each atom and residue contacts
+   once for each residue.
+
+-  16.10.26  Original   By: ACRM
+*/
+void WriteCountTable(FILE *out, PDB *pdb, REAL *counts, REAL *radii, 
+                     int nRadii, int CountType)
+{
+   PDB  *p,
+        *nextRes = pdb;
+   int  i = 0,
+        k;
+   BOOL byResidue = ((CountType == TYP_CONTACT) || 
+                     (CountType == TYP_NORMCONTACT));
+   char resid[MAXBUFF];
+
+   fprintf(out, "# %-8s %-4s %-4s", "resid", "res", (byResidue?"":"atom"));
+   for(k=0; k<nRadii; k++)
+      fprintf(out, " %8.2f", radii[k]);
+   fprintf(out, "\n");
+   
+   for(p=pdb; p!=NULL; NEXT(p), i++)
+   {
+      /* With residue contacts only write the first atom of each 
+         residue 
+      */
+      if(byResidue)
       {
-         if(!GotPR)
-         {
-            sep = 0;
-         }
-         GotQR = TRUE;
-         if(sep > 1)
-         {
-            return(TRUE);
-         }
+         if(p != nextRes)
+            continue;
+         nextRes = blFindNextResidue(p);
+      }
+      
+      MAKERESID(resid, p);
+      fprintf(out, "  %-8s %-4s %-4s", resid, p->resnam, 
+              (byResidue?"":p->atnam));
+      for(k=0; k<nRadii; k++)
+      {
+         if(CountType == TYP_NORMCONTACT)
+            fprintf(out, " %8.3f", counts[i*nRadii + k]);
+         else
+            fprintf(out, " %8d", (int)counts[i*nRadii + k]);
       }
-      sep++;
+      fprintf(out, "\n");
    }
-   return(FALSE);
 }
 
+
 /************************************************************************/
 /*>void Usage(void)
    ----------------
@@ -518,15 +896,18 @@ BOOL ResSep(PDB *pdb, PDB *pr, PDB *qr)
 -  06.11.14 V1.5 By: ACRM
 -  12.02.15 V1.7
 -  12.03.15 V1.8
+-  16.10.26 V1.9
 */
 void Usage(void)
 {
-   fprintf(stderr,"\npdbatomcount V1.8 (c) 1994-2015, Andrew C.R. \
+   fprintf(stderr,"\npdbatomcount V1.9 (c) 1994-2026, Andrew C.R. \
 Martin, UCL\n");
-   fprintf(stderr,"Usage: pdbatomcount [-r <rad>] [-d|-b|-c|-n] [-w] \
-[<in.pdb> [<out.pdb>]]\n");
+   fprintf(stderr,"Usage: pdbatomcount [-r <rad>[,<rad>...]] \
+[-d|-b|-c|-n] [-w] [<in.pdb> [<out>]]\n");
    fprintf(stderr,"       -r Specify radius (Default: %.2f or \
 %.2f with -c/-n)\n", DEFRAD, DEFCRAD);
+   fprintf(stderr,"          A comma-separated list of radii (up to \
+%d) may be given\n", MAXRADII);
    fprintf(stderr,"       -d Ignore atoms in current \
 residue\n");
    fprintf(stderr,"       -b Ignore bonded atoms (<2.0A)\n");
@@ -538,6 +919,11 @@ residue\n");
 radius of each atom in\n");
    fprintf(stderr,"a PDB structure. The results are placed in the \
 B-value column.\n\n");
+   fprintf(stderr,"If more than one radius is given, a table is written \
+instead of a\n");
+   fprintf(stderr,"PDB file with a column of counts for each radius and \
+a row for each\n");
+   fprintf(stderr,"atom (or each residue with -c/-n).\n\n");
    fprintf(stderr,"With residue contacts, the number of residues which \
 make contact with\n");
    fprintf(stderr,"the current residue is calculated. The residues \
@@ -4,12 +4,12 @@
    Program:    pdbfindnearres
    \file       pdbfindnearres.c
    
-   \version    V1.0.2
-   \date       29.06.19       
-   \brief      Finds residues of a specified type near to the given
+   \version    V1.1
+   \date       16.10.26       
+   \brief      Finds residues of specified types near to the given
                zones   
    
-   \copyright  (c) UCL / Prof. Andrew C. R. Martin 2019
+   \copyright  (c) UCL / Prof. Andrew C. R. Martin 2019-26
    \author     Prof. Andrew C. R. Martin
    \par
                Institute of Structural & Molecular Biology,
@@ -50,6 +50,10 @@
    V1.0   05.06.19  Original
    V1.0.1 18.06.19  Fixed buffer size for fussy compiler
    V1.0.2 19.06.19  Fully documented and default radius in help message
+   V1.1   16.10.26  Accepts a comma-separated list of residue types or
+                    'any'. Zone membership is calculated once per 
+                    residue and nearby sidechain atoms are found using
+                    a grid
 
 *************************************************************************/
 /* Includes
@@ -68,6 +72,7 @@
 #define SMALLBUFF 32
 #define MAXBUFF   160
 #define DEFRAD    8.0
+#define MAXGRIDCELLS 1000000  /* Maximum cells in the atom grid         */
 
 typedef struct _zone
 {
@@ -76,6 +81,22 @@ typedef struct _zone
    struct _zone *next;
 } ZONE;
 
+typedef struct
+{
+   PDB  *start,               /* First atom of the residue              */
+        *stop;                /* First atom of the next residue         */
+   BOOL inZone,               /* Residue is in one of the zones         */
+        candidate,            /* Residue is of a type we want           */
+        flagged;              /* Residue is near to a zone              */
+} RESFLAGS;
+
+typedef struct
+{
+   REAL x, y, z;
+   int  res,                  /* Index into the RESFLAGS array          */
+        nextInCell;           /* Next atom in the same cell (or -1)     */
+} GRIDATOM;
+
 #define STRNCPY(a,b,c) \
 do {  strncpy(a,b,c);  \
    a[c-1] = '\0';      \
@@ -100,10 +121,12 @@ void WriteFlaggedAtoms(FILE *out, PDB *pdb);
 void ListFlaggedResidues(FILE *out, PDB *pdb);
 BOOL ResInZone(PDB *res, ZONE *zones);
 void ClearOccup(PDB *pdb);
-void FlagNearRes(PDB *pdb, ZONE *zones, char *restype, REAL radiusSq);
+BOOL FlagNearRes(PDB *pdb, ZONE *zones, char **restypes, 
+                 REAL radiusSq);
+BOOL IsWantedType(PDB *res, char **restypes);
+RESFLAGS *IndexResidues(PDB *pdb, ZONE *zones, char **restypes, 
+                        int *nres);
 void SetOccup(PDB *start, PDB *stop);
-BOOL CheckInRange(PDB *res1, PDB *nextRes1, PDB *res2, PDB *nextRes2, 
-                  REAL radiusSq);
 ZONE *ParseZoneSpec(char *zonespec);
 void PopulateZone(ZONE *z, char *zoneDescription);
 char **blSplitStringOnCharacter(char *string, char charac, 
@@ -125,12 +148,19 @@ int main(int argc, char **argv)
    char infile[MAXBUFF],
         outfile[MAXBUFF],
         zonespec[MAXBUFF],
-        restype[MAXBUFF];
+        restype[MAXBUFF],
+        **restypes;
    
    
    if(ParseCmdLine(argc, argv, infile, outfile, &radius, zonespec, 
                    restype, &listOnly))
    {
+      if((restypes = blSplitStringOnCharacter(restype, ',', 4))==NULL)
+      {
+         fprintf(stderr,"No memory for residue type list\n");
+         return(1);
+      }
+
       if((zones = ParseZoneSpec(zonespec))!=NULL)
       {
 #ifdef DEBUG
@@ -150,7 +180,11 @@ int main(int argc, char **argv)
             if((wpdb = blReadWholePDB(in)) != NULL)
             {
                pdb = wpdb->pdb;
-               FlagNearRes(pdb, zones, restype, radius);
+               if(!FlagNearRes(pdb, zones, restypes, radius))
+               {
+                  fprintf(stderr,"No memory for residue grid\n");
+                  return(1);
+               }
                if(listOnly)
                {
                   ListFlaggedResidues(out, pdb);
@@ -284,58 +318,263 @@ void ClearOccup(PDB *pdb)
 
 
 /************************************************************************/
-/*>void FlagNearRes(PDB *pdb, ZONE *zones, char *restype, REAL radiusSq)
-   ---------------------------------------------------------------------
+/*>BOOL IsWantedType(PDB *res, char **restypes)
+   --------------------------------------------
+*//**
+   \param[in]    res        Pointer to the start of a residue
+   \param[in]    restypes   Residue types terminated by a blank string
+   \return                  Is the residue one of the types?
+
+   Determine whether a residue is any of the specified types. A type
+   of ANY matches all residues.
+
+-  16.10.26 Original    By: ACRM
+*/
+BOOL IsWantedType(PDB *res, char **restypes)
+{
+   int i;
+   
+   for(i=0; restypes[i][0]; i++)
+   {
+      if(!strcmp(restypes[i], "ANY") ||
+         !strncmp(res->resnam, restypes[i], 3))
+      {
+         return(TRUE);
+      }
+   }
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>RESFLAGS *IndexResidues(PDB *pdb, ZONE *zones, char **restypes, 
+                           int *nres)
+   ---------------------------------------------------------------
+*//**
+   \param[in]    pdb       PDB linked list
+   \param[in]    zones     Linked list of zone specifications
+   \param[in]    restypes  Residue types we are looking for
+   \param[out]   nres      Number of residues
+   \return                 Malloc'd array of residue flags (NULL if 
+                           no memory)
+
+   Builds an array of the residues recording whether each is in a zone
+   and whether it is one of the types we are looking for, so these only
+   need to be tested once per residue
+
+-  16.10.26 Original    By: ACRM
+*/
+RESFLAGS *IndexResidues(PDB *pdb, ZONE *zones, char **restypes, 
+                        int *nres)
+{
+   RESFLAGS *residues;
+   PDB      *res, *nextRes;
+   int      i;
+
+   *nres = 0;
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+      (*nres)++;
+
+   if((residues = (RESFLAGS *)malloc((*nres + 1) * sizeof(RESFLAGS)))
+      == NULL)
+      return(NULL);
+
+   for(res=pdb, i=0; res!=NULL; res=nextRes, i++)
+   {
+      nextRes = blFindNextResidue(res);
+      residues[i].start     = res;
+      residues[i].stop      = nextRes;
+      residues[i].inZone    = ResInZone(res, zones);
+      residues[i].candidate = (!residues[i].inZone && 
+                               IsWantedType(res, restypes));
+      residues[i].flagged   = FALSE;
+   }
+
+   return(residues);
+}
+
+
+/************************************************************************/
+/*>BOOL FlagNearRes(PDB *pdb, ZONE *zones, char **restypes, 
+                    REAL radiusSq)
+   --------------------------------------------------------
 *//**
    \param[in]    pdb       PDB linked list
    \param[in]    zones     Linked list of zone specifications
-   \param[in]    restype   Amino acid type we are looking for
+   \param[in]    restypes  Amino acid types we are looking for
+                           terminated by a blank string
    \param[in]    radiusSq  Squared distance for a residue to be in range
+   \return                 Success? (FALSE if no memory)
 
    Uses occupancy as a flag - first clears this for all atoms, then
-   looks for residues of the specified type (restype) within the given
-   distance of any of the given zones. If a residue has any s/c atom in
-   range then the occupancy for the residue is set to 1
+   looks for residues of the specified types (restypes) within the 
+   given distance of any of the given zones. If a residue has any s/c 
+   atom in range then the occupancy for the residue is set to 1
+
+   The sidechain atoms of residues of the required types are placed in
+   a grid with the radius as the cell size so each zone atom need only
+   be compared with atoms in the surrounding cells
 
 -  05.06.19 Original    By: ACRM
+-  16.10.26 Takes a list of residue types. Zone membership is found once
+            per residue and sidechain atoms are found using a grid
 */
-void FlagNearRes(PDB *pdb, ZONE *zones, char *restype, REAL radiusSq)
+BOOL FlagNearRes(PDB *pdb, ZONE *zones, char **restypes, REAL radiusSq)
 {
-   PDB  *nextRes1, *nextRes2, *res1, *res2;
+   RESFLAGS *residues;
+   GRIDATOM *atoms;
+   PDB      *p;
+   int      *cellHead,
+            nres, natoms, ncells,
+            nx, ny, nz,
+            ix, iy, iz,
+            cx, cy, cz,
+            i, j;
+   REAL     minX = 0.0, minY = 0.0, minZ = 0.0,
+            maxX = 0.0, maxY = 0.0, maxZ = 0.0,
+            cellSize;
 
    /* Set occupancies to zero - we will use this as a flag              */
    ClearOccup(pdb);
-   
-   /* First step through the residues                                   */
-   for(res1=pdb; res1!=NULL; res1=nextRes1)
+
+   if((residues = IndexResidues(pdb, zones, restypes, &nres))==NULL)
+      return(FALSE);
+
+   /* Count the sidechain atoms of the candidate residues               */
+   natoms = 0;
+   for(i=0; i<nres; i++)
    {
-      nextRes1 = blFindNextResidue(res1);
+      if(residues[i].candidate)
+      {
+         for(p=residues[i].start; p!=residues[i].stop; NEXT(p))
+         {
+            if(ISSIDECHAIN(p))
+               natoms++;
+         }
+      }
+   }
 
-      /* If this residue is in a zone                                   */
-      if(ResInZone(res1, zones))
+   if((atoms = (GRIDATOM *)malloc((natoms + 1) * sizeof(GRIDATOM)))
+      == NULL)
+   {
+      free(residues);
+      return(FALSE);
+   }
+
+   /* Store them and find their bounding box                            */
+   natoms = 0;
+   for(i=0; i<nres; i++)
+   {
+      if(residues[i].candidate)
       {
-         /* Second step through the residues                            */
-         for(res2=pdb; res2!=NULL; res2=nextRes2)
+         for(p=residues[i].start; p!=residues[i].stop; NEXT(p))
          {
-            nextRes2 = blFindNextResidue(res2);
+            if(ISSIDECHAIN(p))
+            {
+               atoms[natoms].x   = p->x;
+               atoms[natoms].y   = p->y;
+               atoms[natoms].z   = p->z;
+               atoms[natoms].res = i;
+               
+               if(natoms == 0)
+               {
+                  minX = maxX = p->x;
+                  minY = maxY = p->y;
+                  minZ = maxZ = p->z;
+               }
+               minX = MIN(minX, p->x);
+               minY = MIN(minY, p->y);
+               minZ = MIN(minZ, p->z);
+               maxX = MAX(maxX, p->x);
+               maxY = MAX(maxY, p->y);
+               maxZ = MAX(maxZ, p->z);
+               natoms++;
+            }
+         }
+      }
+   }
 
-            /* If this residue is of the correct type, but not in any
-               zones
-            */
-            if(!strncmp(res2->resnam, restype, 3) &&
-               !ResInZone(res2, zones))
+   /* Size the grid, growing the cells if it would be unreasonably 
+      large
+   */
+   cellSize = MAX(sqrt(radiusSq), 0.1);
+   for(;;)
+   {
+      nx = 1 + (int)((maxX - minX) / cellSize);
+      ny = 1 + (int)((maxY - minY) / cellSize);
+      nz = 1 + (int)((maxZ - minZ) / cellSize);
+      if(((double)nx * (double)ny * (double)nz) <= (double)MAXGRIDCELLS)
+         break;
+      cellSize *= 2.0;
+   }
+   ncells = nx * ny * nz;
+
+   if((cellHead = (int *)malloc(ncells * sizeof(int)))==NULL)
+   {
+      free(atoms);
+      free(residues);
+      return(FALSE);
+   }
+   for(i=0; i<ncells; i++)
+      cellHead[i] = (-1);
+
+   /* Bin the atoms                                                     */
+   for(i=0; i<natoms; i++)
+   {
+      int cell = (int)((atoms[i].x - minX) / cellSize) +
+                 nx * ((int)((atoms[i].y - minY) / cellSize) +
+                       ny * (int)((atoms[i].z - minZ) / cellSize));
+      atoms[i].nextInCell = cellHead[cell];
+      cellHead[cell]      = i;
+   }
+
+   /* Step through the atoms of residues in zones and flag any candidate
+      residue with a sidechain atom in range
+   */
+   for(i=0; i<nres; i++)
+   {
+      if(!residues[i].inZone)
+         continue;
+      
+      for(p=residues[i].start; p!=residues[i].stop; NEXT(p))
+      {
+         ix = (int)floor((p->x - minX) / cellSize);
+         iy = (int)floor((p->y - minY) / cellSize);
+         iz = (int)floor((p->z - minZ) / cellSize);
+
+         for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, nz-1); cz++)
+         {
+            for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, ny-1); cy++)
             {
-               /* See if any atoms in res1 are within distance of any
-                  atoms in res2
-               */
-               if(CheckInRange(res1, nextRes1, res2, nextRes2, radiusSq))
+               for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, nx-1); cx++)
                {
-                  SetOccup(res2, nextRes2);
+                  for(j=cellHead[cx + nx * (cy + ny * cz)];
+                      j!=(-1);
+                      j=atoms[j].nextInCell)
+                  {
+                     if(!residues[atoms[j].res].flagged &&
+                        (DISTSQ(p, &(atoms[j])) <= radiusSq))
+                     {
+                        residues[atoms[j].res].flagged = TRUE;
+                     }
+                  }
                }
             }
          }
       }
    }
+
+   for(i=0; i<nres; i++)
+   {
+      if(residues[i].flagged)
+         SetOccup(residues[i].start, residues[i].stop);
+   }
+
+   free(cellHead);
+   free(atoms);
+   free(residues);
+   
+   return(TRUE);
 }
 
 
@@ -360,46 +599,6 @@ void SetOccup(PDB *start, PDB *stop)
 }
 
 
-/************************************************************************/
-/*>BOOL CheckInRange(PDB *res1, PDB *nextRes1, PDB *res2, PDB *nextRes2, 
-                     REAL radiusSq)
-   ----------------------------------------------------------------------
-*//**
-   \param[in]    res1        Start of residue range (all atoms)
-   \param[in]    nextRes1    End of residue range (all atoms)
-   \param[in]    res2        Start of residue range (sidechain atoms)
-   \param[in]    nextRes2    End of residue range (sidechain atoms)
-   \param[in]    radiusSq    Distance squared
-   \return                   BOOL: In range?
-
-   Looks to see if sidechain atoms of res2 are within the specified
-   distance of all atoms of res1. Returns true if they are, false 
-   otherwise
-
--  05.06.19 Original    By: ACRM
-*/
-BOOL CheckInRange(PDB *res1, PDB *nextRes1, PDB *res2, PDB *nextRes2, 
-                  REAL radiusSq)
-{
-   PDB *p, *q;
-   
-   for(p=res1; p!=nextRes1; NEXT(p))
-   {
-      for(q=res2; q!=nextRes2; NEXT(q))
-      {
-         if(ISSIDECHAIN(q))
-         {
-            if(DISTSQ(p,q) <= radiusSq)
-            {
-               return(TRUE);
-            }
-         }
-      }
-   }
-   return(FALSE);
-}
-
-
 /************************************************************************/
 /*>ZONE *ParseZoneSpec(char *zonespec)
    -----------------------------------
@@ -557,7 +756,7 @@ char **blSplitStringOnCharacter(char *string, char charac, int minItemLen)
    \param[out]     *outfile     Output file (or blank string)
    \param[out]     *radius      Neighbour radius
    \param[out]     *zonespec    Zone specification
-   \param[out]     *restype     Res type to look for
+   \param[out]     *restype     Comma-separated res types to look for
    \param[out]     *listOnly    Only list the near residues rather than
                                 PDB output
    \return                      Success?
@@ -566,6 +765,7 @@ char **blSplitStringOnCharacter(char *string, char charac, int minItemLen)
    
 -  05.06.19 Original    By: ACRM
 -  18.06.19 Improved help message
+-  16.10.26 restype may be a comma-separated list
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
                   REAL *radius, char *zonespec, char *restype, 
@@ -604,7 +804,7 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          /* Copy the first to zonespec                                  */
          STRNCPY(zonespec, argv[0], MAXBUFF);
          
-         /* Copy the next to restype                                    */
+         /* Copy the next to restype (a comma-separated list)          */
          argc--;
          argv++;
          STRNCPY(restype, argv[0], MAXBUFF);
@@ -645,21 +845,22 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 -  05.06.19 Original    By: ACRM
 -  18.06.19 V1.0.1
 -  19.06.19 V1.0.2
+-  16.10.26 V1.1
 
 */
 void Usage(void)
 {
-   printf("\npdbfindneares V1.0.2 (c) 2019 UCL, Prof. Andrew C.R. \
+   printf("\npdbfindneares V1.1 (c) 2019-26 UCL, Prof. Andrew C.R. \
 Martin\n");
 
-   printf("\nUsage: pdbfindnearres [-r nnn][-l] zone[,zone...] resnam \
-[in.pdb [out.pdb]]\n");
+   printf("\nUsage: pdbfindnearres [-r nnn][-l] zone[,zone...] \
+resnam[,resnam...] [in.pdb [out.pdb]]\n");
    printf("       -r   Specify the radius used to look for nearby \
 residues [%.3f]\n", DEFRAD);
    printf("       -l   Simply list residues instead of PDB output\n");
 
-   printf("\nFinds occurrences of residues of type 'resnam' that have \
-sidechains\n");
+   printf("\nFinds occurrences of residues of type(s) 'resnam' that \
+have sidechains\n");
    printf("within the specified distance of any atoms in the specified \
 residue\n");
    printf("range(s).\n");
@@ -678,12 +879,18 @@ by a . if numeric\n");
 (,)\n");
    printf("\nresnam is a three-letter code amino acid name (upper or \
 lower case)\n");
+   printf("        Multiple residue types may be listed separated by \
+commas (,)\n");
+   printf("        or 'any' may be given to find residues of any \
+type\n");
    printf("\nFor example:\n");
    printf("        pdbfindnearres L24-L34 tyr test.pdb\n");
    printf("        pdbfindnearres -l L50-L56 tyr test.pdb\n");
    printf("        pdbfindnearres -l L24-L34,L50-L56 tyr test.pdb\n");
    printf("        pdbfindnearres -l L24,L34,L50,L56 tyr test.pdb\n");
    printf("        pdbfindnearres -l -r 16 L50 lys test.pdb\n");
-   printf("        pdbfindnearres -l -r 16 L50,L24-L34 lys test.pdb\n\n");
+   printf("        pdbfindnearres -l -r 16 L50,L24-L34 lys test.pdb\n");
+   printf("        pdbfindnearres -l L24-L34 tyr,phe,trp test.pdb\n");
+   printf("        pdbfindnearres -l L24-L34 any test.pdb\n\n");
 }
 
@@ -7,11 +7,11 @@ Handle PGP file in data directory
 
    \file       pdbhbond.c
    
-   \version    V2.1
-   \date       08.09.17
+   \version    V2.8
+   \date       16.10.26
    \brief      List hydrogen bonds
    
-   \copyright  (c) UCL, Dr. Andrew C.R. Martin, 2014-2017
+   \copyright  (c) UCL, Dr. Andrew C.R. Martin, 2014-2026
    \author     Dr. Andrew C.R. Martin
    \par
                Institute of Structural & Molecular Biology,
@@ -139,6 +139,24 @@ Handle PGP file in data directory
                    CONECT information rather than keeping its own version
                    of the CONECT data
 -   V2.1  08.09.17 Changed comment in output and spacing of fields
+-   V2.2  16.10.26 FindNonBonds() uses a spatial grid, a per-chain
+                   peptide hash and a hash of HBonded pairs rather than
+                   scanning every atom pair
+-   V2.3  16.10.26 FindProtProtHBonds() only tests residue pairs whose
+                   bounding spheres are close enough to HBond
+-   V2.4  16.10.26 Added -j to run the searches in parallel. Protein-
+                   protein HBonds are found while the ligand searches
+                   run and each search is split into ranges of atoms
+                   or residues shared out to a pool of threads
+-   V2.5  16.10.26 Added -c to cache the protonated and typed structure
+                   in a binary file named from a hash of the input
+-   V2.6  16.10.26 Hydrogens and first antecedents are indexed once
+                   per atom rather than searched for each HBond test
+-   V2.7  16.10.26 PDB extras and non-bond contacts are allocated in
+                   blocks which are released in one go
+-   V2.8  16.10.26 Added -l to process a list or directory of files 
+                   with a pool of threads, giving tagged output or
+                   one output file per structure (-o)
 
 *************************************************************************/
 /* Includes
@@ -147,6 +165,11 @@ Handle PGP file in data directory
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "bioplib/macros.h"
 #include "bioplib/SysDefs.h"
@@ -173,6 +196,23 @@ Handle PGP file in data directory
 #define MAX_CHAIN_STRING   8
 #define MAX_START_STRING   8
 #define MAX_PEPTIDE_LENGTH 30
+#define MAXHBONDKEY       40
+#define HASHSIZE        1000
+#define MAXGRIDCELLS 1000000         /* Max cells in the atom grid      */
+#define GRID_SLACK       0.001       /* Added to grid cell size         */
+#define MAXTHREADS       256         /* Maximum number of threads (-j)  */
+#define CHUNKSPERTHREAD    4         /* Work ranges per thread in a 
+                                        search                          */
+#define MAXCACHEFILE     (MAXBUFF+32) /* Length of a cache filename     */
+#define MAXCACHESTRING     8         /* String fields in a cached atom  */
+#define MAXRESKEY         32         /* Residue key for the H index     */
+#define ARENABLOCKITEMS 4096         /* Items allocated at a time       */
+#define MAXOUTFILE       (2*MAXBUFF+8) /* Length of a -o output file    */
+#define OUTFILEEXT       ".hb"       /* Extension of -o output files    */
+#define COPYBUFF        8192         /* Buffer for copying output       */
+#define CACHEMAGIC       "PDBHBOND"  /* Identifies a cache file         */
+#define CACHEVERSION       2         /* Change if CACHEATOM or 
+                                        CACHEHEADER changes             */
 
 #define BOND_TOL             DEFCONECTTOL   /* Tolerance for a bond     */
 
@@ -180,6 +220,8 @@ Handle PGP file in data directory
 #define MAXBONDSQ             3.0           /* 1.732A max bond distance */
 #define MINNBDISTSQ           8.41          /* 2.9A min NB distance     */
 #define MAXNBDISTSQ          15.21          /* 3.9A max NB distance     */
+#define MAXHADIST             2.5           /* Baker & Hubbard max H-A
+                                               distance                 */
 #define MAXTETRAHEDRALANGLE 115.0           /* Max allowed angle for a
                                                tetrahedral carbon. Assumed
                                                to be trigonal planar if
@@ -193,19 +235,224 @@ typedef struct
         acceptor;
 }  HBONDING;
 
+/* Block of items handed out by AllocFromArena()                       */
+typedef struct _arenablock
+{
+   struct _arenablock *next;
+   char               *items;
+}  ARENABLOCK;
+
+/* Allocator for many items of one size which are all freed together.
+   The first block is the one currently being filled
+*/
+typedef struct
+{
+   ARENABLOCK *blocks;
+   size_t     itemSize;
+   int        itemsPerBlock,
+              nUsed;          /* Items used in the first block          */
+}  ARENA;
+
+/* The hydrogens in a residue as found by blFindResidue() or
+   blFindHetatmResidue()
+*/
+typedef struct _reshyd
+{
+   struct _reshyd *next;
+   PDB            *start,     /* First atom of the residue              */
+                  **hydrogens;
+   int            nHydrogens;
+}  RESHYD;
+
 /* PDB.extras structure used for original atom numbers (before adding
-   hydrogens) and molecule IDs                                          */
+   hydrogens) and molecule IDs. Also holds the hydrogen and antecedent
+   index built by BuildHydrogenIndex()                                  */
 typedef struct _pdbextras
 {
-   int origAtnum;
-   int molid;
+   int    origAtnum;
+   int    molid;
+   RESHYD *resHyd;            /* Residue found from this atom's ID      */
+   PDB    **bondedH,          /* Hydrogens bonded to this atom that 
+                                 follow it in the residue               */
+          *antecedent;        /* First antecedent                       */
+   int    nBondedH,
+          nAntecedents;       /* count from FindAntecedent()            */
+   BOOL   haveAntecedent;
 }  PDBEXTRAS;
 
+/* An atom in the spatial grid used by FindNonBonds()                   */
+typedef struct
+{
+   PDB *atom;
+   int nextInCell;      /* Next atom in the same cell (-1 at the end)   */
+}  GRIDATOM;
+
+/* Spatial grid of all atoms with a cell size of at least the maximum
+   non-bond distance
+*/
+typedef struct
+{
+   GRIDATOM *atoms;
+   int      *cellHead,
+            natoms,
+            nx, ny, nz;
+   REAL     minX, minY, minZ,
+            cellSize;
+}  ATOMGRID;
+
+/* A residue in the spatial grid used by FindProtProtHBonds()           */
+typedef struct
+{
+   PDB  *start,               /* First atom of the residue              */
+        *stop;                /* First atom of the next residue         */
+   REAL x, y, z,              /* Centre of the residue's atoms          */
+        radius;               /* Bounding sphere radius about centre    */
+   int  nextInCell;           /* Next residue in the same cell (or -1)  */
+}  RESINFO;
+
+/* Spatial grid of residue centres                                      */
+typedef struct
+{
+   RESINFO *res;              /* Array of residues in file order        */
+   int     *cellHead,         /* First residue in each cell (or -1)     */
+           nres,
+           nx, ny, nz;
+   REAL    minX, minY, minZ,
+           cellSize,
+           cutoff;            /* Max atom-atom distance of interest     */
+}  RESGRID;
+
+/* A range of atoms or residues searched as one unit of work            */
+typedef struct
+{
+   HBLIST *hblist,            /* Results for this range                 */
+          *hbl;               /* Last item appended to hblist           */
+   ARENA  arena;              /* Used for hblist if the stage has a
+                                 resultArena                            */
+   int    start,              /* First atom or residue in the range     */
+          stop;               /* One beyond the last                    */
+   BOOL   noMemory;
+}  HBCHUNK;
+
+/* Data shared by the threads working on one search                     */
+typedef struct _hbstage
+{
+   PDB       *pdb,
+             **pdbarray,
+             **atoms;         /* Atoms in linked list order             */
+   RESGRID   *resGrid;
+   ATOMGRID  *atomGrid;
+   HASHTABLE *peptideHash,
+             *hbondHash;
+   HBCHUNK   *chunks;
+   ARENA     *resultArena;    /* Takes the chunk arenas (NULL if the
+                                 results are allocated individually)    */
+   REAL      maxHBDistSq,
+             minNBDistSq,
+             maxNBDistSq;
+   BOOL      pseudo;
+   int       nChunks,
+             nextChunk;
+   void      (*DoChunk)(struct _hbstage *stage, HBCHUNK *chunk);
+}  HBSTAGE;
+
+/* Options used for every structure processed                          */
+typedef struct
+{
+   FILE          *pgp;        /* Open PGP file                          */
+   unsigned long pgpHash;     /* Hash of its contents (used in cache 
+                                 filenames)                             */
+   char          *cachedir;   /* Cache directory (or blank)             */
+   REAL          minNBDistSq,
+                 maxNBDistSq,
+                 maxHBDistSq;
+   int           nThreads;    /* Threads for each structure's searches  */
+}  HBOPTIONS;
+
+/* A list of files processed by a pool of threads (-l)                  */
+typedef struct
+{
+   HBOPTIONS *options;
+   FILE      *out,            /* Tagged output (if no outdir)           */
+             **results;       /* Results of each file waiting to be 
+                                 copied to the tagged output            */
+   char      **filenames,
+             *outdir;         /* Directory for one output per file      */
+   BOOL      *done,           /* Each file has been processed           */
+             *duplicate;      /* Output would overwrite an earlier 
+                                 file's (or NULL)                       */
+   int       nFiles,
+             maxFiles,
+             nextFile,        /* Next file to be taken by a thread      */
+             nextOutput,      /* Next file to be copied to out          */
+             nFailed;
+}  BATCH;
+
+/* A file's output name and list position, for finding duplicates       */
+typedef struct
+{
+   char      *name;
+   int       index;
+}  BATCHNAME;
+
+/* Header of a structure cache file                                     */
+typedef struct
+{
+   char          magic[MAXCACHESTRING+1];
+   int           version,
+                 atomSize,    /* sizeof(CACHEATOM) when written         */
+                 natoms,
+                 nConects;    /* Total CONECTs over all atoms           */
+   long          nBytes;      /* Size of the PDB file that was cached   */
+   unsigned long pgpHash;     /* Hash of the PGP file used              */
+}  CACHEHEADER;
+
+/* An atom in a structure cache file. This is followed in the file by
+   the CONECTs of all atoms given as indexes into the atom list
+*/
+typedef struct
+{
+   REAL x, y, z,
+        occ, bval;
+   int  atnum,
+        resnum,
+        atomtype,
+        nConect,
+        origAtnum,
+        molid;
+   char record_type[MAXCACHESTRING],
+        atnam[MAXCACHESTRING],
+        atnam_raw[MAXCACHESTRING],
+        resnam[MAXCACHESTRING],
+        insert[MAXCACHESTRING],
+        chain[MAXCACHESTRING],
+        element[MAXCACHESTRING],
+        altpos;
+}  CACHEATOM;
+
+/* Arguments and result for the protein-protein thread in main()        */
+typedef struct
+{
+   PDB    *pdb;
+   HBLIST *hblist;
+   REAL   maxHBDistSq;
+   int    nThreads;
+}  PPTASK;
 
 
 /************************************************************************/
 /* Globals
 */
+static pthread_mutex_t sStageMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* BiopLib's PDB reading and hydrogen addition use static data, so only
+   one structure is prepared at a time
+*/
+static pthread_mutex_t sPrepareMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hands out files in batch mode and serializes writing their output    */
+static pthread_mutex_t sBatchMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static HBONDING sHBonding[] = 
 {
    /* Elements capable of true hydrogen bonds                           */
@@ -276,13 +523,47 @@ int main(int argc, char **argv);
 void Usage(void);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                   char *pgpfile, REAL *minNBDistSq, REAL *maxNBDistSq, 
-                  REAL *maxHBDistSq);
-HBLIST *FindProtProtHBonds(PDB *pdb);
+                  REAL *maxHBDistSq, int *nThreads, char *cachedir,
+                  BOOL *fileList, char *outdir);
+BOOL ProcessStructure(FILE *in, FILE *out, HBOPTIONS *options);
+BOOL DoBatch(char *listname, FILE *out, char *outdir, 
+             HBOPTIONS *options, int nThreads);
+BOOL ReadFileList(BATCH *batch, char *listname);
+BOOL ReadFileDirectory(BATCH *batch, char *dirname);
+BOOL AddBatchFile(BATCH *batch, char *filename);
+int CompareStrings(const void *a, const void *b);
+BOOL MarkDuplicateOutputs(BATCH *batch);
+int CompareBatchNames(const void *a, const void *b);
+void *ProcessBatchFiles(void *arg);
+BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                             char *filename, char *ext);
+void WriteCompletedOutput(BATCH *batch);
+void WriteTaggedOutput(FILE *out, char *filename, FILE *fp);
+PDB *PrepareStructure(FILE *in, FILE *pgp, ARENA *extrasArena);
+char *ReadInputFile(FILE *in, long *nBytes);
+void MakeCacheFilename(char *cachefile, char *cachedir, char *buffer,
+                       long nBytes, unsigned long pgpHash);
+BOOL HashFile(FILE *fp, unsigned long *hash);
+BOOL WriteStructureCache(char *cachefile, PDB *pdb, long nBytes,
+                         unsigned long pgpHash);
+PDB *ReadStructureCache(char *cachefile, long nBytes, 
+                        unsigned long pgpHash, ARENA *extrasArena);
+void CopyCacheString(char *out, char *in, int outSize);
+HBLIST *FindProtProtHBonds(PDB *pdb, REAL maxHBDistSq, int nThreads);
+void ProtProtChunk(HBSTAGE *stage, HBCHUNK *chunk);
+void *ProtProtTask(void *arg);
 HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray,
-                             BOOL pseudo, REAL maxHBDistSq);
+                             BOOL pseudo, REAL maxHBDistSq,
+                             int nThreads);
+void ProtLigandChunk(HBSTAGE *stage, HBCHUNK *chunk);
 HBLIST *FindLigandLigandHBonds(PDB *pdb, 
                                PDB **pdbarray, BOOL pseudo,
-                               REAL maxHBDistSq);
+                               REAL maxHBDistSq, int nThreads);
+void LigandLigandChunk(HBSTAGE *stage, HBCHUNK *chunk);
+BOOL RunStage(HBSTAGE *stage, int nItems, int nThreads);
+void *StageWorker(void *arg);
+HBLIST *JoinChunks(HBSTAGE *stage);
+HBLIST *MergeChunksUnique(HBSTAGE *stage);
 void PrintHBList(FILE *out, HBLIST *hblist, char *type, BOOL relaxed);
 HBLIST *TestForHBond(PDB *pdb, PDB *p, PDB *q, PDB **pdbarray,
                      BOOL pseudo, REAL maxHBDistSq);
@@ -290,14 +571,39 @@ int IsDonor(PDB *p, BOOL allowPseudo, BOOL *pseudo);
 int IsAcceptor(PDB *p, BOOL allowPseudo, BOOL *pseudo);
 PDB *FindAntecedent(PDB *atom, PDB **pdbarray, int *count, int nth);
 PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor);
+void SelectHydrogen(PDB *p, PDB *acceptor, PDB **hydrogen,
+                    REAL *bestDistSq);
 HBLIST *doTestForHBond(PDB *pdb, PDB *donor, PDB *acceptor, 
                        PDB **pdbarray, int donMax, REAL maxHBDistSq);
 HBLIST *FindNonBonds(PDB *pdb, PDB **pdbarray,
-                     HBLIST *hbonds, REAL minNBDistSq, REAL maxNBDistSq);
+                     HBLIST *hbonds, REAL minNBDistSq, REAL maxNBDistSq,
+                     ARENA *nbArena, int nThreads);
+void NonBondChunk(HBSTAGE *stage, HBCHUNK *chunk);
 BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds);
+ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cutoff);
+void FreeAtomGrid(ATOMGRID *grid);
+int FindNearbyAtoms(ATOMGRID *grid, PDB *p, int *nearby);
+int CompareInts(const void *a, const void *b);
+HASHTABLE *BuildPeptideChainHash(PDB *pdb);
+HASHTABLE *BuildHBondHash(HBLIST *hbonds);
+BOOL AddHBondToHash(HASHTABLE *hash, HBLIST *h);
+void MakeHBondKey(char *key, PDB *p, PDB *q);
+BOOL IsHashedAsHBonded(HASHTABLE *hbondHash, PDB *p, PDB *q);
+RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff);
+void FreeResidueGrid(RESGRID *grid);
+int FindLaterNearbyResidues(RESGRID *grid, int centre, int *nearby);
 BOOL isAPeptide(PDB *pdb, PDB *atm);
 void SetAtomNumExtras(PDB *pdb);
-BOOL UpdatePDBExtras(PDB *pdb);
+BOOL UpdatePDBExtras(PDB *pdb, ARENA *extrasArena);
+void InitArena(ARENA *arena, size_t itemSize, int itemsPerBlock);
+APTR AllocFromArena(ARENA *arena);
+void AppendArena(ARENA *arena, ARENA *from);
+void FreeArena(ARENA *arena);
+void ClearPDBExtras(PDBEXTRAS *extras);
+RESHYD *BuildHydrogenIndex(PDB *pdb, PDB **pdbarray);
+void FreeHydrogenIndex(PDB *pdb, RESHYD *resHydList);
+void MakeResidueKey(char *key, char type, PDB *p);
+RESHYD *IndexResidueHydrogens(PDB *start);
 BOOL SetMolecules(PDB *pdb);
 void MarkLinkedResidues(PDB *chainStart, PDB *resStart, 
                         PDB *nextChain, int id);
@@ -316,237 +622,969 @@ void DeleteMetalConects(PDB *pdb);
 -  16.06.99 Added min and max NB/HB distances as variables
 -  22.07.15 Modified to use PDB files and standard BiopLib structures
             and functions
+-  16.10.26 Added -j. All HBond lists are found before any are printed
+            so that protein-protein HBonds can be found in a separate
+            thread
+-  16.10.26 Added -c. Preparation of the structure moved to 
+            PrepareStructure()
+-  16.10.26 Calls BuildHydrogenIndex()
+-  16.10.26 PDB extras and non-bonds are allocated from arenas
+-  16.10.26 Added -l and -o. Processing of a structure moved to
+            ProcessStructure(). The PGP file is opened here
+-  16.10.26 The PGP file is hashed for -c
 */
 int main(int argc, char **argv)
 {
    FILE       *in = stdin, 
-              *out = stdout,
-              *pgp;
-   PDB        *pdb,
-              **pdbarray;
-   int        nhyd,
-              indexSize;
+              *out = stdout;
    char       infile[MAXBUFF],
               outfile[MAXBUFF],
-              pgpfile[MAXBUFF];
+              pgpfile[MAXBUFF],
+              cachedir[MAXBUFF],
+              outdir[MAXBUFF];
+   HBOPTIONS  options;
+   BOOL       fileList    = FALSE;
+   int        nThreads    = 1,
+              retval      = 0;
+
+   options.minNBDistSq = MINNBDISTSQ;
+   options.maxNBDistSq = MAXNBDISTSQ;
+   options.maxHBDistSq = MAXHBONDDISTSQ;
+   
+   if(ParseCmdLine(argc, argv, infile, outfile, pgpfile, 
+                   &options.minNBDistSq, &options.maxNBDistSq, 
+                   &options.maxHBDistSq, &nThreads, cachedir,
+                   &fileList, outdir))
+   {
+      /* Open the PGP file once. blHAddPDB() still re-reads it for each 
+         structure, so only the file handle is shared
+      */
+      if((options.pgp = blOpenPGPFile(pgpfile, FALSE))==NULL)
+      {
+         fprintf(stderr,"pdbhbond: (error) Unable to open PGP file\n");
+         return(1);
+      }
+      /* The PGP contents go into the cache filenames so a changed PGP
+         file is not matched with structures cached using the old one
+      */
+      if(cachedir[0] && !HashFile(options.pgp, &options.pgpHash))
+      {
+         fprintf(stderr,"pdbhbond: (error) Unable to read PGP file\n");
+         return(1);
+      }
+      options.cachedir = cachedir;
+      options.nThreads = nThreads;
+      blSetMaxProteinHBondDADistance((REAL)sqrt(options.maxHBDistSq));
+
+      if(fileList)
+      {
+         /* The list of files is read by DoBatch()                      */
+         if(blOpenStdFiles("", outfile, &in, &out))
+         {
+            if(!DoBatch(infile, out, outdir, &options, nThreads))
+               retval = 1;
+         }
+      }
+      else if(blOpenStdFiles(infile, outfile, &in, &out))
+      {
+         if(!ProcessStructure(in, out, &options))
+            retval = 1;
+      }
+
+      fclose(options.pgp);
+   }
+   else
+   {
+      Usage();
+   }
+
+   return(retval);
+}
+
+
+/************************************************************************/
+/*>BOOL ProcessStructure(FILE *in, FILE *out, HBOPTIONS *options)
+   --------------------------------------------------------------
+*//**
+   \param[in]    *in        Input PDB file
+   \param[in]    *out       Output file
+   \param[in]    *options   Distances, PGP file, cache directory and
+                            number of threads
+   \return                  Success. Errors are reported here
+
+   Prepares (or reads from the cache) a structure, finds its HBonds and
+   non-bonds and prints them. Everything allocated is freed.
+
+-  16.10.26 Original   By: ACRM (from main())
+-  16.10.26 Threads are split between the protein-protein and ligand
+            searches when they run together
+*/
+BOOL ProcessStructure(FILE *in, FILE *out, HBOPTIONS *options)
+{
+   FILE       *tmp        = NULL;
+   PDB        *pdb        = NULL,
+              **pdbarray;
+   int        indexSize,
+              nThreads    = options->nThreads,
+              ligThreads  = nThreads;
+   long       nBytes      = 0;
+   char       cachefile[MAXCACHEFILE],
+              *buffer;
    HBLIST     *ppHBonds = NULL,
               *plHBonds = NULL,
               *llHBonds = NULL,
               *pplHBonds = NULL,
               *nbContacts = NULL,
               *hb;
-   WHOLEPDB   *wpdb = NULL;
-   REAL       minNBDistSq = MINNBDISTSQ,
-              maxNBDistSq = MAXNBDISTSQ,
-              maxHBDistSq = MAXHBONDDISTSQ;
-   STRINGLIST *warnings = NULL;
-   
-   if(ParseCmdLine(argc, argv, infile, outfile, pgpfile, &minNBDistSq, 
-                   &maxNBDistSq, &maxHBDistSq))
+   PPTASK     ppTask;
+   RESHYD     *resHydList;
+   ARENA      extrasArena,
+              nbArena;
+   pthread_t  ppThread;
+   BOOL       ppRunning   = FALSE;
+
+   InitArena(&extrasArena, sizeof(PDBEXTRAS), ARENABLOCKITEMS);
+   InitArena(&nbArena,     sizeof(HBLIST),    ARENABLOCKITEMS);
+
+   /* With -c, look for a cached copy of the prepared structure under a
+      name made from the file contents
+   */
+   if(options->cachedir[0])
    {
-      if(blOpenStdFiles(infile, outfile, &in, &out))
+      if((buffer = ReadInputFile(in, &nBytes))==NULL)
       {
-         /* Open the PGP file                                           */
-         if((pgp = blOpenPGPFile(pgpfile, FALSE))==NULL)
-         {
-            fprintf(stderr,"pdbhbond: (error) Unable to open PGP file\n");
-            return(1);
-         }
-            
-         if((wpdb = blReadWholePDB(in))==NULL)
-         {
-            fprintf(stderr,"pdbhbond: (error) Unable to PDB file\n");
-            return(1);
-         }
-
-         if((pdb = wpdb->pdb)==NULL)
-         {
-            fprintf(stderr,"pdbhbond: (error) No atoms read from PDB \
+         fprintf(stderr,"pdbhbond: (error) Unable to read input \
 file\n");
-            return(1);
-         }
+         return(FALSE);
+      }
+      MakeCacheFilename(cachefile, options->cachedir, buffer, nBytes, 
+                        options->pgpHash);
+      pdb = ReadStructureCache(cachefile, nBytes, options->pgpHash,
+                               &extrasArena);
 
-         /* Store the original atom numbers in the extras field         */
-         if(!UpdatePDBExtras(pdb))
+      /* If it wasn't cached we read the PDB data from a temporary copy
+         of what we have just read
+      */
+      if(pdb == NULL)
+      {
+         if(((tmp = tmpfile())==NULL) ||
+            (fwrite(buffer, 1, nBytes, tmp) != (size_t)nBytes))
          {
-            fprintf(stderr,"pdbhbond: (error) No memory for extra PDB \
-data\n");
-            return(1);
+            fprintf(stderr,"pdbhbond: (error) Unable to create \
+temporary file\n");
+            if(tmp != NULL)
+               fclose(tmp);
+            free(buffer);
+            return(FALSE);
          }
-         
-         SetAtomNumExtras(pdb);
+         rewind(tmp);
+         in = tmp;
+      }
+      free(buffer);
+   }
 
-         /* Add hydrogens to the protein                                */
-         if((nhyd = blHAddPDB(pgp, pdb))==0)
-         {
-            fprintf(stderr,"pdbhbond: (warning) No hydrogens added to \
-PDB file\n");
-         }
+   if(pdb == NULL)
+   {
+      pthread_mutex_lock(&sPrepareMutex);
+      pdb = PrepareStructure(in, options->pgp, &extrasArena);
+      pthread_mutex_unlock(&sPrepareMutex);
 
-         /* Create extras fields for the extra hydrogen atoms           */
-         if(!UpdatePDBExtras(pdb))
-         {
-            fprintf(stderr,"pdbhbond: (error) No memory for extra PDB \
-data\n");
-            return(1);
-         }
+      if(tmp != NULL)
+         fclose(tmp);
 
-         if((warnings = blSetPDBAtomTypes(pdb))!=NULL)
-         {
-            STRINGLIST *s;
-            for(s=warnings; s!=NULL; NEXT(s))
-            {
-               fprintf(stderr,"%s\n", s->string);
-            }
-         }
-         
-         SetMolecules(pdb);
+      if(pdb == NULL)
+      {
+         FreeArena(&extrasArena);
+         return(FALSE);
+      }
 
-         if((pdbarray=blIndexAtomNumbersPDB(pdb, &indexSize))==NULL)
-         {
-            fprintf(stderr,"pdbhbond: (error) Failed to index PDB \
-data\n");
-            return(1);
-         }
+      if(options->cachedir[0] && 
+         !WriteStructureCache(cachefile, pdb, nBytes, options->pgpHash))
+      {
+         fprintf(stderr,"pdbhbond: (warning) Unable to write cache \
+file %s\n", cachefile);
+      }
+   }
 
-         DeleteMetalConects(pdb);
-            
-         /* Find protein-protein HBonds                                 */
-         blSetMaxProteinHBondDADistance((REAL)sqrt(maxHBDistSq));
-         ppHBonds = FindProtProtHBonds(pdb);
-         PrintHBList(out, ppHBonds, "pphbonds", FALSE);
-         FREELIST(ppHBonds, HBLIST);
-
-         /* Find protein-ligand HBonds                                  */
-         plHBonds = FindProtLigandHBonds(pdb, pdbarray, FALSE,
-                                         maxHBDistSq);
-         PrintHBList(out, plHBonds, "plhbonds", TRUE);
-
-         /* Find protein-ligand pseudo-HBonds                           */
-         pplHBonds = FindProtLigandHBonds(pdb, pdbarray, TRUE,
-                                          maxHBDistSq);
-         PrintHBList(out, pplHBonds, "pseudohbonds", FALSE);
-
-         /* Join the pseudo-HBonds list onto the protein-ligand list    */
-         hb = plHBonds;
-         if(hb != NULL)
-         {
-            LAST(hb);
-            hb->next = pplHBonds;
-         }
-         else
-         {
-            plHBonds = hb = pplHBonds;
-         }
+   if((pdbarray=blIndexAtomNumbersPDB(pdb, &indexSize))==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) Failed to index PDB data\n");
+      FreeArena(&extrasArena);
+      FREELIST(pdb, PDB);
+      return(FALSE);
+   }
 
-         /* Find ligand-ligand HBonds                                   */
-         llHBonds = FindLigandLigandHBonds(pdb, pdbarray, FALSE,
-                                           maxHBDistSq);
-         PrintHBList(out, llHBonds, "llhbonds", TRUE);
+   /* Index hydrogens and antecedents for the HBond tests               */
+   if((resHydList = BuildHydrogenIndex(pdb, pdbarray))==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory to index \
+hydrogens\n");
+      free(pdbarray);
+      FreeArena(&extrasArena);
+      FREELIST(pdb, PDB);
+      return(FALSE);
+   }
 
-         /* Join the ligand-ligand HBonds list onto the previous lists  */
-         if(hb!=NULL)
-         {
-            LAST(hb);
-            hb->next = llHBonds;
-         }
-         else
-         {
-            plHBonds = hb = llHBonds;
-         }
+   /* Find protein-protein HBonds. With more than one thread this
+      runs alongside the ligand searches and the threads are shared
+      between them so no more than nThreads are working at once
+   */
+   ppTask.pdb         = pdb;
+   ppTask.hblist      = NULL;
+   ppTask.maxHBDistSq = options->maxHBDistSq;
+   ppTask.nThreads    = nThreads - (nThreads / 2);
+   if((nThreads > 1) &&
+      !pthread_create(&ppThread, NULL, ProtProtTask, 
+                      (void *)&ppTask))
+   {
+      ppRunning  = TRUE;
+      ligThreads = nThreads / 2;
+   }
+   else
+   {
+      ppTask.nThreads = nThreads;
+      ProtProtTask((void *)&ppTask);
+   }
 
-         /* Find non-bonded contacts                                    */
-         nbContacts = FindNonBonds(pdb, pdbarray, plHBonds,
-                                   minNBDistSq, maxNBDistSq);
-         PrintHBList(out, nbContacts, "nonbonds", FALSE);
+   /* Find protein-ligand HBonds                                        */
+   plHBonds = FindProtLigandHBonds(pdb, pdbarray, FALSE,
+                                   options->maxHBDistSq, ligThreads);
 
-         FREEPDBEXTRAS(pdb);
-         FREELIST(pdb, PDB);
-      }
+   /* Find protein-ligand pseudo-HBonds                                 */
+   pplHBonds = FindProtLigandHBonds(pdb, pdbarray, TRUE,
+                                    options->maxHBDistSq, ligThreads);
+
+   /* Find ligand-ligand HBonds                                         */
+   llHBonds = FindLigandLigandHBonds(pdb, pdbarray, FALSE,
+                                     options->maxHBDistSq, ligThreads);
+
+   if(ppRunning)
+      pthread_join(ppThread, NULL);
+   ppHBonds = ppTask.hblist;
+
+   PrintHBList(out, ppHBonds, "pphbonds", FALSE);
+   FREELIST(ppHBonds, HBLIST);
+   PrintHBList(out, plHBonds, "plhbonds", TRUE);
+   PrintHBList(out, pplHBonds, "pseudohbonds", FALSE);
+   PrintHBList(out, llHBonds, "llhbonds", TRUE);
+
+   /* Join the pseudo-HBonds list onto the protein-ligand list          */
+   hb = plHBonds;
+   if(hb != NULL)
+   {
+      LAST(hb);
+      hb->next = pplHBonds;
    }
    else
    {
-      Usage();
+      plHBonds = hb = pplHBonds;
    }
-   
-   
-   return(0);
+
+   /* Join the ligand-ligand HBonds list onto the previous lists        */
+   if(hb!=NULL)
+   {
+      LAST(hb);
+      hb->next = llHBonds;
+   }
+   else
+   {
+      plHBonds = hb = llHBonds;
+   }
+
+   /* Find non-bonded contacts. This needs all the HBonds so must
+      wait for the other searches
+   */
+   nbContacts = FindNonBonds(pdb, pdbarray, plHBonds,
+                             options->minNBDistSq, options->maxNBDistSq,
+                             &nbArena, nThreads);
+   PrintHBList(out, nbContacts, "nonbonds", FALSE);
+   FreeArena(&nbArena);
+
+   /* This also frees the pseudo-HBonds and ligand-ligand HBonds        */
+   FREELIST(plHBonds, HBLIST);
+
+   FreeHydrogenIndex(pdb, resHydList);
+   free(pdbarray);
+   FreeArena(&extrasArena);
+   FREELIST(pdb, PDB);
+
+   return(TRUE);
 }
 
+
 /************************************************************************/
-/*>void Usage(void)
-   ----------------
+/*>BOOL DoBatch(char *listname, FILE *out, char *outdir, 
+                HBOPTIONS *options, int nThreads)
+   ------------------------------------------------------
 *//**
-   Prints a usage message
+   \param[in]    *listname  File containing a list of PDB files, a
+                            directory of PDB files or blank for a list
+                            on stdin
+   \param[in]    *out       Output file for tagged results
+   \param[in]    *outdir    Directory for one output file per PDB file
+                            (or blank to use out)
+   \param[in]    *options   Options used for every structure
+   \param[in]    nThreads   Number of files to process at once
+   \return                  Success (FALSE if the list could not be read,
+                            no memory or any file could not be 
+                            processed)
+
+   Processes a batch of files using a pool of threads. The open PGP file
+   handle is shared (it is re-read for each structure) and each 
+   structure's searches run in a single thread. Files that fail are 
+   reported and skipped. Tagged output is written in list order.
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Tagged output is in list order rather than completion order
+-  16.10.26 Returns FALSE if any file failed
+-  16.10.26 Files whose output would overwrite another's are skipped
+*/
+BOOL DoBatch(char *listname, FILE *out, char *outdir, 
+             HBOPTIONS *options, int nThreads)
+{
+   BATCH     batch;
+   HBOPTIONS fileOptions;
+   pthread_t threads[MAXTHREADS];
+   int       nStarted = 0,
+             i;
+   BOOL      retval;
+
+   fileOptions          = *options;
+   fileOptions.nThreads = 1;
+
+   batch.options   = &fileOptions;
+   batch.out       = out;
+   batch.outdir    = outdir;
+   batch.filenames  = NULL;
+   batch.results    = NULL;
+   batch.done       = NULL;
+   batch.duplicate  = NULL;
+   batch.nFiles     = 0;
+   batch.maxFiles   = 0;
+   batch.nextFile   = 0;
+   batch.nextOutput = 0;
+   batch.nFailed    = 0;
+
+   /* Files with the same name would write the same output file         */
+   if((retval = ReadFileList(&batch, listname)) && outdir[0])
+      retval = MarkDuplicateOutputs(&batch);
+
+   if(retval && !outdir[0] && batch.nFiles)
+   {
+      if(((batch.results = (FILE **)calloc(batch.nFiles, 
+                                           sizeof(FILE *)))==NULL) ||
+         ((batch.done = (BOOL *)calloc(batch.nFiles, 
+                                       sizeof(BOOL)))==NULL))
+      {
+         fprintf(stderr,"pdbhbond: (error) No memory for file list\n");
+         retval = FALSE;
+      }
+   }
 
--  07.06.99 Original   By: ACRM
--  09.06.99 Added -q
--  16.06.99 Added -n, -x, -b
--  22.07.15 V2.0. Added -p
+   if(retval)
+   {
+      /* Start the pool. If a thread can't be created the files are
+         simply shared by those that were
+      */
+      nThreads = MIN(nThreads, batch.nFiles);
+      for(i=1; i<nThreads; i++)
+      {
+         if(pthread_create(&(threads[nStarted]), NULL, ProcessBatchFiles,
+                           (void *)&batch))
+            break;
+         nStarted++;
+      }
+      ProcessBatchFiles((void *)&batch);
+      for(i=0; i<nStarted; i++)
+         pthread_join(threads[i], NULL);
 
+      if(batch.nFailed)
+      {
+         fprintf(stderr,"pdbhbond: (warning) %d of %d files could not \
+be processed\n", batch.nFailed, batch.nFiles);
+         retval = FALSE;
+      }
+   }
+
+   for(i=0; i<batch.nFiles; i++)
+      free(batch.filenames[i]);
+   if(batch.filenames != NULL)
+      free(batch.filenames);
+   if(batch.results != NULL)
+      free(batch.results);
+   if(batch.done != NULL)
+      free(batch.done);
+   if(batch.duplicate != NULL)
+      free(batch.duplicate);
+
+   return(retval);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadFileList(BATCH *batch, char *listname)
+   -----------------------------------------------
+*//**
+   \param[in,out] *batch     Batch to which files are added
+   \param[in]     *listname  File containing a list of PDB files, a
+                             directory or blank to read a list from
+                             stdin
+   \return                   Success. Errors are reported here
+
+-  16.10.26 Original   By: ACRM
 */
-void Usage(void)
+BOOL ReadFileList(BATCH *batch, char *listname)
 {
-   fprintf(stderr,"\npdbhbond V2.0 (c) 2015, Dr. Andrew C.R. Martin, \
-UCL\n");
-   fprintf(stderr,"Usage: pdbhbond [-n dist][-x dist][-b dist]\
-[-p pgpfile] [infile [outfile]]\n");
-   fprintf(stderr,"       -n  Minimum NBond distance (Default: %.2f)\n",
-           sqrt(MINNBDISTSQ));
-   fprintf(stderr,"       -x  Maximum NBond distance (Default: %.2f)\n",
-           sqrt(MAXNBDISTSQ));
-   fprintf(stderr,"       -b  Maximum HBond distance (Default: %.2f)\n",
-           sqrt(MAXHBONDDISTSQ));
-   fprintf(stderr,"       -p  Specify PGP file containing data for \
-adding hydrogens\n");
-   fprintf(stderr,"\nIdentifies hydrogen bonds using simple Baker and \
-Hubbard rules for\n");
-   fprintf(stderr,"the definition of a hydrogen bond.\n");
-   fprintf(stderr,"I/O is to standard input/output if filenames are not \
-specified.\n\n");
+   FILE        *fp = stdin;
+   char        buffer[MAXBUFF];
+   struct stat statBuff;
+   BOOL        ok  = TRUE;
+
+   if(listname[0])
+   {
+      if(!stat(listname, &statBuff) && S_ISDIR(statBuff.st_mode))
+         return(ReadFileDirectory(batch, listname));
+
+      if((fp = fopen(listname, "r"))==NULL)
+      {
+         fprintf(stderr,"pdbhbond: (error) Unable to read file list \
+%s\n", listname);
+         return(FALSE);
+      }
+   }
+
+   while(fgets(buffer, MAXBUFF, fp))
+   {
+      TERMINATE(buffer);
+      if(!buffer[0])
+         continue;
+
+      if(!AddBatchFile(batch, buffer))
+      {
+         ok = FALSE;
+         break;
+      }
+   }
+
+   if(fp != stdin)
+      fclose(fp);
+
+   return(ok);
 }
 
+
 /************************************************************************/
-/*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                     char *pgpfile, REAL *minNBDistSq, REAL *maxNBDistSq,
-                     REAL *maxHBDistSq)
-   ---------------------------------------------------------------------
+/*>BOOL ReadFileDirectory(BATCH *batch, char *dirname)
+   ---------------------------------------------------
 *//**
-   \param[in]    argc          Argument count
-   \param[in]    **argv        Argument array
-   \param[out]   *infile       Input filename (or blank string)
-   \param[out]   *outfile      Output filename (or blank string)
-   \param[out]   *pgpfile     PGP filename
-   \param[out]   *minNBDistSq  Min non-bond distance
-   \param[out]   *maxNBDistSq  Max non-bond distance
-   \param[out]   *maxHBDistSq  Max HBond distance
-   \return                     Success
+   \param[in,out] *batch     Batch to which files are added
+   \param[in]     *dirname   Directory
+   \return                   Success. Errors are reported here
 
-   Parse the command line
+   Adds the regular files in a directory (other than those starting 
+   with a .) to the batch in alphabetical order
 
--  07.06.99 Original    By: ACRM
--  09.06.99 Added -q
--  16.06.99 Added -n, -x, -b and associated parameters
--  21.07.15 Removed -q
--  22.07.15 Added -p and pgpfile
+-  16.10.26 Original   By: ACRM
 */
-BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
-                  char *pgpfile, REAL *minNBDistSq, REAL *maxNBDistSq,
-                  REAL *maxHBDistSq)
+BOOL ReadFileDirectory(BATCH *batch, char *dirname)
 {
-   argc--;
-   argv++;
-   
-   infile[0] = outfile[0] = pgpfile[0] = '\0';
-   
-   while(argc)
+   DIR           *dir;
+   struct dirent *entry;
+   struct stat   statBuff;
+   char          *filename;
+   BOOL          ok = TRUE;
+
+   if((dir = opendir(dirname))==NULL)
    {
-      if(argv[0][0] == '-')
+      fprintf(stderr,"pdbhbond: (error) Unable to read directory %s\n",
+              dirname);
+      return(FALSE);
+   }
+
+   while((entry = readdir(dir))!=NULL)
+   {
+      if(entry->d_name[0] == '.')
+         continue;
+
+      if((filename = (char *)malloc((strlen(dirname) + 
+                                     strlen(entry->d_name) + 2) *
+                                    sizeof(char)))==NULL)
       {
-         switch(argv[0][1])
-         {
-         case 'h':
-            return(FALSE);
+         fprintf(stderr,"pdbhbond: (error) No memory for file list\n");
+         ok = FALSE;
+         break;
+      }
+      sprintf(filename, "%s/%s", dirname, entry->d_name);
+
+      if(!stat(filename, &statBuff) && S_ISREG(statBuff.st_mode))
+         ok = AddBatchFile(batch, filename);
+      free(filename);
+
+      if(!ok)
+         break;
+   }
+   closedir(dir);
+
+   if(batch->nFiles)
+   {
+      qsort((void *)batch->filenames, batch->nFiles, sizeof(char *),
+            CompareStrings);
+   }
+   
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL AddBatchFile(BATCH *batch, char *filename)
+   -----------------------------------------------
+*//**
+   \param[in,out] *batch     Batch
+   \param[in]     *filename  Filename to add (copied)
+   \return                   Success. Errors are reported here
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL AddBatchFile(BATCH *batch, char *filename)
+{
+   char **filenames;
+   
+   if(batch->nFiles == batch->maxFiles)
+   {
+      batch->maxFiles = (batch->maxFiles ? 2 * batch->maxFiles : MAXBUFF);
+      if((filenames = 
+          (char **)realloc((void *)batch->filenames, 
+                           batch->maxFiles * sizeof(char *)))==NULL)
+      {
+         fprintf(stderr,"pdbhbond: (error) No memory for file list\n");
+         return(FALSE);
+      }
+      batch->filenames = filenames;
+   }
+   
+   if((batch->filenames[batch->nFiles] = 
+       (char *)malloc((strlen(filename)+1) * sizeof(char)))==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for file list\n");
+      return(FALSE);
+   }
+   strcpy(batch->filenames[batch->nFiles++], filename);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int CompareStrings(const void *a, const void *b)
+   ------------------------------------------------
+*//**
+   \param[in]    *a     Pointer to a string pointer
+   \param[in]    *b     Pointer to a string pointer
+   \return              strcmp() of the strings
+
+   qsort() comparison function for an array of strings
+
+-  16.10.26 Original   By: ACRM
+*/
+int CompareStrings(const void *a, const void *b)
+{
+   return(strcmp(*(char **)a, *(char **)b));
+}
+
+
+/************************************************************************/
+/*>BOOL MarkDuplicateOutputs(BATCH *batch)
+   ---------------------------------------
+*//**
+   \param[in,out] *batch     Batch
+   \return                   Success (FALSE if no memory)
+
+   Output files are named from the input filename without its path, so
+   files with the same name in different directories would write the
+   same output file. Sets batch->duplicate for every file whose name
+   has already appeared earlier in the list.
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL MarkDuplicateOutputs(BATCH *batch)
+{
+   BATCHNAME *names;
+   int       i;
+
+   if(((batch->duplicate = (BOOL *)calloc(MAX(batch->nFiles, 1), 
+                                          sizeof(BOOL)))==NULL) ||
+      ((names = (BATCHNAME *)malloc(MAX(batch->nFiles, 1) * 
+                                    sizeof(BATCHNAME)))==NULL))
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for file list\n");
+      return(FALSE);
+   }
+
+   for(i=0; i<batch->nFiles; i++)
+   {
+      if((names[i].name = strrchr(batch->filenames[i], '/'))!=NULL)
+         names[i].name++;
+      else
+         names[i].name = batch->filenames[i];
+      names[i].index = i;
+   }
+
+   /* Each run of equal names is sorted by list position, so all but the
+      first in each run are duplicates
+   */
+   qsort((void *)names, batch->nFiles, sizeof(BATCHNAME), 
+         CompareBatchNames);
+   for(i=1; i<batch->nFiles; i++)
+   {
+      if(!strcmp(names[i].name, names[i-1].name))
+         batch->duplicate[names[i].index] = TRUE;
+   }
+
+   free(names);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int CompareBatchNames(const void *a, const void *b)
+   ---------------------------------------------------
+*//**
+   \param[in]    *a     Pointer to a BATCHNAME
+   \param[in]    *b     Pointer to a BATCHNAME
+   \return              Comparison of the names, then of the list
+                        positions
+
+   qsort() comparison function for an array of BATCHNAMEs
+
+-  16.10.26 Original   By: ACRM
+*/
+int CompareBatchNames(const void *a, const void *b)
+{
+   BATCHNAME *nameA = (BATCHNAME *)a,
+             *nameB = (BATCHNAME *)b;
+   int       cmp;
+
+   if((cmp = strcmp(nameA->name, nameB->name))!=0)
+      return(cmp);
+   return(nameA->index - nameB->index);
+}
+
+
+/************************************************************************/
+/*>void *ProcessBatchFiles(void *arg)
+   ----------------------------------
+*//**
+   \param[in,out] *arg   Pointer to the BATCH
+
+   Thread entry point. Repeatedly takes the next unprocessed file from
+   the batch and processes it, writing the results to a file in the
+   output directory or to a temporary file that is kept until it can be
+   copied to the tagged output in list order. Files that cannot be 
+   processed, or whose output file would overwrite that of an earlier 
+   file, are reported and skipped.
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Temporary files are kept for WriteCompletedOutput()
+-  16.10.26 Skips duplicate output names
+*/
+void *ProcessBatchFiles(void *arg)
+{
+   BATCH *batch = (BATCH *)arg;
+   FILE  *in,
+         *out;
+   char  outfile[MAXOUTFILE];
+   int   i;
+   BOOL  ok;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&sBatchMutex);
+      i = batch->nextFile++;
+      pthread_mutex_unlock(&sBatchMutex);
+
+      if(i >= batch->nFiles)
+         break;
+
+      ok  = FALSE;
+      out = NULL;
+      
+      if((batch->duplicate != NULL) && batch->duplicate[i])
+      {
+         fprintf(stderr,"pdbhbond: (warning) Skipped file %s as an earlier \
+file has the same name\n", batch->filenames[i]);
+      }
+      else if((in = fopen(batch->filenames[i], "r"))==NULL)
+      {
+         fprintf(stderr,"pdbhbond: (warning) Unable to read file %s\n",
+                 batch->filenames[i]);
+      }
+      else
+      {
+         if(batch->outdir[0])
+         {
+            if(MakeBatchOutputFilename(outfile, batch->outdir, 
+                                       batch->filenames[i], OUTFILEEXT))
+               out = fopen(outfile, "w");
+         }
+         else
+         {
+            out = tmpfile();
+         }
+
+         if(out == NULL)
+         {
+            fprintf(stderr,"pdbhbond: (warning) Unable to create output \
+file for %s\n", batch->filenames[i]);
+         }
+         else if(!(ok = ProcessStructure(in, out, batch->options)))
+         {
+            fprintf(stderr,"pdbhbond: (warning) Skipped file %s\n",
+                    batch->filenames[i]);
+         }
+         fclose(in);
+      }
+
+      pthread_mutex_lock(&sBatchMutex);
+      if(!ok)
+         batch->nFailed++;
+      if(!batch->outdir[0])
+      {
+         if(ok)
+         {
+            batch->results[i] = out;
+            out = NULL;
+         }
+         batch->done[i] = TRUE;
+         WriteCompletedOutput(batch);
+      }
+      pthread_mutex_unlock(&sBatchMutex);
+
+      if(out != NULL)
+      {
+         fclose(out);
+         if(!ok && batch->outdir[0])
+            remove(outfile);
+      }
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                                char *filename, char *ext)
+   -----------------------------------------------------------
+*//**
+   \param[out]   *outfile   Output filename (MAXOUTFILE characters)
+   \param[in]    *outdir    Output directory
+   \param[in]    *filename  Input PDB filename
+   \param[in]    *ext       Extension to add (or blank)
+   \return                  Success (FALSE if the name is too long)
+
+   Makes outdir/name followed by the extension, where name is the input
+   filename without its path
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Added ext. Built with strcat() so the compiler can see that
+            the name fits
+*/
+BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                             char *filename, char *ext)
+{
+   char *name;
+   
+   if((name = strrchr(filename, '/'))!=NULL)
+      name++;
+   else
+      name = filename;
+
+   if((strlen(outdir) + strlen(name) + strlen(ext) + 2) > MAXOUTFILE)
+      return(FALSE);
+
+   strcpy(outfile, outdir);
+   strcat(outfile, "/");
+   strcat(outfile, name);
+   strcat(outfile, ext);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void WriteCompletedOutput(BATCH *batch)
+   ---------------------------------------
+*//**
+   \param[in,out] *batch     Batch
+
+   Copies the results of files to the tagged output for as long as the
+   next file in the list has been processed. The temporary files are 
+   closed. Must be called with sBatchMutex locked.
+
+-  16.10.26 Original   By: ACRM
+*/
+void WriteCompletedOutput(BATCH *batch)
+{
+   FILE *fp;
+   
+   while((batch->nextOutput < batch->nFiles) && 
+         batch->done[batch->nextOutput])
+   {
+      if((fp = batch->results[batch->nextOutput])!=NULL)
+      {
+         WriteTaggedOutput(batch->out, 
+                           batch->filenames[batch->nextOutput], fp);
+         fclose(fp);
+         batch->results[batch->nextOutput] = NULL;
+      }
+      batch->nextOutput++;
+   }
+}
+
+
+/************************************************************************/
+/*>void WriteTaggedOutput(FILE *out, char *filename, FILE *fp)
+   -----------------------------------------------------------
+*//**
+   \param[in]    *out       Tagged output file
+   \param[in]    *filename  PDB filename
+   \param[in]    *fp        Temporary file containing the results
+
+   Writes a 'FILE:' line followed by the results for a file
+
+-  16.10.26 Original   By: ACRM
+*/
+void WriteTaggedOutput(FILE *out, char *filename, FILE *fp)
+{
+   char   buffer[COPYBUFF];
+   size_t nBytes;
+
+   fprintf(out, "FILE: %s\n", filename);
+   
+   rewind(fp);
+   while((nBytes = fread(buffer, 1, COPYBUFF, fp)) > 0)
+      fwrite(buffer, 1, nBytes, out);
+}
+
+
+/************************************************************************/
+/*>void Usage(void)
+   ----------------
+*//**
+   Prints a usage message
+
+-  07.06.99 Original   By: ACRM
+-  09.06.99 Added -q
+-  16.06.99 Added -n, -x, -b
+-  22.07.15 V2.0. Added -p
+-  16.10.26 V2.2
+-  16.10.26 V2.3
+-  16.10.26 V2.4 Added -j
+-  16.10.26 V2.5 Added -c
+-  16.10.26 V2.6
+-  16.10.26 V2.7
+-  16.10.26 V2.8 Added -l and -o
+
+*/
+void Usage(void)
+{
+   fprintf(stderr,"\npdbhbond V2.8 (c) 2015-2026, Dr. Andrew C.R. Martin, \
+UCL\n");
+   fprintf(stderr,"Usage: pdbhbond [-n dist][-x dist][-b dist]\
+[-p pgpfile][-j nthreads]\n");
+   fprintf(stderr,"                [-c cachedir] [infile [outfile]]\n");
+   fprintf(stderr,"       pdbhbond -l [-o outdir][-n dist][-x dist]\
+[-b dist][-p pgpfile]\n");
+   fprintf(stderr,"                [-j nthreads][-c cachedir] \
+[filelist|directory [outfile]]\n");
+   fprintf(stderr,"       -n  Minimum NBond distance (Default: %.2f)\n",
+           sqrt(MINNBDISTSQ));
+   fprintf(stderr,"       -x  Maximum NBond distance (Default: %.2f)\n",
+           sqrt(MAXNBDISTSQ));
+   fprintf(stderr,"       -b  Maximum HBond distance (Default: %.2f)\n",
+           sqrt(MAXHBONDDISTSQ));
+   fprintf(stderr,"       -p  Specify PGP file containing data for \
+adding hydrogens\n");
+   fprintf(stderr,"       -j  Number of threads to use for the searches \
+(Default: 1)\n");
+   fprintf(stderr,"       -c  Directory in which to cache structures \
+after adding hydrogens\n");
+   fprintf(stderr,"           and assigning atom types. Repeat runs on \
+the same file will\n");
+   fprintf(stderr,"           use the cached copy\n");
+   fprintf(stderr,"       -l  Input is a file containing a list of PDB \
+files, or a directory\n");
+   fprintf(stderr,"           of PDB files. -j then gives the number of \
+files processed at\n");
+   fprintf(stderr,"           once\n");
+   fprintf(stderr,"       -o  With -l, write the results for each file \
+to outdir/file%s\n", OUTFILEEXT);
+   fprintf(stderr,"           A file with the same name as an earlier \
+file is skipped\n");
+   fprintf(stderr,"\nIdentifies hydrogen bonds using simple Baker and \
+Hubbard rules for\n");
+   fprintf(stderr,"the definition of a hydrogen bond.\n");
+   fprintf(stderr,"I/O is to standard input/output if filenames are not \
+specified.\n");
+   fprintf(stderr,"\nWith -l (and no -o), the results for each file are \
+preceded by a line\n");
+   fprintf(stderr,"'FILE: filename'. Files are given in the order they \
+are listed.\n");
+   fprintf(stderr,"Files that cannot be processed are reported and \
+skipped, and the exit\n");
+   fprintf(stderr,"status is then non-zero.\n\n");
+}
+
+/************************************************************************/
+/*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
+                     char *pgpfile, REAL *minNBDistSq, REAL *maxNBDistSq,
+                     REAL *maxHBDistSq, int *nThreads, char *cachedir,
+                     BOOL *fileList, char *outdir)
+   ---------------------------------------------------------------------
+*//**
+   \param[in]    argc          Argument count
+   \param[in]    **argv        Argument array
+   \param[out]   *infile       Input filename (or blank string)
+   \param[out]   *outfile      Output filename (or blank string)
+   \param[out]   *pgpfile     PGP filename
+   \param[out]   *minNBDistSq  Min non-bond distance
+   \param[out]   *maxNBDistSq  Max non-bond distance
+   \param[out]   *maxHBDistSq  Max HBond distance
+   \param[out]   *nThreads     Number of threads for the searches (or
+                               files with -l)
+   \param[out]   *cachedir     Structure cache directory (or blank)
+   \param[out]   *fileList     Input is a list or directory of files
+   \param[out]   *outdir       Directory for per-file output (or blank)
+   \return                     Success
+
+   Parse the command line
+
+-  07.06.99 Original    By: ACRM
+-  09.06.99 Added -q
+-  16.06.99 Added -n, -x, -b and associated parameters
+-  21.07.15 Removed -q
+-  22.07.15 Added -p and pgpfile
+-  16.10.26 Added -j and nThreads
+-  16.10.26 Added -c and cachedir
+-  16.10.26 Added -l, -o, fileList and outdir
+*/
+BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
+                  char *pgpfile, REAL *minNBDistSq, REAL *maxNBDistSq,
+                  REAL *maxHBDistSq, int *nThreads, char *cachedir,
+                  BOOL *fileList, char *outdir)
+{
+   argc--;
+   argv++;
+   
+   infile[0] = outfile[0] = pgpfile[0] = cachedir[0] = outdir[0] = '\0';
+   
+   while(argc)
+   {
+      if(argv[0][0] == '-')
+      {
+         switch(argv[0][1])
+         {
+         case 'h':
+            return(FALSE);
             break;
          case 'n':
             if(!(--argc))
@@ -579,6 +1617,32 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
             strncpy(pgpfile, argv[0], MAXBUFF);
             pgpfile[MAXBUFF-1] = '\0';
             break;
+         case 'j':
+            if(!(--argc))
+               return(FALSE);
+            argv++;
+            if((sscanf(argv[0], "%d", nThreads))==0)
+               return(FALSE);
+            if((*nThreads < 1) || (*nThreads > MAXTHREADS))
+               return(FALSE);
+            break;
+         case 'c':
+            if(!(--argc))
+               return(FALSE);
+            argv++;
+            strncpy(cachedir, argv[0], MAXBUFF);
+            cachedir[MAXBUFF-1] = '\0';
+            break;
+         case 'l':
+            *fileList = TRUE;
+            break;
+         case 'o':
+            if(!(--argc))
+               return(FALSE);
+            argv++;
+            strncpy(outdir, argv[0], MAXBUFF);
+            outdir[MAXBUFF-1] = '\0';
+            break;
          default:
             return(FALSE);
             break;
@@ -613,63 +1677,1064 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 
 
 /************************************************************************/
-/*>HBLIST *FindProtProtHBonds(PDB *pdb)
-   ------------------------------------
+/*>PDB *PrepareStructure(FILE *in, FILE *pgp, ARENA *extrasArena)
+   ---------------------------------------------------------------
 *//**
-   \param[in]   *pdb    PDB linked list
-   \return              Linked list of protein-protein HBonds
-
-   Create a list of HBonds within the protein
-
--  07.06.99 Original   By: ACRM
--  22.07.15 Modified to use PDB files and standard BiopLib structures
-            and functions
+   \param[in]    *in          Input PDB file
+   \param[in]    *pgp         Open PGP file for adding hydrogens
+   \param[in,out] *extrasArena Arena for the PDB extras
+   \return                    Prepared PDB linked list (NULL on error)
+
+   Reads the PDB file, adds hydrogens, sets the atom types and molecule
+   IDs and deletes CONECTs to metals. Errors are reported here.
+
+-  16.10.26 Original   By: ACRM (from main())
+-  16.10.26 Added extrasArena
+-  16.10.26 Takes the open PGP file rather than its name so it is only
+            opened once for a batch. Frees the PDB headers
+-  16.10.26 The PGP data are still parsed for every structure
 */
-HBLIST *FindProtProtHBonds(PDB *pdb)
+PDB *PrepareStructure(FILE *in, FILE *pgp, ARENA *extrasArena)
 {
-   PDB           *p, *q;
-   static HBLIST *hblist = NULL,
-                 *hbl,
-                 *hb;
-   
+   WHOLEPDB   *wpdb = NULL;
+   PDB        *pdb;
+   STRINGLIST *warnings = NULL;
    
-   /* Loop through each residue                                         */
-   for(p=pdb; p!=NULL; p=blFindNextResidue(p))
+   if((wpdb = blReadWholePDB(in))==NULL)
    {
-      /* If it's a protein/nucleotide                                   */
-      if(!(p->atomtype & ATOMTYPE_NONRESIDUE) &&
-         (p->atomtype != ATOMTYPE_UNDEF))
-      {
-         
-         /* Loop through each following residue                         */
-         for(q=blFindNextResidue(p); q!=NULL; q=blFindNextResidue(q))
+      fprintf(stderr,"pdbhbond: (error) Unable to PDB file\n");
+      return(NULL);
+   }
+
+   /* We only need the atoms                                            */
+   pdb       = wpdb->pdb;
+   wpdb->pdb = NULL;
+   blFreeWholePDB(wpdb);
+
+   if(pdb==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) No atoms read from PDB \
+file\n");
+      return(NULL);
+   }
+
+   /* Store the original atom numbers in the extras field               */
+   if(!UpdatePDBExtras(pdb, extrasArena))
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for extra PDB \
+data\n");
+      FREELIST(pdb, PDB);
+      return(NULL);
+   }
+   
+   SetAtomNumExtras(pdb);
+
+   /* Add hydrogens to the protein. blHAddPDB() parses the PGP file 
+      each time it is called so rewind it first
+   */
+   rewind(pgp);
+   if(blHAddPDB(pgp, pdb)==0)
+   {
+      fprintf(stderr,"pdbhbond: (warning) No hydrogens added to \
+PDB file\n");
+   }
+
+   /* Create extras fields for the extra hydrogen atoms                 */
+   if(!UpdatePDBExtras(pdb, extrasArena))
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for extra PDB \
+data\n");
+      FREELIST(pdb, PDB);
+      return(NULL);
+   }
+
+   if((warnings = blSetPDBAtomTypes(pdb))!=NULL)
+   {
+      STRINGLIST *s;
+      for(s=warnings; s!=NULL; NEXT(s))
+      {
+         fprintf(stderr,"%s\n", s->string);
+      }
+   }
+   
+   SetMolecules(pdb);
+   DeleteMetalConects(pdb);
+
+   return(pdb);
+}
+
+
+/************************************************************************/
+/*>char *ReadInputFile(FILE *in, long *nBytes)
+   --------------------------------------------
+*//**
+   \param[in]    *in       Input file
+   \param[out]   *nBytes   Number of bytes read
+   \return                 Malloc'd contents of the file (NULL if no
+                           memory)
+
+   Reads the whole of a file (which may be a pipe) into memory
+
+-  16.10.26 Original   By: ACRM
+*/
+char *ReadInputFile(FILE *in, long *nBytes)
+{
+   char   *buffer = NULL,
+          *newBuffer;
+   long   bufferSize = 0;
+   size_t nRead;
+   
+   *nBytes = 0;
+   do
+   {
+      if(*nBytes == bufferSize)
+      {
+         bufferSize = (bufferSize ? 2 * bufferSize : 65536);
+         if((newBuffer = (char *)realloc(buffer, bufferSize))==NULL)
+         {
+            if(buffer != NULL)
+               free(buffer);
+            return(NULL);
+         }
+         buffer = newBuffer;
+      }
+      nRead = fread(buffer + *nBytes, 1, bufferSize - *nBytes, in);
+      *nBytes += (long)nRead;
+   }  while(nRead > 0);
+
+   return(buffer);
+}
+
+
+/************************************************************************/
+/*>void MakeCacheFilename(char *cachefile, char *cachedir, char *buffer,
+                          long nBytes, unsigned long pgpHash)
+   ----------------------------------------------------------------------
+*//**
+   \param[out]   *cachefile  Cache filename (MAXCACHEFILE characters)
+   \param[in]    *cachedir   Cache directory
+   \param[in]    *buffer     Contents of the PDB file
+   \param[in]    nBytes      Size of the PDB file
+   \param[in]    pgpHash     Hash of the PGP file used to add hydrogens
+
+   The cache file is named from two 32-bit FNV-1a hashes of the PDB
+   file contents and the PGP file contents, so any change to the input
+   gives a new cache file
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Uses a hash of the PGP contents rather than its name
+*/
+void MakeCacheFilename(char *cachefile, char *cachedir, char *buffer,
+                       long nBytes, unsigned long pgpHash)
+{
+   unsigned long hash1 = 2166136261UL,
+                 hash2 = 84696351UL;
+   long          i;
+   int           j;
+
+   for(j=0; j<4; j++)
+   {
+      hash1 = ((hash1 ^ ((pgpHash >> (8*j)) & 0xFFUL)) * 16777619UL) & 
+              0xFFFFFFFFUL;
+      hash2 = ((hash2 ^ ((pgpHash >> (8*(3-j))) & 0xFFUL)) * 
+               16777619UL) & 0xFFFFFFFFUL;
+   }
+   for(i=0; i<nBytes; i++)
+   {
+      hash1 = ((hash1 ^ (unsigned char)buffer[i]) * 16777619UL) & 
+              0xFFFFFFFFUL;
+      hash2 = ((hash2 ^ (unsigned char)buffer[nBytes-i-1]) * 
+               16777619UL) & 0xFFFFFFFFUL;
+   }
+
+   sprintf(cachefile, "%.*s/%08lx%08lx.hbc", MAXBUFF, cachedir, 
+           hash1, hash2);
+}
+
+
+/************************************************************************/
+/*>BOOL HashFile(FILE *fp, unsigned long *hash)
+   --------------------------------------------
+*//**
+   \param[in]    *fp         File to hash. Rewound afterwards
+   \param[out]   *hash       32-bit FNV-1a hash of its contents
+   \return                   Success
+
+   Hashes the contents of a file
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL HashFile(FILE *fp, unsigned long *hash)
+{
+   unsigned char buffer[COPYBUFF];
+   size_t        nRead,
+                 i;
+
+   *hash = 2166136261UL;
+   rewind(fp);
+   while((nRead = fread(buffer, 1, COPYBUFF, fp)) > 0)
+   {
+      for(i=0; i<nRead; i++)
+         *hash = ((*hash ^ buffer[i]) * 16777619UL) & 0xFFFFFFFFUL;
+   }
+   if(ferror(fp))
+      return(FALSE);
+   rewind(fp);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteStructureCache(char *cachefile, PDB *pdb, long nBytes,
+                             unsigned long pgpHash)
+   ----------------------------------------------------------------
+*//**
+   \param[in]    *cachefile  Cache filename
+   \param[in]    *pdb        Prepared PDB linked list
+   \param[in]    nBytes      Size of the PDB file it came from
+   \param[in]    pgpHash     Hash of the PGP file used
+   \return                   Success
+
+   Writes the prepared structure as a CACHEHEADER, an array of
+   CACHEATOMs and the CONECT indexes. The file is written under a
+   temporary name and renamed so a partial file is never read. The
+   temporary name includes the process ID and the address of the 
+   structure so that two threads or processes caching the same file
+   never write to the same temporary file.
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Added pgpHash. Temporary name is unique to the writer
+*/
+BOOL WriteStructureCache(char *cachefile, PDB *pdb, long nBytes,
+                         unsigned long pgpHash)
+{
+   FILE        *fp;
+   PDB         *p;
+   CACHEHEADER header;
+   CACHEATOM   atom;
+   HASHTABLE   *atomHash;
+   char        tmpName[MAXCACHEFILE+64],
+               key[MAXHBONDKEY];
+   int         i,
+               index;
+   BOOL        ok = TRUE;
+
+   /* Hash the atoms so CONECTs can be written as indexes               */
+   if((atomHash = blInitializeHash(HASHSIZE))==NULL)
+      return(FALSE);
+   
+   memset(&header, 0, sizeof(CACHEHEADER));
+   strcpy(header.magic, CACHEMAGIC);
+   header.version  = CACHEVERSION;
+   header.atomSize = sizeof(CACHEATOM);
+   header.nBytes   = nBytes;
+   header.pgpHash  = pgpHash;
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      sprintf(key, "%p", (void *)p);
+      if(!blSetHashValueInt(atomHash, key, header.natoms++))
+      {
+         blFreeHash(atomHash);
+         return(FALSE);
+      }
+      header.nConects += p->nConect;
+   }
+
+   sprintf(tmpName, "%s.%ld.%p.tmp", cachefile, (long)getpid(), 
+           (void *)pdb);
+   if((fp = fopen(tmpName, "wb"))==NULL)
+   {
+      blFreeHash(atomHash);
+      return(FALSE);
+   }
+
+   if(fwrite(&header, sizeof(CACHEHEADER), 1, fp) != 1)
+      ok = FALSE;
+
+   for(p=pdb; ok && (p!=NULL); NEXT(p))
+   {
+      memset(&atom, 0, sizeof(CACHEATOM));
+      atom.x         = p->x;
+      atom.y         = p->y;
+      atom.z         = p->z;
+      atom.occ       = p->occ;
+      atom.bval      = p->bval;
+      atom.atnum     = p->atnum;
+      atom.resnum    = p->resnum;
+      atom.atomtype  = p->atomtype;
+      atom.nConect   = p->nConect;
+      atom.origAtnum = PDBEXTRASPTR(p, PDBEXTRAS)->origAtnum;
+      atom.molid     = PDBEXTRASPTR(p, PDBEXTRAS)->molid;
+      atom.altpos    = p->altpos;
+      CopyCacheString(atom.record_type, p->record_type, MAXCACHESTRING);
+      CopyCacheString(atom.atnam,       p->atnam,       MAXCACHESTRING);
+      CopyCacheString(atom.atnam_raw,   p->atnam_raw,   MAXCACHESTRING);
+      CopyCacheString(atom.resnam,      p->resnam,      MAXCACHESTRING);
+      CopyCacheString(atom.insert,      p->insert,      MAXCACHESTRING);
+      CopyCacheString(atom.chain,       p->chain,       MAXCACHESTRING);
+      CopyCacheString(atom.element,     p->element,     MAXCACHESTRING);
+
+      if(fwrite(&atom, sizeof(CACHEATOM), 1, fp) != 1)
+         ok = FALSE;
+   }
+
+   for(p=pdb; ok && (p!=NULL); NEXT(p))
+   {
+      for(i=0; i<p->nConect; i++)
+      {
+         sprintf(key, "%p", (void *)(p->conect[i]));
+         index = blGetHashValueInt(atomHash, key);
+         if(fwrite(&index, sizeof(int), 1, fp) != 1)
+            ok = FALSE;
+      }
+   }
+
+   blFreeHash(atomHash);
+   if(fclose(fp))
+      ok = FALSE;
+   
+   if(!ok || rename(tmpName, cachefile))
+   {
+      remove(tmpName);
+      return(FALSE);
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>PDB *ReadStructureCache(char *cachefile, long nBytes, 
+                            unsigned long pgpHash, ARENA *extrasArena)
+   -------------------------------------------------------------------
+*//**
+   \param[in]    *cachefile  Cache filename
+   \param[in]    nBytes      Size of the current PDB file
+   \param[in]    pgpHash     Hash of the current PGP file
+   \param[in,out] *extrasArena Arena for the PDB extras. Emptied if the
+                             cache is invalid
+   \return                   Prepared PDB linked list (NULL if not
+                             cached, invalid or no memory)
+
+   Reads a structure written by WriteStructureCache()
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Added extrasArena
+-  16.10.26 Added pgpHash. A cache made with another PGP file is 
+            rejected
+*/
+PDB *ReadStructureCache(char *cachefile, long nBytes, 
+                        unsigned long pgpHash, ARENA *extrasArena)
+{
+   FILE        *fp;
+   PDB         *pdb   = NULL,
+               *p     = NULL,
+               **atoms;
+   CACHEHEADER header;
+   CACHEATOM   atom;
+   int         i, j,
+               index;
+   BOOL        ok = TRUE;
+
+   if((fp = fopen(cachefile, "rb"))==NULL)
+      return(NULL);
+
+   if((fread(&header, sizeof(CACHEHEADER), 1, fp) != 1)  ||
+      strncmp(header.magic, CACHEMAGIC, MAXCACHESTRING)   ||
+      (header.version  != CACHEVERSION)                   ||
+      (header.atomSize != sizeof(CACHEATOM))              ||
+      (header.nBytes   != nBytes)                         ||
+      (header.pgpHash  != pgpHash)                        ||
+      (header.natoms   <= 0)                              ||
+      ((atoms = (PDB **)malloc(header.natoms * sizeof(PDB *)))==NULL))
+   {
+      fclose(fp);
+      return(NULL);
+   }
+
+   for(i=0; ok && (i<header.natoms); i++)
+   {
+      if(fread(&atom, sizeof(CACHEATOM), 1, fp) != 1)
+      {
+         ok = FALSE;
+         break;
+      }
+      
+      if(pdb == NULL)
+      {
+         INIT(pdb, PDB);
+         p = pdb;
+      }
+      else
+      {
+         ALLOCNEXT(p, PDB);
+      }
+      if(p == NULL)
+      {
+         ok = FALSE;
+         break;
+      }
+      CLEAR_PDB(p);
+      atoms[i] = p;
+
+      p->x        = atom.x;
+      p->y        = atom.y;
+      p->z        = atom.z;
+      p->occ      = atom.occ;
+      p->bval     = atom.bval;
+      p->atnum    = atom.atnum;
+      p->resnum   = atom.resnum;
+      p->atomtype = atom.atomtype;
+      p->nConect  = atom.nConect;
+      p->altpos   = atom.altpos;
+      strcpy(p->record_type, atom.record_type);
+      strcpy(p->atnam,       atom.atnam);
+      strcpy(p->atnam_raw,   atom.atnam_raw);
+      strcpy(p->resnam,      atom.resnam);
+      strcpy(p->insert,      atom.insert);
+      strcpy(p->chain,       atom.chain);
+      strcpy(p->element,     atom.element);
+
+      if((p->nConect < 0) || (p->nConect > MAXCONECT) ||
+         ((p->extras = AllocFromArena(extrasArena))==NULL))
+      {
+         p->nConect = 0;
+         ok = FALSE;
+         break;
+      }
+      ClearPDBExtras(PDBEXTRASPTR(p, PDBEXTRAS));
+      PDBEXTRASPTR(p, PDBEXTRAS)->origAtnum = atom.origAtnum;
+      PDBEXTRASPTR(p, PDBEXTRAS)->molid     = atom.molid;
+   }
+
+   /* Resolve the CONECTs                                               */
+   for(i=0; ok && (i<header.natoms); i++)
+   {
+      for(j=0; j<atoms[i]->nConect; j++)
+      {
+         if((fread(&index, sizeof(int), 1, fp) != 1) ||
+            (index < 0) || (index >= header.natoms))
+         {
+            ok = FALSE;
+            break;
+         }
+         atoms[i]->conect[j] = atoms[index];
+      }
+   }
+
+   fclose(fp);
+   free(atoms);
+
+   if(!ok)
+   {
+      FreeArena(extrasArena);
+      if(pdb != NULL)
+         FREELIST(pdb, PDB);
+      fprintf(stderr,"pdbhbond: (warning) Ignoring invalid cache file \
+%s\n", cachefile);
+      return(NULL);
+   }
+   
+   return(pdb);
+}
+
+
+/************************************************************************/
+/*>void CopyCacheString(char *out, char *in, int outSize)
+   ------------------------------------------------------
+*//**
+   \param[out]   *out      Output string
+   \param[in]    *in       Input string
+   \param[in]    outSize   Size of the output string including the
+                           terminating NUL
+
+   Copies a string field into a CACHEATOM, truncating if necessary
+
+-  16.10.26 Original   By: ACRM
+*/
+void CopyCacheString(char *out, char *in, int outSize)
+{
+   strncpy(out, in, outSize);
+   out[outSize-1] = '\0';
+}
+
+
+/************************************************************************/
+/*>HBLIST *FindProtProtHBonds(PDB *pdb, REAL maxHBDistSq, int nThreads)
+   ---------------------------------------------------------------------
+*//**
+   \param[in]   *pdb          PDB linked list
+   \param[in]   maxHBDistSq   Max donor-acceptor distance squared
+   \param[in]   nThreads      Number of threads to use
+   \return                    Linked list of protein-protein HBonds
+
+   Create a list of HBonds within the protein
+
+   Residue pairs are only passed to blListAllHBonds() if their bounding
+   spheres come within the larger of the donor-acceptor and H-acceptor
+   limits. Pairs are still visited in file order so the list is
+   unchanged.
+
+-  07.06.99 Original   By: ACRM
+-  22.07.15 Modified to use PDB files and standard BiopLib structures
+            and functions
+-  16.10.26 Added maxHBDistSq parameter. Uses a residue grid to skip
+            residue pairs which are too far apart to HBond
+-  16.10.26 Added nThreads. The residues are split into ranges handled
+            by ProtProtChunk()
+*/
+HBLIST *FindProtProtHBonds(PDB *pdb, REAL maxHBDistSq, int nThreads)
+{
+   HBSTAGE stage;
+   HBLIST  *hblist;
+   
+   if((stage.resGrid = BuildResidueGrid(pdb, MAX(sqrt(maxHBDistSq), 
+                                                 MAXHADIST)))==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for residue grid\n");
+      return(NULL);
+   }
+   stage.pdb         = pdb;
+   stage.maxHBDistSq = maxHBDistSq;
+   stage.resultArena = NULL;
+   stage.DoChunk     = ProtProtChunk;
+
+   if(!RunStage(&stage, stage.resGrid->nres, nThreads))
+   {
+      FreeResidueGrid(stage.resGrid);
+      fprintf(stderr,"pdbhbond: (error) No memory for protein-protein \
+HBonds\n");
+      return(NULL);
+   }
+
+   hblist = JoinChunks(&stage);
+   FreeResidueGrid(stage.resGrid);
+   
+   return(hblist);
+}
+
+
+/************************************************************************/
+/*>void ProtProtChunk(HBSTAGE *stage, HBCHUNK *chunk)
+   ---------------------------------------------------
+*//**
+   \param[in]     *stage    Shared data for the search
+   \param[in,out] *chunk    Range of residues to process and results
+
+   Finds protein-protein HBonds between each residue in the chunk and
+   the later residues that are close enough. As in the original
+   FindProtProtHBonds(), each list from blListAllHBonds() is linked on
+   from the head of the previous one.
+
+-  16.10.26 Original   By: ACRM
+*/
+void ProtProtChunk(HBSTAGE *stage, HBCHUNK *chunk)
+{
+   RESGRID *grid = stage->resGrid;
+   PDB     *p, *q;
+   HBLIST  *hb;
+   int     *nearby,
+           nNearby,
+           i, j;
+   
+   if((nearby = (int *)malloc((grid->nres + 1) * sizeof(int)))==NULL)
+   {
+      chunk->noMemory = TRUE;
+      return;
+   }
+   
+   /* Loop through each residue                                         */
+   for(i=chunk->start; i<chunk->stop; i++)
+   {
+      p = grid->res[i].start;
+      
+      /* If it's a protein/nucleotide                                   */
+      if(!(p->atomtype & ATOMTYPE_NONRESIDUE) &&
+         (p->atomtype != ATOMTYPE_UNDEF))
+      {
+         /* Loop through each following residue that is close enough   */
+         nNearby = FindLaterNearbyResidues(grid, i, nearby);
+         for(j=0; j<nNearby; j++)
+         {
+            q = grid->res[nearby[j]].start;
+            
+            /* If it's a protein/nucleotide                             */
+            if(!(q->atomtype & ATOMTYPE_NONRESIDUE) &&
+               (q->atomtype != ATOMTYPE_UNDEF))
+            {
+               /* If there is an HBond, add it to the list              */
+               if((hb=blListAllHBonds(p, q))!=NULL)
+               {
+                  if(chunk->hblist==NULL)
+                  {
+                     chunk->hblist = chunk->hbl = hb;
+                  }
+                  else
+                  {
+                     chunk->hbl->next = hb;
+                     chunk->hbl       = hb;
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   free(nearby);
+}
+
+
+/************************************************************************/
+/*>void *ProtProtTask(void *arg)
+   -----------------------------
+*//**
+   \param[in,out] *arg   Pointer to a PPTASK
+
+   Thread entry point used by main() to find protein-protein HBonds
+   while the ligand searches run
+
+-  16.10.26 Original   By: ACRM
+*/
+void *ProtProtTask(void *arg)
+{
+   PPTASK *task = (PPTASK *)arg;
+
+   task->hblist = FindProtProtHBonds(task->pdb, task->maxHBDistSq,
+                                     task->nThreads);
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL RunStage(HBSTAGE *stage, int nItems, int nThreads)
+   -------------------------------------------------------
+*//**
+   \param[in,out] *stage    Shared data for the search. DoChunk must be
+                            set
+   \param[in]     nItems    Number of atoms or residues to process
+   \param[in]     nThreads  Number of threads to use
+   \return                  Success (FALSE if no memory)
+
+   Splits items 0..nItems-1 into consecutive ranges and has a pool of
+   threads apply stage->DoChunk() to each. Results are kept per range
+   so that joining them in order gives the same list as a single pass.
+   With one thread everything is done in the calling thread.
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL RunStage(HBSTAGE *stage, int nItems, int nThreads)
+{
+   pthread_t threads[MAXTHREADS];
+   int       i,
+             nStarted = 0;
+
+   stage->nChunks   = (nThreads > 1) ? (nThreads * CHUNKSPERTHREAD) : 1;
+   stage->nChunks   = MAX(MIN(stage->nChunks, nItems), 1);
+   stage->nextChunk = 0;
+
+   if((stage->chunks = (HBCHUNK *)malloc(stage->nChunks *
+                                         sizeof(HBCHUNK)))==NULL)
+      return(FALSE);
+
+   for(i=0; i<stage->nChunks; i++)
+   {
+      stage->chunks[i].hblist   = NULL;
+      stage->chunks[i].hbl      = NULL;
+      stage->chunks[i].noMemory = FALSE;
+      InitArena(&(stage->chunks[i].arena), sizeof(HBLIST), 
+                ARENABLOCKITEMS);
+      stage->chunks[i].start    = (int)(((double)nItems * i) / 
+                                        stage->nChunks);
+      stage->chunks[i].stop     = (int)(((double)nItems * (i+1)) / 
+                                        stage->nChunks);
+   }
+
+   /* Start the pool. If a thread can't be created the work is simply
+      shared by those that were
+   */
+   nThreads = MIN(nThreads, stage->nChunks);
+   for(i=1; i<nThreads; i++)
+   {
+      if(pthread_create(&(threads[nStarted]), NULL, StageWorker, 
+                        (void *)stage))
+         break;
+      nStarted++;
+   }
+   StageWorker((void *)stage);
+   for(i=0; i<nStarted; i++)
+      pthread_join(threads[i], NULL);
+
+   for(i=0; i<stage->nChunks; i++)
+   {
+      if(stage->chunks[i].noMemory)
+      {
+         for(i=0; i<stage->nChunks; i++)
+         {
+            if(stage->resultArena != NULL)
+               FreeArena(&(stage->chunks[i].arena));
+            else
+               FREELIST(stage->chunks[i].hblist, HBLIST);
+         }
+         free(stage->chunks);
+         return(FALSE);
+      }
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void *StageWorker(void *arg)
+   ----------------------------
+*//**
+   \param[in,out] *arg   Pointer to the HBSTAGE
+
+   Thread entry point. Repeatedly takes the next unprocessed range from
+   the stage and processes it
+
+-  16.10.26 Original   By: ACRM
+*/
+void *StageWorker(void *arg)
+{
+   HBSTAGE *stage = (HBSTAGE *)arg;
+   int     i;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&sStageMutex);
+      i = stage->nextChunk++;
+      pthread_mutex_unlock(&sStageMutex);
+
+      if(i >= stage->nChunks)
+         break;
+
+      (*stage->DoChunk)(stage, &(stage->chunks[i]));
+   }
+   
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>HBLIST *JoinChunks(HBSTAGE *stage)
+   ----------------------------------
+*//**
+   \param[in,out] *stage    Stage after RunStage()
+   \return                  Joined list of results
+
+   Links the result lists from the ranges in order, each onto the item
+   last appended to the one before, and frees the ranges. If the results
+   were allocated from arenas these are handed to the stage's 
+   resultArena
+
+-  16.10.26 Original   By: ACRM
+-  16.10.26 Handles arenas
+*/
+HBLIST *JoinChunks(HBSTAGE *stage)
+{
+   HBLIST *hblist = NULL,
+          *hbl    = NULL;
+   int    i;
+
+   for(i=0; i<stage->nChunks; i++)
+   {
+      if(stage->resultArena != NULL)
+         AppendArena(stage->resultArena, &(stage->chunks[i].arena));
+      
+      if(stage->chunks[i].hblist == NULL)
+         continue;
+      
+      if(hblist == NULL)
+         hblist = stage->chunks[i].hblist;
+      else
+         hbl->next = stage->chunks[i].hblist;
+      hbl = stage->chunks[i].hbl;
+   }
+
+   free(stage->chunks);
+   return(hblist);
+}
+
+
+/************************************************************************/
+/*>HBLIST *MergeChunksUnique(HBSTAGE *stage)
+   -----------------------------------------
+*//**
+   \param[in,out] *stage    Stage after RunStage()
+   \return                  Joined list of results
+
+   Joins the result lists from the ranges in order. An HBond is dropped
+   if its atoms are already HBonded in an earlier range; a single pass
+   would not have tested that pair again. Frees the ranges.
+
+-  16.10.26 Original   By: ACRM
+*/
+HBLIST *MergeChunksUnique(HBSTAGE *stage)
+{
+   HASHTABLE *hash   = NULL;
+   HBLIST    *hblist = NULL,
+             *hbl    = NULL,
+             *h, 
+             *next,
+             *first;
+   int       i;
+
+   if((stage->nChunks > 1) &&
+      ((hash = blInitializeHash(HASHSIZE))==NULL))
+   {
+      fprintf(stderr,"pdbhbond: (warning) No memory to merge HBond \
+lists\n");
+   }
+
+   for(i=0; i<stage->nChunks; i++)
+   {
+      first = NULL;
+      for(h=stage->chunks[i].hblist; h!=NULL; h=next)
+      {
+         next    = h->next;
+         h->next = NULL;
+         
+         if((i > 0) && (hash != NULL) &&
+            IsHashedAsHBonded(hash, h->donor, h->acceptor))
+         {
+            free(h);
+            continue;
+         }
+
+         if(hblist == NULL)
+            hblist = h;
+         else
+            hbl->next = h;
+         hbl = h;
+         if(first == NULL)
+            first = h;
+      }
+
+      /* Now this range is merged, record its pairs                     */
+      if(hash != NULL)
+      {
+         for(h=first; h!=NULL; NEXT(h))
+         {
+            if(!AddHBondToHash(hash, h))
+            {
+               blFreeHash(hash);
+               hash = NULL;
+               fprintf(stderr,"pdbhbond: (warning) No memory to merge \
+HBond lists\n");
+               break;
+            }
+         }
+      }
+   }
+
+   if(hash != NULL)
+      blFreeHash(hash);
+   free(stage->chunks);
+   
+   return(hblist);
+}
+
+
+/************************************************************************/
+/*>RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff)
+   ------------------------------------------------
+*//**
+   \param[in]   *pdb     PDB linked list
+   \param[in]   cutoff   Max atom-atom distance of interest
+   \return               Residue grid (NULL if no memory)
+
+   Finds the centre and bounding sphere of every residue and bins the
+   centres into cells large enough that any two residues with atoms
+   within cutoff of each other are in the same or adjacent cells.
+
+-  16.10.26 Original   By: ACRM
+*/
+RESGRID *BuildResidueGrid(PDB *pdb, REAL cutoff)
+{
+   RESGRID *grid;
+   PDB     *res, *resNext, *a;
+   REAL    maxX, maxY, maxZ,
+           maxRadius = (REAL)0.0;
+   int     i;
+
+   if((grid = (RESGRID *)malloc(sizeof(RESGRID)))==NULL)
+      return(NULL);
+   grid->cutoff   = cutoff;
+   grid->cellHead = NULL;
+
+   grid->nres = 0;
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+      grid->nres++;
+
+   if((grid->res = (RESINFO *)malloc((grid->nres + 1) * sizeof(RESINFO)))
+      ==NULL)
+   {
+      free(grid);
+      return(NULL);
+   }
+
+   /* Find residue centres and radii                                    */
+   grid->minX = grid->minY = grid->minZ = (REAL)0.0;
+   maxX       = maxY       = maxZ       = (REAL)0.0;
+   for(res=pdb, i=0; res!=NULL; res=resNext, i++)
+   {
+      RESINFO *r     = &(grid->res[i]);
+      REAL    natoms = (REAL)0.0,
+              rSq    = (REAL)0.0;
+
+      resNext = blFindNextResidue(res);
+      r->start      = res;
+      r->stop       = resNext;
+      r->nextInCell = (-1);
+      r->x = r->y = r->z = (REAL)0.0;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         r->x   += a->x;
+         r->y   += a->y;
+         r->z   += a->z;
+         natoms += (REAL)1.0;
+      }
+      r->x /= natoms;
+      r->y /= natoms;
+      r->z /= natoms;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         REAL dSq = DISTSQ(a, r);
+         if(dSq > rSq)
+            rSq = dSq;
+      }
+      r->radius = sqrt(rSq);
+
+      if(i==0)
+      {
+         grid->minX = maxX = r->x;
+         grid->minY = maxY = r->y;
+         grid->minZ = maxZ = r->z;
+      }
+      grid->minX = MIN(grid->minX, r->x);
+      grid->minY = MIN(grid->minY, r->y);
+      grid->minZ = MIN(grid->minZ, r->z);
+      maxX       = MAX(maxX, r->x);
+      maxY       = MAX(maxY, r->y);
+      maxZ       = MAX(maxZ, r->z);
+      maxRadius  = MAX(maxRadius, r->radius);
+   }
+
+   /* Size the cells, growing them if the grid would be unreasonably 
+      large
+   */
+   grid->cellSize = cutoff + (2.0 * maxRadius) + GRID_SLACK;
+   for(;;)
+   {
+      grid->nx = 1 + (int)((maxX - grid->minX) / grid->cellSize);
+      grid->ny = 1 + (int)((maxY - grid->minY) / grid->cellSize);
+      grid->nz = 1 + (int)((maxZ - grid->minZ) / grid->cellSize);
+      if(((double)grid->nx * (double)grid->ny * (double)grid->nz) <= 
+         (double)MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                      sizeof(int)))==NULL)
+   {
+      FreeResidueGrid(grid);
+      return(NULL);
+   }
+   for(i=0; i<grid->nx * grid->ny * grid->nz; i++)
+      grid->cellHead[i] = (-1);
+
+   /* Bin the residues                                                  */
+   for(i=0; i<grid->nres; i++)
+   {
+      RESINFO *r   = &(grid->res[i]);
+      int     cell = (int)((r->x - grid->minX) / grid->cellSize) +
+                     grid->nx * 
+                     ((int)((r->y - grid->minY) / grid->cellSize) +
+                      grid->ny * 
+                      (int)((r->z - grid->minZ) / grid->cellSize));
+      r->nextInCell        = grid->cellHead[cell];
+      grid->cellHead[cell] = i;
+   }
+
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeResidueGrid(RESGRID *grid)
+   -----------------------------------
+*//**
+   \param[in]   *grid    Residue grid to free
+
+   Frees a grid created by BuildResidueGrid()
+
+-  16.10.26 Original   By: ACRM
+*/
+void FreeResidueGrid(RESGRID *grid)
+{
+   if(grid->cellHead != NULL)
+      free(grid->cellHead);
+   free(grid->res);
+   free(grid);
+}
+
+
+/************************************************************************/
+/*>int FindLaterNearbyResidues(RESGRID *grid, int centre, int *nearby)
+   -------------------------------------------------------------------
+*//**
+   \param[in]   *grid     Residue grid from BuildResidueGrid()
+   \param[in]   centre    Index of the residue of interest
+   \param[out]  *nearby   Indexes of residues following centre whose
+                          bounding spheres come within grid->cutoff of
+                          that of centre. Must have space for 
+                          grid->nres items
+   \return                Number of residues found
+
+   Residues are returned in file order
+
+-  16.10.26 Original   By: ACRM
+*/
+int FindLaterNearbyResidues(RESGRID *grid, int centre, int *nearby)
+{
+   RESINFO *p = &(grid->res[centre]);
+   int     ix = (int)((p->x - grid->minX) / grid->cellSize),
+           iy = (int)((p->y - grid->minY) / grid->cellSize),
+           iz = (int)((p->z - grid->minZ) / grid->cellSize),
+           cx, cy, cz, j,
+           nNearby = 0;
+
+   for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, grid->nz-1); cz++)
+   {
+      for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, grid->ny-1); cy++)
+      {
+         for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, grid->nx-1); cx++)
          {
-            if(p==q)
-               continue;
-            
-            /* If it's a protein/nucleotide                             */
-            if(!(q->atomtype & ATOMTYPE_NONRESIDUE) &&
-               (q->atomtype != ATOMTYPE_UNDEF))
+            for(j=grid->cellHead[cx + grid->nx * (cy + grid->ny * cz)];
+                j!=(-1);
+                j=grid->res[j].nextInCell)
             {
-               /* If there is an HBond, add it to the list              */
-               if((hb=blListAllHBonds(p, q))!=NULL)
-               {
-                  if(hblist==NULL)
-                  {
-                     hblist = hbl = hb;
-                  }
-                  else
-                  {
-                     hbl->next = hb;
-                     hbl       = hb;
-                  }
-               }
+               RESINFO *q = &(grid->res[j]);
+               REAL    reach;
+
+               if(j <= centre)
+                  continue;
+
+               reach = grid->cutoff + p->radius + q->radius + GRID_SLACK;
+               if(DISTSQ(p, q) <= reach * reach)
+                  nearby[nNearby++] = j;
             }
          }
       }
    }
 
-   return(hblist);
+   qsort(nearby, nNearby, sizeof(int), CompareInts);
+   return(nNearby);
 }
 
 
@@ -860,7 +2925,11 @@ int IsAcceptor(PDB *p, BOOL allowPseudo, BOOL *pseudo)
 
    A complete rewrite of the old XMAS version
 
+   The first antecedent is taken from the index made by 
+   BuildHydrogenIndex() where available
+
 -  21.07.15  Original   By: ACRM
+-  16.10.26  Uses the indexed first antecedent
 */
 PDB *FindAntecedent(PDB *atom, PDB **pdbarray, int *count, int nth)
 {
@@ -873,6 +2942,13 @@ PDB *FindAntecedent(PDB *atom, PDB **pdbarray, int *count, int nth)
    if(nth==0) nth=1;
 
    *count = 0;
+   if((nth==1) && (atom != NULL) && (atom->extras != NULL) &&
+      PDBEXTRASPTR(atom, PDBEXTRAS)->haveAntecedent)
+   {
+      *count = PDBEXTRASPTR(atom, PDBEXTRAS)->nAntecedents;
+      return(PDBEXTRASPTR(atom, PDBEXTRAS)->antecedent);
+   }
+
    if(atom != NULL)
    {
       /* If it's a HETATM with CONECT information                       */
@@ -937,19 +3013,25 @@ PDB *FindAntecedent(PDB *atom, PDB **pdbarray, int *count, int nth)
    Finds a hydrogen bonded to the donor. Selects the hydrogen which is
    closest to acceptor.
 
+   If BuildHydrogenIndex() has been run, the candidate hydrogens are
+   taken from the index rather than by searching the linked list
+
 -  07.06.99 Original   By: ACRM
 -  16.06.99 Initialise bestDistSq to 0
 -  22.07.15 Modified to use PDB files and standard BiopLib structures
             and functions - added pdb parameter
+-  16.10.26 Uses the hydrogen index where available. Selection moved
+            to SelectHydrogen()
 */
 PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor)
 {
-   PDB  *hydrogen = NULL,
-        *p;
-   PDB  *start, 
-        *stop;
-   REAL bestDistSq = (REAL)0.0,
-        distSq;
+   PDB       *hydrogen = NULL,
+             *p;
+   PDB       *start, 
+             *stop;
+   PDBEXTRAS *extras;
+   REAL      bestDistSq = (REAL)0.0;
+   int       i;
    
    if(donor != NULL)
    {
@@ -962,6 +3044,30 @@ PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor)
       {
          return(NULL);
       }
+
+      extras = PDBEXTRASPTR(donor, PDBEXTRAS);
+      if((extras != NULL) && extras->haveAntecedent)
+      {
+         /* Indexed hydrogens following the donor                       */
+         for(i=0; i<extras->nBondedH; i++)
+         {
+            SelectHydrogen(extras->bondedH[i], acceptor,
+                           &hydrogen, &bestDistSq);
+         }
+
+         /* Indexed hydrogens in the residue                            */
+         if(extras->resHyd != NULL)
+         {
+            for(i=0; i<extras->resHyd->nHydrogens; i++)
+            {
+               p = extras->resHyd->hydrogens[i];
+               if(blIsBonded(p, acceptor, BOND_TOL))
+                  SelectHydrogen(p, acceptor, &hydrogen, &bestDistSq);
+            }
+         }
+
+         return(hydrogen);
+      }
       
       /* Search forward for a hydrogen                                  */
       for(p=donor->next;
@@ -971,20 +3077,7 @@ PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor)
          if(!strcmp(p->element, "H") &&
             (DISTSQ(p, donor) <= MAXBONDSQ))
          {
-            if(hydrogen==NULL)
-            {
-               hydrogen = p;
-               bestDistSq = DISTSQ(p, acceptor);
-            }
-            else
-            {
-               distSq = DISTSQ(p, acceptor);
-               if(distSq < bestDistSq)
-               {
-                  bestDistSq = distSq;
-                  hydrogen = p;
-               }
-            }
+            SelectHydrogen(p, acceptor, &hydrogen, &bestDistSq);
          }
       }
       
@@ -1008,20 +3101,7 @@ PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor)
             if(!strcmp(p->element, "H") && 
                blIsBonded(p, acceptor, BOND_TOL))
             {
-               if(hydrogen == NULL)
-               {
-                  hydrogen = p;
-                  bestDistSq = DISTSQ(p, acceptor);
-               }
-               else
-               {
-                  distSq = DISTSQ(p, acceptor);
-                  if(distSq < bestDistSq)
-                  {
-                     bestDistSq = distSq;
-                     hydrogen = p;
-                  }
-               }
+               SelectHydrogen(p, acceptor, &hydrogen, &bestDistSq);
             }
          }
       }
@@ -1033,6 +3113,34 @@ PDB *FindBondedHydrogen(PDB *pdb, PDB *donor, PDB *acceptor)
 }
 
 
+/************************************************************************/
+/*>void SelectHydrogen(PDB *p, PDB *acceptor, PDB **hydrogen,
+                        REAL *bestDistSq)
+   ---------------------------------------------------------
+*//**
+   \param[in]     *p          Candidate hydrogen
+   \param[in]     *acceptor   Acceptor atom
+   \param[in,out] **hydrogen  Best hydrogen so far (NULL if none)
+   \param[in,out] *bestDistSq Its squared distance to the acceptor
+
+   Keeps p as the best hydrogen if there is none yet or it is closer to
+   the acceptor
+
+-  16.10.26 Original   By: ACRM (from FindBondedHydrogen())
+*/
+void SelectHydrogen(PDB *p, PDB *acceptor, PDB **hydrogen,
+                    REAL *bestDistSq)
+{
+   REAL distSq = DISTSQ(p, acceptor);
+
+   if((*hydrogen == NULL) || (distSq < *bestDistSq))
+   {
+      *hydrogen   = p;
+      *bestDistSq = distSq;
+   }
+}
+
+
 /************************************************************************/
 /*>HBLIST *TestForHBond(PDB *pdb, PDB *p, PDB *q, PDB **pdbarray,
                         BOOL pseudo, REAL maxHBDistSq)
@@ -1310,7 +3418,8 @@ HBLIST *doTestForHBond(PDB *pdb, PDB *donor, PDB *acceptor,
 
 /************************************************************************/
 /*>HBLIST *FindNonBonds(PDB *pdb, PDB **pdbarray, HBLIST *hbonds,
-                        REAL minNBDistSq, REAL maxNBDistSq)
+                        REAL minNBDistSq, REAL maxNBDistSq,
+                        ARENA *nbArena, int nThreads)
    --------------------------------------------------------------
 *//**
    \param[in]    *pdb         The PDB linked list
@@ -1319,7 +3428,11 @@ HBLIST *doTestForHBond(PDB *pdb, PDB *donor, PDB *acceptor,
    \param[in]    *hbonds      Linked list of HBonds
    \param[in]    minNBDistSq  Minimum distance for non-bond contact
    \param[in]    maxNBDistSq  Maximum distance for non-bond contact
-   \return                    Linked list of non-bonds
+   \param[in,out] *nbArena    Arena from which the non-bonds are 
+                              allocated
+   \param[in]    nThreads     Number of threads to use
+   \return                    Linked list of non-bonds. Free with
+                              FreeArena(nbArena), not FREELIST()
 
    Finds non-bonded contacts between ligand and protein/nucleotide or
    between nucleotide and protein.
@@ -1337,32 +3450,132 @@ HBLIST *doTestForHBond(PDB *pdb, PDB *donor, PDB *acceptor,
             min and max distances now variables (and parameters)
 -  21.07.15 Modified to use PDB files and standard BiopLib structures
             and functions - added pdb parameter. 
+-  16.10.26 Candidate partners now come from a spatial grid; peptide
+            status is looked up per chain and HBonded pairs from a hash.
+            The two branches share a single loop. Output unchanged.
+-  16.10.26 Added nThreads. The atoms are split into ranges handled by
+            NonBondChunk()
+-  16.10.26 Added nbArena
 */
 HBLIST *FindNonBonds(PDB *pdb, PDB **pdbarray, HBLIST *hbonds, 
-                     REAL minNBDistSq, REAL maxNBDistSq)
-{
-   PDB    *p, 
-          *q;
-   REAL   distSq;
-   HBLIST *nblist = NULL,
-          *nb     = NULL;
-   BOOL   isPeptide;
-   
+                     REAL minNBDistSq, REAL maxNBDistSq, ARENA *nbArena,
+                     int nThreads)
+{
+   HBSTAGE stage;
+   HBLIST  *nblist = NULL;
+
+   stage.pdb         = pdb;
+   stage.pdbarray    = pdbarray;
+   stage.minNBDistSq = minNBDistSq;
+   stage.maxNBDistSq = maxNBDistSq;
+   stage.peptideHash = NULL;
+   stage.hbondHash   = NULL;
+   stage.resultArena = nbArena;
+   stage.DoChunk     = NonBondChunk;
+
+   /* Index the atoms, the peptide status of each chain and the HBonded
+      atom pairs so we don't have to rescan the lists for every pair
+   */
+   if(((stage.atomGrid    = BuildAtomGrid(pdb, sqrt(maxNBDistSq)))
+       ==NULL) ||
+      ((stage.peptideHash = BuildPeptideChainHash(pdb))==NULL) ||
+      ((stage.hbondHash   = BuildHBondHash(hbonds))==NULL))
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for Non-bond \
+indexing\n");
+   }
+   else if(!RunStage(&stage, stage.atomGrid->natoms, nThreads))
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for \
+Non-bond list\n");
+   }
+   else
+   {
+      nblist = JoinChunks(&stage);
+   }
 
-   for(p=pdb; p!=NULL; NEXT(p))
+   if(stage.hbondHash   != NULL) blFreeHash(stage.hbondHash);
+   if(stage.peptideHash != NULL) blFreeHash(stage.peptideHash);
+   FreeAtomGrid(stage.atomGrid);
+
+   return(nblist);
+}
+
+
+/************************************************************************/
+/*>void NonBondChunk(HBSTAGE *stage, HBCHUNK *chunk)
+   --------------------------------------------------
+*//**
+   \param[in]     *stage    Shared data for the search
+   \param[in,out] *chunk    Range of atoms to process and results
+
+   Finds the non-bonded contacts made by a range of atoms (indexes into
+   the atom grid, which are in linked list order). See FindNonBonds()
+   The contacts are allocated from the chunk's arena so a range's list
+   is contiguous in memory
+
+-  16.10.26 Original   By: ACRM (from FindNonBonds())
+-  16.10.26 Allocates from the chunk's arena
+*/
+void NonBondChunk(HBSTAGE *stage, HBCHUNK *chunk)
+{
+   ATOMGRID  *grid        = stage->atomGrid;
+   PDB       *p, 
+             *q,
+             *lastP       = NULL;
+   REAL      distSq;
+   HBLIST    *nb;
+   BOOL      isPeptide    = FALSE,
+             isLigand;
+   int       *nearby,
+             nNearby,
+             atomNum,
+             i;
+
+   if((nearby = (int *)malloc((grid->natoms + 1) * sizeof(int)))==NULL)
    {
+      chunk->noMemory = TRUE;
+      return;
+   }
+
+   for(atomNum=chunk->start; atomNum<chunk->stop; atomNum++)
+   {
+      p = grid->atoms[atomNum].atom;
+      
       /* Skip hydrogens                                                 */
       if(!strcmp(p->element, "H"))
          continue;
-      
-      isPeptide = isAPeptide(pdb, p);
+
+      /* Peptide status can only change when the chain changes          */
+      if((lastP == NULL) || !PDBCHAINMATCH(p, lastP))
+         isPeptide = (BOOL)blGetHashValueInt(stage->peptideHash, 
+                                             p->chain);
+      lastP = p;
       
       /* If it's a HET/METAL/BOUNDHET or a peptide                      */
-      if(((p->atomtype & ATOMTYPE_NONRESIDUE) && 
-          (p->atomtype != ATOMTYPE_WATER)) ||
-         isPeptide)
+      isLigand = (((p->atomtype & ATOMTYPE_NONRESIDUE) && 
+                   (p->atomtype != ATOMTYPE_WATER)) ||
+                  isPeptide);
+
+      /* If it's neither a ligand nor a nucleotide there is nothing to
+         do
+      */
+      if(!isLigand &&
+         (p->atomtype != ATOMTYPE_NUC) &&
+         (p->atomtype != ATOMTYPE_MODNUC))
+         continue;
+
+      /* Candidates are returned in linked list order                   */
+      nNearby = FindNearbyAtoms(grid, p, nearby);
+      
+      for(i=0; i<nNearby; i++)
       {
-         for(q=pdb; q!=NULL; NEXT(q))
+         q = grid->atoms[nearby[i]].atom;
+         
+         if(p==q)
+            continue;
+
+         if(isLigand)
          {
             /* Skip hydrogens                                           */
             if(!strcmp(q->element, "H"))
@@ -1376,129 +3589,414 @@ HBLIST *FindNonBonds(PDB *pdb, PDB **pdbarray, HBLIST *hbonds,
                 PDBEXTRASPTR(q, PDBEXTRAS)->molid))
                continue;
 
-            if(p==q)
+            /* Must be a protein/nucleotide                             */
+            if((q->atomtype & ATOMTYPE_NONRESIDUE) ||
+               (q->atomtype == ATOMTYPE_UNDEF))
+               continue;
+         }
+         else
+         {
+            /* It's a nucleotide so look for interactions with protein  */
+            if((q->atomtype != ATOMTYPE_ATOM) &&
+               (q->atomtype != ATOMTYPE_MODPROT) &&
+               (q->atomtype != ATOMTYPE_NONSTDAA))
                continue;
+         }
 
-            /* If it's a protein/nucleotide                             */
-            if(!(q->atomtype & ATOMTYPE_NONRESIDUE) &&
-                (q->atomtype != ATOMTYPE_UNDEF))
+         distSq = DISTSQ(p,q);
+         if(distSq >= stage->minNBDistSq && distSq <= stage->maxNBDistSq)
+         {
+            if(!RESIDMATCH(p, q)  &&
+               !blIsConected(p, q) &&
+               !IsHashedAsHBonded(stage->hbondHash, p, q))
             {
-               distSq = DISTSQ(p,q);
-               if(distSq >= minNBDistSq && distSq <= maxNBDistSq)
+               if((nb = (HBLIST *)AllocFromArena(&(chunk->arena)))
+                  ==NULL)
                {
-                  if(!RESIDMATCH(p, q)  &&
-                     !blIsConected(p, q) &&
-                     !IsListedAsHBonded(p, q, hbonds))
-                  {
-                     if(nblist==NULL)
-                     {
-                        INIT(nblist, HBLIST);
-                        nb = nblist;
-                     }
-                     else
-                     {
-                        ALLOCNEXT(nb, HBLIST);
-                     }
-                     if(nb==NULL)
-                     {
-                        FREELIST(nblist, HBLIST);
-                        fprintf(stderr,"pdbhbond: (error) No memory for \
-Non-bond list\n");
-                        return(NULL);
-                     }
-                     nb->donor    = p;
-                     nb->acceptor = q;
-                  }
+                  chunk->noMemory = TRUE;
+                  free(nearby);
+                  return;
                }
+               nb->next     = NULL;
+               nb->donor    = p;
+               nb->acceptor = q;
+
+               if(chunk->hblist==NULL)
+                  chunk->hblist = nb;
+               else
+                  chunk->hbl->next = nb;
+               chunk->hbl = nb;
             }
          }
       }
-      else if((p->atomtype == ATOMTYPE_NUC) || 
-              (p->atomtype == ATOMTYPE_MODNUC))
+   }
+
+   free(nearby);
+}
+
+
+/************************************************************************/
+/*>BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
+   ------------------------------------------------------
+*//**
+   \param[in]     *p      PDB pointer
+   \param[in]     *q      PDB pointer
+   \param[in]     *hbonds List of HBonds iedntified thus far
+   \return                Listed?
+
+   Tests whether the two specified atoms are already listed as being
+   hydrogen bonded
+
+-  07.06.99 Original   By: ACRM
+-  21.07.15 Modified to use PDB files and standard BiopLib structures
+            and functions - added pdb parameter. 
+*/
+BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
+{
+   HBLIST *h;
+
+   for(h=hbonds; h!=NULL; NEXT(h))
+   {
+      if(((h->donor == p) && (h->acceptor == q)) ||
+         ((h->donor == q) && (h->acceptor == p)))
+      {
+         return(TRUE);
+      }
+   }
+
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cutoff)
+   ----------------------------------------------
+*//**
+   \param[in]    *pdb     PDB linked list
+   \param[in]    cutoff   Largest distance that will be searched
+   \return                Spatial grid of all atoms (NULL if no memory)
+
+   Bins every atom (including hydrogens) into cubic cells at least
+   cutoff wide so that any atom within cutoff of another lies in the
+   same or an adjacent cell. If that would need more than MAXGRIDCELLS
+   cells the cell size is increased.
+
+-  16.10.26 Original   By: ACRM
+*/
+ATOMGRID *BuildAtomGrid(PDB *pdb, REAL cutoff)
+{
+   ATOMGRID *grid;
+   PDB      *p;
+   REAL     maxX, maxY, maxZ;
+   int      i, cell, ix, iy, iz;
+
+   if((grid = (ATOMGRID *)malloc(sizeof(ATOMGRID)))==NULL)
+      return(NULL);
+   grid->atoms    = NULL;
+   grid->cellHead = NULL;
+   grid->natoms   = 0;
+
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      if(grid->natoms == 0)
+      {
+         grid->minX = maxX = p->x;
+         grid->minY = maxY = p->y;
+         grid->minZ = maxZ = p->z;
+      }
+      else
       {
-         /* If it's a nucleotide
-            Look for interactions with protein
-         */
-         for(q=pdb; q!=NULL; NEXT(q))
-         {
-            if(p==q)
-               continue;
+         grid->minX = MIN(grid->minX, p->x);
+         grid->minY = MIN(grid->minY, p->y);
+         grid->minZ = MIN(grid->minZ, p->z);
+         maxX       = MAX(maxX, p->x);
+         maxY       = MAX(maxY, p->y);
+         maxZ       = MAX(maxZ, p->z);
+      }
+      grid->natoms++;
+   }
+
+   if(grid->natoms == 0)
+   {
+      grid->minX = grid->minY = grid->minZ = 0.0;
+      maxX       = maxY       = maxZ       = 0.0;
+   }
+   
+   grid->cellSize = cutoff + GRID_SLACK;
+   for(;;)
+   {
+      grid->nx = (int)((maxX - grid->minX) / grid->cellSize) + 1;
+      grid->ny = (int)((maxY - grid->minY) / grid->cellSize) + 1;
+      grid->nz = (int)((maxZ - grid->minZ) / grid->cellSize) + 1;
+      if(((double)grid->nx * grid->ny * grid->nz) <= MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if(((grid->atoms = (GRIDATOM *)malloc((grid->natoms + 1) *
+                                         sizeof(GRIDATOM)))==NULL) ||
+      ((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                       sizeof(int)))==NULL))
+   {
+      FreeAtomGrid(grid);
+      return(NULL);
+   }
+
+   for(cell=0; cell<grid->nx * grid->ny * grid->nz; cell++)
+      grid->cellHead[cell] = (-1);
+
+   for(p=pdb, i=0; p!=NULL; NEXT(p), i++)
+   {
+      ix   = (int)((p->x - grid->minX) / grid->cellSize);
+      iy   = (int)((p->y - grid->minY) / grid->cellSize);
+      iz   = (int)((p->z - grid->minZ) / grid->cellSize);
+      cell = (ix * grid->ny + iy) * grid->nz + iz;
+
+      grid->atoms[i].atom       = p;
+      grid->atoms[i].nextInCell = grid->cellHead[cell];
+      grid->cellHead[cell]      = i;
+   }
+   
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeAtomGrid(ATOMGRID *grid)
+   ---------------------------------
+*//**
+   \param[in]    *grid    Spatial grid to free (may be NULL)
+
+   Frees a grid created by BuildAtomGrid()
+
+-  16.10.26 Original   By: ACRM
+*/
+void FreeAtomGrid(ATOMGRID *grid)
+{
+   if(grid != NULL)
+   {
+      if(grid->atoms    != NULL) free(grid->atoms);
+      if(grid->cellHead != NULL) free(grid->cellHead);
+      free(grid);
+   }
+}
+
+
+/************************************************************************/
+/*>int FindNearbyAtoms(ATOMGRID *grid, PDB *p, int *nearby)
+   --------------------------------------------------------
+*//**
+   \param[in]    *grid    Spatial grid from BuildAtomGrid()
+   \param[in]    *p       Atom to search around
+   \param[out]   *nearby  Grid indexes of atoms in the same or adjacent
+                          cells. Must have space for grid->natoms items
+   \return                Number of atoms found
+
+   Collects the atoms which may lie within the grid cutoff of p. These
+   are sorted into linked list order so that callers see partners in
+   the same order as a scan of the whole list.
 
-            if((q->atomtype == ATOMTYPE_ATOM) ||
-               (q->atomtype == ATOMTYPE_MODPROT) ||
-               (q->atomtype == ATOMTYPE_NONSTDAA))
+-  16.10.26 Original   By: ACRM
+*/
+int FindNearbyAtoms(ATOMGRID *grid, PDB *p, int *nearby)
+{
+   int ix, iy, iz,
+       cx, cy, cz,
+       i,
+       nNearby = 0;
+
+   cx = (int)((p->x - grid->minX) / grid->cellSize);
+   cy = (int)((p->y - grid->minY) / grid->cellSize);
+   cz = (int)((p->z - grid->minZ) / grid->cellSize);
+   
+   for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, grid->nx-1); ix++)
+   {
+      for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, grid->ny-1); iy++)
+      {
+         for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, grid->nz-1); iz++)
+         {
+            for(i=grid->cellHead[(ix * grid->ny + iy) * grid->nz + iz];
+                i>=0;
+                i=grid->atoms[i].nextInCell)
             {
-               distSq = DISTSQ(p,q);
-               if(distSq >= minNBDistSq && distSq <= maxNBDistSq)
-               {
-                  if(!RESIDMATCH(p, q) &&
-                     !blIsConected(p, q) &&
-                     !IsListedAsHBonded(p, q, hbonds))
-                  {
-                     if(nblist==NULL)
-                     {
-                        INIT(nblist, HBLIST);
-                        nb = nblist;
-                     }
-                     else
-                     {
-                        ALLOCNEXT(nb, HBLIST);
-                     }
-                     if(nb==NULL)
-                     {
-                        FREELIST(nblist, HBLIST);
-                        fprintf(stderr,"pdbhbond: (error) No memory for \
-Non-bond list\n");
-                        return(NULL);
-                     }
-                     nb->donor    = p;
-                     nb->acceptor = q;
-                  }
-               }
+               nearby[nNearby++] = i;
             }
          }
       }
    }
-   return(nblist);
+
+   qsort(nearby, nNearby, sizeof(int), CompareInts);
+   return(nNearby);
+}
+
+
+/************************************************************************/
+/*>int CompareInts(const void *a, const void *b)
+   ---------------------------------------------
+*//**
+   qsort() comparison function for ints
+
+-  16.10.26 Original   By: ACRM
+*/
+int CompareInts(const void *a, const void *b)
+{
+   return(*(const int *)a - *(const int *)b);
+}
+
+
+/************************************************************************/
+/*>HASHTABLE *BuildPeptideChainHash(PDB *pdb)
+   ------------------------------------------
+*//**
+   \param[in]    *pdb    PDB linked list
+   \return               Hash of chain label to peptide status (1/0),
+                         NULL if no memory
+
+   Works out isAPeptide() once for each chain label. As in isAPeptide()
+   only the first block of atoms with a given label is counted.
+
+-  16.10.26 Original   By: ACRM
+*/
+HASHTABLE *BuildPeptideChainHash(PDB *pdb)
+{
+   HASHTABLE *hash;
+   PDB       *chainStart,
+             *nextChain,
+             *res;
+   int       nRes;
+   
+   if((hash = blInitializeHash(HASHSIZE))==NULL)
+      return(NULL);
+   
+   for(chainStart=pdb; chainStart!=NULL; chainStart=nextChain)
+   {
+      nextChain = blFindNextChain(chainStart);
+
+      if(!blHashKeyDefined(hash, chainStart->chain))
+      {
+         for(res=chainStart, nRes=0;
+             res!=nextChain;
+             res=blFindNextResidue(res))
+         {
+            nRes++;
+         }
+         
+         if(!blSetHashValueInt(hash, chainStart->chain,
+                               (nRes > MAX_PEPTIDE_LENGTH) ? 0 : 1))
+         {
+            blFreeHash(hash);
+            return(NULL);
+         }
+      }
+   }
+   
+   return(hash);
 }
 
 
 /************************************************************************/
-/*>BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
-   ------------------------------------------------------
+/*>HASHTABLE *BuildHBondHash(HBLIST *hbonds)
+   -----------------------------------------
 *//**
-   \param[in]     *p      PDB pointer
-   \param[in]     *q      PDB pointer
-   \param[in]     *hbonds List of HBonds iedntified thus far
-   \return                Listed?
+   \param[in]    *hbonds  Linked list of HBonds
+   \return                Hash of HBonded atom pairs (NULL if no memory)
 
-   Tests whether the two specified atoms are already listed as being
-   hydrogen bonded
+   Builds a hash containing both orderings of each HBonded pair so that
+   IsHashedAsHBonded() can replace a scan with IsListedAsHBonded()
 
--  07.06.99 Original   By: ACRM
--  21.07.15 Modified to use PDB files and standard BiopLib structures
-            and functions - added pdb parameter. 
+-  16.10.26 Original   By: ACRM
 */
-BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
+HASHTABLE *BuildHBondHash(HBLIST *hbonds)
 {
-   HBLIST *h;
+   HASHTABLE *hash;
+   HBLIST    *h;
 
+   if((hash = blInitializeHash(HASHSIZE))==NULL)
+      return(NULL);
+   
    for(h=hbonds; h!=NULL; NEXT(h))
    {
-      if(((h->donor == p) && (h->acceptor == q)) ||
-         ((h->donor == q) && (h->acceptor == p)))
+      if(!AddHBondToHash(hash, h))
       {
-         return(TRUE);
+         blFreeHash(hash);
+         return(NULL);
       }
    }
+   
+   return(hash);
+}
 
-   return(FALSE);
+
+/************************************************************************/
+/*>BOOL AddHBondToHash(HASHTABLE *hash, HBLIST *h)
+   ----------------------------------------------
+*//**
+   \param[in,out] *hash   Hash of HBonded atom pairs
+   \param[in]     *h      HBond to add
+   \return                Success
+
+   Adds both orderings of an HBonded pair to the hash
+
+-  16.10.26 Original   By: ACRM (from BuildHBondHash())
+*/
+BOOL AddHBondToHash(HASHTABLE *hash, HBLIST *h)
+{
+   char key[MAXHBONDKEY];
+
+   MakeHBondKey(key, h->donor, h->acceptor);
+   if(!blSetHashValuePointer(hash, key, (BPTR)h))
+      return(FALSE);
+   MakeHBondKey(key, h->acceptor, h->donor);
+   if(!blSetHashValuePointer(hash, key, (BPTR)h))
+      return(FALSE);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void MakeHBondKey(char *key, PDB *p, PDB *q)
+   --------------------------------------------
+*//**
+   \param[out]   *key    Hash key (at least MAXHBONDKEY characters)
+   \param[in]    *p      PDB pointer
+   \param[in]    *q      PDB pointer
+
+   Creates a hash key for an ordered pair of atoms
+
+-  16.10.26 Original   By: ACRM
+*/
+void MakeHBondKey(char *key, PDB *p, PDB *q)
+{
+   sprintf(key, "%p %p", (void *)p, (void *)q);
+}
+
+
+/************************************************************************/
+/*>BOOL IsHashedAsHBonded(HASHTABLE *hbondHash, PDB *p, PDB *q)
+   ------------------------------------------------------------
+*//**
+   \param[in]    *hbondHash  Hash from BuildHBondHash()
+   \param[in]    *p          PDB pointer
+   \param[in]    *q          PDB pointer
+   \return                   Listed?
+
+   Hashed equivalent of IsListedAsHBonded()
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL IsHashedAsHBonded(HASHTABLE *hbondHash, PDB *p, PDB *q)
+{
+   char key[MAXHBONDKEY];
+   
+   MakeHBondKey(key, p, q);
+   return(blHashKeyDefined(hbondHash, key));
 }
 
 
 /************************************************************************/
 /*>HBLIST *FindLigandLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
-                                  REAL maxHBDistSq)
+                                  REAL maxHBDistSq, int nThreads)
    ---------------------------------------------------------------------
 *//**
    \param[in]      *pdb        PDB linked list
@@ -1506,6 +4004,7 @@ BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
                                number
    \param[in]      pseudo      Pseudo hbonds? (or true HBonds)
    \param[in]      maxHBDistSq Max D-A Hbond distance
+   \param[in]      nThreads    Number of threads to use
    \return                     Linked list of hbonds
 
    Finds HBonds between ligands. If pseudo is true then it finds 
@@ -1516,33 +4015,73 @@ BOOL IsListedAsHBonded(PDB *p, PDB *q, HBLIST *hbonds)
 -  16.06.99 Added maxHBDistSq parameter
 -  21.07.15 Modified to use PDB files and standard BiopLib structures
             and functions - added pdb parameter. 
+-  16.10.26 Added nThreads. The atoms are split into ranges handled by
+            LigandLigandChunk()
 */
 HBLIST *FindLigandLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
-                               REAL maxHBDistSq)
+                               REAL maxHBDistSq, int nThreads)
 {
-   PDB           *p, *q;
-   static HBLIST *hblist = NULL,
-                 *hbl,
-                 *hb;
-   static int    prevPseudo = (-5);
+   HBSTAGE stage;
+   HBLIST  *hblist = NULL;
+   int     natoms;
 
+   if((stage.atoms = blIndexPDB(pdb, &natoms))==NULL)
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for ligand-ligand \
+HBonds\n");
+      return(NULL);
+   }
    
-   if(pseudo != prevPseudo)
+   stage.pdb         = pdb;
+   stage.pdbarray    = pdbarray;
+   stage.pseudo      = pseudo;
+   stage.maxHBDistSq = maxHBDistSq;
+   stage.resultArena = NULL;
+   stage.DoChunk     = LigandLigandChunk;
+
+   if(RunStage(&stage, natoms, nThreads))
+   {
+      hblist = MergeChunksUnique(&stage);
+   }
+   else
    {
-      prevPseudo = pseudo;
-      hblist = NULL;
-      hbl    = NULL;
-      hb     = NULL;
+      fprintf(stderr,"pdbhbond: (error) No memory for ligand-ligand \
+HBonds\n");
    }
    
-   for(p=pdb; p!=NULL; NEXT(p))
+   free(stage.atoms);
+   return(hblist);
+}
+
+
+/************************************************************************/
+/*>void LigandLigandChunk(HBSTAGE *stage, HBCHUNK *chunk)
+   -------------------------------------------------------
+*//**
+   \param[in]     *stage    Shared data for the search
+   \param[in,out] *chunk    Range of atoms to process and results
+
+   Finds the ligand-ligand HBonds made by a range of atoms. See
+   FindLigandLigandHBonds()
+
+-  16.10.26 Original   By: ACRM (from FindLigandLigandHBonds())
+*/
+void LigandLigandChunk(HBSTAGE *stage, HBCHUNK *chunk)
+{
+   PDB    *p, *q;
+   HBLIST *hb;
+   int    atomNum;
+
+   for(atomNum=chunk->start; atomNum<chunk->stop; atomNum++)
    {
+      p = stage->atoms[atomNum];
+      
       /* If it's a HET/METAL/BOUNDHET                                   */
       if((p->atomtype & ATOMTYPE_NONRESIDUE) &&
          (p->atomtype != ATOMTYPE_WATER))
       {
          /* Look for interactions with protein or nucleotide            */
-         for(q=pdb; q!=NULL; NEXT(q))
+         for(q=stage->pdb; q!=NULL; NEXT(q))
          {
             /* Inter-molecule only...                                   */
             if((p == q) || PDBCHAINMATCH(p, q))
@@ -1556,36 +4095,35 @@ HBLIST *FindLigandLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
                   current HBond list
                */
                if(!blIsConected(p, q) &&
-                  !IsListedAsHBonded(p, q, hblist))
+                  !IsListedAsHBonded(p, q, chunk->hblist))
                {
-                  if((hb=TestForHBond(pdb, p, q,pdbarray,pseudo,
-                                      maxHBDistSq))!=NULL)
+                  if((hb=TestForHBond(stage->pdb, p, q, stage->pdbarray,
+                                      stage->pseudo,
+                                      stage->maxHBDistSq))!=NULL)
                   {
                      /* Store the Hbond                                 */
-                     if(hblist==NULL)
+                     if(chunk->hblist==NULL)
                      {
-                        hblist = hbl = hb;
+                        chunk->hblist = chunk->hbl = hb;
                      }
                      else
                      {
-                        hbl->next = hb;
+                        chunk->hbl->next = hb;
                      }
-                     if(hbl!=NULL)
-                        LAST(hbl);
+                     if(chunk->hbl!=NULL)
+                        LAST(chunk->hbl);
                   }
                }
             }
          }
       }
    }
-   
-   return(hblist);
 }
 
 
 /************************************************************************/
 /*>HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
-                                REAL maxHBDistSq)
+                                REAL maxHBDistSq, int nThreads)
    -------------------------------------------------------------------
 *//**
    \param[in]     *pdb        PDB linked list
@@ -1593,6 +4131,7 @@ HBLIST *FindLigandLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
                               number
    \param[in]     pseudo      Pseudo hbonds? (or true HBonds)
    \param[in]     maxHBDistSq Max D-A HBond distance
+   \param[in]     nThreads    Number of threads to use
    \return                    Linked list of hbonds
 
    Finds HBonds between protein and ligand. If pseudo is true then it
@@ -1608,33 +4147,79 @@ HBLIST *FindLigandLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
             molecules!
 -  21.07.15 Modified to use PDB files and standard BiopLib structures
             and functions - added pdb parameter. 
+-  16.10.26 Added nThreads. The atoms are split into ranges handled by
+            ProtLigandChunk(). Peptide status is looked up per chain
 */
 HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
-                             REAL maxHBDistSq)
+                             REAL maxHBDistSq, int nThreads)
 {
-   PDB           *p, *q;
-   static HBLIST *hblist = NULL,
-                 *hbl,
-                 *hb;
-   static int    prevPseudo = (-5);
+   HBSTAGE stage;
+   HBLIST  *hblist = NULL;
+   int     natoms;
 
-   
-   if(pseudo != prevPseudo)
+   stage.peptideHash = NULL;
+   if(((stage.atoms       = blIndexPDB(pdb, &natoms))==NULL) ||
+      ((stage.peptideHash = BuildPeptideChainHash(pdb))==NULL))
    {
-      prevPseudo = pseudo;
-      hblist = NULL;
-      hbl    = NULL;
-      hb     = NULL;
+      if(stage.atoms != NULL)
+         free(stage.atoms);
+      fprintf(stderr,"pdbhbond: (error) No memory for protein-ligand \
+HBonds\n");
+      return(NULL);
    }
    
-   for(p=pdb; p!=NULL; NEXT(p))
+   stage.pdb         = pdb;
+   stage.pdbarray    = pdbarray;
+   stage.pseudo      = pseudo;
+   stage.maxHBDistSq = maxHBDistSq;
+   stage.resultArena = NULL;
+   stage.DoChunk     = ProtLigandChunk;
+
+   if(RunStage(&stage, natoms, nThreads))
+   {
+      hblist = MergeChunksUnique(&stage);
+   }
+   else
+   {
+      fprintf(stderr,"pdbhbond: (error) No memory for protein-ligand \
+HBonds\n");
+   }
+
+   blFreeHash(stage.peptideHash);
+   free(stage.atoms);
+   return(hblist);
+}
+
+
+/************************************************************************/
+/*>void ProtLigandChunk(HBSTAGE *stage, HBCHUNK *chunk)
+   -----------------------------------------------------
+*//**
+   \param[in]     *stage    Shared data for the search
+   \param[in,out] *chunk    Range of atoms to process and results
+
+   Finds the protein-ligand HBonds made by a range of atoms. See
+   FindProtLigandHBonds()
+
+-  16.10.26 Original   By: ACRM (from FindProtLigandHBonds())
+*/
+void ProtLigandChunk(HBSTAGE *stage, HBCHUNK *chunk)
+{
+   PDB    *p, *q;
+   HBLIST *hb;
+   BOOL   pseudo = stage->pseudo;
+   int    atomNum;
+
+   for(atomNum=chunk->start; atomNum<chunk->stop; atomNum++)
    {
+      p = stage->atoms[atomNum];
+      
       /* If it's a HET/METAL/BOUNDHET                                   */
       if((p->atomtype & ATOMTYPE_NONRESIDUE) && 
          (p->atomtype != ATOMTYPE_WATER))
       {
          /* Look for interactions with protein or nucleotide            */
-         for(q=pdb; q!=NULL; NEXT(q))
+         for(q=stage->pdb; q!=NULL; NEXT(q))
          {
             /* 03.11.99 Check that it's a different molecule as well as 
                a different atom
@@ -1652,22 +4237,22 @@ HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
                   current HBond list
                */
                if(!blIsConected(p, q) &&
-                  !IsListedAsHBonded(p, q, hblist))
+                  !IsListedAsHBonded(p, q, chunk->hblist))
                {
-                  if((hb=TestForHBond(pdb, p,q,pdbarray,pseudo,
-                                      maxHBDistSq))!=NULL)
+                  if((hb=TestForHBond(stage->pdb, p, q, stage->pdbarray,
+                                      pseudo, stage->maxHBDistSq))!=NULL)
                   {
                      /* Store the Hbond                                 */
-                     if(hblist==NULL)
+                     if(chunk->hblist==NULL)
                      {
-                        hblist = hbl = hb;
+                        chunk->hblist = chunk->hbl = hb;
                      }
                      else
                      {
-                        hbl->next = hb;
+                        chunk->hbl->next = hb;
                      }
-                     if(hbl!=NULL)
-                        LAST(hbl);
+                     if(chunk->hbl!=NULL)
+                        LAST(chunk->hbl);
                   }
                }
             }
@@ -1678,10 +4263,10 @@ HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
          /* If it's a nucleotide or a peptide                           */
          if((p->atomtype == ATOMTYPE_NUC) || 
             (p->atomtype == ATOMTYPE_MODNUC) ||
-            isAPeptide(pdb, p))
+            blGetHashValueInt(stage->peptideHash, p->chain))
          {
             /* Look for interactions with protein                       */
-            for(q=pdb; q!=NULL; NEXT(q))
+            for(q=stage->pdb; q!=NULL; NEXT(q))
             {
                /* 03.11.99 Check that it's a different molecule as well
                   as a different atom
@@ -1699,23 +4284,24 @@ HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
                      current HBond list
                   */
                   if(!blIsConected(p, q) &&
-                     !IsListedAsHBonded(p, q, hblist))
+                     !IsListedAsHBonded(p, q, chunk->hblist))
                   {
-                     if((hb=TestForHBond(pdb,p,q,pdbarray,pseudo,
-                                         maxHBDistSq))
+                     if((hb=TestForHBond(stage->pdb, p, q,
+                                         stage->pdbarray, pseudo,
+                                         stage->maxHBDistSq))
                         != NULL)
                      {
                         /* Store the Hbond                              */
-                        if(hblist==NULL)
+                        if(chunk->hblist==NULL)
                         {
-                           hblist = hbl = hb;
+                           chunk->hblist = chunk->hbl = hb;
                         }
                         else
                         {
-                           hbl->next = hb;
+                           chunk->hbl->next = hb;
                         }
-                        if(hbl!=NULL)
-                           LAST(hbl);
+                        if(chunk->hbl!=NULL)
+                           LAST(chunk->hbl);
                      }
                   }
                }
@@ -1723,8 +4309,6 @@ HBLIST *FindProtLigandHBonds(PDB *pdb, PDB **pdbarray, BOOL pseudo,
          }
       }
    }
-   
-   return(hblist);
 }
 
 
@@ -1790,20 +4374,25 @@ void SetAtomNumExtras(PDB *pdb)
 }
 
 /************************************************************************/
-/*>BOOL UpdatePDBExtras(PDB *pdb)
-   ------------------------------
+/*>BOOL UpdatePDBExtras(PDB *pdb, ARENA *extrasArena)
+   ---------------------------------------------------
 *//**
-   \param[in, out]   *pdb    PDB linked list
-   \return                   Success in allocations
+   \param[in, out]   *pdb         PDB linked list
+   \param[in, out]   *extrasArena Arena for the extras
+   \return                        Success in allocations
 
    Walks the PDB linked list creating an 'extra' structure for each
    PDB entry that doesn't already have one. 
    It initializes the PDB.extras.origAtnum to -1
    and the PDB.extras.molid to 0
 
+   The extras are freed with FreeArena(extrasArena) rather than 
+   FREEPDBEXTRAS()
+
 -  21.07.15  Original   By: ACRM
+-  16.10.26  Allocates from extrasArena
 */
-BOOL UpdatePDBExtras(PDB *pdb)
+BOOL UpdatePDBExtras(PDB *pdb, ARENA *extrasArena)
 {
    PDB *p;
    
@@ -1811,10 +4400,9 @@ BOOL UpdatePDBExtras(PDB *pdb)
    {
       if(p->extras == NULL)
       {
-         if((p->extras = (APTR)malloc(sizeof(PDBEXTRAS)))==NULL)
+         if((p->extras = AllocFromArena(extrasArena))==NULL)
             return(FALSE);
-         PDBEXTRASPTR(p, PDBEXTRAS)->origAtnum = (-1);
-         PDBEXTRASPTR(p, PDBEXTRAS)->molid     = 0;
+         ClearPDBExtras(PDBEXTRASPTR(p, PDBEXTRAS));
       }
    }
 
@@ -1822,6 +4410,381 @@ BOOL UpdatePDBExtras(PDB *pdb)
 }
 
 
+/************************************************************************/
+/*>void InitArena(ARENA *arena, size_t itemSize, int itemsPerBlock)
+   ----------------------------------------------------------------
+*//**
+   \param[out]   *arena         Arena to initialize
+   \param[in]    itemSize       Size of each item
+   \param[in]    itemsPerBlock  Number of items allocated at a time
+
+   Sets up an empty arena. Nothing is allocated until the first call to
+   AllocFromArena()
+
+-  16.10.26 Original   By: ACRM
+*/
+void InitArena(ARENA *arena, size_t itemSize, int itemsPerBlock)
+{
+   arena->blocks        = NULL;
+   arena->itemSize      = itemSize;
+   arena->itemsPerBlock = itemsPerBlock;
+   arena->nUsed         = itemsPerBlock;
+}
+
+
+/************************************************************************/
+/*>APTR AllocFromArena(ARENA *arena)
+   ---------------------------------
+*//**
+   \param[in,out] *arena    Arena
+   \return                  Zeroed item (NULL if no memory)
+
+   Hands out the next item from the current block, allocating a new
+   block when that is full. Items are only freed by FreeArena()
+
+-  16.10.26 Original   By: ACRM
+*/
+APTR AllocFromArena(ARENA *arena)
+{
+   ARENABLOCK *block;
+   
+   if(arena->nUsed == arena->itemsPerBlock)
+   {
+      if((block = (ARENABLOCK *)malloc(sizeof(ARENABLOCK)))==NULL)
+         return(NULL);
+      if((block->items = (char *)calloc(arena->itemsPerBlock, 
+                                        arena->itemSize))==NULL)
+      {
+         free(block);
+         return(NULL);
+      }
+      block->next   = arena->blocks;
+      arena->blocks = block;
+      arena->nUsed  = 0;
+   }
+
+   return((APTR)(arena->blocks->items + 
+                 (arena->nUsed++ * arena->itemSize)));
+}
+
+
+/************************************************************************/
+/*>void AppendArena(ARENA *arena, ARENA *from)
+   --------------------------------------------
+*//**
+   \param[in,out] *arena    Arena to take the blocks
+   \param[in,out] *from     Arena of the same item size. Left empty
+
+   Moves the blocks of one arena to another so they are freed with it.
+   The current block of arena is kept for further allocations
+
+-  16.10.26 Original   By: ACRM
+*/
+void AppendArena(ARENA *arena, ARENA *from)
+{
+   ARENABLOCK *block;
+   
+   if(from->blocks == NULL)
+      return;
+
+   if(arena->blocks == NULL)
+   {
+      arena->blocks = from->blocks;
+      arena->nUsed  = from->nUsed;
+   }
+   else
+   {
+      for(block=from->blocks; block->next!=NULL; block=block->next);
+      block->next          = arena->blocks->next;
+      arena->blocks->next  = from->blocks;
+   }
+
+   InitArena(from, from->itemSize, from->itemsPerBlock);
+}
+
+
+/************************************************************************/
+/*>void FreeArena(ARENA *arena)
+   -----------------------------
+*//**
+   \param[in,out] *arena    Arena
+
+   Frees everything allocated from the arena, leaving it empty and ready
+   for reuse
+
+-  16.10.26 Original   By: ACRM
+*/
+void FreeArena(ARENA *arena)
+{
+   ARENABLOCK *block;
+
+   while((block = arena->blocks) != NULL)
+   {
+      arena->blocks = block->next;
+      free(block->items);
+      free(block);
+   }
+   arena->nUsed = arena->itemsPerBlock;
+}
+
+
+/************************************************************************/
+/*>void ClearPDBExtras(PDBEXTRAS *extras)
+   ---------------------------------------
+*//**
+   \param[out]   *extras    Extras structure to initialize
+
+   Sets origAtnum to -1, molid to 0 and clears the hydrogen and 
+   antecedent index
+
+-  16.10.26 Original   By: ACRM (from UpdatePDBExtras())
+*/
+void ClearPDBExtras(PDBEXTRAS *extras)
+{
+   extras->origAtnum      = (-1);
+   extras->molid          = 0;
+   extras->resHyd         = NULL;
+   extras->bondedH        = NULL;
+   extras->nBondedH       = 0;
+   extras->antecedent     = NULL;
+   extras->nAntecedents   = 0;
+   extras->haveAntecedent = FALSE;
+}
+
+
+/************************************************************************/
+/*>RESHYD *BuildHydrogenIndex(PDB *pdb, PDB **pdbarray)
+   ----------------------------------------------------
+*//**
+   \param[in,out] *pdb       PDB linked list with extras
+   \param[in]     **pdbarray Array of PDB pointers indexed by atom number
+   \return                   List of residue hydrogen records (NULL if
+                             no memory)
+
+   Builds the index used by FindBondedHydrogen() and FindAntecedent()
+   so that they don't have to search the linked list for every HBond
+   tested. Must be called once hydrogens have been added and CONECTs
+   finalized. For each atom the extras are set with:
+   - the hydrogens in the residue that blFindResidue() (or for HETATMs
+     blFindHetatmResidue()) would find for the atom's residue ID. These
+     are looked up via a hash of residue IDs built in a single pass
+   - the hydrogens within bonding distance that follow the atom in its
+     residue
+   - the first antecedent and its count
+
+-  16.10.26 Original   By: ACRM
+*/
+RESHYD *BuildHydrogenIndex(PDB *pdb, PDB **pdbarray)
+{
+   HASHTABLE *resHash;
+   RESHYD    *resHydList = NULL,
+             *rh;
+   PDB       *p, *q;
+   PDBEXTRAS *extras;
+   char      key[MAXRESKEY];
+   int       pass,
+             nBondedH;
+   BOOL      ok = TRUE;
+
+   if((resHash = blInitializeHash(HASHSIZE))==NULL)
+      return(NULL);
+
+   /* Record the first atom of each residue ID, and separately the first
+      HETATM, as these are what blFindResidue() and 
+      blFindHetatmResidue() return
+   */
+   for(p=pdb; ok && (p!=NULL); NEXT(p))
+   {
+      for(pass=0; pass<2; pass++)
+      {
+         if((pass==1) && strncmp(p->record_type, "HETATM", 6))
+            continue;
+         
+         MakeResidueKey(key, (pass ? 'H' : 'A'), p);
+         if(!blHashKeyDefined(resHash, key))
+         {
+            if(((rh = IndexResidueHydrogens(p))==NULL) ||
+               !blSetHashValuePointer(resHash, key, (BPTR)rh))
+            {
+               if(rh != NULL)
+               {
+                  free(rh->hydrogens);
+                  free(rh);
+               }
+               ok = FALSE;
+               break;
+            }
+            rh->next   = resHydList;
+            resHydList = rh;
+         }
+      }
+   }
+
+   for(p=pdb; ok && (p!=NULL); NEXT(p))
+   {
+      extras = PDBEXTRASPTR(p, PDBEXTRAS);
+      
+      /* Residue hydrogens                                              */
+      MakeResidueKey(key, 
+                     (strncmp(p->record_type, "HETATM", 6) ? 'A' : 'H'),
+                     p);
+      extras->resHyd = (RESHYD *)blGetHashValuePointer(resHash, key);
+
+      /* Bonded hydrogens following this atom                           */
+      if(strcmp(p->element, "H"))
+      {
+         nBondedH = 0;
+         for(q=p->next; q!=NULL && RESIDMATCH(q, p); NEXT(q))
+         {
+            if(!strcmp(q->element, "H") && (DISTSQ(q, p) <= MAXBONDSQ))
+               nBondedH++;
+         }
+
+         if(nBondedH)
+         {
+            if((extras->bondedH = (PDB **)malloc(nBondedH * 
+                                                 sizeof(PDB *)))==NULL)
+            {
+               ok = FALSE;
+               break;
+            }
+            for(q=p->next; q!=NULL && RESIDMATCH(q, p); NEXT(q))
+            {
+               if(!strcmp(q->element, "H") && 
+                  (DISTSQ(q, p) <= MAXBONDSQ))
+                  extras->bondedH[extras->nBondedH++] = q;
+            }
+         }
+      }
+
+      /* First antecedent                                               */
+      extras->antecedent     = FindAntecedent(p, pdbarray, 
+                                              &(extras->nAntecedents), 1);
+      extras->haveAntecedent = TRUE;
+   }
+
+   blFreeHash(resHash);
+
+   if(!ok)
+   {
+      FreeHydrogenIndex(pdb, resHydList);
+      return(NULL);
+   }
+   
+   return(resHydList);
+}
+
+
+/************************************************************************/
+/*>RESHYD *IndexResidueHydrogens(PDB *start)
+   ------------------------------------------
+*//**
+   \param[in]    *start    First atom of a residue
+   \return                 Record of the hydrogens from start up to the
+                           next residue (NULL if no memory)
+
+-  16.10.26 Original   By: ACRM
+*/
+RESHYD *IndexResidueHydrogens(PDB *start)
+{
+   RESHYD *rh;
+   PDB    *stop,
+          *p;
+   
+   if((rh = (RESHYD *)malloc(sizeof(RESHYD)))==NULL)
+      return(NULL);
+
+   rh->next       = NULL;
+   rh->start      = start;
+   rh->hydrogens  = NULL;
+   rh->nHydrogens = 0;
+
+   stop = blFindNextResidue(start);
+   for(p=start; p!=stop; NEXT(p))
+   {
+      if(!strcmp(p->element, "H"))
+         rh->nHydrogens++;
+   }
+
+   if(rh->nHydrogens)
+   {
+      if((rh->hydrogens = (PDB **)malloc(rh->nHydrogens * 
+                                         sizeof(PDB *)))==NULL)
+      {
+         free(rh);
+         return(NULL);
+      }
+      rh->nHydrogens = 0;
+      for(p=start; p!=stop; NEXT(p))
+      {
+         if(!strcmp(p->element, "H"))
+            rh->hydrogens[rh->nHydrogens++] = p;
+      }
+   }
+   
+   return(rh);
+}
+
+
+/************************************************************************/
+/*>void MakeResidueKey(char *key, char type, PDB *p)
+   -------------------------------------------------
+*//**
+   \param[out]   *key     Hash key (MAXRESKEY characters)
+   \param[in]    type     'A' for any record type, 'H' for HETATM
+   \param[in]    *p       Atom whose residue ID is used
+
+   Makes a key from the residue ID, matching as blFindResidue() does
+
+-  16.10.26 Original   By: ACRM
+*/
+void MakeResidueKey(char *key, char type, PDB *p)
+{
+   sprintf(key, "%c|%.8s|%d|%c", type, p->chain, p->resnum, 
+           p->insert[0]);
+}
+
+
+/************************************************************************/
+/*>void FreeHydrogenIndex(PDB *pdb, RESHYD *resHydList)
+   ----------------------------------------------------
+*//**
+   \param[in,out] *pdb         PDB linked list with extras
+   \param[in]     *resHydList  List from BuildHydrogenIndex()
+
+   Frees the hydrogen index and clears it from the extras
+
+-  16.10.26 Original   By: ACRM
+*/
+void FreeHydrogenIndex(PDB *pdb, RESHYD *resHydList)
+{
+   PDB       *p;
+   RESHYD    *rh;
+   PDBEXTRAS *extras;
+
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      if((extras = PDBEXTRASPTR(p, PDBEXTRAS)) != NULL)
+      {
+         if(extras->bondedH != NULL)
+            free(extras->bondedH);
+         extras->bondedH        = NULL;
+         extras->nBondedH       = 0;
+         extras->resHyd         = NULL;
+         extras->haveAntecedent = FALSE;
+      }
+   }
+
+   for(rh=resHydList; rh!=NULL; rh=resHydList)
+   {
+      resHydList = rh->next;
+      if(rh->hydrogens != NULL)
+         free(rh->hydrogens);
+      free(rh);
+   }
+}
+
+
 /************************************************************************/
 /*>BOOL SetMolecules(PDB *pdb)
    ---------------------------
@@ -3,11 +3,11 @@
 
    \file       pdbmakepatch.c
    
-   \version    V1.12
-   \date       12.03.15
+   \version    V1.16
+   \date       16.10.26
    \brief      Build patches around a surface atom
    
-   \copyright  (c) UCL / Dr. Andrew C. R. Martin 2009-2017
+   \copyright  (c) UCL / Dr. Andrew C. R. Martin 2009-2026
    \author     Dr. Andrew C. R. Martin, Anja Baresic
    \par
                Biomolecular Structure & Modelling Unit,
@@ -51,6 +51,9 @@
    contacting that central atom and in turn contacting atoms already in
    the patch.
 
+   With -a, a patch is built around the named atom of every surface 
+   residue and a one-line summary of each is written.
+
 
 **************************************************************************
 
@@ -81,15 +84,28 @@
 -  V1.10 06.11.14  Renamed from makepatch
 -  V1.11 12.03.15  Changed to allow multi-character chain names
 -  V1.12 21.11.17  Updated usage to explain use with pdbsolv
+-  V1.13 16.10.26  Added -a to build the patch around every surface
+                   residue in one run. The solvent vectors are now 
+                   calculated once by CalcSolvVecs()
+-  V1.14 16.10.26  Patches are grown breadth-first over precomputed 
+                   contact lists rather than by repeated sweeps of the
+                   whole structure
+-  V1.15 16.10.26  The nearest C-alphas for the solvent vectors are 
+                   found from a grid rather than by sorting the whole
+                   chain, and occ is no longer used to store distances
+-  V1.16 16.10.26  The C-alpha of each atom's residue is looked up once
+                   when the contact lists are built
 
 *************************************************************************/
 /* Includes
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "bioplib/pdb.h"
+#include "bioplib/hash.h"
 #include "bioplib/macros.h"
 
 
@@ -105,6 +121,55 @@
                                    include when claculating centre of 
                                    mass in CalcMassCentre()
                                 */
+#define MAXGRIDCELLS       1000000 /* Max cells used to find contacts   */
+#define GRID_SLACK         0.001   /* Added to cell size                */
+#define HASHSIZE           1000    /* Size of the C-alpha index         */
+#define CAGRIDSIZE         6.0     /* Cell size used to find the nearest
+                                      C-alphas
+                                   */
+#define MINCADIST          0.01    /* C-alphas closer than this to the
+                                      central one are ignored
+                                   */
+
+/* Key for the C-alpha of a residue                                     */
+#define MAKECAKEY(key, p)                                                \
+   sprintf((key), "%.8s|%d|%.8s", (p)->chain, (p)->resnum, (p)->insert)
+
+/************************************************************************/
+/* Structure definitions
+*/
+/* End of the solvent vector of a C-alpha, i.e. the centre of mass of the
+   NCLOSE nearest C-alphas
+*/
+typedef struct
+{
+   REAL x, y, z;
+}  SOLVVEC;
+
+/* Atoms which may be in a patch and the atoms each of them contacts. The
+   contacts of atom i are contacts[first[i]] to contacts[first[i+1]-1]
+*/
+typedef struct
+{
+   PDB  **atoms,
+        **residueCA;            /* C-alpha of each atom's residue       */
+   int  natoms,
+        *first,
+        *contacts,
+        *queue;                 /* Frontier of the patch being grown    */
+}  CONTACTS;
+
+/* C-alphas sorted into cubic cells to find the nearest ones            */
+typedef struct
+{
+   PDB  **atoms;
+   int  natoms,
+        *cellHead,              /* First atom in each cell (or -1)      */
+        *nextInCell,            /* Next atom in the same cell (or -1)   */
+        nx, ny, nz;
+   REAL minX, minY, minZ,
+        cellSize;
+}  CAGRID;
 
 /************************************************************************/
 /* Globals
@@ -117,6 +182,16 @@ int  main(int argc, char **argv);
 void MakePatches(PDB *pdb, char *CentreRes, char *CentreAtom,
                  REAL radius, REAL tolerance, PDB *CA, BOOL ringOnly,
                  REAL minAccess);
+void GrowPatch(PDB *pdb, PDB *catom, REAL radius, CONTACTS *contacts,
+               BOOL ringOnly);
+CONTACTS *BuildContacts(PDB *pdb, PDB *CA, REAL tolerance, 
+                        REAL minAccess, PDB *catom, REAL radius);
+BOOL IndexResidueCAs(CONTACTS *contacts, PDB *CA);
+void FreeContacts(CONTACTS *contacts);
+void MakeAllPatches(FILE *out, PDB *pdb, char *CentreAtom, REAL radius,
+                    REAL tolerance, PDB *CA, int nCatom, BOOL ringOnly, 
+                    REAL minAccess);
+PDB  *FindResidueCA(HASHTABLE *caIndex, PDB *p);
 BOOL FlagSet(PDB *p);
 void SetFlag(PDB *p);
 void ClearFlag(PDB *p);
@@ -125,13 +200,18 @@ void ClearFlags(PDB *pdb);
 BOOL ParseCmdLine(int argc, char **argv, char *CentreRes, 
                   char *CentreAtom, char *infile, char *outfile,
                   REAL *radius, REAL *tolerance, BOOL *summary,
-                  BOOL *ringOnly, REAL *minAccess);
+                  BOOL *ringOnly, REAL *minAccess, BOOL *allCentres);
 
 void FlagSolvVecAngles(PDB *CA, char *Central, int natom);
-void DistFromCentral(PDB *pdb, PDB *central);
-void MassCentre(PDB *pdb, PDB *central, int *natom, REAL *Masscen_x,
+SOLVVEC *CalcSolvVecs(PDB *CA, int natom);
+void FlagAngles(PDB *CA, SOLVVEC *solvVecs, PDB *patchCentre);
+CAGRID *BuildCAGrid(PDB *CA, int natom);
+void FreeCAGrid(CAGRID *grid);
+void MassCentre(CAGRID *grid, int central, REAL *Masscen_x,
                 REAL *Masscen_y, REAL *Masscen_z);
-int  CompareFunc(const void* e1, const void* e2);
+int  FindNearestCA(CAGRID *grid, int central, PDB **tab);
+void AddNearestCA(int *heap, REAL *heapDistSq, int *nHeap, int j, 
+                  REAL distSq);
 void CalcMassCentre(PDB **tab, int natoms, 
                     REAL *cen_x, REAL *cen_y, REAL *cen_z);
 BOOL CheckVectAngle(PDB * cetral, REAL *Masscen_x, REAL *Masscen_y, 
@@ -140,6 +220,7 @@ BOOL CheckVectAngle(PDB * cetral, REAL *Masscen_x, REAL *Masscen_y,
 
 void FlagWholeResidues(PDB *pdb);
 void PrintSummary(PDB *p, char *Central);
+void PrintPatch(FILE *out, PDB *pdb, char *Central);
 void CleanUpPDB(PDB *pdb);
 void Usage(void);
 
@@ -153,6 +234,7 @@ void Usage(void);
 -  02.06.09  Added -s command line option   By: Anja
 -  22.07.14 Renamed deprecated functions with bl prefix. By: CTP
 -  19.08.14 Added AsCopy suffix to call to blSelectAtomsPDB() By: CTP
+-  16.10.26 Added -a   By: ACRM
 */
 int main(int argc, char **argv)
 {
@@ -172,10 +254,12 @@ int main(int argc, char **argv)
         tolerance = DEF_TOLERANCE,
         minAccess = DEF_MINACCESS;
    BOOL summary,
-        ringOnly;
+        ringOnly,
+        allCentres;
 
    if(ParseCmdLine(argc, argv, CentreRes, CentreAtom, InFile, OutFile,
-                   &radius, &tolerance, &summary, &ringOnly, &minAccess))
+                   &radius, &tolerance, &summary, &ringOnly, &minAccess,
+                   &allCentres))
    {
       if(blOpenStdFiles(InFile, OutFile, &in, &out))
       {
@@ -198,9 +282,20 @@ file\n");
          */
          SELECT(sel[0],"CA  ");
          Calphas = blSelectAtomsPDBAsCopy(pdb, 1, sel, &nCatom);
+         PADCHARMINTERM(CentreAtom, ' ', 4);
+
+         /* Build a patch around every surface residue and write a 
+            summary of each
+         */
+         if(allCentres)
+         {
+            MakeAllPatches(out, pdb, CentreAtom, radius, tolerance,
+                           Calphas, nCatom, ringOnly, minAccess);
+            return(0);
+         }
+
          FlagSolvVecAngles(Calphas, CentreRes, nCatom);
  
-         PADCHARMINTERM(CentreAtom, ' ', 4);
          MakePatches(pdb, CentreRes, CentreAtom, radius, tolerance, 
                      Calphas, ringOnly, minAccess);
 
@@ -241,15 +336,20 @@ file\n");
 -  06.11.14  V1.10 By: ACRM
 -  12.03.15  V1.11
 -  21.11.17  V1.12
+-  16.10.26  V1.13
 */
 void Usage(void)
 {
-   fprintf(stderr,"\npdbmakepatch V1.12 Andrew C.R. Martin, Anja \
-Baresic, UCL 2009-2017\n");
+   fprintf(stderr,"\npdbmakepatch V1.13 Andrew C.R. Martin, Anja \
+Baresic, UCL 2009-2026\n");
 
    fprintf(stderr,"\nUsage: pdbmakepatch [-r radius] [-t tolerance] [-c] \
 [-m minaccess]\n");
    fprintf(stderr,"                    resspec atomname [in.pdb \
+[out.pdb]]\n");
+   fprintf(stderr,"       pdbmakepatch [-r radius] [-t tolerance] [-c] \
+[-m minaccess]\n");
+   fprintf(stderr,"                    -a atomname [in.pdb \
 [out.pdb]]\n");
    fprintf(stderr,"       -r  Specify radius for considering atoms \
 [%.2f]\n", (REAL)DEF_RADIUS);
@@ -263,6 +363,11 @@ patch\n");
 around the central one only\n");
    fprintf(stderr,"       -m  Specify minimum accessibility to consider \
 a residue to be on the surface\n");
+   fprintf(stderr,"       -a  Build a patch around the named atom of \
+every residue where that\n");
+   fprintf(stderr,"           atom is on the surface and write a summary \
+line for each, as\n");
+   fprintf(stderr,"           given by -s, instead of the PDB file\n");
 
    fprintf(stderr,"\npdbmakepatch takes a PDB file where the B-values \
 have been replaced by\n");
@@ -292,10 +397,8 @@ atoms already in\n");
    ---------------------------------------------------------------------
 *//**
 
-   Identifies the central atom, clears flags for all atoms then sets
-   the central atom flag. Iterates over the PDB file, flagging atoms
-   within the required radius of the central atom and within touching
-   distance of that atom or other flagged atoms.
+   Identifies the central atom and grows the patch around it with
+   GrowPatch()
 
 -  01.06.09  Original   By: ACRM
 -  02.06.09  Added check on solvent vector < 120degrees   By: Anja
@@ -303,15 +406,16 @@ atoms already in\n");
 -  02.10.13  Added minAccess - rather than just using zero
 -  22.07.14 Renamed deprecated functions with bl prefix. By: CTP
 -  12.03.15 Changed to allow multi-character chain names  By: ACRM
+-  16.10.26 Patch growth moved to GrowPatch()
+-  16.10.26 Builds the contact lists for GrowPatch()
 */
 void MakePatches(PDB *pdb, char *CentreRes, char *CentreAtom,
                  REAL radius, REAL tolerance, PDB *CA, BOOL ringOnly,
                  REAL minAccess)
 {
-   PDB *catom, *p;
-   BOOL Found = FALSE;
-   BOOL Changed, FoundInCA;
-   REAL RadSq = radius * radius;
+   PDB      *catom, *p;
+   CONTACTS *contacts;
+   BOOL     Found = FALSE;
    
    /* Find the central residue and atom                                */
    catom = blFindResidueSpec(pdb, CentreRes);
@@ -332,106 +436,546 @@ Atom %s\n",
       exit(1);
    }
    catom = p;
-   
+
+   /* Only atoms within the radius can be in the patch                  */
+   if((contacts = BuildContacts(pdb, CA, tolerance, minAccess, catom, 
+                                radius))==NULL)
+   {
+      fprintf(stderr, "pdbmakepatch: (Error) No memory for contact \
+lists\n");
+      exit(1);
+   }
+
+   GrowPatch(pdb, catom, radius, contacts, ringOnly);
+   FreeContacts(contacts);
+}
+
+
+/************************************************************************/
+/*>void GrowPatch(PDB *pdb, PDB *catom, REAL radius, 
+                  CONTACTS *contacts, BOOL ringOnly)
+   ----------------------------------------------------
+*//**
+
+   \param[in,out]  *pdb         PDB linked list. Patch atoms are flagged
+   \param[in]      *catom       Central atom
+   \param[in]      radius       Radius to include atoms
+   \param[in,out]  *contacts    Contact lists from BuildContacts(). The
+                                C-alphas are flagged by 
+                                FlagSolvVecAngles()
+   \param[in]      ringOnly     Only do residues in contact with central
+
+   Clears flags for all atoms then sets the central atom flag. Grows the
+   patch breadth-first from the central atom, flagging atoms within the
+   required radius of the central atom and within touching distance of 
+   that atom or other flagged atoms.
+
+   Each flagged atom is taken from the frontier queue once and only its
+   contacts are tested, so the cost depends on the size of the patch 
+   rather than the structure. The atoms flagged are the same as those 
+   found by sweeping the structure until nothing changes.
+
+-  16.10.26  Original   By: ACRM (from MakePatches())
+-  16.10.26  Breadth-first growth over contact lists
+-  16.10.26  C-alpha of each residue taken from the contact lists
+*/
+void GrowPatch(PDB *pdb, PDB *catom, REAL radius, CONTACTS *contacts,
+               BOOL ringOnly)
+{
+   PDB  *p, *q, *r;
+   REAL RadSq = radius * radius;
+   int  head = 0,
+        tail = 0,
+        i, j;
+
    /* Clear flags and set the flag for the central patch atom           */
    ClearFlags(pdb);
    SetFlag(catom);
 
-   /* Iterate over the PDB file while we make a change                  */
-   do
+   for(i=0; i<contacts->natoms; i++)
+   {
+      if(contacts->atoms[i] == catom)
+      {
+         contacts->queue[tail++] = i;
+         break;
+      }
+   }
+
+   /* Take each flagged atom from the frontier and look at the atoms it
+      contacts. These are all on the surface
+   */
+   while(head < tail)
    {
-      PDB *p, *q, *r;
+      i = contacts->queue[head++];
+      p = contacts->atoms[i];
       
-      Changed = FALSE;
+      for(j=contacts->first[i]; j<contacts->first[i+1]; j++)
+      {
+         q = contacts->atoms[contacts->contacts[j]];
+
+         /* If this atom not yet flagged and within the specified radius
+          */
+         if(FlagSet(q) || (DISTSQ(q,catom) >= RadSq))
+            continue;
+
+         /* If we are doing a single ring of residues around            */
+         if(ringOnly)
+         {
+            /* Test we are in same residue                              */
+            if(!(((p->resnum == q->resnum) &&   
+                  (p->insert[0] == q->insert[0]) &&
+                  CHAINMATCH(p->chain, q->chain)) ||
+                 /* or other residue is the central one                 */
+                 ((p->resnum == catom->resnum) && 
+                  (p->insert[0] == catom->insert[0]) &&
+                  CHAINMATCH(p->chain, catom->chain))))
+            {
+               continue;
+            }
+         }
+
+         /* V1.1+  By: Anja
+            Check solvvec vector angle is <120 degrees  
+         */
+         r = contacts->residueCA[contacts->contacts[j]];
+         if((r != NULL) && FlagSet(r))
+         {
+            /* Set the flag for this atom and add it to the frontier    */
+            SetFlag(q);
+            contacts->queue[tail++] = contacts->contacts[j];
+         }
+#ifdef DEBUG
+         else if(r != NULL)
+         {
+            fprintf(stderr, "pdbmakepatch: (Debug) Residue %s.%d%s \
+failed on angle test\n", 
+                    q->chain, q->resnum, q->insert);
+         }
+#endif
+         /* V1.1-END                                                    */
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>CONTACTS *BuildContacts(PDB *pdb, PDB *CA, REAL tolerance, 
+                            REAL minAccess, PDB *catom, REAL radius)
+   ----------------------------------------------------------------
+*//**
+
+   \param[in]      *pdb         PDB linked list with radii in occ and
+                                accessibilities in bval
+   \param[in]      *CA          C-alphas-only in linked list
+   \param[in]      tolerance    Tolerance on contact distance for atoms
+   \param[in]      minAccess    Minimum accessibility to be on the 
+                                surface
+   \param[in]      *catom       Central atom (or NULL)
+   \param[in]      radius       Radius to include atoms
+   \return                      Malloc'd contact lists (NULL if no 
+                                memory)
+
+   Finds the atoms which may be in a patch - those on the surface and,
+   if catom is given, within the radius of catom (plus catom itself). 
+   For each of these, lists the others within touching distance 
+   (the sum of the radii plus the tolerance). The atoms are sorted into
+   cubic cells at least as wide as the largest touching distance, so
+   only the same and adjacent cells need to be searched. Also records 
+   the C-alpha of each atom's residue.
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Added CA parameter and calls IndexResidueCAs()
+*/
+CONTACTS *BuildContacts(PDB *pdb, PDB *CA, REAL tolerance, 
+                        REAL minAccess, PDB *catom, REAL radius)
+{
+   CONTACTS *contacts;
+   PDB      *p, *q;
+   REAL     RadSq = radius * radius,
+            minX, minY, minZ, 
+            maxX, maxY, maxZ,
+            minOcc, maxOcc,
+            cellSize;
+   int      *cellHead   = NULL,
+            *nextInCell = NULL,
+            nx, ny, nz,
+            ix, iy, iz,
+            cx, cy, cz,
+            i, j, k,
+            pass,
+            nContacts;
+
+   if((contacts = (CONTACTS *)malloc(sizeof(CONTACTS)))==NULL)
+      return(NULL);
+   contacts->atoms     = NULL;
+   contacts->residueCA = NULL;
+   contacts->first     = NULL;
+   contacts->contacts  = NULL;
+   contacts->queue     = NULL;
+   contacts->natoms    = 0;
+
+   /* Count and then store the atoms which may be in a patch            */
+   for(pass=0; pass<2; pass++)
+   {
+      i = 0;
       for(p=pdb; p!=NULL; NEXT(p))
       {
-         /* If this is a flagged atom then look for neighbouring atoms  */
-         if(FlagSet(p))
+         if((p == catom) ||
+            ((p->bval > minAccess) && 
+             ((catom == NULL) || (DISTSQ(p,catom) < RadSq))))
+         {
+            if(pass)
+               contacts->atoms[i] = p;
+            i++;
+         }
+      }
+
+      if(!pass)
+      {
+         contacts->natoms = i;
+         if(((contacts->atoms = 
+              (PDB **)malloc(MAX(i, 1) * sizeof(PDB *)))==NULL) ||
+            ((contacts->first = 
+              (int *)malloc((i+1) * sizeof(int)))==NULL) ||
+            ((contacts->queue = 
+              (int *)malloc(MAX(i, 1) * sizeof(int)))==NULL) ||
+            ((contacts->residueCA = 
+              (PDB **)malloc(MAX(i, 1) * sizeof(PDB *)))==NULL))
          {
-            for(q=pdb; q!=NULL; NEXT(q))
+            FreeContacts(contacts);
+            return(NULL);
+         }
+      }
+   }
+
+   if(!IndexResidueCAs(contacts, CA))
+   {
+      FreeContacts(contacts);
+      return(NULL);
+   }
+
+   contacts->first[0] = 0;
+   if(contacts->natoms == 0)
+      return(contacts);
+
+   /* Find the extent of the atoms and the range of touching distances */
+   p = contacts->atoms[0];
+   minX   = maxX   = p->x;
+   minY   = maxY   = p->y;
+   minZ   = maxZ   = p->z;
+   minOcc = maxOcc = p->occ;
+   for(i=1; i<contacts->natoms; i++)
+   {
+      p      = contacts->atoms[i];
+      minX   = MIN(minX, p->x);
+      minY   = MIN(minY, p->y);
+      minZ   = MIN(minZ, p->z);
+      maxX   = MAX(maxX, p->x);
+      maxY   = MAX(maxY, p->y);
+      maxZ   = MAX(maxZ, p->z);
+      minOcc = MIN(minOcc, p->occ);
+      maxOcc = MAX(maxOcc, p->occ);
+   }
+
+   /* Double the cell size until the number of cells is reasonable      */
+   cellSize = MAX(ABS(2.0 * maxOcc + tolerance), 
+                  ABS(2.0 * minOcc + tolerance)) + GRID_SLACK;
+   for(;;)
+   {
+      nx = (int)((maxX - minX) / cellSize) + 1;
+      ny = (int)((maxY - minY) / cellSize) + 1;
+      nz = (int)((maxZ - minZ) / cellSize) + 1;
+      if(((double)nx * ny * nz) <= MAXGRIDCELLS)
+         break;
+      cellSize *= 2.0;
+   }
+
+   if(((cellHead = (int *)malloc(nx * ny * nz * sizeof(int)))==NULL) ||
+      ((nextInCell = (int *)malloc(contacts->natoms * sizeof(int)))
+       ==NULL))
+   {
+      if(cellHead != NULL) free(cellHead);
+      FreeContacts(contacts);
+      return(NULL);
+   }
+
+   for(i=0; i<nx * ny * nz; i++)
+      cellHead[i] = (-1);
+   for(i=0; i<contacts->natoms; i++)
+   {
+      p  = contacts->atoms[i];
+      ix = (int)((p->x - minX) / cellSize);
+      iy = (int)((p->y - minY) / cellSize);
+      iz = (int)((p->z - minZ) / cellSize);
+      k  = (ix * ny + iy) * nz + iz;
+      nextInCell[i] = cellHead[k];
+      cellHead[k]   = i;
+   }
+
+   /* Count the contacts of each atom, then allocate and store them     */
+   for(pass=0; pass<2; pass++)
+   {
+      nContacts = 0;
+      for(i=0; i<contacts->natoms; i++)
+      {
+         p  = contacts->atoms[i];
+         cx = (int)((p->x - minX) / cellSize);
+         cy = (int)((p->y - minY) / cellSize);
+         cz = (int)((p->z - minZ) / cellSize);
+         
+         if(pass)
+            nContacts = contacts->first[i];
+
+         for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, nx-1); ix++)
+         {
+            for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, ny-1); iy++)
             {
-               if(p!=q)
+               for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, nz-1); iz++)
                {
-                  /* If this atom not yet flagged                       */
-                  if(!FlagSet(q))
+                  for(j=cellHead[(ix * ny + iy) * nz + iz];
+                      j != (-1);
+                      j=nextInCell[j])
                   {
-                     /* See if it is on the surface and within the 
-                        specified radius
-                     */
-                     if((q->bval > minAccess) && 
-                        (DISTSQ(q,catom) < RadSq))
+                     q = contacts->atoms[j];
+                     if((j != i) &&
+                        (DISTSQ(p,q) < ((p->occ + q->occ + tolerance) *
+                                        (p->occ + q->occ + tolerance))))
                      {
-                        /* If it's in contact distance of the flagged 
-                           atom
-                        */
-                        if(DISTSQ(p,q) < ((p->occ + q->occ + tolerance) *
-                                          (p->occ + q->occ + tolerance)))
-                        {
-                           /* If we are doing a single ring of residues 
-                              around
-                           */
-                           if(ringOnly)
-                           {
-                              /* Test we are in same residue            */
-                              if(!(((p->resnum == q->resnum) &&   
-                                    (p->insert[0] == q->insert[0]) &&
-                                    CHAINMATCH(p->chain, q->chain)) ||
-                                   /* or other residue is the central 
-                                      one 
-                                   */
-                                   ((p->resnum == catom->resnum) && 
-                                    (p->insert[0] == catom->insert[0]) &&
-                                    CHAINMATCH(p->chain, catom->chain))))
-                              {
-                                 continue;
-                              }
-                           }
-
-                           /* V1.1+  By: Anja
-                              Check solvvec vector angle is <120 degrees  
-                           */
-                           FoundInCA = FALSE;
-                           
-                           for (r=CA; r!=NULL && (!FoundInCA); NEXT(r))
-                           {
-                              if ( (r->resnum == q->resnum) &&
-                                   (!strcmp(r->chain, q->chain)) && 
-                                   (!strcmp(r->insert, q->insert)) )
-                              {
-                                 FoundInCA = TRUE;
-                                 
-                                 if(FlagSet(r))
-                                 {
-                                    
-                                    /* Set the flag for this atom and 
-                                       update the iteration flag to say 
-                                       we've done something            
-                                    */
-                                    SetFlag(q);
-                                    Changed = TRUE;
-                                 }
-#ifdef DEBUG
-                                 else
-                                 {
-                                    fprintf(stderr, "pdbmakepatch: \
-(Debug) Residue %s.%d%s failed on angle test\n", 
-                                            q->chain, q->resnum, 
-                                            q->insert);
-                                 }
-#endif
-                              }
-                           }                        
-                           /* V1.1-END                                  */
-                        }
+                        if(pass)
+                           contacts->contacts[nContacts] = j;
+                        nContacts++;
                      }
                   }
                }
             }
          }
+
+         if(!pass)
+            contacts->first[i+1] = nContacts;
       }
-   } while(Changed);
+
+      if(!pass)
+      {
+         if((contacts->contacts = 
+             (int *)malloc(MAX(nContacts, 1) * sizeof(int)))==NULL)
+         {
+            free(cellHead);
+            free(nextInCell);
+            FreeContacts(contacts);
+            return(NULL);
+         }
+      }
+   }
+
+   free(cellHead);
+   free(nextInCell);
+   
+   return(contacts);
+}
+
+
+/************************************************************************/
+/*>void FreeContacts(CONTACTS *contacts)
+   --------------------------------------
+*//**
+
+   \param[in]      *contacts    Contact lists from BuildContacts()
+
+   Frees the contact lists
+
+-  16.10.26  Original   By: ACRM
+*/
+void FreeContacts(CONTACTS *contacts)
+{
+   if(contacts->atoms     != NULL) free(contacts->atoms);
+   if(contacts->residueCA != NULL) free(contacts->residueCA);
+   if(contacts->first     != NULL) free(contacts->first);
+   if(contacts->contacts  != NULL) free(contacts->contacts);
+   if(contacts->queue     != NULL) free(contacts->queue);
+   free(contacts);
+}
+
+
+/************************************************************************/
+/*>BOOL IndexResidueCAs(CONTACTS *contacts, PDB *CA)
+   -------------------------------------------------
+*//**
+
+   \param[in,out]  *contacts    Contact lists. residueCA[] is filled in
+   \param[in]      *CA          C-alphas-only in linked list
+   \return                      Success (FALSE if no memory)
+
+   Records the C-alpha of each atom's residue (or NULL if it has none)
+   so that the solvent vector flag can be checked without searching the
+   C-alpha list. The C-alphas are indexed in a hash and each residue is 
+   looked up once.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL IndexResidueCAs(CONTACTS *contacts, PDB *CA)
+{
+   HASHTABLE *caIndex;
+   PDB       *p,
+             *prev = NULL;
+   char      key[MAXBUFF];
+   int       i;
+
+   if((caIndex = blInitializeHash(HASHSIZE))==NULL)
+      return(FALSE);
+
+   /* If a residue appears twice, the first C-alpha is used             */
+   for(p=CA; p!=NULL; NEXT(p))
+   {
+      MAKECAKEY(key, p);
+      if(!blHashKeyDefined(caIndex, key) &&
+         !blSetHashValuePointer(caIndex, key, (BPTR)p))
+      {
+         blFreeHash(caIndex);
+         return(FALSE);
+      }
+   }
+
+   for(i=0; i<contacts->natoms; i++)
+   {
+      p = contacts->atoms[i];
+      if((prev != NULL) &&
+         (p->resnum == prev->resnum) &&
+         CHAINMATCH(p->chain, prev->chain) &&
+         !strcmp(p->insert, prev->insert))
+      {
+         contacts->residueCA[i] = contacts->residueCA[i-1];
+      }
+      else
+      {
+         contacts->residueCA[i] = FindResidueCA(caIndex, p);
+      }
+      prev = p;
+   }
+
+   blFreeHash(caIndex);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void MakeAllPatches(FILE *out, PDB *pdb, char *CentreAtom, 
+                       REAL radius, REAL tolerance, PDB *CA, int nCatom,
+                       BOOL ringOnly, REAL minAccess)
+   ----------------------------------------------------------------------
+*//**
+
+   \param[in]      *out         Output file
+   \param[in,out]  *pdb         PDB linked list
+   \param[in]      *CentreAtom  Central atom name (padded to 4 chars)
+   \param[in]      radius       Radius to include atoms
+   \param[in]      tolerance    Tolerance on contact distance for atoms
+   \param[in]      *CA          C-alphas-only in linked list
+   \param[in]      nCatom       Number of C-alphas
+   \param[in]      ringOnly     Only do residues in contact with central
+   \param[in]      minAccess    Minimum accessibility to be on the 
+                                surface
+
+   Builds a patch around the CentreAtom of every residue where that atom
+   is on the surface (accessibility > minAccess) and writes a summary 
+   line for each. The solvent vectors and contact lists are calculated 
+   only once. Residues without the atom or without a C-alpha are skipped.
+
+-  16.10.26  Original   By: ACRM
+*/
+void MakeAllPatches(FILE *out, PDB *pdb, char *CentreAtom, REAL radius,
+                    REAL tolerance, PDB *CA, int nCatom, BOOL ringOnly, 
+                    REAL minAccess)
+{
+   PDB      *res,
+            *NextRes,
+            *catom,
+            *patchCentre;
+   SOLVVEC  *solvVecs;
+   CONTACTS *contacts;
+   char     Central[MAXBUFF];
+   int      i = 0;
+   
+   if((solvVecs = CalcSolvVecs(CA, nCatom))==NULL)
+   {
+      fprintf(stderr, "pdbmakepatch: (Error) No memory for solvent \
+vectors\n");
+      exit(1);
+   }
+
+   /* Every centre is on the surface, so the contacts between surface 
+      atoms serve for all the patches
+   */
+   if((contacts = BuildContacts(pdb, CA, tolerance, minAccess, NULL, 
+                                radius))==NULL)
+   {
+      fprintf(stderr, "pdbmakepatch: (Error) No memory for contact \
+lists\n");
+      exit(1);
+   }
+   
+   for(res=pdb; res!=NULL; res=NextRes)
+   {
+      NextRes = blFindNextResidue(res);
+      
+      /* Find the central atom and check it is on the surface           */
+      for(catom=res; catom!=NextRes; NEXT(catom))
+      {
+         if(!strncmp(catom->atnam, CentreAtom, 4))
+            break;
+      }
+      if((catom == NextRes) || (catom->bval <= minAccess))
+         continue;
+
+      /* The centres are on the surface so are in the contact lists in
+         the same order as the PDB file
+      */
+      while((i < contacts->natoms) && (contacts->atoms[i] != catom))
+         i++;
+      if((i == contacts->natoms) || 
+         ((patchCentre = contacts->residueCA[i])==NULL))
+         continue;
+
+      FlagAngles(CA, solvVecs, patchCentre);
+      GrowPatch(pdb, catom, radius, contacts, ringOnly);
+      FlagWholeResidues(pdb);
+
+      sprintf(Central, "%s.%d%s", res->chain, res->resnum, 
+              ((res->insert[0] == ' ') ? "" : res->insert));
+      PrintPatch(out, pdb, Central);
+   }
+
+   ClearFlags(pdb);
+   FreeContacts(contacts);
+   free(solvVecs);
+}
+
+
+/************************************************************************/
+/*>PDB *FindResidueCA(HASHTABLE *caIndex, PDB *p)
+   -----------------------------------------------
+*//**
+
+   \param[in]      *caIndex     C-alphas indexed by MAKECAKEY()
+   \param[in]      *p           An atom
+   \return                      The C-alpha of the atom's residue (or
+                                NULL)
+
+   Finds the C-alpha of an atom's residue
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Uses a hash of the C-alphas rather than searching the list
+*/
+PDB *FindResidueCA(HASHTABLE *caIndex, PDB *p)
+{
+   char key[MAXBUFF];
+
+   MAKECAKEY(key, p);
+   if(blHashKeyDefined(caIndex, key))
+      return((PDB *)blGetHashValuePointer(caIndex, key));
+   return(NULL);
 }
 
+
 /************************************************************************/
 /*>void CleanUpPDB(PDB *pdb)
    -------------------------
@@ -549,6 +1093,39 @@ void PrintSummary(PDB *pdb, char *Central)
 }
 
 
+/************************************************************************/
+/*>void PrintPatch(FILE *out, PDB *pdb, char *Central)
+   ---------------------------------------------------
+*//**
+
+   \param[in]      *out         Output file
+   \param[in]      *pdb         PDB linked list with whole residues
+                                flagged
+   \param[in]      *Central     Centre of the patch
+
+   Prints the residues in a patch in the same format as PrintSummary() 
+   but using the flags rather than the B-values
+
+-  16.10.26  Original   By: ACRM
+*/
+void PrintPatch(FILE *out, PDB *pdb, char *Central)
+{
+   PDB *res;
+   
+   fprintf(out, "<patch %s> ", Central);
+
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+   {
+      if(FlagSet(res))
+      {
+         fprintf(out, "%s:%d%s ",
+                 res->chain, res->resnum, res->insert);
+      }
+   }
+   fprintf(out, "\n");
+}
+
+
 /************************************************************************/
 /*>void SetFlag(PDB *p)
    --------------------
@@ -602,7 +1179,8 @@ void ClearFlags(PDB *pdb)
 /*>BOOL ParseCmdLine(int argc, char **argv, char *CentreRes, 
                      char *CentreAtom, char *infile, char *outfile,
                      REAL *radius, REAL *tolerance, BOOL *summary,
-                     BOOL *ringOnly, REAL *minAcess)
+                     BOOL *ringOnly, REAL *minAcess, 
+                     BOOL *allCentres)
    ----------------------------------------------------------------
 *//**
 
@@ -618,6 +1196,8 @@ void ClearFlags(PDB *pdb)
                                 (default: FALSE)
    \param[out]     *ringOnly    Only do residues in contact with central
    \param[out]     *minAccess   minimum accessibility to be on the surface
+   \param[out]     *allCentres  Build a patch around every surface 
+                                residue (CentreRes is not used)
    \return                      Success?
 
    Parse the command line
@@ -626,11 +1206,12 @@ void ClearFlags(PDB *pdb)
 -  02.06.09  Added -s command line option  By: Anja
 -  09.05.13  Added -c command line option  By: ACRM
 -  02.10.13  Added -m command line option
+-  16.10.26  Added -a command line option
 */
 BOOL ParseCmdLine(int argc, char **argv, char *CentreRes, 
                   char *CentreAtom, char *infile, char *outfile,
                   REAL *radius, REAL *tolerance, BOOL *summary,
-                  BOOL *ringOnly, REAL *minAccess)
+                  BOOL *ringOnly, REAL *minAccess, BOOL *allCentres)
 {
    BOOL UserTol = FALSE;
    
@@ -643,6 +1224,8 @@ BOOL ParseCmdLine(int argc, char **argv, char *CentreRes,
    *summary = FALSE;
    *ringOnly = FALSE;
    *minAccess = DEF_MINACCESS;
+   *allCentres = FALSE;
+   CentreRes[0] = '\0';
    
    
    if(!argc)
@@ -690,6 +1273,9 @@ BOOL ParseCmdLine(int argc, char **argv, char *CentreRes,
             case 'c':
                *ringOnly = TRUE;
                break;
+            case 'a':
+               *allCentres = TRUE;
+               break;
             default:
                return(FALSE);
                break;
@@ -706,14 +1292,26 @@ BOOL ParseCmdLine(int argc, char **argv, char *CentreRes,
             *tolerance = DEF_RING_TOLERANCE;
          }
 
-         /* Check that there are 2, 3 or 4 arguments left               */
-         if(argc < 2 || argc > 4)
-            return(FALSE);
+         /* Check that there are 2, 3 or 4 arguments left (1, 2 or 3
+            with -a)
+         */
+         if(*allCentres)
+         {
+            if(argc < 1 || argc > 3)
+               return(FALSE);
+         }
+         else
+         {
+            if(argc < 2 || argc > 4)
+               return(FALSE);
          
-         /* Copy the first to CentreRes and second one to CentreAtom    */
-         strcpy(CentreRes, argv[0]);
-         argc--;
-         argv++;
+            /* Copy the first to CentreRes                              */
+            strcpy(CentreRes, argv[0]);
+            argc--;
+            argv++;
+         }
+         
+         /* Copy the next one to CentreAtom                             */
          strcpy(CentreAtom, argv[0]);
          argc--;
          argv++;
@@ -763,18 +1361,13 @@ BOOL ParseCmdLine(int argc, char **argv, char *CentreRes,
 -  02.10.13  Changed to use 'extras' for the flag rather than bval
 -  04.11.13  Added check that Central residue is found
 -  22.07.14 Renamed deprecated functions with bl prefix. By: CTP
+-  16.10.26 Mass centres calculated by CalcSolvVecs() and flags set by
+            FlagAngles()   By: ACRM
 */
 void FlagSolvVecAngles(PDB *CA, char *Central, int natom)
 {
-   PDB  *current,
-        *patchCentre;   
-   BOOL AngleOK;
-   REAL Masscen_x = 0.0, 
-        Masscen_y = 0.0, 
-        Masscen_z = 0.0;
-   REAL Masscurr_x = 0.0, 
-        Masscurr_y = 0.0, 
-        Masscurr_z = 0.0;
+   PDB     *patchCentre;   
+   SOLVVEC *solvVecs;
 
    /* for Central                                                       */
    if((patchCentre = blFindResidueSpec(CA, Central))==NULL)
@@ -784,20 +1377,100 @@ void FlagSolvVecAngles(PDB *CA, char *Central, int natom)
       exit(1);
    }
 
-   DistFromCentral(CA, patchCentre);
-   MassCentre(CA, patchCentre, &natom, 
-              &Masscen_x, &Masscen_y, &Masscen_z);
+   if((solvVecs = CalcSolvVecs(CA, natom))==NULL)
+   {
+      fprintf(stderr, "pdbmakepatch: (Error) No memory for solvent \
+vectors\n");
+      exit(1);
+   }
 
    /* flagging for angles in CA                                         */
-   for (current=CA; current!=NULL; NEXT(current))
+   FlagAngles(CA, solvVecs, patchCentre);
+   free(solvVecs);
+}
+
+
+/************************************************************************/
+/*>SOLVVEC *CalcSolvVecs(PDB *CA, int natom)
+   ------------------------------------------
+*//**
+ 
+   \param[in]      *CA          C-alphas-only in linked list
+   \param[in]      natom        Number of C-alphas
+   \return                      Malloc'd mass centre of each C-alpha in
+                                the order of the list (NULL if no 
+                                memory)
+
+   Calculates the end of the solvent vector (the mass centre of the 
+   closest C-alphas) for every C-alpha
+
+-  16.10.26  Original   By: ACRM (from FlagSolvVecAngles())
+-  16.10.26  Uses a grid of the C-alphas
+*/
+SOLVVEC *CalcSolvVecs(PDB *CA, int natom)
+{
+   SOLVVEC *solvVecs;
+   CAGRID  *grid;
+   int     i;
+
+   if((solvVecs = (SOLVVEC *)malloc(MAX(natom, 1) * sizeof(SOLVVEC)))
+      ==NULL)
+      return(NULL);
+   if((grid = BuildCAGrid(CA, natom))==NULL)
    {
-      DistFromCentral(CA, current);
-      MassCentre(CA, current, &natom, 
-                 &Masscurr_x, &Masscurr_y, &Masscurr_z);
+      free(solvVecs);
+      return(NULL);
+   }
+
+   for (i=0; i<grid->natoms; i++)
+   {
+      MassCentre(grid, i, 
+                 &(solvVecs[i].x), &(solvVecs[i].y), &(solvVecs[i].z));
+   }
+
+   FreeCAGrid(grid);
+   return(solvVecs);
+}
+
+
+/************************************************************************/
+/*>void FlagAngles(PDB *CA, SOLVVEC *solvVecs, PDB *patchCentre)
+   --------------------------------------------------------------
+*//**
+ 
+   \param[in,out]  *CA          C-alphas-only in linked list
+   \param[in]      *solvVecs    Mass centre of each C-alpha
+   \param[in]      *patchCentre C-alpha of the central residue
 
-      AngleOK = CheckVectAngle(patchCentre, &Masscen_x, &Masscen_y,
-                               &Masscen_z, current, &Masscurr_x, 
-                               &Masscurr_y, &Masscurr_z);          
+   Flags each C-alpha if the angle between its solvent vector and that
+   of the central residue is <120 degrees
+
+-  16.10.26  Original   By: ACRM (from FlagSolvVecAngles())
+*/
+void FlagAngles(PDB *CA, SOLVVEC *solvVecs, PDB *patchCentre)
+{
+   PDB     *current;
+   SOLVVEC *centreVec = NULL;
+   BOOL    AngleOK;
+   int     i;
+
+   for (current=CA, i=0; current!=NULL; NEXT(current), i++)
+   {
+      if(current == patchCentre)
+      {
+         centreVec = &(solvVecs[i]);
+         break;
+      }
+   }
+   if(centreVec == NULL)
+      return;
+
+   for (current=CA, i=0; current!=NULL; NEXT(current), i++)
+   {
+      AngleOK = CheckVectAngle(patchCentre, &(centreVec->x), 
+                               &(centreVec->y), &(centreVec->z), 
+                               current, &(solvVecs[i].x), 
+                               &(solvVecs[i].y), &(solvVecs[i].z));
       
       if (AngleOK)
       {
@@ -815,58 +1488,132 @@ solvvec FlagSolvVecAngles\n",
       }      
    }   
 }
-         
+
 
 /************************************************************************/
-/*>void DistFromCentral(PDB *pdb, PDB *central)
-   --------------------------------------------
+/*>CAGRID *BuildCAGrid(PDB *CA, int natom)
+   ----------------------------------------
 *//**
 
-   \param[in]      *pdb     
-   \param[in]      *central    Pointer to the central residue
+   \param[in]      *CA          C-alphas-only in linked list
+   \param[in]      natom        Number of C-alphas
+   \return                      Malloc'd grid (NULL if no memory)
 
-   Adds distance from the central residue to the occ parameter 
-   of residues in the same chain as central, all other residues 
-   get occ set to 999.99.
+   Sorts the C-alphas into cubic cells so that the nearest ones can be
+   found by searching outwards from the cell of the central one. Atoms 
+   are linked in each cell in increasing order.
 
--  08.12.08  Original  By: Anja         
--  26.10.11  Changed double to REAL  By: ACRM
--  12.03.15 Changed to allow multi-character chain names
+-  16.10.26  Original   By: ACRM
 */
-void DistFromCentral(PDB *pdb, PDB *central)
+CAGRID *BuildCAGrid(PDB *CA, int natom)
 {
-   PDB *current;
-   REAL dist_sq;    
-  
-   for (current=pdb; current!=NULL; NEXT(current))
+   CAGRID *grid;
+   PDB    *p;
+   REAL   maxX, maxY, maxZ;
+   int    i, 
+          cell,
+          ix, iy, iz;
+
+   if((grid = (CAGRID *)malloc(sizeof(CAGRID)))==NULL)
+      return(NULL);
+   grid->cellHead   = NULL;
+   grid->nextInCell = NULL;
+   grid->natoms     = 0;
+   
+   if((grid->atoms = (PDB **)malloc(MAX(natom, 1) * sizeof(PDB *)))
+      ==NULL)
    {
-      /* centre of mass is based on atoms within the same 
-         chain as central
-      */
-      if (CHAINMATCH(current->chain, central->chain))
-      {
-         dist_sq = DISTSQ(central, current);
-         current->occ = sqrt(dist_sq);
-      }
-      else
-      {
-         current->occ = 999.99;	
-      }			
+      FreeCAGrid(grid);
+      return(NULL);
    }
-} 
+   for(p=CA; (p!=NULL) && (grid->natoms < natom); NEXT(p))
+      grid->atoms[grid->natoms++] = p;
+   if(grid->natoms == 0)
+      return(grid);
+
+   grid->minX = maxX = CA->x;
+   grid->minY = maxY = CA->y;
+   grid->minZ = maxZ = CA->z;
+   for(i=0; i<grid->natoms; i++)
+   {
+      p          = grid->atoms[i];
+      grid->minX = MIN(grid->minX, p->x);
+      grid->minY = MIN(grid->minY, p->y);
+      grid->minZ = MIN(grid->minZ, p->z);
+      maxX       = MAX(maxX, p->x);
+      maxY       = MAX(maxY, p->y);
+      maxZ       = MAX(maxZ, p->z);
+   }
+
+   /* Double the cell size until the number of cells is reasonable      */
+   grid->cellSize = CAGRIDSIZE;
+   for(;;)
+   {
+      grid->nx = (int)((maxX - grid->minX) / grid->cellSize) + 1;
+      grid->ny = (int)((maxY - grid->minY) / grid->cellSize) + 1;
+      grid->nz = (int)((maxZ - grid->minZ) / grid->cellSize) + 1;
+      if(((double)grid->nx * grid->ny * grid->nz) <= MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if(((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                       sizeof(int)))==NULL) ||
+      ((grid->nextInCell = (int *)malloc(grid->natoms * sizeof(int)))
+       ==NULL))
+   {
+      FreeCAGrid(grid);
+      return(NULL);
+   }
+
+   for(i=0; i<grid->nx * grid->ny * grid->nz; i++)
+      grid->cellHead[i] = (-1);
+
+   /* Work backwards so each cell lists its atoms in increasing order   */
+   for(i=grid->natoms-1; i>=0; i--)
+   {
+      p    = grid->atoms[i];
+      ix   = (int)((p->x - grid->minX) / grid->cellSize);
+      iy   = (int)((p->y - grid->minY) / grid->cellSize);
+      iz   = (int)((p->z - grid->minZ) / grid->cellSize);
+      cell = (ix * grid->ny + iy) * grid->nz + iz;
+      grid->nextInCell[i]  = grid->cellHead[cell];
+      grid->cellHead[cell] = i;
+   }
+
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeCAGrid(CAGRID *grid)
+   ------------------------------
+*//**
+
+   \param[in]      *grid        Grid from BuildCAGrid()
+
+   Frees the C-alpha grid
+
+-  16.10.26  Original   By: ACRM
+*/
+void FreeCAGrid(CAGRID *grid)
+{
+   if(grid->atoms      != NULL) free(grid->atoms);
+   if(grid->cellHead   != NULL) free(grid->cellHead);
+   if(grid->nextInCell != NULL) free(grid->nextInCell);
+   free(grid);
+}
 
 
 /**********************************************************************/
-/*>void MassCentre(PDB *pdb, PDB *central, int *natom, 
-                   REAL *Masscen_x,REAL *Masscen_y, 
-                   REAL *Masscen_z)
-   ----------------------------------------------------
+/*>void MassCentre(CAGRID *grid, int central, REAL *Masscen_x,
+                   REAL *Masscen_y, REAL *Masscen_z)
+   ------------------------------------------------------------
 *//**
 
-   \param[in]      *pdb     
-   \param[in]      *central       Pointer to the central residue
-   \param[in]      *natom         Number of atoms read from PDB file
-   \param[in]      *MassCenCoo    Coordinates of centre of mass
+   \param[in]      *grid          Grid of C-alphas
+   \param[in]      central        Index of the central residue in grid
+   \param[out]     *MassCenCoo    Coordinates of centre of mass
 
    Outputs the coordinates of the beginning and end point of the solvent 
    vector for the central residue. i.e. the centre of mass of the nearest
@@ -876,32 +1623,21 @@ void DistFromCentral(PDB *pdb, PDB *central)
 -  03.06.09  Returns coordinates rather than printing them
 -  26.10.11  Changed double to REAL  By: ACRM
 -  05.11.13  CalcMassCentre() now takes the number of atoms
+-  16.10.26  Takes the nearest atoms from FindNearestCA() rather than
+             sorting them all by the distance in occ
 */
-void MassCentre(PDB *pdb, PDB *central, int *natom, REAL *Masscen_x,
+void MassCentre(CAGRID *grid, int central, REAL *Masscen_x,
                 REAL *Masscen_y, REAL *Masscen_z)
 {   
-   PDB  **tab,  
-        *it;
-   int  i;
+   PDB  *tab[NCLOSE];
+   int  nclose;
    REAL cen_x = 0, 
         cen_y = 0, 
         cen_z = 0;
 
-   tab = malloc(*natom * sizeof (PDB*));
-   
-   /* Creates an array of pointers to the nodes in pdb                  */
-   for(it = pdb, i=0; i<*natom; i++, it = it->next)
-   {             
-      tab[i] = it;
-   }
-
-   /* sorts these in ascending order of value stored in occ             */
-   qsort(tab, *natom, sizeof(PDB*), CompareFunc); 
-
    /* takes closest 10 residues, returns (x,y,z) for centre of mass     */
-   CalcMassCentre(tab, *natom, &cen_x, &cen_y, &cen_z);
-
-   free(tab);
+   nclose = FindNearestCA(grid, central, tab);
+   CalcMassCentre(tab, nclose, &cen_x, &cen_y, &cen_z);
 
 #ifdef DEBUG
    /* prints out coordinates of the central residue C-alpha (solvent
@@ -909,7 +1645,8 @@ void MassCentre(PDB *pdb, PDB *central, int *natom, REAL *Masscen_x,
       This is the mass vector not the solvent vector, angle is the same 
    */
    fprintf(stdout,"(%.4f,%.4f,%.4f):(%.4f,%.4f,%.4f)\n", 
-           central->x, central->y, central->z, cen_x, cen_y, cen_z);
+           grid->atoms[central]->x, grid->atoms[central]->y, 
+           grid->atoms[central]->z, cen_x, cen_y, cen_z);
 #endif
 
    /* returning centre of mass coordinates                              */
@@ -920,6 +1657,189 @@ void MassCentre(PDB *pdb, PDB *central, int *natom, REAL *Masscen_x,
 } 
 
 
+/************************************************************************/
+/*>int FindNearestCA(CAGRID *grid, int central, PDB **tab)
+   -------------------------------------------------------
+*//**
+
+   \param[in]      *grid        Grid of C-alphas
+   \param[in]      central      Index of the central residue in grid
+   \param[out]     **tab        The nearest C-alphas, closest first
+   \return                      Number of C-alphas in tab (<= NCLOSE)
+
+   Finds the NCLOSE C-alphas in the same chain nearest to the central 
+   one, ignoring any closer than MINCADIST. The cells are searched in 
+   shells around the cell of the central atom, keeping the best so far 
+   in a heap, until no unsearched cell can hold anything closer. Equal 
+   distances are resolved by the order of the atoms.
+
+   If the chain is too short, other chains make up the numbers in the 
+   order of the atoms.
+
+-  16.10.26  Original   By: ACRM (replaces DistFromCentral() and 
+             sorting with CompareFunc())
+*/
+int FindNearestCA(CAGRID *grid, int central, PDB **tab)
+{
+   PDB  *c = grid->atoms[central],
+        *p;
+   REAL heapDistSq[NCLOSE],
+        distSq,
+        bound;
+   int  heap[NCLOSE],
+        nHeap = 0,
+        maxShell,
+        shell,
+        cx, cy, cz,
+        ix, iy, iz,
+        i, j, t;
+
+   cx = (int)((c->x - grid->minX) / grid->cellSize);
+   cy = (int)((c->y - grid->minY) / grid->cellSize);
+   cz = (int)((c->z - grid->minZ) / grid->cellSize);
+   maxShell = MAX(MAX(grid->nx, grid->ny), grid->nz);
+
+   for(shell=0; shell<maxShell; shell++)
+   {
+      /* Anything in this or a further shell is at least this far away  */
+      bound = (shell - 1) * grid->cellSize;
+      if((nHeap == NCLOSE) && (bound > 0.0) && 
+         (heapDistSq[0] < bound * bound))
+         break;
+      
+      /* Visit the cells on the surface of the cube around cx,cy,cz     */
+      for(ix=MAX(cx-shell, 0); ix<=MIN(cx+shell, grid->nx-1); ix++)
+      {
+         for(iy=MAX(cy-shell, 0); iy<=MIN(cy+shell, grid->ny-1); iy++)
+         {
+            for(iz=MAX(cz-shell, 0); iz<=MIN(cz+shell, grid->nz-1); iz++)
+            {
+               if((ABS(ix-cx) != shell) && (ABS(iy-cy) != shell) &&
+                  (ABS(iz-cz) != shell))
+               {
+                  /* Skip to the far face                               */
+                  iz = cz+shell-1;
+                  continue;
+               }
+
+               for(j=grid->cellHead[(ix * grid->ny + iy) * grid->nz + iz];
+                   j != (-1);
+                   j=grid->nextInCell[j])
+               {
+                  p = grid->atoms[j];
+                  
+                  /* centre of mass is based on atoms within the same 
+                     chain as central, excluding central
+                  */
+                  if((j == central) || !CHAINMATCH(p->chain, c->chain))
+                     continue;
+
+                  distSq = DISTSQ(c, p);
+                  if(distSq < (MINCADIST * MINCADIST))
+                     continue;
+
+                  AddNearestCA(heap, heapDistSq, &nHeap, j, distSq);
+               }
+            }
+         }
+      }
+   }
+
+   /* Sort what is left in the heap so the closest is first           */
+   for(i=1; i<nHeap; i++)
+   {
+      t      = heap[i];
+      distSq = heapDistSq[i];
+      for(j=i; (j>0) && ((heapDistSq[j-1] > distSq) ||
+                         ((heapDistSq[j-1] == distSq) && 
+                          (heap[j-1] > t))); j--)
+      {
+         heap[j]       = heap[j-1];
+         heapDistSq[j] = heapDistSq[j-1];
+      }
+      heap[j]       = t;
+      heapDistSq[j] = distSq;
+   }
+   for(i=0; i<nHeap; i++)
+      tab[i] = grid->atoms[heap[i]];
+
+   /* Not enough in this chain so use other chains                      */
+   for(j=0; (j<grid->natoms) && (nHeap<NCLOSE); j++)
+   {
+      if(!CHAINMATCH(grid->atoms[j]->chain, c->chain))
+         tab[nHeap++] = grid->atoms[j];
+   }
+
+   return(nHeap);
+}
+
+
+/************************************************************************/
+/*>void AddNearestCA(int *heap, REAL *heapDistSq, int *nHeap, int j, 
+                     REAL distSq)
+   -------------------------------------------------------------------
+*//**
+
+   \param[in,out]  *heap        Indexes of the nearest atoms so far
+   \param[in,out]  *heapDistSq  Their squared distances
+   \param[in,out]  *nHeap       Number in the heap
+   \param[in]      j            Index of a new atom
+   \param[in]      distSq       Its squared distance
+
+   Adds an atom to a heap of up to NCLOSE atoms with the furthest at the
+   top, replacing the furthest if the heap is full and the new one is
+   closer. Of two atoms at the same distance, the later one is treated 
+   as further.
+
+-  16.10.26  Original   By: ACRM
+*/
+void AddNearestCA(int *heap, REAL *heapDistSq, int *nHeap, int j, 
+                  REAL distSq)
+{
+   int parent, 
+       child,
+       i;
+   
+   if(*nHeap < NCLOSE)
+   {
+      /* Add at the bottom and move it up                               */
+      for(i=(*nHeap)++; i>0; i=parent)
+      {
+         parent = (i-1)/2;
+         if((heapDistSq[parent] > distSq) ||
+            ((heapDistSq[parent] == distSq) && (heap[parent] > j)))
+            break;
+         heap[i]       = heap[parent];
+         heapDistSq[i] = heapDistSq[parent];
+      }
+   }
+   else
+   {
+      /* Ignore it unless it is closer than the top                     */
+      if((distSq > heapDistSq[0]) ||
+         ((distSq == heapDistSq[0]) && (j > heap[0])))
+         return;
+
+      /* Replace the top and move it down                               */
+      for(i=0; (child = 2*i+1) < *nHeap; i=child)
+      {
+         if((child+1 < *nHeap) &&
+            ((heapDistSq[child+1] > heapDistSq[child]) ||
+             ((heapDistSq[child+1] == heapDistSq[child]) &&
+              (heap[child+1] > heap[child]))))
+            child++;
+         if((distSq > heapDistSq[child]) ||
+            ((distSq == heapDistSq[child]) && (j > heap[child])))
+            break;
+         heap[i]       = heap[child];
+         heapDistSq[i] = heapDistSq[child];
+      }
+   }
+   heap[i]       = j;
+   heapDistSq[i] = distSq;
+}
+
+
 /************************************************************************/
 /*>int CalcMassCentre(PDB **tab, int natoms, 
                       REAL *cen_x, REAL *cen_y, REAL *cen_z)
@@ -937,28 +1857,23 @@ void MassCentre(PDB *pdb, PDB *central, int *natom, REAL *Masscen_x,
 -  26.10.11  Changed double to REAL  
              Uses NCLOSE instead of hard-coded 10   By: ACRM
 -  05.11.13  Added natoms parameter and check on this
+-  16.10.26  tab[] now only contains the closest atoms excluding the
+             central one  By: ACRM
 */
 void CalcMassCentre(PDB **tab, int natoms, 
                     REAL *cen_x,REAL *cen_y, REAL *cen_z)
 {
-   int  added_count = 0,
-        array_count = 0;
+   int  added_count = 0;
    REAL x_sum = 0, 
         y_sum = 0, 
         z_sum = 0;
  
-   while ((added_count < NCLOSE) && (array_count < natoms))
+   while ((added_count < NCLOSE) && (added_count < natoms))
    {
-      /* if distance from central != 0 -> excluding coo. of central     */
-      if (! ( ((tab[array_count]->occ) > -0.01) && 
-              ((tab[array_count]->occ) < 0.01) ) )
-      {      
-         x_sum += tab[array_count] -> x;
-         y_sum += tab[array_count] -> y;
-         z_sum += tab[array_count] -> z;
-         added_count++;   
-      }      
-      array_count++;      
+      x_sum += tab[added_count] -> x;
+      y_sum += tab[added_count] -> y;
+      z_sum += tab[added_count] -> z;
+      added_count++;   
    }
    
    /* coordinates of the centre of mass                                 */
@@ -968,40 +1883,6 @@ void CalcMassCentre(PDB **tab, int natoms,
 }
 
 
-/**********************************************************************/
-/*>int CompareFunc(const void* e1, const void* e2)
-   -----------------------------------------------
-*//**
-
-   \param[in]      elements to compare
-   \param[out]     0 or 1, depending whether the left element1 goes 
-                   before, is equal, or goes after element2, respectively
-
-   Defines comparison metric for qsort. Obtained from
-   http://www.codeguru.com/forum/archive/index.php/t-315091.html
-
--  08.12.08    By: Anja
-*/
-int CompareFunc(const void* e1, const void* e2) 
-{
-   const PDB* elem1 = *(PDB**)e1;
-   const PDB* elem2 = *(PDB**)e2;
-
-   if ( (elem1->occ) < (elem2->occ) )
-   {
-      return (-1);
-   }
-   else if ( (elem1->occ) == (elem2->occ) )
-   {
-      return (0);
-   }
-   else
-   {
-      return (1);           
-   }
-}
-
-
 /**********************************************************************/
 /*>BOOL CheckVectAngle(PDB *central, REAL *Masscen_x, REAL *Masscen_y, 
                     REAL *Masscen_z, PDB *current, REAL *Masscurr_x,
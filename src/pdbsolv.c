@@ -3,11 +3,11 @@
 
    \file       pdbsolv.c
    
-   \version    V1.6
-   \date       21.11.17
+   \version    V1.11
+   \date       16.10.26
    \brief      Solvent accessibility using bioplib
    
-   \copyright  (c) UCL, Dr. Andrew C.R. Martin, 2014-2017
+   \copyright  (c) UCL, Dr. Andrew C.R. Martin, 2014-2026
    \author     Dr. Andrew C.R. Martin
    \par
                Institute of Structural & Molecular Biology,
@@ -55,6 +55,16 @@
 -   V1.5   08.03.16 Corrected insert code printing so it is left-justified
                     and now touches the residue number
 -   V1.7   21.11.17 Added -x flag to add radii in occupancy column
+-   V1.8   16.10.26 Added -j to calculate accessibility with a pool of
+                    threads using a cell list of neighbouring atoms
+-   V1.9   16.10.26 Added -s for a faster Shrake and Rupley calculation
+                    with a given number of points per atom
+-   V1.10  16.10.26 Added -d and -g to calculate the surface area of 
+                    each residue buried on forming the complex from
+                    isolated chains (or groups of chains)
+-   V1.11  16.10.26 Added -l and -o to process a list of files with a 
+                    pool of threads. Radii are kept in a hashed table
+                    shared by all the structures
 
 *************************************************************************/
 /* Includes
@@ -62,11 +72,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "bioplib/macros.h"
 #include "bioplib/SysDefs.h"
 #include "bioplib/pdb.h"
 #include "bioplib/access.h"
+#include "bioplib/general.h"
+#include "bioplib/hash.h"
 
 /************************************************************************/
 /* Defines and macros
@@ -75,10 +92,149 @@
 #define DEF_PROBERADIUS 1.4
 #define DEF_RADFILE "radii.dat"
 #define DATA_ENV "DATADIR"
+#define MAXTHREADS       256         /* Maximum number of threads (-j)  */
+#define CHUNKSPERTHREAD    4         /* Work ranges per thread          */
+#define MAXGRIDCELLS 1000000         /* Max cells in the cell list      */
+#define GRID_SLACK       0.001       /* Added to cell size              */
+#define NEIGHBOURSTEP    64          /* Growth of neighbour arrays      */
+#define OCCLUDEBLOCK      8          /* Neighbours tested together for
+                                        occlusion of a point            */
+#define MAXCHAINGROUPS   64          /* Maximum -g chain groups         */
+#define HASHSIZE       1000          /* Size of the radius hash         */
+#define MAXRADKEY        24          /* Residue and atom name key       */
+#define RADIUSSTEP      256          /* Growth of the radius table      */
+#define MAXOUTFILE   (3*MAXBUFF)     /* Length of a -o output file      */
+
+/************************************************************************/
+/* Structure definitions
+*/
+/* A neighbour of the atom being processed                              */
+typedef struct
+{
+   REAL dx, dy, dz,           /* Offset from the atom                   */
+        dxysq, dxy,           /* Squared and actual XY distance         */
+        z,
+        radsq;                /* Squared radius (plus probe)            */
+}  ACCNEIGHBOUR;
+
+/* An arc of a slice circle buried by a neighbour                       */
+typedef struct
+{
+   REAL start,
+        stop;
+}  ACCARC;
+
+/* Work arrays for one thread                                           */
+typedef struct
+{
+   ACCNEIGHBOUR *neighbours;
+   ACCARC       *arcs;
+   REAL         *nbX,         /* Neighbour offsets and squared radii as */
+                *nbY,         /* separate arrays for Shrake and Rupley  */
+                *nbZ,
+                *nbRadSq;
+   int          nNeighbours,
+                maxNeighbours;
+}  ACCSCRATCH;
+
+/* Atoms and cell list shared by the threads calculating accessibility  */
+typedef struct _accessdata
+{
+   REAL *x, *y, *z,
+        *radius,              /* Atom radius plus probe radius          */
+        *access;              /* Result for each atom                   */
+   int  *cellHead,            /* First atom in each cell (or -1)        */
+        *nextInCell,          /* Next atom in the same cell (or -1)     */
+        *group,               /* Chain group of each atom (or NULL)     */
+        *calcList,            /* Atoms to calculate (NULL for all)      */
+        nCalc,                /* Number of atoms to calculate           */
+        natoms,
+        nx, ny, nz,
+        nChunks,
+        nextChunk;            /* Next range of atoms to be processed    */
+   REAL minX, minY, minZ,
+        cellSize,
+        sliceWidth,           /* Integration accuracy                   */
+        probeRadius,
+        *pointX,              /* Unit sphere points for Shrake and      */
+        *pointY,              /* Rupley                                 */
+        *pointZ;
+   int  nPoints;              /* 0 for Lee and Richards                 */
+   BOOL doAccessibility,
+        noMemory,
+        isolated,             /* Ignore atoms in other chain groups     */
+        *interface;           /* Atom has a neighbour in another group  */
+   BOOL (*CalcAtom)(struct _accessdata *data, int atomNum,
+                    ACCSCRATCH *scratch);
+}  ACCESSDATA;
+
+/* Atom radii keyed on residue and atom name. Names not yet in the 
+   table are given radii by blSetAtomRadii() and then added
+*/
+typedef struct
+{
+   HASHTABLE *hash;           /* Key to index in radius[]               */
+   FILE      *fpRad;          /* Radius file                            */
+   RESRAD    *resrad;         /* Residue data for -r                    */
+   REAL      *radius;
+   int       nRadii,
+             maxRadii;
+}  RADIUSTABLE;
+
+/* Options used for every structure processed                          */
+typedef struct
+{
+   RADIUSTABLE *radii;
+   char        ***groups;     /* Chain labels of each -g group          */
+   REAL        integrationAccuracy,
+               probeRadius;
+   int         nThreads,      /* 0 to use blCalcAccess()                */
+               nPoints,
+               nGroups;
+   BOOL        doAccessibility,
+               noAtoms,
+               addRadii,
+               doDelta;
+}  SOLVOPTIONS;
+
+/* A list of files processed by a pool of threads (-l)                  */
+typedef struct
+{
+   SOLVOPTIONS *options;
+   char        **filenames,
+               *outdir,       /* Directory for the output files         */
+               *resext;       /* Extension for residue files (or blank) */
+   BOOL        *duplicate;    /* Output would overwrite an earlier 
+                                 file's                                 */
+   int         nFiles,
+               maxFiles,
+               nextFile,      /* Next file to be taken by a thread      */
+               nFailed;
+}  BATCH;
+
+/* A file's output name and list position, for finding duplicates       */
+typedef struct
+{
+   char        *name;
+   int         index;
+}  BATCHNAME;
 
 /************************************************************************/
 /* Globals
 */
+/* Hands out ranges of atoms to the accessibility threads               */
+static pthread_mutex_t sAccessMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* BiopLib's PDB reading and writing use static data, so only one 
+   structure is read or written at a time
+*/
+static pthread_mutex_t sPDBMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes use of the radius table                                   */
+static pthread_mutex_t sRadiusMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hands out files in batch mode                                        */
+static pthread_mutex_t sBatchMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /************************************************************************/
 /* Prototypes
@@ -87,11 +243,50 @@ int  main(int argc, char **argv);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
                   REAL *integrationAccuracy, REAL *rad, char *radfile,
                   BOOL *doAccessibility, char *resfile, BOOL *noAtoms,
-                  BOOL *addRadii);
+                  BOOL *addRadii, int *nThreads, int *nPoints,
+                  BOOL *doDelta, char ***groups, int *nGroups,
+                  BOOL *fileList, char *outdir);
 void Usage(void);
+BOOL ProcessStructure(FILE *in, FILE *out, FILE *resout, char *infile,
+                      SOLVOPTIONS *options);
+BOOL InitRadiusTable(RADIUSTABLE *table, FILE *fpRad);
+BOOL SetAtomRadii(RADIUSTABLE *table, PDB *pdb);
+void MakeRadiusKey(char *key, PDB *p);
+void FreeRadiusTable(RADIUSTABLE *table);
+BOOL DoBatch(char *listname, char *outdir, char *resext, 
+             SOLVOPTIONS *options);
+BOOL ReadFileList(BATCH *batch, char *listname);
+BOOL ReadFileDirectory(BATCH *batch, char *dirname);
+BOOL AddBatchFile(BATCH *batch, char *filename);
+int  CompareStrings(const void *a, const void *b);
+BOOL MarkDuplicateOutputs(BATCH *batch);
+int  CompareBatchNames(const void *a, const void *b);
+void *ProcessBatchFiles(void *arg);
+BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                             char *filename, char *ext);
+BOOL CalcAccessThreaded(PDB *pdb, REAL integrationAccuracy, 
+                        REAL probeRadius, BOOL doAccessibility,
+                        int nThreads, int nPoints, int *group,
+                        REAL *isolated);
+BOOL RunAccessPool(ACCESSDATA *data, int nThreads);
+BOOL BuildAccessCells(ACCESSDATA *data);
+BOOL MakeSpherePoints(ACCESSDATA *data, int nPoints);
+void *AccessWorker(void *arg);
+BOOL FindAccessNeighbours(ACCESSDATA *data, int atomNum, 
+                          ACCSCRATCH *scratch);
+BOOL GrowAccessScratch(ACCSCRATCH *scratch);
+BOOL CalcAtomAccess(ACCESSDATA *data, int atomNum, ACCSCRATCH *scratch);
+BOOL CalcAtomAccessSR(ACCESSDATA *data, int atomNum, 
+                      ACCSCRATCH *scratch);
+REAL ScaleAccess(ACCESSDATA *data, int atomNum, REAL area);
+int CompareArcs(const void *a, const void *b);
+void FreeAccessData(ACCESSDATA *data);
 void PopulateBValWithAccess(PDB *pdb);
 void PopulateOccWithRadii(PDB *pdb);
 void PrintResidueAccessibility(FILE *out, PDB *pdb, RESRAD *resrad);
+int  *AssignChainGroups(PDB *pdb, int natoms, char ***groups, 
+                        int nGroups);
+void PrintResidueDelta(FILE *out, PDB *pdb, REAL *isolated);
 
 
 /************************************************************************/
@@ -104,129 +299,247 @@ void PrintResidueAccessibility(FILE *out, PDB *pdb, RESRAD *resrad);
 -  19.08.14 Fixed call to renamed function: blStripWatersPDBAsCopy()
                   By: CTP
 -  13.02.15 Modified to use whole PDB   By: ACRM
+-  16.10.26 Added -j
+-  16.10.26 Added -s
+-  16.10.26 Added -d and -g
+-  16.10.26 Added -l and -o. Processing of a structure moved to 
+            ProcessStructure(). The radius file is opened here and 
+            shared through a RADIUSTABLE
 
 */
 int main(int argc, char **argv)
 {
-   RESRAD   *resrad;
-   FILE     *in     = stdin,
-            *out    = stdout,
-            *resout = stdout,
-            *fpRad  = NULL;
-   int      natoms;
-   WHOLEPDB *wpdb;
-   PDB      *pdb;
-   BOOL     doAccessibility = FALSE,
-            noenv           = FALSE,
-            noAtoms         = FALSE,
-            doResaccess     = FALSE,
-            addRadii        = FALSE;
-   REAL     integrationAccuracy,
-            probeRadius;
-   char     infile[MAXBUFF],
-            outfile[MAXBUFF],
-            radfile[MAXBUFF],
-            resfile[MAXBUFF];
+   FILE        *in     = stdin,
+               *out    = stdout,
+               *resout = NULL,
+               *fpRad  = NULL;
+   RADIUSTABLE radii;
+   SOLVOPTIONS options;
+   BOOL        noenv    = FALSE,
+               fileList = FALSE;
+   int         retval   = 0;
+   char        **groups[MAXCHAINGROUPS],
+               infile[MAXBUFF],
+               outfile[MAXBUFF],
+               radfile[MAXBUFF],
+               resfile[MAXBUFF],
+               outdir[MAXBUFF];
+   
+   options.addRadii = FALSE;
+   options.nThreads = 0;
+   options.nPoints  = 0;
+   options.groups   = groups;
    
    if(!ParseCmdLine(argc, argv, infile, outfile, 
-                    &integrationAccuracy, &probeRadius, 
-                    radfile, &doAccessibility, resfile, &noAtoms,
-                    &addRadii))
+                    &options.integrationAccuracy, &options.probeRadius, 
+                    radfile, &options.doAccessibility, resfile, 
+                    &options.noAtoms, &options.addRadii, 
+                    &options.nThreads, &options.nPoints,
+                    &options.doDelta, groups, &options.nGroups,
+                    &fileList, outdir))
    {
       Usage();
       return(0);
    }
 
-   if(resfile[0] != '\0')
+   /* Without -r the buried areas are written instead of the atoms      */
+   if(options.doDelta && (resfile[0] == '\0'))
+      options.noAtoms = TRUE;
+
+   /* Open the radius file. The radii are shared by all the structures  */
+   if((fpRad=blOpenFile(radfile, DATA_ENV, "r", &noenv))==NULL)
    {
-      doResaccess = TRUE;
-      if((resout = blOpenOrPipe(resfile))==NULL)
+      fprintf(stderr, "Error (pdbsolv): Unable to open radius file, \
+%s\n", radfile);
+      if(noenv)
       {
-         fprintf(stderr, "Error (pdbsolv): Unable to open file or pipe \
-for residue accessibility data (%s)\n", resfile);
-         return(1);
+         fprintf(stderr, "              Environment variable %s \
+not set\n", DATA_ENV);
       }
+      return(1);
    }
 
-   if(!blOpenStdFiles(infile, outfile, &in, &out))
+   if(!InitRadiusTable(&radii, fpRad))
    {
-      fprintf(stderr, "Error (pdbsolv): Unable to open input or output \
-file\n");
+      fprintf(stderr, "Error (pdbsolv): No memory for radius table\n");
       return(1);
    }
+   options.radii = &radii;
+
+   if(fileList)
+   {
+      /* The list of files is read by DoBatch()                         */
+      if(!DoBatch(infile, outdir, resfile, &options))
+         retval = 1;
+   }
+   else
+   {
+      if(resfile[0] != '\0')
+      {
+         if((resout = blOpenOrPipe(resfile))==NULL)
+         {
+            fprintf(stderr, "Error (pdbsolv): Unable to open file or \
+pipe for residue accessibility data (%s)\n", resfile);
+            return(1);
+         }
+      }
+
+      if(!blOpenStdFiles(infile, outfile, &in, &out))
+      {
+         fprintf(stderr, "Error (pdbsolv): Unable to open input or \
+output file\n");
+         return(1);
+      }
+
+      if(!ProcessStructure(in, out, resout, infile, &options))
+         retval = 1;
+
+      if(resout != NULL)
+         blCloseOrPipe(resout);
+   }
+
+   /* Free up the memory from the radii                                 */
+   FreeRadiusTable(&radii);
+   fclose(fpRad);
+
+   return(retval);
+}
+
+
+/************************************************************************/
+/*>BOOL ProcessStructure(FILE *in, FILE *out, FILE *resout, 
+                         char *infile, SOLVOPTIONS *options)
+   --------------------------------------------------------------
+*//**
+   \param[in]  FILE        *in       Input PDB file
+   \param[in]  FILE        *out      Output PDB file
+   \param[in]  FILE        *resout   Output residue file (or NULL)
+   \param[in]  char        *infile   Input filename for messages
+   \param[in]  SOLVOPTIONS *options  Options and radii
+   \return     BOOL                  Success. Errors are reported here
+
+   Reads a structure, calculates the accessibilities and writes the
+   results. Everything allocated is freed.
+
+-  16.10.26  Original   By: ACRM (from main())
+*/
+BOOL ProcessStructure(FILE *in, FILE *out, FILE *resout, char *infile,
+                      SOLVOPTIONS *options)
+{
+   WHOLEPDB *wpdb;
+   PDB      *pdb;
+   int      natoms,
+            *group    = NULL;
+   REAL     *isolated = NULL;
+   BOOL     ok        = TRUE;
 
+   pthread_mutex_lock(&sPDBMutex);
    if((wpdb = blReadWholePDB(in))==NULL)
    {
+      pthread_mutex_unlock(&sPDBMutex);
       fprintf(stderr, "Error (pdbsolv): No atoms read from PDB \
 file, %s\n", infile);
-      return(1);
+      return(FALSE);
    }
 
    /* Strip waters                                                      */
    if((pdb = blStripWatersPDBAsCopy(wpdb->pdb, &natoms))==NULL)
    {
+      blFreeWholePDB(wpdb);
+      pthread_mutex_unlock(&sPDBMutex);
       fprintf(stderr, "Error (pdbsolv): No memory to strip waters from \
 PDB file, %s\n",
               infile);
-      return(1);
+      return(FALSE);
    }
+   pthread_mutex_unlock(&sPDBMutex);
 
    /* Free the original linked list of atoms and patch in the new one   */
    FREELIST(wpdb->pdb, PDB);
    wpdb->pdb = pdb;
 
-   /* Open the radius file                                              */
-   if((fpRad=blOpenFile(radfile, DATA_ENV, "r", &noenv))==NULL)
+   /* Set the atom radii in the linked list                             */
+   if(!SetAtomRadii(options->radii, pdb))
    {
-      fprintf(stderr, "Error (pdbsolv): Unable to open radius file, \
-%s\n", radfile);
-      if(noenv)
+      fprintf(stderr,"Error: (pdbsolv) No memory for atom radii\n");
+      ok = FALSE;
+   }
+
+   /* Find the chain group of each atom for the isolated calculations   */
+   if(ok && options->doDelta)
+   {
+      if(((group = AssignChainGroups(pdb, natoms, options->groups, 
+                                     options->nGroups))==NULL) ||
+         ((isolated = (REAL *)malloc(MAX(natoms, 1) * sizeof(REAL)))
+          ==NULL))
       {
-         fprintf(stderr, "              Environment variable %s \
-not set\n", DATA_ENV);
+         fprintf(stderr,"Error: (pdbsolv) No memory for chain \
+groups\n");
+         ok = FALSE;
       }
-      return(1);
    }
 
-   /* Set the atom radii in the linked list                             */
-   resrad = blSetAtomRadii(pdb, fpRad);
-
    /* Do the actual accessibility calculations                          */
-   if(!blCalcAccess(pdb, natoms, 
-                    integrationAccuracy, probeRadius,
-                    doAccessibility))
+   if(ok)
    {
-      fprintf(stderr,"Error: (pdbsolv) No memory for accessibility \
+      if(options->nThreads || options->nPoints || options->doDelta)
+      {
+         ok = CalcAccessThreaded(pdb, options->integrationAccuracy, 
+                                 options->probeRadius,
+                                 options->doAccessibility, 
+                                 MAX(options->nThreads, 1), 
+                                 options->nPoints, group, isolated);
+      }
+      else
+      {
+         ok = blCalcAccess(pdb, natoms, 
+                           options->integrationAccuracy, 
+                           options->probeRadius,
+                           options->doAccessibility);
+      }
+      
+      if(!ok)
+      {
+         fprintf(stderr,"Error: (pdbsolv) No memory for accessibility \
 arrays\n");
-      return(1);
+      }
    }
 
-   /* And populate the B-values with the accessibility and write the
-      new PDB file
-   */
-   if(!noAtoms)
+   if(ok)
    {
-      PopulateBValWithAccess(pdb);
-      if(addRadii)
+      /* And populate the B-values with the accessibility and write the
+         new PDB file
+      */
+      if(!options->noAtoms)
       {
-         PopulateOccWithRadii(pdb);
+         PopulateBValWithAccess(pdb);
+         if(options->addRadii)
+         {
+            PopulateOccWithRadii(pdb);
+         }
+         
+         pthread_mutex_lock(&sPDBMutex);
+         blWriteWholePDB(out, wpdb);
+         pthread_mutex_unlock(&sPDBMutex);
       }
-      
-      blWriteWholePDB(out, wpdb);
-   }
 
-   if(doResaccess)
-   {
-      PrintResidueAccessibility(resout, pdb, resrad);
-      blCloseOrPipe(resout);
+      if(options->doDelta)
+      {
+         PrintResidueDelta(((resout != NULL) ? resout : out), 
+                           pdb, isolated);
+      }
+      else if(resout != NULL)
+      {
+         PrintResidueAccessibility(resout, pdb, options->radii->resrad);
+      }
    }
 
-   /* Free up the memory for the PDB linked list                        */
-   FREELIST(pdb, PDB);
-   /* Free up the memory from the residue radii                         */
-   FREELIST(resrad, RESRAD);
+   /* Free up the memory for the PDB linked list and chain groups       */
+   blFreeWholePDB(wpdb);
+   if(group    != NULL) free(group);
+   if(isolated != NULL) free(isolated);
 
-   return(0);
+   return(ok);
 }
 
 
@@ -234,7 +547,9 @@ arrays\n");
 /*>BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
                      REAL *p, REAL *rad, char *radfile,
                      BOOL *doAccessibility, char *resfile, BOOL *noAtoms,
-                     BOOL *addRadii)
+                     BOOL *addRadii, int *nThreads, int *nPoints,
+                     BOOL *doDelta, char ***groups, int *nGroups,
+                     BOOL *fileList, char *outdir)
    ----------------------------------------------------------------------
 *//**
    \param[in]   int    argc              Argument count
@@ -250,17 +565,34 @@ arrays\n");
                                          accessibilities
    \param[out]  BOOL   *noAtoms          Do not write atom accessibilities
    \param[out]  BOOL   *addRadii         Add radii to occupancy column
+   \param[out]  int    *nThreads         Number of threads (0 to use
+                                         blCalcAccess())
+   \param[out]  int    *nPoints          Points per atom for Shrake and
+                                         Rupley (0 for Lee and Richards)
+   \param[out]  BOOL   *doDelta          Calculate buried area from 
+                                         isolated chain groups
+   \param[out]  char   ***groups         Chain labels of each -g group
+   \param[out]  int    *nGroups          Number of -g groups
+   \param[out]  BOOL   *fileList         Input is a list of files (or
+                                         a directory)
+   \param[out]  char   *outdir           Directory for -l output files
    \return      BOOL                     Success
 
    Parse the command line
 
    17.07.14 Original    By: ACRM
    21.11.17 Added -x addRadii
+   16.10.26 Added -j nThreads
+   16.10.26 Added -s nPoints
+   16.10.26 Added -d doDelta and -g groups
+   16.10.26 Added -l fileList and -o outdir
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile, 
                   REAL *integrationAccuracy, REAL *rad, char *radfile,
                   BOOL *doAccessibility, char *resfile, BOOL *noAtoms,
-                  BOOL *addRadii)
+                  BOOL *addRadii, int *nThreads, int *nPoints,
+                  BOOL *doDelta, char ***groups, int *nGroups,
+                  BOOL *fileList, char *outdir)
 {
    argc--;
    argv++;
@@ -269,8 +601,11 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
    *integrationAccuracy = ACCESS_DEF_INTACC;
    *rad                 = DEF_PROBERADIUS;
    *noAtoms             = FALSE;
+   *doDelta             = FALSE;
+   *nGroups             = 0;
+   *fileList            = FALSE;
 
-   infile[0] = outfile[0] = radfile[0] = resfile[0] = '\0';
+   infile[0] = outfile[0] = radfile[0] = resfile[0] = outdir[0] = '\0';
    strcpy(radfile, DEF_RADFILE);
    
    while(argc)
@@ -307,6 +642,41 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          case 'x':
             *addRadii = TRUE;
             break;
+         case 'j':
+            if(!(--argc) || !sscanf((++argv)[0],"%d",nThreads) ||
+               (*nThreads < 1) || (*nThreads > MAXTHREADS))
+               return(FALSE);
+            break;
+         case 's':
+            if(!(--argc) || !sscanf((++argv)[0],"%d",nPoints) ||
+               (*nPoints < 1))
+               return(FALSE);
+            break;
+         case 'd':
+            *doDelta = TRUE;
+            break;
+         case 'g':
+            if(!(--argc) || (*nGroups == MAXCHAINGROUPS))
+               return(FALSE);
+            if((groups[*nGroups] = 
+                blSplitStringOnCommas((++argv)[0], MAXCHAINLABEL))==NULL)
+            {
+               fprintf(stderr,"Error (pdbsolv): No memory for storing \
+chain labels: %s\n", argv[0]);
+               exit(1);
+            }
+            (*nGroups)++;
+            *doDelta = TRUE;
+            break;
+         case 'l':
+            *fileList = TRUE;
+            break;
+         case 'o':
+            if(!(--argc))
+               return(FALSE);
+            strncpy(outdir,(++argv)[0],MAXBUFF);
+            outdir[MAXBUFF-1] = '\0';
+            break;
          default:
             return(FALSE);
             break;
@@ -327,12 +697,16 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          if(argc)
             strcpy(outfile, argv[0]);
             
-         return(TRUE);
+         break;
       }
 
       argc--;
       argv++;
    }
+
+   /* -l needs a directory for the output files instead of outfile      */
+   if(*fileList && ((outdir[0] == '\0') || (outfile[0] != '\0')))
+      return(FALSE);
    
    return(TRUE);
 }
@@ -350,14 +724,24 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 -   17.06.15 V1.4
 -   08.03.16 V1.5
 -   21.11.17 V1.6
+-   16.10.26 V1.8
+-   16.10.26 V1.9
+-   16.10.26 V1.10
+-   16.10.26 V1.11 Added -l and -o
+-   16.10.26 States which options change the calculation
 */
 void Usage(void)
 {
-   fprintf(stderr,"\npdbsolv V1.6 (c) 2014-2017 UCL, Dr. Andrew C.R. \
+   fprintf(stderr,"\npdbsolv V1.11 (c) 2014-2026 UCL, Dr. Andrew C.R. \
 Martin\n");
 
    fprintf(stderr,"\nUsage: pdbsolv [-i val] [-p val] [-f radfile] \
-[-r resfile] [-n] [-c] [-x] [in.pdb [out.pdb]]\n");
+[-r resfile] [-n] [-c] [-x]\n");
+   fprintf(stderr,"               [-j nthreads] [-s npoints] [-d] \
+[-g chain[,chain...]]...\n");
+   fprintf(stderr,"               [in.pdb [out.pdb]]\n");
+   fprintf(stderr,"       pdbsolv [options] -l -o outdir \
+[filelist|directory]\n");
    fprintf(stderr,"            -i val      Specify integration accuracy \
 (Default: %.2f)\n",ACCESS_DEF_INTACC);
    fprintf(stderr,"            -p val      Specify probe radius \
@@ -381,6 +765,54 @@ accessibility. Used with -r\n");
 accessibility\n");
    fprintf(stderr,"            -x          Add radii in occupancy \
 column of PDB file\n");
+   fprintf(stderr,"            -j nthreads Calculate accessibility \
+with the given number of\n");
+   fprintf(stderr,"                        threads. The results do not \
+depend on the number\n");
+   fprintf(stderr,"                        of threads\n");
+   fprintf(stderr,"            -s npoints  Use the faster Shrake and \
+Rupley method with the\n");
+   fprintf(stderr,"                        given number of points per \
+atom instead of Lee\n");
+   fprintf(stderr,"                        and Richards. -i is then \
+ignored. Compared with\n");
+   fprintf(stderr,"                        Lee and Richards, 100 points \
+gives totals within\n");
+   fprintf(stderr,"                        about 0.5%% (25x faster) and \
+1000 points within\n");
+   fprintf(stderr,"                        about 0.1%% (5x faster)\n");
+   fprintf(stderr,"            -d          Also calculate each chain \
+in isolation and write the\n");
+   fprintf(stderr,"                        area of each residue buried \
+in the complex. This\n");
+   fprintf(stderr,"                        goes to resfile if -r is \
+given, otherwise it is\n");
+   fprintf(stderr,"                        written instead of the \
+atoms\n");
+   fprintf(stderr,"            -g chains   Treat the comma-separated \
+chains as one molecule\n");
+   fprintf(stderr,"                        for -d (implies -d). May be \
+repeated. Other\n");
+   fprintf(stderr,"                        chains are each treated \
+alone\n");
+   fprintf(stderr,"            -l          Input is a file containing a \
+list of PDB files,\n");
+   fprintf(stderr,"                        or a directory of PDB files. \
+-j then gives the\n");
+   fprintf(stderr,"                        number of files processed at \
+once. The results\n");
+   fprintf(stderr,"                        are the same as processing \
+each file with -j 1\n");
+   fprintf(stderr,"            -o outdir   With -l, write the output for \
+each file to\n");
+   fprintf(stderr,"                        outdir/file. If -r is given, \
+the residue data go\n");
+   fprintf(stderr,"                        to outdir/file followed by \
+resfile, so resfile\n");
+   fprintf(stderr,"                        should be an extension such \
+as .res. A file with\n");
+   fprintf(stderr,"                        the same name as an earlier \
+file is skipped\n");
 
 
    fprintf(stderr,"\nPerforms solvent accessibility calculations \
@@ -388,7 +820,17 @@ according to the method of\n");
    fprintf(stderr,"Lee and Richards. Reads and writes PDB format files. \
 Input/output is\n");
    fprintf(stderr,"to standard input/output if files are not \
-specified.\n\n");
+specified.\n");
+   fprintf(stderr,"With -l, files that cannot be processed are reported \
+and skipped, and the\n");
+   fprintf(stderr,"exit status is then non-zero.\n");
+   fprintf(stderr,"\nBy default the accessibility is calculated by \
+BiopLib. -j, -s, -d, -g\n");
+   fprintf(stderr,"and -l use a threaded calculation in pdbsolv \
+instead. Its results do not\n");
+   fprintf(stderr,"depend on the number of threads, but may differ \
+slightly from the\n");
+   fprintf(stderr,"default.\n\n");
 }
 
 
@@ -447,6 +889,7 @@ void PopulateOccWithRadii(PDB *pdb)
 -  17.07.14  Original   By:ACRM
 -  17.06.15  Added sidechain accessibility printing
 -  08.03.16  Corrected insertion printing so it is left justified
+-  16.10.26  Frees the residue accessibilities
 */
 void PrintResidueAccessibility(FILE *out, PDB *pdb, RESRAD *resrad)
 {
@@ -468,6 +911,1649 @@ residue accessibilities\n");
                  r->resAccess, r->relAccess,
                  r->scAccess,  r->scRelAccess);
       }
+      FREELIST(resaccess, RESACCESS);
+   }
+}
+
+
+
+/************************************************************************/
+/*>int *AssignChainGroups(PDB *pdb, int natoms, char ***groups, 
+                           int nGroups)
+   ---------------------------------------------------------------
+*//**
+   \param[in]  PDB    *pdb      PDB linked list
+   \param[in]  int    natoms    Number of atoms in the list
+   \param[in]  char   ***groups Chain labels of each group
+   \param[in]  int    nGroups   Number of groups
+   \return     int    *         Malloc'd group number of each atom 
+                                (NULL if no memory)
+
+   Numbers the chain group of each atom. Chains that are not in one of
+   the specified groups each form a group of their own.
+
+-  16.10.26  Original   By: ACRM
+*/
+int *AssignChainGroups(PDB *pdb, int natoms, char ***groups, int nGroups)
+{
+   PDB  *p,
+        **otherChains;
+   int  *group,
+        nOtherChains = 0,
+        i, g, c, k;
+
+   if((group = (int *)malloc(MAX(natoms, 1) * sizeof(int)))==NULL)
+      return(NULL);
+   if((otherChains = (PDB **)malloc(MAX(natoms, 1) * sizeof(PDB *)))
+      ==NULL)
+   {
+      free(group);
+      return(NULL);
+   }
+   
+   for(i=0, p=pdb; p!=NULL; NEXT(p), i++)
+   {
+      /* See if the chain is in one of the specified groups             */
+      group[i] = (-1);
+      for(g=0; (g<nGroups) && (group[i] < 0); g++)
+      {
+         for(c=0; 
+             (groups[g][c] != NULL) && (groups[g][c][0] != '\0'); 
+             c++)
+         {
+            if(CHAINMATCH(p->chain, groups[g][c]))
+            {
+               group[i] = g;
+               break;
+            }
+         }
+      }
+
+      /* If not, find (or start) the group for this chain alone. Try the
+         most recent chain first
+      */
+      if(group[i] < 0)
+      {
+         for(k=nOtherChains-1; k>=0; k--)
+         {
+            if(PDBCHAINMATCH(p, otherChains[k]))
+               break;
+         }
+         if(k < 0)
+         {
+            k = nOtherChains++;
+            otherChains[k] = p;
+         }
+         group[i] = nGroups + k;
+      }
+   }
+
+   free(otherChains);
+   return(group);
+}
+
+
+/************************************************************************/
+/*>void PrintResidueDelta(FILE *out, PDB *pdb, REAL *isolated)
+   -----------------------------------------------------------
+*//**
+   \param[in]  FILE   *out      Output file pointer
+   \param[in]  PDB    *pdb      PDB linked list with the accessibility
+                                in the complex
+   \param[in]  REAL   *isolated Accessibility of each atom in its 
+                                isolated chain group
+
+   Prints the accessibility of each residue in the complex and in its
+   isolated chain group, and the area buried on forming the complex
+
+-  16.10.26  Original   By: ACRM
+*/
+void PrintResidueDelta(FILE *out, PDB *pdb, REAL *isolated)
+{
+   PDB  *p,
+        *start,
+        *nextRes;
+   REAL resComplex,
+        resIsolated,
+        totComplex  = 0.0,
+        totIsolated = 0.0;
+   int  i = 0;
+
+   fprintf(out, "#       RESIDUE  AA   COMPLEX ISOLATED   BURIED\n");
+
+   for(start=pdb; start!=NULL; start=nextRes)
+   {
+      nextRes     = blFindNextResidue(start);
+      resComplex  = resIsolated = 0.0;
+      for(p=start; p!=nextRes; NEXT(p), i++)
+      {
+         resComplex  += p->access;
+         resIsolated += isolated[i];
+      }
+      
+      fprintf(out, "RESBUR %2s%5d%-2s %s %8.3f %8.3f %8.3f\n",
+              start->chain, start->resnum, start->insert, start->resnam,
+              resComplex, resIsolated, resIsolated - resComplex);
+
+      totComplex  += resComplex;
+      totIsolated += resIsolated;
+   }
+
+   fprintf(out, "TOTBUR                 %8.3f %8.3f %8.3f\n",
+           totComplex, totIsolated, totIsolated - totComplex);
+}
+
+
+/************************************************************************/
+/*>BOOL InitRadiusTable(RADIUSTABLE *table, FILE *fpRad)
+   -----------------------------------------------------
+*//**
+   \param[out]  RADIUSTABLE *table   Radius table
+   \param[in]   FILE        *fpRad   Open radius file
+   \return      BOOL                 Success (FALSE if no memory)
+
+   Creates an empty radius table. Radii are added by SetAtomRadii() as
+   residue and atom names are met.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL InitRadiusTable(RADIUSTABLE *table, FILE *fpRad)
+{
+   table->fpRad    = fpRad;
+   table->resrad   = NULL;
+   table->radius   = NULL;
+   table->nRadii   = 0;
+   table->maxRadii = 0;
+   
+   return((table->hash = blInitializeHash(HASHSIZE))!=NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL SetAtomRadii(RADIUSTABLE *table, PDB *pdb)
+   -----------------------------------------------
+*//**
+   \param[in,out]  RADIUSTABLE *table   Radius table
+   \param[in,out]  PDB         *pdb     PDB linked list
+   \return         BOOL                 Success (FALSE if no memory)
+
+   Sets the radius of each atom from the table. One copy of each atom 
+   whose residue and atom name are not yet in the table is given its
+   radius by blSetAtomRadii() and added to the table first, so the
+   radius file is only re-read when new names are seen. 
+
+   The RESRAD data from the first blSetAtomRadii() call are kept in the
+   table for residue accessibilities.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL SetAtomRadii(RADIUSTABLE *table, PDB *pdb)
+{
+   PDB    *p,
+          *q,
+          *newAtoms = NULL,
+          *lastNew  = NULL;
+   RESRAD *resrad;
+   REAL   *radius;
+   char   key[MAXRADKEY];
+   int    firstNew,
+          i;
+   BOOL   ok = TRUE;
+
+   pthread_mutex_lock(&sRadiusMutex);
+
+   /* Copy one atom for each name not yet in the table. Its index in
+      radius[] is reserved now and filled in below
+   */
+   firstNew = table->nRadii;
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      MakeRadiusKey(key, p);
+      if(blHashKeyDefined(table->hash, key))
+         continue;
+
+      if(table->nRadii == table->maxRadii)
+      {
+         if((radius = (REAL *)realloc(table->radius, 
+                                      (table->maxRadii + RADIUSSTEP) *
+                                      sizeof(REAL)))==NULL)
+         {
+            ok = FALSE;
+            break;
+         }
+         table->radius    = radius;
+         table->maxRadii += RADIUSSTEP;
+      }
+
+      INIT(q, PDB);
+      if(q == NULL)
+      {
+         ok = FALSE;
+         break;
+      }
+      blCopyPDB(q, p);
+      
+      if(!blSetHashValueInt(table->hash, key, table->nRadii))
+      {
+         free(q);
+         ok = FALSE;
+         break;
+      }
+      table->nRadii++;
+      
+      if(newAtoms == NULL)
+         newAtoms = q;
+      else
+         lastNew->next = q;
+      lastNew = q;
+   }
+
+   /* Get their radii from BiopLib and fill them in                     */
+   if(newAtoms != NULL)
+   {
+      rewind(table->fpRad);
+      resrad = blSetAtomRadii(newAtoms, table->fpRad);
+      if(table->resrad == NULL)
+      {
+         table->resrad = resrad;
+      }
+      else if(resrad != NULL)
+      {
+         FREELIST(resrad, RESRAD);
+      }
+
+      for(q=newAtoms, i=firstNew; q!=NULL; NEXT(q), i++)
+         table->radius[i] = q->radius;
+      FREELIST(newAtoms, PDB);
+   }
+
+   /* Now set the radii from the table                                  */
+   if(ok)
+   {
+      for(p=pdb; p!=NULL; NEXT(p))
+      {
+         MakeRadiusKey(key, p);
+         p->radius = table->radius[blGetHashValueInt(table->hash, key)];
+      }
+   }
+
+   pthread_mutex_unlock(&sRadiusMutex);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>void MakeRadiusKey(char *key, PDB *p)
+   --------------------------------------
+*//**
+   \param[out]  char   *key     Key (MAXRADKEY characters)
+   \param[in]   PDB    *p       Atom
+
+   Makes the radius table key from the residue and atom names
+
+-  16.10.26  Original   By: ACRM
+*/
+void MakeRadiusKey(char *key, PDB *p)
+{
+   sprintf(key, "%.8s:%.8s", p->resnam, p->atnam_raw);
+}
+
+
+/************************************************************************/
+/*>void FreeRadiusTable(RADIUSTABLE *table)
+   -----------------------------------------
+*//**
+   \param[in,out]  RADIUSTABLE *table   Radius table
+
+   Frees the contents of a radius table. The radius file is not closed.
+
+-  16.10.26  Original   By: ACRM
+*/
+void FreeRadiusTable(RADIUSTABLE *table)
+{
+   if(table->hash   != NULL) blFreeHash(table->hash);
+   if(table->radius != NULL) free(table->radius);
+   if(table->resrad != NULL) FREELIST(table->resrad, RESRAD);
+}
+
+
+/************************************************************************/
+/*>BOOL DoBatch(char *listname, char *outdir, char *resext, 
+                SOLVOPTIONS *options)
+   -------------------------------------------------------
+*//**
+   \param[in]  char        *listname  File containing a list of PDB 
+                                      files, a directory of PDB files 
+                                      or blank for a list on stdin
+   \param[in]  char        *outdir    Directory for the output files
+   \param[in]  char        *resext    Extension for residue files (or
+                                      blank)
+   \param[in]  SOLVOPTIONS *options   Options used for every structure.
+                                      nThreads gives the number of files
+                                      processed at once
+   \return     BOOL                   Success (FALSE if the list could
+                                      not be read, no memory or any 
+                                      file could not be processed)
+
+   Processes a batch of files using a pool of threads. The radius table
+   is shared and each structure's accessibility is calculated in a 
+   single thread, as for a single file run with -j 1. Files that fail
+   are reported and skipped.
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Returns FALSE if any file failed
+-  16.10.26  Files whose output would overwrite another's are skipped
+*/
+BOOL DoBatch(char *listname, char *outdir, char *resext, 
+             SOLVOPTIONS *options)
+{
+   BATCH       batch;
+   SOLVOPTIONS fileOptions;
+   pthread_t   threads[MAXTHREADS];
+   int         nThreads = MAX(options->nThreads, 1),
+               nStarted = 0,
+               i;
+   BOOL        retval;
+
+   /* blCalcAccess() may not be used from several threads, so the
+      threaded calculation is always used. Each structure is calculated
+      in one thread as the threads are used for separate files
+   */
+   fileOptions          = *options;
+   fileOptions.nThreads = 1;
+
+   batch.options   = &fileOptions;
+   batch.outdir    = outdir;
+   batch.resext    = resext;
+   batch.filenames = NULL;
+   batch.nFiles    = 0;
+   batch.maxFiles  = 0;
+   batch.nextFile  = 0;
+   batch.nFailed   = 0;
+   batch.duplicate = NULL;
+
+   /* Files with the same name would write the same output file         */
+   if((retval = ReadFileList(&batch, listname)))
+      retval = MarkDuplicateOutputs(&batch);
+
+   if(retval)
+   {
+      /* Start the pool. If a thread can't be created the files are
+         simply shared by those that were
+      */
+      nThreads = MIN(nThreads, batch.nFiles);
+      for(i=1; i<nThreads; i++)
+      {
+         if(pthread_create(&(threads[nStarted]), NULL, ProcessBatchFiles,
+                           (void *)&batch))
+            break;
+         nStarted++;
+      }
+      ProcessBatchFiles((void *)&batch);
+      for(i=0; i<nStarted; i++)
+         pthread_join(threads[i], NULL);
+
+      if(batch.nFailed)
+      {
+         fprintf(stderr,"Warning (pdbsolv): %d of %d files could not be \
+processed\n", batch.nFailed, batch.nFiles);
+         retval = FALSE;
+      }
    }
+
+   for(i=0; i<batch.nFiles; i++)
+      free(batch.filenames[i]);
+   if(batch.filenames != NULL)
+      free(batch.filenames);
+   if(batch.duplicate != NULL)
+      free(batch.duplicate);
+
+   return(retval);
 }
 
+
+/************************************************************************/
+/*>BOOL ReadFileList(BATCH *batch, char *listname)
+   -----------------------------------------------
+*//**
+   \param[in,out]  BATCH  *batch     Batch to which files are added
+   \param[in]      char   *listname  File containing a list of PDB 
+                                     files, a directory or blank to 
+                                     read a list from stdin
+   \return         BOOL              Success. Errors are reported here
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL ReadFileList(BATCH *batch, char *listname)
+{
+   FILE        *fp = stdin;
+   char        buffer[MAXBUFF];
+   struct stat statBuff;
+   BOOL        ok  = TRUE;
+
+   if(listname[0])
+   {
+      if(!stat(listname, &statBuff) && S_ISDIR(statBuff.st_mode))
+         return(ReadFileDirectory(batch, listname));
+
+      if((fp = fopen(listname, "r"))==NULL)
+      {
+         fprintf(stderr,"Error (pdbsolv): Unable to read file list \
+%s\n", listname);
+         return(FALSE);
+      }
+   }
+
+   while(fgets(buffer, MAXBUFF, fp))
+   {
+      TERMINATE(buffer);
+      if(!buffer[0])
+         continue;
+
+      if(!AddBatchFile(batch, buffer))
+      {
+         ok = FALSE;
+         break;
+      }
+   }
+
+   if(fp != stdin)
+      fclose(fp);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadFileDirectory(BATCH *batch, char *dirname)
+   ---------------------------------------------------
+*//**
+   \param[in,out]  BATCH  *batch     Batch to which files are added
+   \param[in]      char   *dirname   Directory
+   \return         BOOL              Success. Errors are reported here
+
+   Adds the regular files in a directory (other than those starting 
+   with a .) to the batch in alphabetical order
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL ReadFileDirectory(BATCH *batch, char *dirname)
+{
+   DIR           *dir;
+   struct dirent *entry;
+   struct stat   statBuff;
+   char          *filename;
+   BOOL          ok = TRUE;
+
+   if((dir = opendir(dirname))==NULL)
+   {
+      fprintf(stderr,"Error (pdbsolv): Unable to read directory %s\n",
+              dirname);
+      return(FALSE);
+   }
+
+   while((entry = readdir(dir))!=NULL)
+   {
+      if(entry->d_name[0] == '.')
+         continue;
+
+      if((filename = (char *)malloc((strlen(dirname) + 
+                                     strlen(entry->d_name) + 2) *
+                                    sizeof(char)))==NULL)
+      {
+         fprintf(stderr,"Error (pdbsolv): No memory for file list\n");
+         ok = FALSE;
+         break;
+      }
+      sprintf(filename, "%s/%s", dirname, entry->d_name);
+
+      if(!stat(filename, &statBuff) && S_ISREG(statBuff.st_mode))
+         ok = AddBatchFile(batch, filename);
+      free(filename);
+
+      if(!ok)
+         break;
+   }
+   closedir(dir);
+
+   if(batch->nFiles)
+   {
+      qsort((void *)batch->filenames, batch->nFiles, sizeof(char *),
+            CompareStrings);
+   }
+   
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL AddBatchFile(BATCH *batch, char *filename)
+   -----------------------------------------------
+*//**
+   \param[in,out]  BATCH  *batch     Batch
+   \param[in]      char   *filename  Filename to add (copied)
+   \return         BOOL              Success. Errors are reported here
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL AddBatchFile(BATCH *batch, char *filename)
+{
+   char **filenames;
+   
+   if(batch->nFiles == batch->maxFiles)
+   {
+      batch->maxFiles = (batch->maxFiles ? 2 * batch->maxFiles : MAXBUFF);
+      if((filenames = 
+          (char **)realloc((void *)batch->filenames, 
+                           batch->maxFiles * sizeof(char *)))==NULL)
+      {
+         fprintf(stderr,"Error (pdbsolv): No memory for file list\n");
+         return(FALSE);
+      }
+      batch->filenames = filenames;
+   }
+   
+   if((batch->filenames[batch->nFiles] = 
+       (char *)malloc((strlen(filename)+1) * sizeof(char)))==NULL)
+   {
+      fprintf(stderr,"Error (pdbsolv): No memory for file list\n");
+      return(FALSE);
+   }
+   strcpy(batch->filenames[batch->nFiles++], filename);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int CompareStrings(const void *a, const void *b)
+   ------------------------------------------------
+*//**
+   \param[in]  const void *a    Pointer to a string pointer
+   \param[in]  const void *b    Pointer to a string pointer
+   \return     int              strcmp() of the strings
+
+   qsort() comparison function for an array of strings
+
+-  16.10.26  Original   By: ACRM
+*/
+int CompareStrings(const void *a, const void *b)
+{
+   return(strcmp(*(char **)a, *(char **)b));
+}
+
+
+/************************************************************************/
+/*>BOOL MarkDuplicateOutputs(BATCH *batch)
+   ---------------------------------------
+*//**
+   \param[in,out]  BATCH  *batch     Batch
+   \return         BOOL              Success (FALSE if no memory)
+
+   Output files are named from the input filename without its path, so
+   files with the same name in different directories would write the
+   same output file. Sets batch->duplicate for every file whose name
+   has already appeared earlier in the list.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL MarkDuplicateOutputs(BATCH *batch)
+{
+   BATCHNAME *names;
+   int       i;
+
+   if(((batch->duplicate = (BOOL *)calloc(MAX(batch->nFiles, 1), 
+                                          sizeof(BOOL)))==NULL) ||
+      ((names = (BATCHNAME *)malloc(MAX(batch->nFiles, 1) * 
+                                    sizeof(BATCHNAME)))==NULL))
+   {
+      fprintf(stderr,"Error (pdbsolv): No memory for file list\n");
+      return(FALSE);
+   }
+
+   for(i=0; i<batch->nFiles; i++)
+   {
+      if((names[i].name = strrchr(batch->filenames[i], '/'))!=NULL)
+         names[i].name++;
+      else
+         names[i].name = batch->filenames[i];
+      names[i].index = i;
+   }
+
+   /* Each run of equal names is sorted by list position, so all but the
+      first in each run are duplicates
+   */
+   qsort((void *)names, batch->nFiles, sizeof(BATCHNAME), 
+         CompareBatchNames);
+   for(i=1; i<batch->nFiles; i++)
+   {
+      if(!strcmp(names[i].name, names[i-1].name))
+         batch->duplicate[names[i].index] = TRUE;
+   }
+
+   free(names);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int CompareBatchNames(const void *a, const void *b)
+   ---------------------------------------------------
+*//**
+   \param[in]  const void *a    Pointer to a BATCHNAME
+   \param[in]  const void *b    Pointer to a BATCHNAME
+   \return     int              Comparison of the names, then of the
+                                list positions
+
+   qsort() comparison function for an array of BATCHNAMEs
+
+-  16.10.26  Original   By: ACRM
+*/
+int CompareBatchNames(const void *a, const void *b)
+{
+   BATCHNAME *nameA = (BATCHNAME *)a,
+             *nameB = (BATCHNAME *)b;
+   int       cmp;
+
+   if((cmp = strcmp(nameA->name, nameB->name))!=0)
+      return(cmp);
+   return(nameA->index - nameB->index);
+}
+
+
+/************************************************************************/
+/*>void *ProcessBatchFiles(void *arg)
+   ----------------------------------
+*//**
+   \param[in,out]  void  *arg   Pointer to the BATCH
+
+   Thread entry point. Repeatedly takes the next unprocessed file from
+   the batch and processes it, writing outdir/file and, if a residue
+   file extension was given, outdir/file followed by the extension.
+   Files that cannot be processed, or whose output files would 
+   overwrite those of an earlier file, are reported and skipped.
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Skips duplicate output names
+*/
+void *ProcessBatchFiles(void *arg)
+{
+   BATCH       *batch   = (BATCH *)arg;
+   SOLVOPTIONS *options = batch->options;
+   FILE        *in,
+               *out,
+               *resout;
+   char        outfile[MAXOUTFILE],
+               resfile[MAXOUTFILE];
+   int         i;
+   BOOL        ok;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&sBatchMutex);
+      i = batch->nextFile++;
+      pthread_mutex_unlock(&sBatchMutex);
+
+      if(i >= batch->nFiles)
+         break;
+
+      ok     = FALSE;
+      out    = resout = NULL;
+      
+      if((batch->duplicate != NULL) && batch->duplicate[i])
+      {
+         fprintf(stderr,"Warning (pdbsolv): Skipped file %s as an earlier \
+file has the same name\n", batch->filenames[i]);
+      }
+      else if((in = fopen(batch->filenames[i], "r"))==NULL)
+      {
+         fprintf(stderr,"Warning (pdbsolv): Unable to read file %s\n",
+                 batch->filenames[i]);
+      }
+      else
+      {
+         /* The atoms, or the buried areas if there is no residue file,
+            go to outdir/file
+         */
+         if((!options->noAtoms || 
+             (options->doDelta && !batch->resext[0])) &&
+            (!MakeBatchOutputFilename(outfile, batch->outdir,
+                                      batch->filenames[i], "") ||
+             ((out = fopen(outfile, "w"))==NULL)))
+         {
+            fprintf(stderr,"Warning (pdbsolv): Unable to create output \
+file for %s\n", batch->filenames[i]);
+         }
+         else if(batch->resext[0] &&
+                 (!MakeBatchOutputFilename(resfile, batch->outdir,
+                                           batch->filenames[i], 
+                                           batch->resext) ||
+                  ((resout = fopen(resfile, "w"))==NULL)))
+         {
+            fprintf(stderr,"Warning (pdbsolv): Unable to create residue \
+file for %s\n", batch->filenames[i]);
+         }
+         else if(!(ok = ProcessStructure(in, out, resout, 
+                                         batch->filenames[i], options)))
+         {
+            fprintf(stderr,"Warning (pdbsolv): Skipped file %s\n",
+                    batch->filenames[i]);
+         }
+         fclose(in);
+      }
+
+      if(!ok)
+      {
+         pthread_mutex_lock(&sBatchMutex);
+         batch->nFailed++;
+         pthread_mutex_unlock(&sBatchMutex);
+      }
+
+      if(out != NULL)
+      {
+         fclose(out);
+         if(!ok)
+            remove(outfile);
+      }
+      if(resout != NULL)
+      {
+         fclose(resout);
+         if(!ok)
+            remove(resfile);
+      }
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                                char *filename, char *ext)
+   -----------------------------------------------------------
+*//**
+   \param[out]  char   *outfile   Output filename (MAXOUTFILE 
+                                  characters)
+   \param[in]   char   *outdir    Output directory
+   \param[in]   char   *filename  Input PDB filename
+   \param[in]   char   *ext       Extension to add (or blank)
+   \return      BOOL              Success (FALSE if the name is too long)
+
+   Makes outdir/name followed by the extension, where name is the input
+   filename without its path
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Built with strcat() so the compiler can see that the name
+             fits
+*/
+BOOL MakeBatchOutputFilename(char *outfile, char *outdir, 
+                             char *filename, char *ext)
+{
+   char *name;
+   
+   if((name = strrchr(filename, '/'))!=NULL)
+      name++;
+   else
+      name = filename;
+
+   if((strlen(outdir) + strlen(name) + strlen(ext) + 2) > MAXOUTFILE)
+      return(FALSE);
+
+   strcpy(outfile, outdir);
+   strcat(outfile, "/");
+   strcat(outfile, name);
+   strcat(outfile, ext);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL CalcAccessThreaded(PDB *pdb, REAL integrationAccuracy, 
+                           REAL probeRadius, BOOL doAccessibility,
+                           int nThreads, int nPoints, int *group,
+                           REAL *isolated)
+   -------------------------------------------------------------------
+*//**
+   \param[in,out]  PDB  *pdb                  PDB linked list with radii
+   \param[in]      REAL integrationAccuracy   Slice width
+   \param[in]      REAL probeRadius           Probe radius
+   \param[in]      BOOL doAccessibility       Calculate accessibility 
+                                              rather than contact area
+   \param[in]      int  nThreads              Number of threads
+   \param[in]      int  nPoints               Points per atom for 
+                                              Shrake and Rupley (0 for
+                                              Lee and Richards)
+   \param[in]      int  *group                Chain group of each atom
+                                              (or NULL)
+   \param[out]     REAL *isolated             Accessibility of each atom
+                                              in its isolated group 
+                                              (used if group is given)
+   \return         BOOL                       Success (FALSE if no 
+                                              memory)
+
+   Calculates atom accessibilities (or contact areas) by the method of
+   Lee and Richards, or of Shrake and Rupley if nPoints is given, and 
+   stores them in the access field of each atom.
+   Neighbours are found from a cell list and the atoms are split into
+   ranges which a pool of threads processes. Each atom is calculated
+   independently, in the same order, so the results do not depend on
+   the number of threads.
+
+   If chain groups are given, atoms with a neighbour from another group
+   are then recalculated ignoring the other groups. These are the only
+   atoms whose accessibility changes when the group is on its own, so
+   the others simply keep their values from the complex.
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Added nPoints
+-  16.10.26  Added group and isolated
+*/
+BOOL CalcAccessThreaded(PDB *pdb, REAL integrationAccuracy, 
+                        REAL probeRadius, BOOL doAccessibility,
+                        int nThreads, int nPoints, int *group,
+                        REAL *isolated)
+{
+   ACCESSDATA data;
+   PDB        *p;
+   int        i;
+
+   data.x = data.y = data.z = data.radius = data.access = NULL;
+   data.cellHead        = data.nextInCell = NULL;
+   data.calcList        = NULL;
+   data.interface       = NULL;
+   data.group           = group;
+   data.isolated        = FALSE;
+   data.pointX = data.pointY = data.pointZ = NULL;
+   data.nPoints         = nPoints;
+   data.CalcAtom        = (nPoints ? CalcAtomAccessSR : CalcAtomAccess);
+   data.sliceWidth      = integrationAccuracy;
+   data.probeRadius     = probeRadius;
+   data.doAccessibility = doAccessibility;
+   data.noMemory        = FALSE;
+
+   for(data.natoms=0, p=pdb; p!=NULL; NEXT(p))
+      data.natoms++;
+   if(data.natoms == 0)
+      return(TRUE);
+
+   /* Copy the coordinates and radii to arrays                          */
+   if(((data.x      = (REAL *)malloc(data.natoms * sizeof(REAL)))==NULL) ||
+      ((data.y      = (REAL *)malloc(data.natoms * sizeof(REAL)))==NULL) ||
+      ((data.z      = (REAL *)malloc(data.natoms * sizeof(REAL)))==NULL) ||
+      ((data.radius = (REAL *)malloc(data.natoms * sizeof(REAL)))==NULL) ||
+      ((data.access = (REAL *)malloc(data.natoms * sizeof(REAL)))==NULL))
+   {
+      FreeAccessData(&data);
+      return(FALSE);
+   }
+   if((group != NULL) &&
+      ((data.interface = (BOOL *)calloc(data.natoms, sizeof(BOOL)))
+       ==NULL))
+   {
+      FreeAccessData(&data);
+      return(FALSE);
+   }
+
+   for(i=0, p=pdb; p!=NULL; NEXT(p), i++)
+   {
+      data.x[i]      = p->x;
+      data.y[i]      = p->y;
+      data.z[i]      = p->z;
+      data.radius[i] = p->radius + probeRadius;
+   }
+
+   if(!BuildAccessCells(&data) ||
+      (nPoints && !MakeSpherePoints(&data, nPoints)))
+   {
+      FreeAccessData(&data);
+      return(FALSE);
+   }
+
+   /* The complex                                                       */
+   data.nCalc = data.natoms;
+   if(!RunAccessPool(&data, nThreads))
+   {
+      FreeAccessData(&data);
+      return(FALSE);
+   }
+
+   for(i=0, p=pdb; p!=NULL; NEXT(p), i++)
+      p->access = data.access[i];
+
+   /* The isolated chain groups                                         */
+   if(group != NULL)
+   {
+      if((data.calcList = (int *)malloc(data.natoms * sizeof(int)))==NULL)
+      {
+         FreeAccessData(&data);
+         return(FALSE);
+      }
+      
+      for(i=0, data.nCalc=0; i<data.natoms; i++)
+      {
+         if(data.interface[i])
+            data.calcList[data.nCalc++] = i;
+      }
+
+      data.isolated = TRUE;
+      if(!RunAccessPool(&data, nThreads))
+      {
+         FreeAccessData(&data);
+         return(FALSE);
+      }
+
+      for(i=0; i<data.natoms; i++)
+         isolated[i] = data.access[i];
+   }
+
+   FreeAccessData(&data);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL RunAccessPool(ACCESSDATA *data, int nThreads)
+   --------------------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data      Atom data
+   \param[in]      int         nThreads   Number of threads
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Calculates the accessibility of the data->nCalc atoms in 
+   data->calcList (or of the first data->nCalc atoms if there is no
+   list) with a pool of threads. If a thread can't be created the work
+   is simply shared by those that were.
+
+-  16.10.26  Original   By: ACRM (from CalcAccessThreaded())
+*/
+BOOL RunAccessPool(ACCESSDATA *data, int nThreads)
+{
+   pthread_t threads[MAXTHREADS];
+   int       i,
+             nStarted = 0;
+
+   data->nChunks   = MIN(nThreads * CHUNKSPERTHREAD, data->nCalc);
+   data->nextChunk = 0;
+   data->noMemory  = FALSE;
+   nThreads        = MIN(nThreads, data->nChunks);
+   for(i=1; i<nThreads; i++)
+   {
+      if(pthread_create(&(threads[nStarted]), NULL, AccessWorker,
+                        (void *)data))
+         break;
+      nStarted++;
+   }
+   AccessWorker((void *)data);
+   for(i=0; i<nStarted; i++)
+      pthread_join(threads[i], NULL);
+
+   return(!data->noMemory);
+}
+
+
+/************************************************************************/
+/*>BOOL BuildAccessCells(ACCESSDATA *data)
+   ---------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data    Atom data
+   \return         BOOL                 Success (FALSE if no memory)
+
+   Sorts the atoms into cubic cells at least as wide as the largest 
+   atom (plus probe) diameter, so any atom whose sphere overlaps another
+   is in the same or an adjacent cell. Atoms are linked in each cell in
+   increasing order.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL BuildAccessCells(ACCESSDATA *data)
+{
+   REAL maxX, maxY, maxZ,
+        maxRadius = 0.0;
+   int  i, 
+        cell,
+        ix, iy, iz;
+
+   data->minX = maxX = data->x[0];
+   data->minY = maxY = data->y[0];
+   data->minZ = maxZ = data->z[0];
+   for(i=0; i<data->natoms; i++)
+   {
+      data->minX = MIN(data->minX, data->x[i]);
+      data->minY = MIN(data->minY, data->y[i]);
+      data->minZ = MIN(data->minZ, data->z[i]);
+      maxX       = MAX(maxX, data->x[i]);
+      maxY       = MAX(maxY, data->y[i]);
+      maxZ       = MAX(maxZ, data->z[i]);
+      maxRadius  = MAX(maxRadius, data->radius[i]);
+   }
+
+   /* Double the cell size until the number of cells is reasonable      */
+   data->cellSize = 2.0 * maxRadius + GRID_SLACK;
+   for(;;)
+   {
+      data->nx = (int)((maxX - data->minX) / data->cellSize) + 1;
+      data->ny = (int)((maxY - data->minY) / data->cellSize) + 1;
+      data->nz = (int)((maxZ - data->minZ) / data->cellSize) + 1;
+      if(((double)data->nx * data->ny * data->nz) <= MAXGRIDCELLS)
+         break;
+      data->cellSize *= 2.0;
+   }
+
+   if(((data->cellHead = (int *)malloc(data->nx * data->ny * data->nz *
+                                       sizeof(int)))==NULL) ||
+      ((data->nextInCell = (int *)malloc(data->natoms * sizeof(int)))
+       ==NULL))
+      return(FALSE);
+
+   for(i=0; i<data->nx * data->ny * data->nz; i++)
+      data->cellHead[i] = (-1);
+
+   /* Work backwards so each cell lists its atoms in increasing order   */
+   for(i=data->natoms-1; i>=0; i--)
+   {
+      ix = (int)((data->x[i] - data->minX) / data->cellSize);
+      iy = (int)((data->y[i] - data->minY) / data->cellSize);
+      iz = (int)((data->z[i] - data->minZ) / data->cellSize);
+      cell = (ix * data->ny + iy) * data->nz + iz;
+      data->nextInCell[i] = data->cellHead[cell];
+      data->cellHead[cell] = i;
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void *AccessWorker(void *arg)
+   -----------------------------
+*//**
+   \param[in,out]  void  *arg    Pointer to the ACCESSDATA
+
+   Thread entry point. Repeatedly takes the next range of atoms to be
+   calculated and calculates their accessibilities
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Calls data->CalcAtom()
+-  16.10.26  Works through data->calcList if there is one
+*/
+void *AccessWorker(void *arg)
+{
+   ACCESSDATA *data = (ACCESSDATA *)arg;
+   ACCSCRATCH scratch;
+   int        chunk,
+              atomNum,
+              i,
+              stop;
+
+   scratch.neighbours    = NULL;
+   scratch.arcs          = NULL;
+   scratch.nbX           = scratch.nbY = scratch.nbZ = NULL;
+   scratch.nbRadSq       = NULL;
+   scratch.nNeighbours   = 0;
+   scratch.maxNeighbours = 0;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&sAccessMutex);
+      chunk = data->nextChunk++;
+      pthread_mutex_unlock(&sAccessMutex);
+
+      if(chunk >= data->nChunks)
+         break;
+
+      i    = (int)(((double)data->nCalc * chunk) / data->nChunks);
+      stop = (int)(((double)data->nCalc * (chunk+1)) / data->nChunks);
+      for(; i<stop; i++)
+      {
+         atomNum = ((data->calcList != NULL) ? data->calcList[i] : i);
+         if(!(*data->CalcAtom)(data, atomNum, &scratch))
+         {
+            pthread_mutex_lock(&sAccessMutex);
+            data->noMemory = TRUE;
+            pthread_mutex_unlock(&sAccessMutex);
+            break;
+         }
+      }
+   }
+
+   if(scratch.neighbours != NULL) free(scratch.neighbours);
+   if(scratch.arcs       != NULL) free(scratch.arcs);
+   if(scratch.nbX        != NULL) free(scratch.nbX);
+   if(scratch.nbY        != NULL) free(scratch.nbY);
+   if(scratch.nbZ        != NULL) free(scratch.nbZ);
+   if(scratch.nbRadSq    != NULL) free(scratch.nbRadSq);
+   
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL FindAccessNeighbours(ACCESSDATA *data, int atomNum, 
+                             ACCSCRATCH *scratch)
+   --------------------------------------------------------
+*//**
+   \param[in]      ACCESSDATA  *data      Atom data
+   \param[in]      int         atomNum    Atom of interest
+   \param[in,out]  ACCSCRATCH  *scratch   Work arrays for this thread.
+                                          The neighbours are stored here
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Finds the atoms whose (expanded) spheres overlap that of atomNum 
+   using the cell list. Neighbours are always found in the same order.
+
+-  16.10.26  Original   By: ACRM (from CalcAtomAccess())
+-  16.10.26  Handles chain groups
+*/
+BOOL FindAccessNeighbours(ACCESSDATA *data, int atomNum, 
+                          ACCSCRATCH *scratch)
+{
+   ACCNEIGHBOUR *n;
+   REAL         xi    = data->x[atomNum],
+                yi    = data->y[atomNum],
+                zi    = data->z[atomNum],
+                rr    = data->radius[atomNum],
+                dx, dy, dz, dxysq, rsum;
+   int          ix, iy, iz, 
+                cx, cy, cz,
+                j;
+
+   scratch->nNeighbours = 0;
+   
+   /* Find the atoms whose spheres overlap this one                     */
+   cx = (int)((xi - data->minX) / data->cellSize);
+   cy = (int)((yi - data->minY) / data->cellSize);
+   cz = (int)((zi - data->minZ) / data->cellSize);
+   for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, data->nx-1); ix++)
+   {
+      for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, data->ny-1); iy++)
+      {
+         for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, data->nz-1); iz++)
+         {
+            for(j=data->cellHead[(ix * data->ny + iy) * data->nz + iz];
+                j != (-1);
+                j=data->nextInCell[j])
+            {
+               if(j == atomNum)
+                  continue;
+
+               dx    = data->x[j] - xi;
+               dy    = data->y[j] - yi;
+               dz    = data->z[j] - zi;
+               dxysq = dx*dx + dy*dy;
+               rsum  = rr + data->radius[j];
+               if((dxysq + dz*dz) >= (rsum * rsum))
+                  continue;
+
+               /* Atoms in other chain groups are ignored for the
+                  isolated groups and mark an interface atom otherwise
+               */
+               if((data->group != NULL) &&
+                  (data->group[j] != data->group[atomNum]))
+               {
+                  if(data->isolated)
+                     continue;
+                  data->interface[atomNum] = TRUE;
+               }
+
+               if((scratch->nNeighbours == scratch->maxNeighbours) &&
+                  !GrowAccessScratch(scratch))
+                  return(FALSE);
+
+               n        = &(scratch->neighbours[scratch->nNeighbours++]);
+               n->dx    = dx;
+               n->dy    = dy;
+               n->dz    = dz;
+               n->dxysq = dxysq;
+               n->dxy   = sqrt(dxysq);
+               n->z     = data->z[j];
+               n->radsq = data->radius[j] * data->radius[j];
+            }
+         }
+      }
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL GrowAccessScratch(ACCSCRATCH *scratch)
+   --------------------------------------------
+*//**
+   \param[in,out]  ACCSCRATCH  *scratch   Work arrays for a thread
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Makes room for NEIGHBOURSTEP more neighbours
+
+-  16.10.26  Original   By: ACRM (from CalcAtomAccess())
+*/
+BOOL GrowAccessScratch(ACCSCRATCH *scratch)
+{
+   ACCNEIGHBOUR *neighbours;
+   ACCARC       *arcs;
+   REAL         *array;
+   int          maxNeighbours = scratch->maxNeighbours + NEIGHBOURSTEP;
+
+   if((neighbours = (ACCNEIGHBOUR *)
+       realloc(scratch->neighbours, 
+               maxNeighbours * sizeof(ACCNEIGHBOUR)))==NULL)
+      return(FALSE);
+   scratch->neighbours = neighbours;
+
+   /* A neighbour can give two arcs in a slice                          */
+   if((arcs = (ACCARC *)realloc(scratch->arcs, 
+                                2 * maxNeighbours * sizeof(ACCARC)))==NULL)
+      return(FALSE);
+   scratch->arcs = arcs;
+
+   if((array = (REAL *)realloc(scratch->nbX, 
+                               maxNeighbours * sizeof(REAL)))==NULL)
+      return(FALSE);
+   scratch->nbX = array;
+   if((array = (REAL *)realloc(scratch->nbY, 
+                               maxNeighbours * sizeof(REAL)))==NULL)
+      return(FALSE);
+   scratch->nbY = array;
+   if((array = (REAL *)realloc(scratch->nbZ, 
+                               maxNeighbours * sizeof(REAL)))==NULL)
+      return(FALSE);
+   scratch->nbZ = array;
+   if((array = (REAL *)realloc(scratch->nbRadSq, 
+                               maxNeighbours * sizeof(REAL)))==NULL)
+      return(FALSE);
+   scratch->nbRadSq = array;
+
+   scratch->maxNeighbours = maxNeighbours;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL CalcAtomAccess(ACCESSDATA *data, int atomNum, 
+                       ACCSCRATCH *scratch)
+   --------------------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data      Atom data. The result is 
+                                          stored in data->access
+   \param[in]      int         atomNum    Atom to calculate
+   \param[in,out]  ACCSCRATCH  *scratch   Work arrays for this thread
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Lee and Richards calculation for one atom. The expanded sphere is cut
+   into slices perpendicular to Z. In each slice the arcs of the circle
+   buried by neighbouring spheres are merged and the exposed length
+   summed. The area of each slice is its exposed angle times the sphere
+   radius times the slice width.
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Neighbour search moved to FindAccessNeighbours()
+*/
+BOOL CalcAtomAccess(ACCESSDATA *data, int atomNum, ACCSCRATCH *scratch)
+{
+   ACCNEIGHBOUR *n;
+   REAL         zi    = data->z[atomNum],
+                rr    = data->radius[atomNum],
+                rrsq  = rr * rr,
+                area  = 0.0,
+                sliceWidth, zSlice,
+                rsecrsq, rsecr, rsecnsq, rsecn,
+                b, alpha, beta, start, stop,
+                arcSum, t;
+   int          nNeighbours,
+                nSlices,
+                nArcs,
+                slice,
+                i, k;
+   BOOL         buried;
+
+   if(!FindAccessNeighbours(data, atomNum, scratch))
+      return(FALSE);
+   nNeighbours = scratch->nNeighbours;
+
+   if(nNeighbours == 0)
+   {
+      /* An isolated atom is fully exposed                              */
+      area = 4.0 * PI * rrsq;
+   }
+   else
+   {
+      nSlices    = (int)((2.0 * rr) / data->sliceWidth + 0.5);
+      nSlices    = MAX(nSlices, 1);
+      sliceWidth = (2.0 * rr) / nSlices;
+      zSlice     = zi - rr - (sliceWidth / 2.0);
+
+      for(slice=0; slice<nSlices; slice++)
+      {
+         zSlice  += sliceWidth;
+         rsecrsq  = rrsq - (zSlice - zi) * (zSlice - zi);
+         rsecr    = sqrt(rsecrsq);
+         nArcs    = 0;
+         buried   = FALSE;
+
+         /* Find the arcs of this slice's circle inside each neighbour  */
+         for(i=0; i<nNeighbours; i++)
+         {
+            n       = &(scratch->neighbours[i]);
+            rsecnsq = n->radsq - (zSlice - n->z) * (zSlice - n->z);
+            if(rsecnsq <= 0.0)
+               continue;
+            rsecn = sqrt(rsecnsq);
+
+            /* Circles don't intersect                                  */
+            if(n->dxy >= (rsecr + rsecn))
+               continue;
+
+            /* One circle is inside the other                           */
+            b = rsecr - rsecn;
+            if(n->dxy <= fabs(b))
+            {
+               if(b <= 0.0)
+               {
+                  buried = TRUE;
+                  break;
+               }
+               continue;
+            }
+
+            alpha = acos((n->dxysq + rsecrsq - rsecnsq) / 
+                         (2.0 * n->dxy * rsecr));
+            beta  = atan2(n->dy, n->dx) + PI;
+            start = beta - alpha;
+            stop  = beta + alpha;
+            if(start < 0.0)
+               start += 2.0 * PI;
+            if(stop > 2.0 * PI)
+               stop -= 2.0 * PI;
+
+            /* Split an arc that crosses zero                           */
+            if(stop < start)
+            {
+               scratch->arcs[nArcs].start   = start;
+               scratch->arcs[nArcs++].stop  = 2.0 * PI;
+               scratch->arcs[nArcs].start   = 0.0;
+               scratch->arcs[nArcs++].stop  = stop;
+            }
+            else
+            {
+               scratch->arcs[nArcs].start   = start;
+               scratch->arcs[nArcs++].stop  = stop;
+            }
+         }
+
+         if(buried)
+            continue;
+
+         /* Sum the exposed angle between the merged arcs               */
+         if(nArcs == 0)
+         {
+            arcSum = 2.0 * PI;
+         }
+         else
+         {
+            qsort((void *)scratch->arcs, nArcs, sizeof(ACCARC), 
+                  CompareArcs);
+            arcSum = scratch->arcs[0].start;
+            t      = scratch->arcs[0].stop;
+            for(k=1; k<nArcs; k++)
+            {
+               if(t < scratch->arcs[k].start)
+                  arcSum += scratch->arcs[k].start - t;
+               if(scratch->arcs[k].stop > t)
+                  t = scratch->arcs[k].stop;
+            }
+            arcSum += 2.0 * PI - t;
+         }
+
+         area += arcSum * sliceWidth;
+      }
+
+      area *= rr;
+   }
+
+   data->access[atomNum] = ScaleAccess(data, atomNum, area);
+   return(TRUE);
+}
+
+
+
+
+/************************************************************************/
+/*>BOOL CalcAtomAccessSR(ACCESSDATA *data, int atomNum, 
+                         ACCSCRATCH *scratch)
+   ----------------------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data      Atom data. The result is 
+                                          stored in data->access
+   \param[in]      int         atomNum    Atom to calculate
+   \param[in,out]  ACCSCRATCH  *scratch   Work arrays for this thread
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Shrake and Rupley calculation for one atom. Points spread evenly over
+   the expanded sphere are tested against the neighbouring spheres and
+   the area is the fraction not inside any of them.
+
+   The neighbours are copied to separate coordinate arrays and tested
+   OCCLUDEBLOCK at a time without branches so the compiler can
+   vectorize the test. The neighbour that buried the previous point is 
+   tried first as it usually buries the next one too.
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL CalcAtomAccessSR(ACCESSDATA *data, int atomNum, 
+                      ACCSCRATCH *scratch)
+{
+   REAL rr     = data->radius[atomNum],
+        *nbX, *nbY, *nbZ, *nbRadSq,
+        px, py, pz,
+        dx, dy, dz;
+   int  nNeighbours,
+        nPadded,
+        nExposed = 0,
+        lastBurier = 0,
+        point,
+        i, j,
+        hits;
+   
+   if(!FindAccessNeighbours(data, atomNum, scratch))
+      return(FALSE);
+   nNeighbours = scratch->nNeighbours;
+
+   /* Round up to whole blocks. The padding can't bury anything         */
+   nPadded = ((nNeighbours + OCCLUDEBLOCK - 1) / OCCLUDEBLOCK) *
+             OCCLUDEBLOCK;
+   while(scratch->maxNeighbours < nPadded)
+   {
+      if(!GrowAccessScratch(scratch))
+         return(FALSE);
+   }
+
+   nbX     = scratch->nbX;
+   nbY     = scratch->nbY;
+   nbZ     = scratch->nbZ;
+   nbRadSq = scratch->nbRadSq;
+   for(i=0; i<nNeighbours; i++)
+   {
+      nbX[i]     = scratch->neighbours[i].dx;
+      nbY[i]     = scratch->neighbours[i].dy;
+      nbZ[i]     = scratch->neighbours[i].dz;
+      nbRadSq[i] = scratch->neighbours[i].radsq;
+   }
+   for(; i<nPadded; i++)
+   {
+      nbX[i] = nbY[i] = nbZ[i] = 0.0;
+      nbRadSq[i] = -1.0;
+   }
+
+   for(point=0; point<data->nPoints; point++)
+   {
+      px = rr * data->pointX[point];
+      py = rr * data->pointY[point];
+      pz = rr * data->pointZ[point];
+
+      /* Try the neighbour that buried the last point                   */
+      if(nNeighbours)
+      {
+         dx = px - nbX[lastBurier];
+         dy = py - nbY[lastBurier];
+         dz = pz - nbZ[lastBurier];
+         if((dx*dx + dy*dy + dz*dz) < nbRadSq[lastBurier])
+            continue;
+      }
+
+      /* Then test the neighbours a block at a time                     */
+      for(i=0, hits=0; (i<nPadded) && !hits; i+=OCCLUDEBLOCK)
+      {
+         for(j=i; j<i+OCCLUDEBLOCK; j++)
+         {
+            dx = px - nbX[j];
+            dy = py - nbY[j];
+            dz = pz - nbZ[j];
+            hits += ((dx*dx + dy*dy + dz*dz) < nbRadSq[j]);
+         }
+      }
+
+      if(hits)
+      {
+         /* Remember which neighbour in the block buried the point      */
+         for(j=i-OCCLUDEBLOCK; j<i; j++)
+         {
+            dx = px - nbX[j];
+            dy = py - nbY[j];
+            dz = pz - nbZ[j];
+            if((dx*dx + dy*dy + dz*dz) < nbRadSq[j])
+            {
+               lastBurier = j;
+               break;
+            }
+         }
+      }
+      else
+      {
+         nExposed++;
+      }
+   }
+
+   data->access[atomNum] = 
+      ScaleAccess(data, atomNum, 
+                  (4.0 * PI * rr * rr * nExposed) / data->nPoints);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>REAL ScaleAccess(ACCESSDATA *data, int atomNum, REAL area)
+   ----------------------------------------------------------
+*//**
+   \param[in]      ACCESSDATA  *data      Atom data
+   \param[in]      int         atomNum    Atom 
+   \param[in]      REAL        area       Area of the expanded sphere
+   \return         REAL                   Accessible or contact area
+
+   Scales the area to the contact surface if that was requested
+
+-  16.10.26  Original   By: ACRM (from CalcAtomAccess())
+*/
+REAL ScaleAccess(ACCESSDATA *data, int atomNum, REAL area)
+{
+   REAL rr = data->radius[atomNum],
+        innerRadius;
+
+   if(!data->doAccessibility)
+   {
+      innerRadius = rr - data->probeRadius;
+      area *= (innerRadius * innerRadius) / (rr * rr);
+   }
+   return(area);
+}
+
+
+/************************************************************************/
+/*>BOOL MakeSpherePoints(ACCESSDATA *data, int nPoints)
+   ----------------------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data      Atom data
+   \param[in]      int         nPoints    Number of points
+   \return         BOOL                   Success (FALSE if no memory)
+
+   Spreads points evenly over a unit sphere using a golden section
+   spiral
+
+-  16.10.26  Original   By: ACRM
+*/
+BOOL MakeSpherePoints(ACCESSDATA *data, int nPoints)
+{
+   REAL increment = PI * (3.0 - sqrt(5.0)),
+        y, r, phi;
+   int  i;
+
+   if(((data->pointX = (REAL *)malloc(nPoints * sizeof(REAL)))==NULL) ||
+      ((data->pointY = (REAL *)malloc(nPoints * sizeof(REAL)))==NULL) ||
+      ((data->pointZ = (REAL *)malloc(nPoints * sizeof(REAL)))==NULL))
+      return(FALSE);
+
+   for(i=0; i<nPoints; i++)
+   {
+      y   = 1.0 - (2.0 * (i + 0.5)) / nPoints;
+      r   = sqrt(1.0 - y*y);
+      phi = i * increment;
+      data->pointX[i] = r * cos(phi);
+      data->pointY[i] = y;
+      data->pointZ[i] = r * sin(phi);
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int CompareArcs(const void *a, const void *b)
+   ---------------------------------------------
+*//**
+   \param[in]   void  *a    Pointer to an ACCARC
+   \param[in]   void  *b    Pointer to an ACCARC
+   \return      int         -1, 0 or 1 by arc start then stop
+
+   qsort() comparison function for arcs
+
+-  16.10.26  Original   By: ACRM
+*/
+int CompareArcs(const void *a, const void *b)
+{
+   const ACCARC *arcA = (const ACCARC *)a,
+                *arcB = (const ACCARC *)b;
+
+   if(arcA->start < arcB->start) return(-1);
+   if(arcA->start > arcB->start) return(1);
+   if(arcA->stop  < arcB->stop)  return(-1);
+   if(arcA->stop  > arcB->stop)  return(1);
+   return(0);
+}
+
+
+/************************************************************************/
+/*>void FreeAccessData(ACCESSDATA *data)
+   -------------------------------------
+*//**
+   \param[in,out]  ACCESSDATA  *data    Atom data
+
+   Frees the arrays in the atom data
+
+-  16.10.26  Original   By: ACRM
+-  16.10.26  Frees the sphere points
+-  16.10.26  Frees the chain group arrays
+*/
+void FreeAccessData(ACCESSDATA *data)
+{
+   if(data->x          != NULL) free(data->x);
+   if(data->y          != NULL) free(data->y);
+   if(data->z          != NULL) free(data->z);
+   if(data->radius     != NULL) free(data->radius);
+   if(data->access     != NULL) free(data->access);
+   if(data->cellHead   != NULL) free(data->cellHead);
+   if(data->nextInCell != NULL) free(data->nextInCell);
+   if(data->pointX     != NULL) free(data->pointX);
+   if(data->pointY     != NULL) free(data->pointY);
+   if(data->pointZ     != NULL) free(data->pointZ);
+   if(data->calcList   != NULL) free(data->calcList);
+   if(data->interface  != NULL) free(data->interface);
+}
@@ -3,12 +3,12 @@
 
    \file       pdbsphere.c
    
-   \version    V1.10
-   \date       12.03.15
+   \version    V1.11
+   \date       16.10.26
    \brief      Output all aminoacids within range from central aminoacid 
                in a PDB file
    
-   \copyright  (c) UCL/Anja Baresic/Dr. Andrew C.R. Martin-2015
+   \copyright  (c) UCL/Anja Baresic/Dr. Andrew C.R. Martin-2015-26
    \author     Anja Baresic/Dr. Andrew C.R. Martin
    \par
                Biomolecular Structure & Modelling Unit,
@@ -70,11 +70,18 @@
 -  V1.9  22.07.14  Renamed deprecated functions with bl prefix.
                    Added doxygen annotation. By: CTP
 -  V1.10 12.03.15  Changed to allow multi-character chain names
+-  V1.11 16.10.26  Added -m to take a list of central residues. -a and
+                   -m use a grid of residues built once for the file.
+                   Stops checking a residue once an atom is in range
 
 **************************************************************************/
 /* Includes
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include "bioplib/pdb.h"
 #include "bioplib/SysDefs.h"
 #include "bioplib/MathType.h"
@@ -84,6 +91,28 @@
 /* Defines and macros
 */
 #define MAXBUFF 160
+#define MAXGRIDCELLS 1000000  /* Maximum cells in the residue grid      */
+#define GRID_SLACK   0.001    /* Allowance for rounding in grid tests   */
+
+typedef struct
+{
+   PDB  *start,               /* First atom of the residue              */
+        *stop;                /* First atom of the next residue         */
+   REAL x, y, z,              /* Centre of the residue's atoms          */
+        radius;               /* Bounding sphere radius about centre    */
+   int  nextInCell;           /* Next residue in the same cell (or -1)  */
+}  RESINFO;
+
+typedef struct
+{
+   RESINFO *res;              /* Array of residues in file order        */
+   int     *cellHead,         /* First residue in each cell (or -1)     */
+           nres,
+           nx, ny, nz;
+   REAL    minX, minY, minZ,
+           cellSize,
+           radius;            /* Sphere radius                          */
+}  RESGRID;
 
 /************************************************************************/
 /* Globals
@@ -98,8 +127,20 @@ void WriteAtoms(PDB *pdb, FILE *out);
 void WriteResidues(PDB *pdb, FILE *out, BOOL colons, BOOL compact);
 BOOL ParseCmdLine(int argc, char **argv,char *resspec, char *InFile, 
                   char *OutFile, BOOL *summary, REAL *radiusSq,
-                  BOOL *colons, BOOL *isHet, BOOL *doAuto);
+                  BOOL *colons, BOOL *isHet, BOOL *doAuto,
+                  char **centreList);
 void ClearExtras(PDB *pdb);
+RESGRID *BuildResidueGrid(PDB *pdb, REAL radius);
+void FreeResidueGrid(RESGRID *grid);
+int FindResidueIndex(RESGRID *grid, PDB *res);
+int FindResiduesInRange(RESGRID *grid, int centre, REAL radiusSq, 
+                        int *inRange);
+BOOL ResidueInRange(RESINFO *r1, RESINFO *r2, REAL radiusSq);
+void WriteSphere(FILE *out, RESGRID *grid, int centre, int *inRange,
+                 int nInRange);
+int CompareInts(const void *a, const void *b);
+BOOL DoMultiSpheres(FILE *out, PDB *pdb, REAL radiusSq, BOOL doAuto,
+                    char *centreList, BOOL isHet);
 void Usage(void);
 
 /************************************************************************/
@@ -112,6 +153,8 @@ void Usage(void);
    a specified radius (default 8A, override with -r). Summary output
    (just the residue list) can be generated with -s and -c provides an
    alternative output format.
+
+-  16.10.26 -a and -m handled by DoMultiSpheres()   By: ACRM
 */
 int main(int argc, char **argv)
 {
@@ -123,14 +166,15 @@ int main(int argc, char **argv)
    REAL   radiusSq;
    char   resspec[MAXBUFF],
           InFile[MAXBUFF],
-          OutFile[MAXBUFF];
+          OutFile[MAXBUFF],
+          *centreList = NULL;
    BOOL   summary,
           colons = FALSE,
           isHet = FALSE,
           doAuto = FALSE;
    
    if (ParseCmdLine(argc, argv, resspec, InFile, OutFile, &summary, 
-                    &radiusSq, &colons, &isHet, &doAuto))
+                    &radiusSq, &colons, &isHet, &doAuto, &centreList))
    {
       if (blOpenStdFiles(InFile, OutFile, &in, &out))
       {
@@ -145,18 +189,11 @@ file\n");
             /* Clear the ->extras field                                 */
             ClearExtras(pdb);
 
-            if(doAuto)
+            if(doAuto || (centreList != NULL))
             {
-               for(central=pdb; central!=NULL; central=blFindNextResidue(central))
-               {
-                  FlagResiduesInRange(pdb, central, radiusSq);
-                  fprintf(out, "%s %s%d%s:",central->resnam, 
-                          central->chain,
-                          central->resnum,
-                          central->insert);
-                  WriteResidues(pdb, out, colons, TRUE);
-                  ClearExtras(pdb);
-               }
+               if(!DoMultiSpheres(out, pdb, radiusSq, doAuto, centreList,
+                                  isHet))
+                  return(1);
             }
             else
             {
@@ -214,6 +251,7 @@ found in %s\n", resspec, InFile);
 
 -  17.05.11 Changed double to REAL and use extras field rather than occ
             By: ACRM
+-  16.10.26 Stops checking a residue once an atom is found in range
 */
 void FlagResiduesInRange(PDB *pdb, PDB *central, REAL radiusSq)
 {
@@ -232,15 +270,14 @@ void FlagResiduesInRange(PDB *pdb, PDB *central, REAL radiusSq)
       aaInRange=FALSE;
       nextCurrentRes=blFindNextResidue(current);
       
-      for (q=current; q!=nextCurrentRes; NEXT(q))
+      for (q=current; (q!=nextCurrentRes) && !aaInRange; NEXT(q))
       {            
          for (p=central; p!=nextPRes; NEXT(p))
          {
             if (DISTSQ(p, q)<radiusSq)
             {
                aaInRange=TRUE;
-               /*q=nextCurrentRes;
-                 break;*/
+               break;
             }
          }
       }
@@ -366,17 +403,20 @@ void WriteResidues(PDB *pdb, FILE *out, BOOL colons, BOOL compact)
 -  27.07.12 V1.8 By: ACRM
 -  22.07.14 V1.9 By: CTP
 -  12.03.15 V1.10 By: ACRM
+-  16.10.26 V1.11 By: ACRM
 */
 void Usage(void)
 {
    fprintf(stderr,"\n");
-   fprintf(stderr,"PDBsphere V1.10 (c) 2011-2015 UCL, Anja Baresic, \
+   fprintf(stderr,"PDBsphere V1.11 (c) 2011-2026 UCL, Anja Baresic, \
 Andrew Martin.\n");
    fprintf(stderr,"\nUsage: \
 pdbsphere [-s] [-c] [-r radius] [-h] [-H] resspec\n                 \
 [in.pdb [out.pdb/out.txt]]\n");
    fprintf(stderr,"-or-   \
 pdbsphere -a [-r radius] [in.pdb [out.txt]]\n");
+   fprintf(stderr,"-or-   \
+pdbsphere -m [-r radius] [-H] resspec[,resspec...] [in.pdb [out.txt]]\n");
    fprintf(stderr,"       -s  Output summary: only list of residue \
 IDs.\n");
    fprintf(stderr,"       -c  Colon separated summary format.\n");
@@ -385,6 +425,9 @@ IDs.\n");
    fprintf(stderr,"       -r  Set your own allowed range to radius.\n");
    fprintf(stderr,"       -a  'Auto' mode - analyses all residues \
 producing\n           summary for each.\n");
+   fprintf(stderr,"       -m  Multiple centres - analyses each of a \
+comma-separated\n           list of residues producing summary for \
+each as for -a.\n           May not be used with -s or -c.\n");
 
    fprintf(stderr,"\npdbsphere identifies residues within a specified \
 radius of a specified\n");
@@ -420,6 +463,9 @@ specified.\n\n");
                                 (Default:64, max range:8 angstroms)
    \param[out]     *colons      Colon separated output format
    \param[out]     *isHet       Residue spec is for a HETATM (-H)
+   \param[out]     *doAuto      Analyse all residues (-a)
+   \param[out]     **centreList Comma-separated list of central
+                                residues (-m) or NULL
    \return                     Success?
 
    Parse the command line
@@ -429,11 +475,16 @@ specified.\n\n");
 -  26.10.11 Added -H
 -  14.05.12 Added -a
 -  27.07.12 Fixed bug in checking of doAuto
+-  16.10.26 Added -m   By: ACRM
+-  16.10.26 -s and -c are rejected with -m
 */
 BOOL ParseCmdLine(int argc, char **argv,char *resspec, char *InFile, 
                   char *OutFile, BOOL *summary, REAL *radiusSq, 
-                  BOOL *colons, BOOL *isHet, BOOL *doAuto)
+                  BOOL *colons, BOOL *isHet, BOOL *doAuto,
+                  char **centreList)
 {
+   BOOL doMulti = FALSE;
+   
    argc--;
    argv++;
 
@@ -443,6 +494,7 @@ BOOL ParseCmdLine(int argc, char **argv,char *resspec, char *InFile,
    *colons   = FALSE;
    *isHet    = FALSE;
    *doAuto   = FALSE;
+   *centreList = NULL;
  
    if (argc<1)
    {      
@@ -486,6 +538,9 @@ BOOL ParseCmdLine(int argc, char **argv,char *resspec, char *InFile,
             case 'a':
                *doAuto = TRUE;
                break;
+            case 'm':
+               doMulti = TRUE;
+               break;
             default:
                return(FALSE);
                break;
@@ -498,12 +553,23 @@ BOOL ParseCmdLine(int argc, char **argv,char *resspec, char *InFile,
          if(argc<1 || argc > 3)
             return(FALSE);
 
-         /* Copy the first to resspec                                   */
+         /* -m always produces a summary for each centre so -s and -c
+            are not allowed
+         */
+         if(doMulti && (*summary || *colons))
+            return(FALSE);
+
+         /* Copy the first to resspec, or keep the list of residues 
+            with -m
+         */
          if(!(*doAuto))
          {
             if(argc)
             {
-               strncpy(resspec, argv[0], MAXBUFF);
+               if(doMulti)
+                  *centreList = argv[0];
+               else
+                  strncpy(resspec, argv[0], MAXBUFF);
                argc--;
                argv++;
             }
@@ -557,3 +623,419 @@ void ClearExtras(PDB *pdb)
       p->extras = (APTR)0;
    }
 }
+
+
+/************************************************************************/
+/*>BOOL DoMultiSpheres(FILE *out, PDB *pdb, REAL radiusSq, BOOL doAuto,
+                       char *centreList, BOOL isHet)
+   ---------------------------------------------------------------------
+*//**
+
+   \param[in]      *out         Output file
+   \param[in]      *pdb         PDB linked list
+   \param[in]      radiusSq     Squared sphere radius
+   \param[in]      doAuto       Use every residue as a centre
+   \param[in]      *centreList  Comma-separated list of central residues
+                                (used if doAuto is not set)
+   \param[in]      isHet        Residue specs are for HETATMs
+   \return                      Success?
+
+   Writes a summary line of the residues in range for each of a set of
+   central residues. A grid of residues is built once and used for all
+   the centres.
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL DoMultiSpheres(FILE *out, PDB *pdb, REAL radiusSq, BOOL doAuto,
+                    char *centreList, BOOL isHet)
+{
+   RESGRID *grid;
+   PDB     *central;
+   int     *inRange,
+           nInRange,
+           centre;
+   char    *resspec,
+           *comma;
+
+   if((grid = BuildResidueGrid(pdb, sqrt(radiusSq)))==NULL)
+   {
+      fprintf(stderr,"Error: (pdbsphere) No memory for residue grid\n");
+      return(FALSE);
+   }
+
+   if((inRange = (int *)malloc((grid->nres + 1) * sizeof(int)))==NULL)
+   {
+      fprintf(stderr,"Error: (pdbsphere) No memory for residue list\n");
+      FreeResidueGrid(grid);
+      return(FALSE);
+   }
+
+   if(doAuto)
+   {
+      for(centre=0; centre<grid->nres; centre++)
+      {
+         nInRange = FindResiduesInRange(grid, centre, radiusSq, inRange);
+         WriteSphere(out, grid, centre, inRange, nInRange);
+      }
+   }
+   else
+   {
+      for(resspec=centreList; resspec!=NULL; resspec=comma)
+      {
+         if((comma = strchr(resspec, ','))!=NULL)
+            *(comma++) = '\0';
+         if(*resspec == '\0')
+            continue;
+         
+         if(isHet)
+            central = blFindHetatmResidueSpec(pdb, resspec);
+         else
+            central = blFindResidueSpec(pdb, resspec);
+
+         if((central == NULL) || 
+            ((centre = FindResidueIndex(grid, central)) < 0))
+         {
+            fprintf(stderr,"Error: (pdbsphere) Residue %s not found\n",
+                    resspec);
+            free(inRange);
+            FreeResidueGrid(grid);
+            return(FALSE);
+         }
+         
+         nInRange = FindResiduesInRange(grid, centre, radiusSq, inRange);
+         WriteSphere(out, grid, centre, inRange, nInRange);
+      }
+   }
+
+   free(inRange);
+   FreeResidueGrid(grid);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>RESGRID *BuildResidueGrid(PDB *pdb, REAL radius)
+   ------------------------------------------------
+*//**
+
+   \param[in]      *pdb      PDB linked list
+   \param[in]      radius    Sphere radius
+   \return                   Malloc'd residue grid (NULL if no memory)
+
+   Builds an array of residues with their centres and bounding sphere 
+   radii, and bins them on their centres into a uniform grid. The cells 
+   are large enough that two residues with any atoms within the radius
+   must be in the same or adjacent cells.
+
+-  16.10.26 Original   By: ACRM
+*/
+RESGRID *BuildResidueGrid(PDB *pdb, REAL radius)
+{
+   RESGRID *grid;
+   PDB     *res, *resNext, *a;
+   REAL    maxX, maxY, maxZ,
+           maxRadius = (REAL)0.0;
+   int     i;
+
+   if((grid = (RESGRID *)malloc(sizeof(RESGRID)))==NULL)
+      return(NULL);
+   grid->radius   = radius;
+   grid->cellHead = NULL;
+
+   grid->nres = 0;
+   for(res=pdb; res!=NULL; res=blFindNextResidue(res))
+      grid->nres++;
+
+   if((grid->res = (RESINFO *)malloc((grid->nres + 1) * sizeof(RESINFO)))
+      ==NULL)
+   {
+      free(grid);
+      return(NULL);
+   }
+
+   /* Find residue centres and radii                                    */
+   grid->minX = grid->minY = grid->minZ = (REAL)0.0;
+   maxX       = maxY       = maxZ       = (REAL)0.0;
+   for(res=pdb, i=0; res!=NULL; res=resNext, i++)
+   {
+      RESINFO *r     = &(grid->res[i]);
+      REAL    natoms = (REAL)0.0,
+              rSq    = (REAL)0.0;
+
+      resNext = blFindNextResidue(res);
+      r->start      = res;
+      r->stop       = resNext;
+      r->nextInCell = (-1);
+      r->x = r->y = r->z = (REAL)0.0;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         r->x   += a->x;
+         r->y   += a->y;
+         r->z   += a->z;
+         natoms += (REAL)1.0;
+      }
+      r->x /= natoms;
+      r->y /= natoms;
+      r->z /= natoms;
+
+      for(a=res; a!=resNext; NEXT(a))
+      {
+         REAL dSq = DISTSQ(a, r);
+         if(dSq > rSq)
+            rSq = dSq;
+      }
+      r->radius = sqrt(rSq);
+
+      if(i==0)
+      {
+         grid->minX = maxX = r->x;
+         grid->minY = maxY = r->y;
+         grid->minZ = maxZ = r->z;
+      }
+      grid->minX = MIN(grid->minX, r->x);
+      grid->minY = MIN(grid->minY, r->y);
+      grid->minZ = MIN(grid->minZ, r->z);
+      maxX       = MAX(maxX, r->x);
+      maxY       = MAX(maxY, r->y);
+      maxZ       = MAX(maxZ, r->z);
+      maxRadius  = MAX(maxRadius, r->radius);
+   }
+
+   /* Size the cells, growing them if the grid would be unreasonably 
+      large
+   */
+   grid->cellSize = radius + (2.0 * maxRadius) + GRID_SLACK;
+   for(;;)
+   {
+      grid->nx = 1 + (int)((maxX - grid->minX) / grid->cellSize);
+      grid->ny = 1 + (int)((maxY - grid->minY) / grid->cellSize);
+      grid->nz = 1 + (int)((maxZ - grid->minZ) / grid->cellSize);
+      if(((double)grid->nx * (double)grid->ny * (double)grid->nz) <= 
+         (double)MAXGRIDCELLS)
+         break;
+      grid->cellSize *= 2.0;
+   }
+
+   if((grid->cellHead = (int *)malloc(grid->nx * grid->ny * grid->nz *
+                                      sizeof(int)))==NULL)
+   {
+      FreeResidueGrid(grid);
+      return(NULL);
+   }
+   for(i=0; i<grid->nx * grid->ny * grid->nz; i++)
+      grid->cellHead[i] = (-1);
+
+   /* Bin the residues                                                  */
+   for(i=0; i<grid->nres; i++)
+   {
+      RESINFO *r   = &(grid->res[i]);
+      int     cell = (int)((r->x - grid->minX) / grid->cellSize) +
+                     grid->nx * 
+                     ((int)((r->y - grid->minY) / grid->cellSize) +
+                      grid->ny * 
+                      (int)((r->z - grid->minZ) / grid->cellSize));
+      r->nextInCell        = grid->cellHead[cell];
+      grid->cellHead[cell] = i;
+   }
+
+   return(grid);
+}
+
+
+/************************************************************************/
+/*>void FreeResidueGrid(RESGRID *grid)
+   -----------------------------------
+*//**
+
+   \param[in]      *grid     Residue grid
+
+   Frees a residue grid
+
+-  16.10.26 Original   By: ACRM
+*/
+void FreeResidueGrid(RESGRID *grid)
+{
+   if(grid->cellHead != NULL)
+      free(grid->cellHead);
+   free(grid->res);
+   free(grid);
+}
+
+
+/************************************************************************/
+/*>int FindResidueIndex(RESGRID *grid, PDB *res)
+   ---------------------------------------------
+*//**
+
+   \param[in]      *grid     Residue grid
+   \param[in]      *res      First atom of a residue
+   \return                   Index of the residue in the grid (-1 if
+                             not found)
+
+   Finds the index of a residue in the grid's residue array
+
+-  16.10.26 Original   By: ACRM
+*/
+int FindResidueIndex(RESGRID *grid, PDB *res)
+{
+   int i;
+   
+   for(i=0; i<grid->nres; i++)
+   {
+      if(grid->res[i].start == res)
+         return(i);
+   }
+   return(-1);
+}
+
+
+/************************************************************************/
+/*>BOOL ResidueInRange(RESINFO *r1, RESINFO *r2, REAL radiusSq)
+   ------------------------------------------------------------
+*//**
+
+   \param[in]      *r1       First residue
+   \param[in]      *r2       Second residue
+   \param[in]      radiusSq  Squared radius
+   \return                   Is any atom of r2 within the radius of
+                             any atom of r1?
+
+-  16.10.26 Original   By: ACRM
+*/
+BOOL ResidueInRange(RESINFO *r1, RESINFO *r2, REAL radiusSq)
+{
+   PDB *p, *q;
+
+   for(q=r2->start; q!=r2->stop; NEXT(q))
+   {
+      for(p=r1->start; p!=r1->stop; NEXT(p))
+      {
+         if(DISTSQ(p, q) < radiusSq)
+            return(TRUE);
+      }
+   }
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>int FindResiduesInRange(RESGRID *grid, int centre, REAL radiusSq, 
+                           int *inRange)
+   -----------------------------------------------------------------
+*//**
+
+   \param[in]      *grid     Residue grid
+   \param[in]      centre    Index of the central residue
+   \param[in]      radiusSq  Squared sphere radius
+   \param[out]     *inRange  Indexes of residues in range in file order
+   \return                   Number of residues in range
+
+   Finds the residues with any atom within range of the central residue.
+   Only residues in the surrounding grid cells whose bounding spheres 
+   are close enough are checked atom by atom. The indexes are sorted so 
+   that residues are listed in the same order as the linked list.
+
+-  16.10.26 Original   By: ACRM
+*/
+int FindResiduesInRange(RESGRID *grid, int centre, REAL radiusSq, 
+                        int *inRange)
+{
+   RESINFO *p = &(grid->res[centre]);
+   int     ix = (int)((p->x - grid->minX) / grid->cellSize),
+           iy = (int)((p->y - grid->minY) / grid->cellSize),
+           iz = (int)((p->z - grid->minZ) / grid->cellSize),
+           cx, cy, cz, j,
+           nInRange = 0;
+
+   for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, grid->nz-1); cz++)
+   {
+      for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, grid->ny-1); cy++)
+      {
+         for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, grid->nx-1); cx++)
+         {
+            for(j=grid->cellHead[cx + grid->nx * (cy + grid->ny * cz)];
+                j!=(-1);
+                j=grid->res[j].nextInCell)
+            {
+               RESINFO *q    = &(grid->res[j]);
+               REAL    reach = grid->radius + p->radius + q->radius +
+                               GRID_SLACK;
+
+               if((DISTSQ(p, q) <= reach * reach) &&
+                  ResidueInRange(p, q, radiusSq))
+               {
+                  inRange[nInRange++] = j;
+               }
+            }
+         }
+      }
+   }
+
+   qsort(inRange, nInRange, sizeof(int), CompareInts);
+   return(nInRange);
+}
+
+
+/************************************************************************/
+/*>int CompareInts(const void *a, const void *b)
+   ---------------------------------------------
+*//**
+
+   \param[in]      *a        Pointer to first int
+   \param[in]      *b        Pointer to second int
+   \return                   Comparison for qsort()
+
+   Compares two integers for sorting into ascending order
+
+-  16.10.26 Original   By: ACRM
+*/
+int CompareInts(const void *a, const void *b)
+{
+   return(*(const int *)a - *(const int *)b);
+}
+
+
+/************************************************************************/
+/*>void WriteSphere(FILE *out, RESGRID *grid, int centre, int *inRange,
+                    int nInRange)
+   --------------------------------------------------------------------
+*//**
+
+   \param[in]      *out      Output file
+   \param[in]      *grid     Residue grid
+   \param[in]      centre    Index of the central residue
+   \param[in]      *inRange  Indexes of residues in range
+   \param[in]      nInRange  Number of residues in range
+
+   Writes the central residue and the residues in range on one line in
+   the compact format used by WriteResidues()
+
+-  16.10.26 Original   By: ACRM
+*/
+void WriteSphere(FILE *out, RESGRID *grid, int centre, int *inRange,
+                 int nInRange)
+{
+   PDB *central = grid->res[centre].start,
+       *p;
+   int i;
+
+   fprintf(out, "%s %s%d%s:",central->resnam, 
+           central->chain,
+           central->resnum,
+           central->insert);
+
+   for(i=0; i<nInRange; i++)
+   {
+      p = grid->res[inRange[i]].start;
+      if(isdigit(p->chain[0]))
+      {
+         fprintf(out, " %s.%d%c", p->chain, p->resnum, p->insert[0]);
+      }
+      else
+      {
+         fprintf(out, " %s%d%c", p->chain, p->resnum, p->insert[0]);
+      }
+   }
+   fprintf(out,"\n");
+}
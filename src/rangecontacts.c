@@ -3,11 +3,11 @@
    Program:    rangecontacts
    File:       rangecontacts.c
    
-   Version:    V1.1
-   Date:       12.01.21
+   Version:    V1.2
+   Date:       16.10.26
    Function:   Finds residues contacting a specified range of residues
    
-   Copyright:  (c) Prof. Andrew C. R. Martin 2020-21
+   Copyright:  (c) Prof. Andrew C. R. Martin 2020-26
    Author:     Prof. Andrew C. R. Martin
    Address:    Biomolecular Structure & Modelling Unit,
                Department of Biochemistry & Molecular Biology,
@@ -48,11 +48,15 @@
    V1.0  26.03.20 Original
    V1.1  12.01.21 Added -i for internal contacts, -c to show
                   counts of contacts and -m for mainchain contacts
+   V1.2  16.10.26 The range is indexed once with residue boundaries,
+                  atom type flags and a spatial grid so that contacts
+                  are found without rescanning the range for each atom
 
 *************************************************************************/
 /* Includes
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
 
@@ -71,6 +75,38 @@
 #define BONDED_NTER 1
 #define BONDED_CTER 2
 
+#define ATOMFLAG_SIDECHAIN 1  /* Flags describing range atoms           */
+#define ATOMFLAG_C         2
+#define ATOMFLAG_N         4
+
+#define MAXGRIDCELLS 1000000  /* Maximum cells in the range atom grid   */
+
+typedef struct
+{
+   PDB  *start,               /* First atom of the residue              */
+        *stop;                /* First atom of the next residue         */
+}  RANGERES;
+
+typedef struct
+{
+   REAL x, y, z;
+   int  res,                  /* Index of the residue in the range      */
+        flags,                /* ATOMFLAG_ values                       */
+        nextInCell;           /* Next atom in the same cell (or -1)     */
+}  RANGEATOM;
+
+typedef struct
+{
+   RANGERES  *res;            /* Residues in the range                  */
+   RANGEATOM *atoms;          /* Atoms in the range                     */
+   int       *cellHead,       /* First atom in each cell (or -1)        */
+             nres,
+             natoms,
+             nx, ny, nz;
+   REAL      minX, minY, minZ,
+             cellSize;
+}  RANGEINDEX;
+
 /************************************************************************/
 /* Globals
 */
@@ -86,11 +122,15 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 void DoAnalysis(FILE *out, PDB *pdb, REAL RadSq, char *startres,
                 char *stopres, BOOL doMainChain, BOOL doInternal,
                 BOOL showCounts);
-int MakesContact(PDB *res, PDB *nextRes, PDB *pStart, PDB *pStop,
+int MakesContact(PDB *res, PDB *nextRes, RANGEINDEX *range,
                  BOOL doMainChain, BOOL showCounts, REAL RadSq,
                  BOOL isInternal);
 void PrintContact(FILE *out, PDB *p, BOOL showCounts, int nContacts);
 BOOL IsSidechain(PDB *p);
+int AtomFlags(PDB *p);
+RANGEINDEX *BuildRangeIndex(PDB *rangeStart, PDB *rangeStop, 
+                            REAL cellSize);
+void FreeRangeIndex(RANGEINDEX *range);
 
 
 /************************************************************************/
@@ -253,14 +293,16 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 
    26.03.20 Original   By: ACRM
    12.01.21 Added doMainChain, doInternal and showCounts
+   16.10.26 Builds a RANGEINDEX for MakesContact()
 */   
 void DoAnalysis(FILE *out, PDB *pdb, REAL RadSq, char *startres,
                 char *stopres, BOOL doMainChain, BOOL doInternal,
                 BOOL showCounts)
 {
-   PDB  *p,
-        *pStart, *pLast, *pStop,
-        *nextRes;
+   PDB        *p,
+              *pStart, *pLast, *pStop,
+              *nextRes;
+   RANGEINDEX *range;
 
    /* Find the first residue of the range                               */
    if((pStart = blFindResidueSpec(pdb, startres))==NULL)
@@ -279,6 +321,13 @@ void DoAnalysis(FILE *out, PDB *pdb, REAL RadSq, char *startres,
    }
    
    pStop  = blFindNextResidue(pLast);
+
+   if((range = BuildRangeIndex(pStart, pStop, sqrt(RadSq)))==NULL)
+   {
+      fprintf(stderr,"Error (rangecontacts) - No memory for range \
+index\n");
+      return;
+   }
    
    /* Run through the linked list a residue at a time                   */
    for(p=pdb; p!=NULL; p=nextRes)
@@ -293,7 +342,7 @@ void DoAnalysis(FILE *out, PDB *pdb, REAL RadSq, char *startres,
          if(doInternal)
             isInternal = blInPDBZoneSpec(p, startres, stopres);
 
-         if((nContacts = MakesContact(p, nextRes, pStart, pStop,
+         if((nContacts = MakesContact(p, nextRes, range,
                                       doMainChain, showCounts,
                                       RadSq, isInternal)) > 0)
          {
@@ -301,6 +350,8 @@ void DoAnalysis(FILE *out, PDB *pdb, REAL RadSq, char *startres,
          }
       }
    }
+
+   FreeRangeIndex(range);
 }
 
 
@@ -357,126 +408,304 @@ BOOL IsSidechain(PDB *p)
 
 
 /************************************************************************/
-/*>int MakesContact(PDB *testResStart, PDB *testResStop, PDB *rangeStart,
-                    PDB *rangeStop, BOOL doMainChain, BOOL showCounts,
-                    REAL RadSq, BOOL isInternal)
+/*>int AtomFlags(PDB *p)
+   ---------------------
+   Input:   PDB    *p    PDB pointer
+   Returns: int          ATOMFLAG_ values for this atom
+
+   Classifies an atom as sidechain, mainchain C or mainchain N
+
+   16.10.26 Original    By: ACRM
+*/
+int AtomFlags(PDB *p)
+{
+   int flags = 0;
+
+   if(IsSidechain(p))
+      flags |= ATOMFLAG_SIDECHAIN;
+   if(!strncmp(p->atnam, "C   ", 4))
+      flags |= ATOMFLAG_C;
+   if(!strncmp(p->atnam, "N   ", 4))
+      flags |= ATOMFLAG_N;
+
+   return(flags);
+}
+
+
+/************************************************************************/
+/*>RANGEINDEX *BuildRangeIndex(PDB *rangeStart, PDB *rangeStop, 
+                               REAL cellSize)
+   ------------------------------------------------------------
+   Input:   PDB    *rangeStart  First atom of the range
+            PDB    *rangeStop   Atom after the end of the range
+            REAL   cellSize     Grid cell size (the contact radius)
+   Returns: RANGEINDEX *        Malloc'd index of the range (NULL if 
+                                no memory)
+
+   Builds an array of the residues in the range and an array of the 
+   atoms with their coordinates, residue and type flags. The atoms are
+   binned into a grid so that only those in the cells around an atom 
+   need be tested for contact.
+
+   16.10.26 Original    By: ACRM
+*/
+RANGEINDEX *BuildRangeIndex(PDB *rangeStart, PDB *rangeStop, 
+                            REAL cellSize)
+{
+   RANGEINDEX *range;
+   PDB        *res, *nextRes, *q;
+   REAL       maxX, maxY, maxZ;
+   int        i;
+
+   if((range = (RANGEINDEX *)malloc(sizeof(RANGEINDEX)))==NULL)
+      return(NULL);
+
+   range->nres     = range->natoms = 0;
+   range->res      = NULL;
+   range->atoms    = NULL;
+   range->cellHead = NULL;
+   for(res=rangeStart; ((res!=rangeStop) && (res!=NULL)); res=nextRes)
+   {
+      nextRes = blFindNextResidue(res);
+      range->nres++;
+      for(q=res; q!=nextRes; NEXT(q))
+         range->natoms++;
+   }
+
+   if(((range->res = (RANGERES *)malloc((range->nres+1) * 
+                                         sizeof(RANGERES)))==NULL) ||
+      ((range->atoms = (RANGEATOM *)malloc((range->natoms+1) * 
+                                            sizeof(RANGEATOM)))==NULL))
+   {
+      FreeRangeIndex(range);
+      return(NULL);
+   }
+
+   /* Store the residues and atoms                                      */
+   range->minX = range->minY = range->minZ = (REAL)0.0;
+   maxX        = maxY        = maxZ        = (REAL)0.0;
+   range->nres = range->natoms = 0;
+   for(res=rangeStart; ((res!=rangeStop) && (res!=NULL)); res=nextRes)
+   {
+      nextRes = blFindNextResidue(res);
+      range->res[range->nres].start = res;
+      range->res[range->nres].stop  = nextRes;
+
+      for(q=res; q!=nextRes; NEXT(q))
+      {
+         RANGEATOM *a = &(range->atoms[range->natoms]);
+         a->x          = q->x;
+         a->y          = q->y;
+         a->z          = q->z;
+         a->res        = range->nres;
+         a->flags      = AtomFlags(q);
+         a->nextInCell = (-1);
+
+         if(range->natoms == 0)
+         {
+            range->minX = maxX = a->x;
+            range->minY = maxY = a->y;
+            range->minZ = maxZ = a->z;
+         }
+         range->minX = MIN(range->minX, a->x);
+         range->minY = MIN(range->minY, a->y);
+         range->minZ = MIN(range->minZ, a->z);
+         maxX        = MAX(maxX, a->x);
+         maxY        = MAX(maxY, a->y);
+         maxZ        = MAX(maxZ, a->z);
+         range->natoms++;
+      }
+      range->nres++;
+   }
+
+   /* Size the grid, growing the cells if it would be unreasonably 
+      large
+   */
+   range->cellSize = MAX(cellSize, (REAL)0.1);
+   for(;;)
+   {
+      range->nx = 1 + (int)((maxX - range->minX) / range->cellSize);
+      range->ny = 1 + (int)((maxY - range->minY) / range->cellSize);
+      range->nz = 1 + (int)((maxZ - range->minZ) / range->cellSize);
+      if(((double)range->nx * (double)range->ny * (double)range->nz) <=
+         (double)MAXGRIDCELLS)
+         break;
+      range->cellSize *= 2.0;
+   }
+
+   if((range->cellHead = (int *)malloc(range->nx * range->ny * 
+                                       range->nz * sizeof(int)))==NULL)
+   {
+      FreeRangeIndex(range);
+      return(NULL);
+   }
+   for(i=0; i<range->nx * range->ny * range->nz; i++)
+      range->cellHead[i] = (-1);
+
+   /* Bin the atoms                                                     */
+   for(i=range->natoms-1; i>=0; i--)
+   {
+      RANGEATOM *a   = &(range->atoms[i]);
+      int       cell = (int)((a->x - range->minX) / range->cellSize) +
+                       range->nx * 
+                       ((int)((a->y - range->minY) / range->cellSize) +
+                        range->ny * 
+                        (int)((a->z - range->minZ) / range->cellSize));
+      a->nextInCell         = range->cellHead[cell];
+      range->cellHead[cell] = i;
+   }
+
+   return(range);
+}
+
+
+/************************************************************************/
+/*>void FreeRangeIndex(RANGEINDEX *range)
+   --------------------------------------
+   Input:   RANGEINDEX *range    Range index
+
+   Frees a range index
+
+   16.10.26 Original    By: ACRM
+*/
+void FreeRangeIndex(RANGEINDEX *range)
+{
+   if(range->res != NULL)
+      free(range->res);
+   if(range->atoms != NULL)
+      free(range->atoms);
+   if(range->cellHead != NULL)
+      free(range->cellHead);
+   free(range);
+}
+
+
+/************************************************************************/
+/*>int MakesContact(PDB *testResStart, PDB *testResStop, 
+                    RANGEINDEX *range, BOOL doMainChain, 
+                    BOOL showCounts, REAL RadSq, BOOL isInternal)
    -----------------------------------------------------------------
 
    testResStart/testResStop  is the residue we are looking at for contacts
-   rangeStart/rangeStop      is the residue range with which we are 
-                             looking for contacts
+   range                     is the index of the residue range with 
+                             which we are looking for contacts
 
    26.03.20 Original    By: ACRM
    12.01.20 Now works a residue at a time to support mainchain and 
             internal contacts as well as printing.
+   16.10.26 Works from the RANGEINDEX so only range atoms in the grid
+            cells around each atom are examined and atom types are
+            tested with precomputed flags
 */
 int MakesContact(PDB *testResStart, PDB *testResStop,
-                 PDB *rangeStart, PDB *rangeStop,
-                 BOOL doMainChain, BOOL showCounts,
+                 RANGEINDEX *range, BOOL doMainChain, BOOL showCounts,
                  REAL RadSq, BOOL isInternal)
 {
-   PDB  *p, *q,
-        *rangeRes     = NULL,
-        *nextRangeRes = NULL;
-   int  NContacts     = 0,
-        bonded        = BONDED_NOT;
+   PDB  *p;
+   int  NContacts = 0,
+        bonded    = BONDED_NOT,
+        pFlags,
+        ix, iy, iz,
+        cx, cy, cz,
+        i;
    REAL distSq;
    
-   
    /* Step through atoms in the residue of interest                     */
    for(p=testResStart; p!=testResStop; NEXT(p))
    {
-      if(doMainChain || IsSidechain(p))
+      pFlags = AtomFlags(p);
+      
+      if(!doMainChain && !(pFlags & ATOMFLAG_SIDECHAIN))
+         continue;
+
+      ix = (int)floor((p->x - range->minX) / range->cellSize);
+      iy = (int)floor((p->y - range->minY) / range->cellSize);
+      iz = (int)floor((p->z - range->minZ) / range->cellSize);
+
+      /* Step through range atoms in the surrounding grid cells         */
+      for(cz=MAX(iz-1, 0); cz<=MIN(iz+1, range->nz-1); cz++)
       {
-         /* Step through residues in the range we are looking at        */
-         for(rangeRes=rangeStart;
-             rangeRes!=rangeStop;
-             rangeRes=nextRangeRes)
+         for(cy=MAX(iy-1, 0); cy<=MIN(iy+1, range->ny-1); cy++)
          {
-            nextRangeRes = blFindNextResidue(rangeRes);
-            
-            /* If we are looking at internal residues and the current
-               test residue is the same as the current range residue
-               then continue to the next range residue - i.e. don't
-               look for contacts within a residue
-            */
-            if(rangeRes == testResStart)
-               continue;
-            
-            if(doMainChain)
+            for(cx=MAX(ix-1, 0); cx<=MIN(ix+1, range->nx-1); cx++)
             {
-               bonded = BONDED_NOT;
-               /* If this range residue is the one after the current test 
-                  residue and they are in the same chain then it's the
-                  residue bonded to the N-terminus of the range.
-                  This deals with handling of internal residues too.
-               */
-               if((rangeRes == testResStop) &&
-                  PDBCHAINMATCH(rangeRes, testResStop))
+               for(i=range->cellHead[cx + range->nx * 
+                                     (cy + range->ny * cz)];
+                   i!=(-1);
+                   i=range->atoms[i].nextInCell)
                {
-                  bonded = BONDED_NTER;
-               }
-               /* If the current test residue is the one after this range
-                  residue and they are in the same chain then it's the
-                  residue bonded to the C-terminus of the range.
-                  This deals with handling of internal residues too.
-               */
-               else if((testResStart == nextRangeRes) &&
-                       PDBCHAINMATCH(testResStart, nextRangeRes))
-               {
-                  bonded = BONDED_CTER;
-               }
-            }
+                  RANGEATOM *q        = &(range->atoms[i]);
+                  RANGERES  *rangeRes = &(range->res[q->res]);
+
+                  /* If we are looking at internal residues and the
+                     current test residue is the same as the current 
+                     range residue then skip it - i.e. don't look for
+                     contacts within a residue
+                  */
+                  if(rangeRes->start == testResStart)
+                     continue;
+
+                  distSq = DISTSQ(p, q);
+                  if(distSq > RadSq)
+                     continue;
             
-            /* Step through atoms in this residue from the range        */
-            for(q=rangeRes; q!=nextRangeRes; NEXT(q))
-            {
-               /* If the current test residue is bonded to the 
-                  N-terminus and it's the C of this test residue and
-                  the N of the range residue then ignore the 
-                  interaction
-               */
-               if((bonded == BONDED_NTER) &&
-                  !strncmp(p->atnam, "C   ", 4) &&
-                  !strncmp(q->atnam, "N   ", 4)) 
-               {
-#ifdef DEBUG
-                  fprintf(stderr,"> NTer bond %s%d%s.%s : %s%d%s.%s\n",
-                          p->chain, p->resnum, p->insert, p->atnam,
-                          q->chain, q->resnum, q->insert, q->atnam);
-#endif
-                  
-                  continue;
-               }
-               
-               
-               /* If the current test residue is bonded to the 
-                  C-terminus and it's the N of this test residue and
-                  the C of the range residue then ignore the 
-                  interaction
-               */
-               if((bonded == BONDED_CTER) &&
-                  !strncmp(p->atnam, "N   ", 4) &&
-                  !strncmp(q->atnam, "C   ", 4))
-               {
-#ifdef DEBUG
-                  fprintf(stderr,"> CTer bond %s%d%s.%s : %s%d%s.%s\n",
-                          p->chain, p->resnum, p->insert, p->atnam,
-                          q->chain, q->resnum, q->insert, q->atnam);
-#endif
-                  
-                  continue;
-               }
-               
+                  if(doMainChain)
+                  {
+                     bonded = BONDED_NOT;
+                     /* If this range residue is the one after the 
+                        current test residue and they are in the same
+                        chain then it's the residue bonded to the
+                        N-terminus of the range. This deals with 
+                        handling of internal residues too.
+                     */
+                     if((rangeRes->start == testResStop) &&
+                        PDBCHAINMATCH(rangeRes->start, testResStop))
+                     {
+                        bonded = BONDED_NTER;
+                     }
+                     /* If the current test residue is the one after 
+                        this range residue and they are in the same 
+                        chain then it's the residue bonded to the 
+                        C-terminus of the range. This deals with 
+                        handling of internal residues too.
+                     */
+                     else if((testResStart == rangeRes->stop) &&
+                             PDBCHAINMATCH(testResStart, rangeRes->stop))
+                     {
+                        bonded = BONDED_CTER;
+                     }
+                  }
+
+                  /* If the current test residue is bonded to the 
+                     N-terminus and it's the C of this test residue and
+                     the N of the range residue then ignore the 
+                     interaction
+                  */
+                  if((bonded == BONDED_NTER) &&
+                     (pFlags & ATOMFLAG_C) &&
+                     (q->flags & ATOMFLAG_N))
+                  {
+                     continue;
+                  }
                
-               /* Otherwise check the distance for a contact            */
-               distSq = DISTSQ(p, q);
-               if(distSq <= RadSq)
-               {
+                  /* If the current test residue is bonded to the 
+                     C-terminus and it's the N of this test residue and
+                     the C of the range residue then ignore the 
+                     interaction
+                  */
+                  if((bonded == BONDED_CTER) &&
+                     (pFlags & ATOMFLAG_N) &&
+                     (q->flags & ATOMFLAG_C))
+                  {
+                     continue;
+                  }
+
 #if (DEBUG > 2)
-                  fprintf(stderr,"> %s%d%s.%s : %s%d%s.%s : %f\n",
+                  fprintf(stderr,"> %s%d%s.%s : %s%d%s : %f\n",
                           p->chain, p->resnum, p->insert, p->atnam,
-                          q->chain, q->resnum, q->insert, q->atnam,
+                          rangeRes->start->chain, 
+                          rangeRes->start->resnum, 
+                          rangeRes->start->insert,
                           sqrt(distSq));
 #endif
                   if(!showCounts)
@@ -499,10 +728,11 @@ int MakesContact(PDB *testResStart, PDB *testResStop,
 
    26.03.20 Original    By: ACRM
    12.01.21 V1.1
+   16.10.26 V1.2
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nRangeContacts V1.1 (c) 2020-21, Andrew C.R. \
+   fprintf(stderr,"\nRangeContacts V1.2 (c) 2020-26, Andrew C.R. \
 Martin, UCL\n");
    fprintf(stderr,"Usage: rangecontacts [-r radius][-i][-c] startres \
 stopres [in.pdb [out.dat]]\n");